@@ -87,8 +87,9 @@ func build(dir, config, platform string) {
 	slnPath := filepath.Join("vs2019", "SumatraPDF.sln")
 
 	p := fmt.Sprintf(`/p:Configuration=%s;Platform=%s`, config, platform)
-	runExeLoggedMust(msbuildPath, slnPath, `/t:test_util:Rebuild`, p, `/m`)
+	runExeLoggedMust(msbuildPath, slnPath, `/t:test_util:Rebuild;paint_bench:Rebuild`, p, `/m`)
 	runTestUtilMust(dir)
+	runPaintBenchTestMust(dir)
 
 	runExeLoggedMust(msbuildPath, slnPath, `/t:SumatraPDF:Rebuild;SumatraPDF-dll:Rebuild;PdfFilter:Rebuild;PdfPreview:Rebuild`, p, `/m`)
 	signFilesMust(dir)
@@ -205,6 +206,13 @@ func runTestUtilMust(dir string) {
 	u.RunCmdLoggedMust(cmd)
 }
 
+// checks that SIMD and plain C paint, scale and convert pixels identically
+func runPaintBenchTestMust(dir string) {
+	cmd := exec.Command(`.\paint_bench.exe`, "-test")
+	cmd.Dir = dir
+	u.RunCmdLoggedMust(cmd)
+}
+
 func buildLzsa() {
 	// early exit if missing
 	detectSigntoolPath()
@@ -232,9 +240,10 @@ func smokeBuild() {
 	u.PanicIf(!u.FileExists(lzsa), "file '%s' doesn't exist", lzsa)
 
 	msbuildPath := detectMsbuildPath()
-	runExeLoggedMust(msbuildPath, `vs2019\SumatraPDF.sln`, `/t:SumatraPDF-dll:Rebuild;test_util:Rebuild`, `/p:Configuration=Release;Platform=x64`, `/m`)
+	runExeLoggedMust(msbuildPath, `vs2019\SumatraPDF.sln`, `/t:SumatraPDF-dll:Rebuild;test_util:Rebuild;paint_bench:Rebuild`, `/p:Configuration=Release;Platform=x64`, `/m`)
 	outDir := filepath.Join("out", "rel64")
 	runTestUtilMust(outDir)
+	runPaintBenchTestMust(outDir)
 
 	{
 		cmd := exec.Command(lzsa, "SumatraPDF.pdb.lzsa", "libmupdf.pdb:libmupdf.pdb", "SumatraPDF-dll.pdb:SumatraPDF-dll.pdb")
@@ -554,7 +563,7 @@ func buildTestUtil() {
 	config := "Release"
 	platform := "x64"
 	p := fmt.Sprintf(`/p:Configuration=%s;Platform=%s`, config, platform)
-	runExeLoggedMust(msbuildPath, slnPath, `/t:test_util:Rebuild`, p, `/m`)
+	runExeLoggedMust(msbuildPath, slnPath, `/t:test_util:Rebuild;paint_bench:Rebuild`, p, `/m`)
 }
 
 // a faster release build for testing that only does 64-bit installer
@@ -180,7 +180,7 @@ func main() {
 		flag.StringVar(&flgUpdateVer, "update-auto-update-ver", "", "update version used for auto-update checks")
 		flag.BoolVar(&flgDrMem, "drmem", false, "run drmemory of rel 64")
 		flag.BoolVar(&flgLogView, "logview", false, "run logview")
-		flag.BoolVar(&flgRunTests, "run-tests", false, "run test_util executable")
+		flag.BoolVar(&flgRunTests, "run-tests", false, "run test_util and paint_bench -test executables")
 		flag.Parse()
 	}
 
@@ -422,9 +422,8 @@ func main() {
 	if flgRunTests {
 		buildTestUtil()
 		dir := filepath.Join("out", "rel64")
-		cmd := exec.Command(".\\test_util.exe")
-		cmd.Dir = dir
-		u.RunCmdLoggedMust(cmd)
+		runTestUtilMust(dir)
+		runPaintBenchTestMust(dir)
 		return
 	}
 
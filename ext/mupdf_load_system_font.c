@@ -1,9 +1,14 @@
 // this file is compiled as part of mupdf library and ends up
 // in libmupdf.dll, to avoid issues related to crossing .dll boundaries
-// It implements loading of Fonts included in windows
+// It implements loading of Fonts included in windows (or in a font directory
+// set with pdf_set_system_font_dir). Parsed font names are cached in a
+// binary font catalog (see pdf_set_system_font_catalog_path) so that
+// only new or modified font files have to be parsed on startup.
 #include "mupdf/fitz.h"
 #include "mupdf/pdf.h"
 
+#include <stdint.h>
+
 #ifdef _WIN32
 
 #ifndef UNICODE
@@ -14,6 +19,29 @@
 #endif
 
 #include <windows.h>
+
+#else
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef uint8_t BYTE;
+typedef uint16_t USHORT;
+typedef uint32_t ULONG;
+typedef int BOOL;
+
+#ifndef MAX_PATH
+#define MAX_PATH 1024
+#endif
+#define LANG_CHINESE 0x04
+#define PRIMARYLANGID(lgid) ((USHORT)(lgid)&0x3ff)
+
+#endif
+
 #include <assert.h>
 
 // TODO: Use more of FreeType for TTF parsing (for performance reasons,
@@ -102,8 +130,21 @@ static pdf_fontlistMS fontlistMS = {
     0,
 };
 
+// directory scanned for fonts, the Windows fonts directory if not set
+static char font_dir[MAX_PATH];
+// path of the font catalog file, no catalog is used if not set
+static char font_catalog_path[MAX_PATH];
+
 static int did_init = 0;
+#ifdef _WIN32
 static CRITICAL_SECTION cs_fonts;
+#define lock_fonts() EnterCriticalSection(&cs_fonts)
+#define unlock_fonts() LeaveCriticalSection(&cs_fonts)
+#else
+static pthread_mutex_t cs_fonts = PTHREAD_MUTEX_INITIALIZER;
+#define lock_fonts() pthread_mutex_lock(&cs_fonts)
+#define unlock_fonts() pthread_mutex_unlock(&cs_fonts)
+#endif
 
 static inline USHORT BEtoHs(USHORT x) {
     BYTE* data = (BYTE*)&x;
@@ -125,11 +166,15 @@ static int lookup_compare(const void* elem1, const void* elem2) {
 
     if (len1 != len2) {
         const char* rest = len1 > len2 ? val1 + len2 : val2 + len1;
-        if (',' == *rest || !_stricmp(rest, "-roman"))
-            return _strnicmp(val1, val2, fz_mini(len1, len2));
+        if (',' == *rest || !fz_strcasecmp(rest, "-roman"))
+            return fz_strncasecmp(val1, val2, fz_mini(len1, len2));
     }
 
-    return _stricmp(val1, val2);
+    return fz_strcasecmp(val1, val2);
+}
+
+static int fontface_compare(const void* elem1, const void* elem2) {
+    return fz_strcasecmp((const char*)elem1, (const char*)elem2);
 }
 
 static void remove_spaces(char* srcDest) {
@@ -154,21 +199,38 @@ static sys_font_info* pdf_find_windows_font_path(const char* fontname) {
 
 /* source and dest can be same */
 static void decode_unicode_BE(fz_context* ctx, char* source, int sourcelen, char* dest, int destlen) {
-    WCHAR* tmp;
-    int converted, i;
+    BYTE* src;
+    char utf8[FZ_UTFMAX];
+    int i, n, c, c2, len = 0;
 
     if (sourcelen % 2 != 0)
         fz_throw(ctx, FZ_ERROR_GENERIC, "fonterror : invalid unicode string");
 
-    tmp = fz_malloc_array(ctx, sourcelen / 2 + 1, WCHAR);
-    for (i = 0; i < sourcelen / 2; i++)
-        tmp[i] = BEtoHs(((WCHAR*)source)[i]);
-    tmp[sourcelen / 2] = '\0';
-
-    converted = WideCharToMultiByte(CP_UTF8, 0, tmp, -1, dest, destlen, NULL, NULL);
-    fz_free(ctx, tmp);
-    if (!converted)
-        fz_throw(ctx, FZ_ERROR_GENERIC, "fonterror : invalid unicode string");
+    // decode from a copy, as source and dest can be the same buffer
+    src = fz_malloc(ctx, sourcelen);
+    memcpy(src, source, sourcelen);
+    for (i = 0; i < sourcelen; i += 2) {
+        c = (src[i] << 8) | src[i + 1];
+        if (c >= 0xD800 && c <= 0xDBFF && i + 3 < sourcelen) {
+            c2 = (src[i + 2] << 8) | src[i + 3];
+            if (c2 >= 0xDC00 && c2 <= 0xDFFF) {
+                c = 0x10000 + ((c - 0xD800) << 10) + (c2 - 0xDC00);
+                i += 2;
+            }
+        }
+        if (c >= 0xD800 && c <= 0xDFFF)
+            c = 0xFFFD;
+        n = fz_runetochar(utf8, c);
+        if (len + n >= destlen) {
+            fz_free(ctx, src);
+            fz_throw(ctx, FZ_ERROR_GENERIC, "fonterror : invalid unicode string");
+        }
+        memcpy(dest + len, utf8, n);
+        len += n;
+    }
+    fz_free(ctx, src);
+    if (destlen > 0)
+        dest[len] = '\0';
 }
 
 static void decode_platform_string(fz_context* ctx, int platform, int enctype, char* source, int sourcelen, char* dest,
@@ -264,14 +326,14 @@ static void read_ttf_string(fz_context* ctx, fz_stream* file, int offset, TT_NAM
 
 static void makeFakePSName(char szName[MAX_FACENAME], const char* szStyle) {
     // append the font's subfamily, unless it's a Regular font
-    if (*szStyle && _stricmp(szStyle, "Regular") != 0) {
+    if (*szStyle && fz_strcasecmp(szStyle, "Regular") != 0) {
         fz_strlcat(szName, "-", MAX_FACENAME);
         fz_strlcat(szName, szStyle, MAX_FACENAME);
     }
     remove_spaces(szName);
 }
 
-static void parseTTF(fz_context* ctx, fz_stream* file, int offset, int index, const char* path) {
+static void parseTTF(fz_context* ctx, pdf_fontlistMS* fl, fz_stream* file, int offset, int index, const char* path) {
     TT_OFFSET_TABLE ttOffsetTableBE;
     TT_TABLE_DIRECTORY tblDirBE;
     TT_NAME_TABLE_HEADER ttNTHeaderBE;
@@ -352,27 +414,27 @@ static void parseTTF(fz_context* ctx, fz_stream* file, int offset, int index, co
     }
 
     if (szPSName[0])
-        append_mapping(ctx, &fontlistMS, szPSName, path, index);
+        append_mapping(ctx, fl, szPSName, path, index);
     if (szTTName[0]) {
         // derive a PostScript-like name and add it, if it's different from the font's
         // included PostScript name; cf. https://code.google.com/p/sumatrapdf/issues/detail?id=376
         makeFakePSName(szTTName, szStyle);
         // compare the two names before adding this one
         if (lookup_compare(szTTName, szPSName))
-            append_mapping(ctx, &fontlistMS, szTTName, path, index);
+            append_mapping(ctx, fl, szTTName, path, index);
     }
     if (szCJKName[0]) {
         makeFakePSName(szCJKName, szStyle);
         if (lookup_compare(szCJKName, szPSName) && lookup_compare(szCJKName, szTTName))
-            append_mapping(ctx, &fontlistMS, szCJKName, path, index);
+            append_mapping(ctx, fl, szCJKName, path, index);
     }
 }
 
-static void parseTTFs(fz_context* ctx, const char* path) {
+static void parseTTFs(fz_context* ctx, pdf_fontlistMS* fl, const char* path) {
     fz_stream* file = fz_open_file(ctx, path);
     /* "fonterror : %s not found", path */
     fz_try(ctx) {
-        parseTTF(ctx, file, 0, 0, path);
+        parseTTF(ctx, fl, file, 0, 0, path);
     }
     fz_always(ctx) {
         fz_drop_stream(ctx, file);
@@ -382,7 +444,7 @@ static void parseTTFs(fz_context* ctx, const char* path) {
     }
 }
 
-static void parseTTCs(fz_context* ctx, const char* path) {
+static void parseTTCs(fz_context* ctx, pdf_fontlistMS* fl, const char* path) {
     FONT_COLLECTION fontcollectionBE;
     ULONG i, numFonts, *offsettableBE = NULL;
 
@@ -405,7 +467,7 @@ static void parseTTCs(fz_context* ctx, const char* path) {
         int offset = (int)sizeof(FONT_COLLECTION);
         safe_read(ctx, file, offset, (char*)offsettableBE, numFonts * sizeof(ULONG));
         for (i = 0; i < numFonts; i++) {
-            parseTTF(ctx, file, BEtoHl(offsettableBE[i]), i, path);
+            parseTTF(ctx, fl, file, BEtoHl(offsettableBE[i]), i, path);
         }
     }
     fz_always(ctx) {
@@ -417,6 +479,32 @@ static void parseTTCs(fz_context* ctx, const char* path) {
     }
 }
 
+static int is_font_file_name(const char* name, int* isCollection) {
+    size_t len = strlen(name);
+    const char* fileExt = name + len - 4;
+    if (len < 4)
+        return 0;
+    *isCollection = !fz_strcasecmp(fileExt, ".ttc");
+    return *isCollection || !fz_strcasecmp(fileExt, ".ttf") || !fz_strcasecmp(fileExt, ".otf");
+}
+
+// adds all fonts from a given font file to fl, ignoring errors
+static void parse_font_file(fz_context* ctx, pdf_fontlistMS* fl, const char* path) {
+    int isCollection;
+    if (!is_font_file_name(path, &isCollection))
+        return;
+    fz_try(ctx) {
+        if (isCollection)
+            parseTTCs(ctx, fl, path);
+        else
+            parseTTFs(ctx, fl, path);
+    }
+    fz_catch(ctx) {
+        // ignore errors occurring while parsing a given font file
+    }
+}
+
+#ifdef _WIN32
 static void extend_system_font_list(fz_context* ctx, const WCHAR* path) {
     WCHAR szPath[MAX_PATH], *lpFileName;
     WIN32_FIND_DATA FileData;
@@ -433,7 +521,7 @@ static void extend_system_font_list(fz_context* ctx, const WCHAR* path) {
     }
     do {
         if (!(FileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
-            char szPathUtf8[MAX_PATH], *fileExt;
+            char szPathUtf8[MAX_PATH];
             int res;
             lstrcpyn(lpFileName, FileData.cFileName, szPath + MAX_PATH - lpFileName);
             res = WideCharToMultiByte(CP_UTF8, 0, szPath, -1, szPathUtf8, sizeof(szPathUtf8), NULL, NULL);
@@ -441,43 +529,633 @@ static void extend_system_font_list(fz_context* ctx, const WCHAR* path) {
                 fz_warn(ctx, "WideCharToMultiByte failed for %S", szPath);
                 continue;
             }
-            fileExt = szPathUtf8 + strlen(szPathUtf8) - 4;
-            fz_try(ctx) {
-                if (!_stricmp(fileExt, ".ttc"))
-                    parseTTCs(ctx, szPathUtf8);
-                else if (!_stricmp(fileExt, ".ttf") || !_stricmp(fileExt, ".otf"))
-                    parseTTFs(ctx, szPathUtf8);
-            }
-            fz_catch(ctx) {
-                // ignore errors occurring while parsing a given font file
-            }
+            parse_font_file(ctx, &fontlistMS, szPathUtf8);
         }
     } while (FindNextFile(hList, &FileData));
     FindClose(hList);
 }
+#endif
+
+/* Font catalog
+
+   The catalog caches the result of parsing all font files in font_dir:
+
+     font_catalog_header
+     font_catalog_file[nfiles] (sorted by name)
+     font_catalog_face[nfaces] (grouped by file)
+     char strings[strings_size] (0-terminated strings)
+
+   A catalog entry is only used if name, size and modification time of the
+   font file still match, so that only new or modified files are parsed. */
+
+#define FONT_CATALOG_MAGIC "SFCT"
+#define FONT_CATALOG_VERSION 1
+
+// number of files that have to be parsed before we parse them on multiple threads
+#define FONT_SCAN_MIN_PARALLEL 16
+#define FONT_SCAN_MAX_THREADS 8
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t nfiles;
+    uint32_t nfaces;
+    uint32_t strings_size;
+    uint32_t dir_off; // font_dir the catalog was built for
+} font_catalog_header;
+
+typedef struct {
+    uint64_t size;
+    uint64_t mtime;
+    uint32_t name_off;
+    uint32_t first_face;
+    uint32_t nfaces;
+    uint32_t reserved;
+} font_catalog_file;
+
+typedef struct {
+    uint32_t name_off;
+    int32_t index;
+} font_catalog_face;
+
+typedef struct {
+    void* data;
+    size_t size;
+    const font_catalog_header* hdr;
+    const font_catalog_file* files;
+    const font_catalog_face* faces;
+    const char* strings;
+} font_catalog;
+
+typedef struct {
+    char* name; // file name inside font_dir
+    uint64_t size;
+    uint64_t mtime;
+    const font_catalog_file* cached;
+    // result of parsing the file on a scan thread
+    int worker;
+    int first;
+    int count;
+    // range of the file's fonts in fontlistMS
+    int out_first;
+    int out_count;
+} font_file_entry;
+
+typedef struct {
+    font_file_entry* files;
+    int len;
+    int cap;
+} font_file_list;
+
+static void append_font_file(fz_context* ctx, font_file_list* list, const char* name, uint64_t size, uint64_t mtime) {
+    font_file_entry* e;
+    if (list->len == list->cap) {
+        int newcap = list->cap ? list->cap * 2 : 256;
+        list->files = fz_realloc_array(ctx, list->files, newcap, font_file_entry);
+        list->cap = newcap;
+    }
+    e = &list->files[list->len];
+    memset(e, 0, sizeof(*e));
+    e->name = fz_strdup(ctx, name);
+    e->size = size;
+    e->mtime = mtime;
+    list->len++;
+}
+
+static void free_font_file_list(fz_context* ctx, font_file_list* list) {
+    int i;
+    for (i = 0; i < list->len; i++)
+        fz_free(ctx, list->files[i].name);
+    fz_free(ctx, list->files);
+    memset(list, 0, sizeof(*list));
+}
+
+static int font_file_entry_compare(const void* elem1, const void* elem2) {
+    return strcmp(((const font_file_entry*)elem1)->name, ((const font_file_entry*)elem2)->name);
+}
+
+static void make_font_path(char* dst, size_t dstSize, const char* dir, const char* name) {
+#ifdef _WIN32
+    fz_snprintf(dst, dstSize, "%s\\%s", dir, name);
+#else
+    fz_snprintf(dst, dstSize, "%s/%s", dir, name);
+#endif
+}
+
+#ifdef _WIN32
+static void list_font_dir(fz_context* ctx, const char* dir, font_file_list* list) {
+    char pattern[MAX_PATH], name[MAX_PATH];
+    WIN32_FIND_DATAW fd;
+    wchar_t* patternW;
+    HANDLE hList;
+    int isCollection;
+
+    make_font_path(pattern, sizeof(pattern), dir, "*");
+    patternW = fz_wchar_from_utf8(pattern);
+    if (!patternW)
+        fz_throw(ctx, FZ_ERROR_GENERIC, "list_font_dir: invalid path");
+    hList = FindFirstFileW(patternW, &fd);
+    free(patternW);
+    if (hList == INVALID_HANDLE_VALUE)
+        return;
+    do {
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            continue;
+        if (!WideCharToMultiByte(CP_UTF8, 0, fd.cFileName, -1, name, sizeof(name), NULL, NULL))
+            continue;
+        if (!is_font_file_name(name, &isCollection))
+            continue;
+        append_font_file(ctx, list, name, ((uint64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow,
+                         ((uint64_t)fd.ftLastWriteTime.dwHighDateTime << 32) | fd.ftLastWriteTime.dwLowDateTime);
+    } while (FindNextFileW(hList, &fd));
+    FindClose(hList);
+}
+
+static void* map_file(const char* path, size_t* sizeOut) {
+    wchar_t* pathW = fz_wchar_from_utf8(path);
+    HANDLE hFile, hMap;
+    LARGE_INTEGER size;
+    void* data = NULL;
+
+    if (!pathW)
+        return NULL;
+    hFile = CreateFileW(pathW, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    free(pathW);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return NULL;
+    if (GetFileSizeEx(hFile, &size) && size.QuadPart > 0 && size.QuadPart < 0x7fffffff) {
+        hMap = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (hMap) {
+            // the view keeps the mapping alive
+            data = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(hMap);
+        }
+        *sizeOut = (size_t)size.QuadPart;
+    }
+    CloseHandle(hFile);
+    return data;
+}
+
+static void unmap_file(void* data, size_t size) {
+    (void)size;
+    UnmapViewOfFile(data);
+}
+
+static int replace_file(const char* src, const char* dst) {
+    wchar_t* srcW = fz_wchar_from_utf8(src);
+    wchar_t* dstW = fz_wchar_from_utf8(dst);
+    int ok = srcW && dstW && MoveFileExW(srcW, dstW, MOVEFILE_REPLACE_EXISTING);
+    free(srcW);
+    free(dstW);
+    return ok;
+}
 
+static int get_process_id(void) {
+    return (int)GetCurrentProcessId();
+}
+#else
+static void list_font_dir(fz_context* ctx, const char* dir, font_file_list* list) {
+    char path[MAX_PATH];
+    struct dirent* de;
+    struct stat st;
+    int isCollection;
+    DIR* d = opendir(dir);
+
+    if (!d)
+        return;
+    fz_try(ctx) {
+        while ((de = readdir(d)) != NULL) {
+            if (!is_font_file_name(de->d_name, &isCollection))
+                continue;
+            make_font_path(path, sizeof(path), dir, de->d_name);
+            if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+                continue;
+            append_font_file(ctx, list, de->d_name, (uint64_t)st.st_size, (uint64_t)st.st_mtime);
+        }
+    }
+    fz_always(ctx) {
+        closedir(d);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+}
+
+static void* map_file(const char* path, size_t* sizeOut) {
+    struct stat st;
+    void* data = NULL;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && st.st_size < 0x7fffffff) {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+            data = NULL;
+        *sizeOut = (size_t)st.st_size;
+    }
+    close(fd);
+    return data;
+}
+
+static void unmap_file(void* data, size_t size) {
+    munmap(data, size);
+}
+
+static int replace_file(const char* src, const char* dst) {
+    return rename(src, dst) == 0;
+}
+
+static int get_process_id(void) {
+    return (int)getpid();
+}
+#endif
+
+static int is_valid_catalog_string(const font_catalog* cat, uint32_t off) {
+    return off < cat->hdr->strings_size;
+}
+
+// maps the catalog at path into memory and validates it
+static int load_font_catalog(font_catalog* cat, const char* path, const char* dir) {
+    const font_catalog_header* hdr;
+    size_t expectedSize;
+    uint32_t i;
+
+    memset(cat, 0, sizeof(*cat));
+    cat->data = map_file(path, &cat->size);
+    if (!cat->data)
+        return 0;
+
+    hdr = (const font_catalog_header*)cat->data;
+    if (cat->size < sizeof(*hdr) || memcmp(hdr->magic, FONT_CATALOG_MAGIC, 4) != 0 ||
+        hdr->version != FONT_CATALOG_VERSION)
+        goto Invalid;
+    expectedSize = sizeof(*hdr) + (size_t)hdr->nfiles * sizeof(font_catalog_file) +
+                   (size_t)hdr->nfaces * sizeof(font_catalog_face) + hdr->strings_size;
+    if (cat->size != expectedSize || hdr->strings_size == 0)
+        goto Invalid;
+
+    cat->hdr = hdr;
+    cat->files = (const font_catalog_file*)(hdr + 1);
+    cat->faces = (const font_catalog_face*)(cat->files + hdr->nfiles);
+    cat->strings = (const char*)(cat->faces + hdr->nfaces);
+    if (cat->strings[hdr->strings_size - 1] != '\0')
+        goto Invalid;
+    if (!is_valid_catalog_string(cat, hdr->dir_off) || strcmp(cat->strings + hdr->dir_off, dir) != 0)
+        goto Invalid;
+    for (i = 0; i < hdr->nfiles; i++) {
+        const font_catalog_file* f = &cat->files[i];
+        if (!is_valid_catalog_string(cat, f->name_off) || f->first_face > hdr->nfaces ||
+            f->nfaces > hdr->nfaces - f->first_face)
+            goto Invalid;
+    }
+    for (i = 0; i < hdr->nfaces; i++) {
+        if (!is_valid_catalog_string(cat, cat->faces[i].name_off))
+            goto Invalid;
+    }
+    return 1;
+
+Invalid:
+    unmap_file(cat->data, cat->size);
+    memset(cat, 0, sizeof(*cat));
+    return 0;
+}
+
+static void unload_font_catalog(font_catalog* cat) {
+    if (cat->data)
+        unmap_file(cat->data, cat->size);
+    memset(cat, 0, sizeof(*cat));
+}
+
+static const font_catalog_file* find_in_font_catalog(const font_catalog* cat, const font_file_entry* e) {
+    int lo = 0, hi = cat->hdr ? (int)cat->hdr->nfiles - 1 : -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        const font_catalog_file* f = &cat->files[mid];
+        int cmp = strcmp(e->name, cat->strings + f->name_off);
+        if (cmp == 0)
+            return f->size == e->size && f->mtime == e->mtime ? f : NULL;
+        if (cmp < 0)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
+    }
+    return NULL;
+}
+
+static void write_font_catalog(fz_context* ctx, const char* path, const char* dir, font_file_list* list) {
+    font_catalog_header hdr;
+    font_catalog_file* files = NULL;
+    font_catalog_face* faces = NULL;
+    fz_buffer* strings = NULL;
+    fz_output* out = NULL;
+    char tmpPath[MAX_PATH + 32];
+    unsigned char* data;
+    int i, j, nfaces = 0;
+
+    fz_var(files);
+    fz_var(faces);
+    fz_var(strings);
+    fz_var(out);
+
+    for (i = 0; i < list->len; i++)
+        nfaces += list->files[i].out_count;
+
+    fz_snprintf(tmpPath, sizeof(tmpPath), "%s.%d.tmp", path, get_process_id());
+    fz_try(ctx) {
+        files = fz_malloc_array(ctx, list->len, font_catalog_file);
+        faces = fz_malloc_array(ctx, nfaces, font_catalog_face);
+        strings = fz_new_buffer(ctx, 64 * 1024);
+
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, FONT_CATALOG_MAGIC, 4);
+        hdr.version = FONT_CATALOG_VERSION;
+        hdr.nfiles = list->len;
+        hdr.nfaces = nfaces;
+        hdr.dir_off = (uint32_t)strings->len;
+        fz_append_data(ctx, strings, dir, strlen(dir) + 1);
+
+        nfaces = 0;
+        for (i = 0; i < list->len; i++) {
+            font_file_entry* e = &list->files[i];
+            font_catalog_file* f = &files[i];
+            memset(f, 0, sizeof(*f));
+            f->size = e->size;
+            f->mtime = e->mtime;
+            f->name_off = (uint32_t)strings->len;
+            fz_append_data(ctx, strings, e->name, strlen(e->name) + 1);
+            f->first_face = nfaces;
+            f->nfaces = e->out_count;
+            for (j = e->out_first; j < e->out_first + e->out_count; j++) {
+                sys_font_info* fi = &fontlistMS.fontmap[j];
+                faces[nfaces].name_off = (uint32_t)strings->len;
+                faces[nfaces].index = fi->index;
+                fz_append_data(ctx, strings, fi->fontface, strlen(fi->fontface) + 1);
+                nfaces++;
+            }
+        }
+        hdr.strings_size = (uint32_t)fz_buffer_storage(ctx, strings, &data);
+
+        out = fz_new_output_with_path(ctx, tmpPath, 0);
+        fz_write_data(ctx, out, &hdr, sizeof(hdr));
+        fz_write_data(ctx, out, files, list->len * sizeof(font_catalog_file));
+        fz_write_data(ctx, out, faces, nfaces * sizeof(font_catalog_face));
+        fz_write_data(ctx, out, data, hdr.strings_size);
+        fz_close_output(ctx, out);
+        fz_drop_output(ctx, out);
+        out = NULL;
+
+        if (!replace_file(tmpPath, path))
+            fz_throw(ctx, FZ_ERROR_GENERIC, "couldn't replace '%s'", path);
+    }
+    fz_always(ctx) {
+        fz_drop_output(ctx, out);
+        fz_drop_buffer(ctx, strings);
+        fz_free(ctx, faces);
+        fz_free(ctx, files);
+    }
+    fz_catch(ctx) {
+        remove(tmpPath);
+        fz_warn(ctx, "couldn't write font catalog '%s'", path);
+    }
+}
+
+/* Parsing of font files not in the catalog, on multiple threads if there are many */
+
+typedef struct font_scan_job font_scan_job;
+
+typedef struct {
+    fz_context* ctx;
+    font_scan_job* job;
+    int no;
+    pdf_fontlistMS fonts;
+#ifdef _WIN32
+    HANDLE hThread;
+#else
+    pthread_t thread;
+#endif
+} font_scan_worker;
+
+struct font_scan_job {
+    const char* dir;
+    font_file_list* list;
+    int* todo;
+    int ntodo;
+#ifdef _WIN32
+    volatile LONG next;
+#else
+    volatile int next;
+#endif
+};
+
+static int next_font_scan_item(font_scan_job* job) {
+#ifdef _WIN32
+    return (int)InterlockedIncrement(&job->next) - 1;
+#else
+    return __sync_fetch_and_add(&job->next, 1);
+#endif
+}
+
+static void run_font_scan_worker(font_scan_worker* w) {
+    char path[MAX_PATH];
+    font_scan_job* job = w->job;
+    int i;
+    while ((i = next_font_scan_item(job)) < job->ntodo) {
+        font_file_entry* e = &job->list->files[job->todo[i]];
+        make_font_path(path, sizeof(path), job->dir, e->name);
+        e->worker = w->no;
+        e->first = w->fonts.len;
+        parse_font_file(w->ctx, &w->fonts, path);
+        e->count = w->fonts.len - e->first;
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI font_scan_thread_proc(void* data) {
+    run_font_scan_worker((font_scan_worker*)data);
+    return 0;
+}
+
+static int get_cpu_count(void) {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (int)si.dwNumberOfProcessors;
+}
+
+static int start_font_scan_thread(font_scan_worker* w) {
+    w->hThread = CreateThread(NULL, 0, font_scan_thread_proc, w, 0, NULL);
+    return w->hThread != NULL;
+}
+
+static void join_font_scan_thread(font_scan_worker* w) {
+    WaitForSingleObject(w->hThread, INFINITE);
+    CloseHandle(w->hThread);
+}
+#else
+static void* font_scan_thread_proc(void* data) {
+    run_font_scan_worker((font_scan_worker*)data);
+    return NULL;
+}
+
+static int get_cpu_count(void) {
+    return (int)sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+static int start_font_scan_thread(font_scan_worker* w) {
+    return pthread_create(&w->thread, NULL, font_scan_thread_proc, w) == 0;
+}
+
+static void join_font_scan_thread(font_scan_worker* w) {
+    pthread_join(w->thread, NULL);
+}
+#endif
+
+// parses the files at job->todo, using the calling thread as worker 0
+// additional workers need a cloned fz_context, which is only possible
+// if ctx has locking functions
+static void scan_font_files(fz_context* ctx, font_scan_job* job, font_scan_worker* workers, int* nworkers) {
+    int i, n = 1;
+
+    if (job->ntodo >= FONT_SCAN_MIN_PARALLEL)
+        n = fz_clampi(get_cpu_count(), 1, FONT_SCAN_MAX_THREADS);
+    n = fz_mini(n, job->ntodo);
+
+    memset(workers, 0, sizeof(font_scan_worker) * FONT_SCAN_MAX_THREADS);
+    workers[0].ctx = ctx;
+    workers[0].job = job;
+    for (i = 1; i < n; i++) {
+        workers[i].ctx = fz_clone_context(ctx);
+        if (!workers[i].ctx)
+            break;
+        workers[i].job = job;
+        workers[i].no = i;
+        if (!start_font_scan_thread(&workers[i])) {
+            fz_drop_context(workers[i].ctx);
+            workers[i].ctx = NULL;
+            break;
+        }
+    }
+    *nworkers = i;
+
+    run_font_scan_worker(&workers[0]);
+    for (i = 1; i < *nworkers; i++) {
+        join_font_scan_thread(&workers[i]);
+        fz_drop_context(workers[i].ctx);
+    }
+}
+
+static void get_default_font_dir(char* dir, size_t dirSize) {
+    dir[0] = '\0';
+#ifdef _WIN32
+    WCHAR szFontDir[MAX_PATH];
+    UINT cch = GetWindowsDirectory(szFontDir, nelem(szFontDir) - 12);
+    if (0 < cch && cch < nelem(szFontDir) - 12) {
+        wcscat_s(szFontDir, MAX_PATH, L"\\Fonts");
+        if (!WideCharToMultiByte(CP_UTF8, 0, szFontDir, -1, dir, (int)dirSize, NULL, NULL))
+            dir[0] = '\0';
+    }
+#else
+    (void)dirSize;
+#endif
+}
+
+// adds fonts from all font files in dir, using (and updating)
+// the font catalog at font_catalog_path, if set
+static void scan_font_dir(fz_context* ctx, const char* dir) {
+    font_file_list list = {NULL, 0, 0};
+    font_catalog cat;
+    font_scan_job job;
+    font_scan_worker workers[FONT_SCAN_MAX_THREADS];
+    int nworkers = 0;
+    int i, j, changed;
+
+    memset(&cat, 0, sizeof(cat));
+    memset(&job, 0, sizeof(job));
+    memset(workers, 0, sizeof(workers));
+
+    fz_var(nworkers);
+
+    fz_try(ctx) {
+        list_font_dir(ctx, dir, &list);
+        qsort(list.files, list.len, sizeof(font_file_entry), font_file_entry_compare);
+
+        if (font_catalog_path[0])
+            load_font_catalog(&cat, font_catalog_path, dir);
+        // the catalog has to be re-written if any file was added, changed or removed
+        changed = font_catalog_path[0] && (!cat.hdr || cat.hdr->nfiles != (uint32_t)list.len);
+
+        job.dir = dir;
+        job.list = &list;
+        job.todo = fz_malloc_array(ctx, list.len + 1, int);
+        for (i = 0; i < list.len; i++) {
+            list.files[i].cached = find_in_font_catalog(&cat, &list.files[i]);
+            if (!list.files[i].cached)
+                job.todo[job.ntodo++] = i;
+        }
+        if (job.ntodo > 0) {
+            scan_font_files(ctx, &job, workers, &nworkers);
+            changed = font_catalog_path[0] != '\0';
+        }
+
+        // merge in directory order so that the result doesn't depend on threading
+        for (i = 0; i < list.len; i++) {
+            char path[MAX_PATH];
+            font_file_entry* e = &list.files[i];
+            make_font_path(path, sizeof(path), dir, e->name);
+            e->out_first = fontlistMS.len;
+            if (e->cached) {
+                for (j = 0; j < (int)e->cached->nfaces; j++) {
+                    const font_catalog_face* face = &cat.faces[e->cached->first_face + j];
+                    append_mapping(ctx, &fontlistMS, cat.strings + face->name_off, path, face->index);
+                }
+            } else {
+                pdf_fontlistMS* fl = &workers[e->worker].fonts;
+                for (j = e->first; j < e->first + e->count; j++)
+                    append_mapping(ctx, &fontlistMS, fl->fontmap[j].fontface, path, fl->fontmap[j].index);
+            }
+            e->out_count = fontlistMS.len - e->out_first;
+        }
+
+        unload_font_catalog(&cat);
+        if (changed)
+            write_font_catalog(ctx, font_catalog_path, dir, &list);
+    }
+    fz_always(ctx) {
+        unload_font_catalog(&cat);
+        for (i = 0; i < nworkers; i++)
+            free(workers[i].fonts.fontmap);
+        fz_free(ctx, job.todo);
+        free_font_file_list(ctx, &list);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+}
+
+#ifdef _WIN32
 // cf. https://blogs.msdn.com/b/oldnewthing/archive/2004/10/25/247180.aspx
 EXTERN_C IMAGE_DOS_HEADER __ImageBase;
 #define CURRENT_HMODULE ((HMODULE)&__ImageBase)
+#endif
 
 static void create_system_font_list(fz_context* ctx) {
-    WCHAR szFontDir[MAX_PATH];
-    UINT cch;
+    char dir[MAX_PATH];
 
-    cch = GetWindowsDirectory(szFontDir, nelem(szFontDir) - 12);
-    if (0 < cch && cch < nelem(szFontDir) - 12) {
-        wcscat_s(szFontDir, MAX_PATH, L"\\Fonts\\*.?t?");
-        extend_system_font_list(ctx, szFontDir);
-    }
+    if (font_dir[0])
+        fz_strlcpy(dir, font_dir, sizeof(dir));
+    else
+        get_default_font_dir(dir, sizeof(dir));
+    if (dir[0])
+        scan_font_dir(ctx, dir);
 
     if (fontlistMS.len == 0)
         fz_warn(ctx, "couldn't find any usable system fonts");
 
-#ifdef NOCJKFONT
+#if defined(_WIN32) && defined(NOCJKFONT)
     {
         // If no CJK fallback font is builtin but one has been shipped separately (in the same
         // directory as the main executable), add it to the list of loadable system fonts
-        WCHAR szFile[MAX_PATH], *lpFileName;
+        WCHAR szFontDir[MAX_PATH], szFile[MAX_PATH], *lpFileName;
         szFile[0] = '\0';
         GetModuleFileName(CURRENT_HMODULE, szFontDir, MAX_PATH);
         szFontDir[nelem(szFontDir) - 1] = '\0';
@@ -488,22 +1166,25 @@ static void create_system_font_list(fz_context* ctx) {
 #endif
 
     // sort the font list, so that it can be searched binarily
-    qsort((void*)fontlistMS.fontmap, (size_t)fontlistMS.len, sizeof(sys_font_info), _stricmp);
+    qsort((void*)fontlistMS.fontmap, (size_t)fontlistMS.len, sizeof(sys_font_info), fontface_compare);
 
-#ifdef DEBUG
+#if defined(_WIN32) && defined(DEBUG)
     // allow to overwrite system fonts for debugging purposes
     // (either pass a full path or a search pattern such as "fonts\*.ttf")
-    cch = GetEnvironmentVariable(L"MUPDF_FONTS_PATTERN", szFontDir, nelem(szFontDir));
-    if (0 < cch && cch < nelem(szFontDir)) {
-        int i, prev_len = fontlistMS.len;
-        extend_system_font_list(ctx, szFontDir);
-        for (i = prev_len; i < fontlistMS.len; i++) {
-            sys_font_info* entry = bsearch(fontlistMS.fontmap[i].fontface, fontlistMS.fontmap, prev_len,
-                                           sizeof(sys_font_info), lookup_compare);
-            if (entry)
-                *entry = fontlistMS.fontmap[i];
+    {
+        WCHAR szFontDir[MAX_PATH];
+        UINT cch = GetEnvironmentVariable(L"MUPDF_FONTS_PATTERN", szFontDir, nelem(szFontDir));
+        if (0 < cch && cch < nelem(szFontDir)) {
+            int i, prev_len = fontlistMS.len;
+            extend_system_font_list(ctx, szFontDir);
+            for (i = prev_len; i < fontlistMS.len; i++) {
+                sys_font_info* entry = bsearch(fontlistMS.fontmap[i].fontface, fontlistMS.fontmap, prev_len,
+                                               sizeof(sys_font_info), lookup_compare);
+                if (entry)
+                    *entry = fontlistMS.fontmap[i];
+            }
+            qsort(fontlistMS.fontmap, fontlistMS.len, sizeof(sys_font_info), fontface_compare);
         }
-        qsort(fontlistMS.fontmap, fontlistMS.len, sizeof(sys_font_info), _stricmp);
     }
 #endif
 }
@@ -526,7 +1207,7 @@ typedef struct cached_font {
 static cached_font* cached_fonts = 0;
 
 static fz_buffer* get_cached_font_buffer(fz_context* ctx, sys_font_info* fi) {
-    EnterCriticalSection(&cs_fonts);
+    lock_fonts();
     cached_font* f = cached_fonts;
     fz_buffer* buffer = NULL;
     while (f) {
@@ -536,12 +1217,12 @@ static fz_buffer* get_cached_font_buffer(fz_context* ctx, sys_font_info* fi) {
         }
         f = f->next;
     }
-    LeaveCriticalSection(&cs_fonts);
+    unlock_fonts();
     return buffer;
 }
 
 void drop_cached_fonts_for_ctx(fz_context* ctx) {
-    EnterCriticalSection(&cs_fonts);
+    lock_fonts();
 
     cached_font** currp = &cached_fonts;
     cached_font** nextp;
@@ -568,16 +1249,11 @@ void drop_cached_fonts_for_ctx(fz_context* ctx) {
             currp = nextp;
         }
     }
-    LeaveCriticalSection(&cs_fonts);
+    unlock_fonts();
 }
 
-static fz_font* pdf_load_windows_font_by_name(fz_context* ctx, const char* orig_name) {
-    sys_font_info* found = NULL;
-    char *comma, *fontname;
-    fz_font* font;
-    fz_buffer* buffer;
-
-    EnterCriticalSection(&cs_fonts);
+static void ensure_system_font_list(fz_context* ctx) {
+    lock_fonts();
     if (fontlistMS.len == 0) {
         fz_try(ctx) {
             create_system_font_list(ctx);
@@ -585,10 +1261,13 @@ static fz_font* pdf_load_windows_font_by_name(fz_context* ctx, const char* orig_
         fz_catch(ctx) {
         }
     }
-    LeaveCriticalSection(&cs_fonts);
+    unlock_fonts();
+}
 
-    if (fontlistMS.len == 0)
-        fz_throw(ctx, FZ_ERROR_GENERIC, "fonterror: couldn't find any fonts");
+// returns the system font best matching the given font name or NULL
+static sys_font_info* find_system_font(fz_context* ctx, const char* orig_name) {
+    sys_font_info* found = NULL;
+    char *comma, *fontname;
 
     // work on a normalized copy of the font name
     fontname = fz_strdup(ctx, orig_name);
@@ -623,6 +1302,7 @@ static fz_font* pdf_load_windows_font_by_name(fz_context* ctx, const char* orig_
         if (!found)
             found = pdf_find_windows_font_path(fontname);
     }
+#ifdef _WIN32
     // fifth, try to convert the font name from the common Chinese codepage 936
     if (!found && fontname[0] < 0) {
         WCHAR cjkNameW[MAX_FACENAME];
@@ -639,8 +1319,22 @@ static fz_font* pdf_load_windows_font_by_name(fz_context* ctx, const char* orig_
                 found = pdf_find_windows_font_path(cjkName);
         }
     }
+#endif
 
     fz_free(ctx, fontname);
+    return found;
+}
+
+static fz_font* pdf_load_windows_font_by_name(fz_context* ctx, const char* orig_name) {
+    sys_font_info* found;
+    fz_font* font;
+    fz_buffer* buffer;
+
+    ensure_system_font_list(ctx);
+    if (fontlistMS.len == 0)
+        fz_throw(ctx, FZ_ERROR_GENERIC, "fonterror: couldn't find any fonts");
+
+    found = find_system_font(ctx, orig_name);
     if (!found)
         fz_throw(ctx, FZ_ERROR_GENERIC, "couldn't find system font '%s'", orig_name);
 
@@ -659,10 +1353,10 @@ static fz_font* pdf_load_windows_font_by_name(fz_context* ctx, const char* orig_
         f->fi = found;
         f->ctx = ctx;
         f->buffer = buffer;
-        EnterCriticalSection(&cs_fonts);
+        lock_fonts();
         f->next = cached_fonts;
         cached_fonts = f;
-        LeaveCriticalSection(&cs_fonts);
+        unlock_fonts();
 
         fz_warn(ctx, "loading non-embedded font '%s' from '%s'", orig_name, found->fontpath);
     }
@@ -764,28 +1458,57 @@ static fz_font* pdf_load_windows_cjk_font(fz_context* ctx, const char* fontname,
 
     return font;
 }
-#endif
 
 void init_system_font_list(void) {
     // this should always happen on main thread
     if (did_init)
         return;
+#ifdef _WIN32
     InitializeCriticalSection(&cs_fonts);
+#endif
     did_init = 1;
 }
 
 void destroy_system_font_list(void) {
     free(fontlistMS.fontmap);
     memset(&fontlistMS, 0, sizeof(fontlistMS));
+#ifdef _WIN32
     DeleteCriticalSection(&cs_fonts);
+#endif
+    did_init = 0;
+}
+
+// must be called before the first non-embedded font is loaded
+// dir: directory with .ttf/.otf/.ttc files, NULL for the Windows fonts directory
+void pdf_set_system_font_dir(const char* dir) {
+    fz_strlcpy(font_dir, dir ? dir : "", sizeof(font_dir));
+}
+
+// must be called before the first non-embedded font is loaded
+// path: file for caching parsed font names across runs, NULL to not use a catalog
+void pdf_set_system_font_catalog_path(const char* path) {
+    fz_strlcpy(font_catalog_path, path ? path : "", sizeof(font_catalog_path));
+}
+
+// returns the path of the file a non-embedded font with the given name would be
+// loaded from (or NULL), without loading the font. Used by unit tests
+const char* pdf_lookup_system_font_path(fz_context* ctx, const char* fontname) {
+    sys_font_info* found;
+    init_system_font_list();
+    ensure_system_font_list(ctx);
+    found = find_system_font(ctx, fontname);
+    return found ? found->fontpath : NULL;
 }
 
 void pdf_install_load_system_font_funcs(fz_context* ctx) {
-#ifdef _WIN32
+#ifndef _WIN32
+    // there's no default font directory outside of Windows
+    if (!font_dir[0])
+        return;
+#endif
     // TODO(port): also fallback font?
     init_system_font_list();
     fz_install_load_system_font_funcs(ctx, pdf_load_windows_font, pdf_load_windows_cjk_font, NULL);
-#endif
 }
 
 void version_check_3_4() {
@@ -1,6 +1,7 @@
 #include "mupdf/fitz.h"
 
 #include "color-imp.h"
+#include "cpu-imp.h"
 
 #include <math.h>
 
@@ -202,6 +203,338 @@ fz_lookup_fast_color_converter(fz_context *ctx, fz_colorspace *ss, fz_colorspace
 	fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find color converter");
 }
 
+#if FZ_SIMD_SSE2
+
+/*
+
+SIMD row converters
+
+These convert one row of pixels without spots for the most common fast
+conversions, with the same results as the C loops below (which they
+replace for the whole pixmap). Conversions between pixels of 4 bytes
+(and from 1 or 2 bytes to 4) only need SSE2; those involving pixels of
+3 bytes need pshufb, which is used by the AVX2 versions (every CPU with
+AVX2 has SSSE3). The last few pixels of a row are converted in C.
+
+*/
+
+typedef void (fast_row_fn)(unsigned char * FZ_RESTRICT d, const unsigned char * FZ_RESTRICT s, size_t w);
+
+static void
+convert_rows_simd(fast_row_fn *row, unsigned char *d, const unsigned char *s, size_t w, int h, int sn, int dn, ptrdiff_t d_line_inc, ptrdiff_t s_line_inc)
+{
+	while (h--)
+	{
+		row(d, s, w);
+		d += w * dn + d_line_inc;
+		s += w * sn + s_line_inc;
+	}
+}
+
+/* gray to rgb(a) */
+
+static void
+gray_to_rgba_row_sse2(unsigned char * FZ_RESTRICT d, const unsigned char * FZ_RESTRICT s, size_t w)
+{
+	const __m128i a = _mm_set1_epi8((char)255);
+	for (; w >= 16; w -= 16)
+	{
+		__m128i g = _mm_loadu_si128((const __m128i *)s);
+		__m128i gg = _mm_unpacklo_epi8(g, g);
+		__m128i ga = _mm_unpacklo_epi8(g, a);
+		_mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi16(gg, ga));
+		_mm_storeu_si128((__m128i *)(d + 16), _mm_unpackhi_epi16(gg, ga));
+		gg = _mm_unpackhi_epi8(g, g);
+		ga = _mm_unpackhi_epi8(g, a);
+		_mm_storeu_si128((__m128i *)(d + 32), _mm_unpacklo_epi16(gg, ga));
+		_mm_storeu_si128((__m128i *)(d + 48), _mm_unpackhi_epi16(gg, ga));
+		s += 16;
+		d += 64;
+	}
+	while (w--)
+	{
+		d[0] = s[0];
+		d[1] = s[0];
+		d[2] = s[0];
+		d[3] = 255;
+		s++;
+		d += 4;
+	}
+}
+
+static void
+graya_to_rgba_row_sse2(unsigned char * FZ_RESTRICT d, const unsigned char * FZ_RESTRICT s, size_t w)
+{
+	const __m128i lo = _mm_set1_epi16(0x00FF);
+	for (; w >= 8; w -= 8)
+	{
+		__m128i ga = _mm_loadu_si128((const __m128i *)s);
+		__m128i g = _mm_and_si128(ga, lo);
+		__m128i gg = _mm_or_si128(g, _mm_slli_epi16(g, 8));
+		_mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi16(gg, ga));
+		_mm_storeu_si128((__m128i *)(d + 16), _mm_unpackhi_epi16(gg, ga));
+		s += 16;
+		d += 32;
+	}
+	while (w--)
+	{
+		d[0] = s[0];
+		d[1] = s[0];
+		d[2] = s[0];
+		d[3] = s[1];
+		s += 2;
+		d += 4;
+	}
+}
+
+/* rgb(a) to bgr(a), either way round */
+
+/* swaps the 1st and 3rd byte of every 32 bit word */
+static inline __m128i
+swap_rb_sse2(__m128i v)
+{
+	__m128i ga = _mm_and_si128(v, _mm_set1_epi32((int)0xFF00FF00));
+	__m128i r = _mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0xFF)), 16);
+	__m128i b = _mm_and_si128(_mm_srli_epi32(v, 16), _mm_set1_epi32(0xFF));
+	return _mm_or_si128(ga, _mm_or_si128(r, b));
+}
+
+static void
+rgba_to_bgra_row_sse2(unsigned char * FZ_RESTRICT d, const unsigned char * FZ_RESTRICT s, size_t w)
+{
+	for (; w >= 4; w -= 4)
+	{
+		_mm_storeu_si128((__m128i *)d, swap_rb_sse2(_mm_loadu_si128((const __m128i *)s)));
+		s += 16;
+		d += 16;
+	}
+	while (w--)
+	{
+		d[0] = s[2];
+		d[1] = s[1];
+		d[2] = s[0];
+		d[3] = s[3];
+		s += 4;
+		d += 4;
+	}
+}
+
+/* cmyk to rgb(a) or bgr(a) */
+
+/* 255 - min(c + k, 255) etc. of 4 cmyk pixels, with the alpha byte set to 255 */
+static inline __m128i
+cmyk_to_rgba_sse2(__m128i v)
+{
+	__m128i k = _mm_srli_epi32(v, 24);
+	k = _mm_or_si128(k, _mm_or_si128(_mm_slli_epi32(k, 8), _mm_slli_epi32(k, 16)));
+	v = _mm_xor_si128(_mm_adds_epu8(v, k), _mm_set1_epi32(-1));
+	return _mm_or_si128(v, _mm_set1_epi32((int)0xFF000000));
+}
+
+static inline void
+cmyk_to_rgb_pixel(unsigned char * FZ_RESTRICT d, const unsigned char * FZ_RESTRICT s, int bgr)
+{
+	int r = 255 - fz_mini(s[0] + s[3], 255);
+	int g = 255 - fz_mini(s[1] + s[3], 255);
+	int b = 255 - fz_mini(s[2] + s[3], 255);
+	d[0] = bgr ? b : r;
+	d[1] = g;
+	d[2] = bgr ? r : b;
+}
+
+static void
+cmyk_to_rgba_row_sse2(unsigned char * FZ_RESTRICT d, const unsigned char * FZ_RESTRICT s, size_t w)
+{
+	for (; w >= 4; w -= 4)
+	{
+		_mm_storeu_si128((__m128i *)d, cmyk_to_rgba_sse2(_mm_loadu_si128((const __m128i *)s)));
+		s += 16;
+		d += 16;
+	}
+	for (; w > 0; w--)
+	{
+		cmyk_to_rgb_pixel(d, s, 0);
+		d[3] = 255;
+		s += 4;
+		d += 4;
+	}
+}
+
+static void
+cmyk_to_bgra_row_sse2(unsigned char * FZ_RESTRICT d, const unsigned char * FZ_RESTRICT s, size_t w)
+{
+	for (; w >= 4; w -= 4)
+	{
+		_mm_storeu_si128((__m128i *)d, swap_rb_sse2(cmyk_to_rgba_sse2(_mm_loadu_si128((const __m128i *)s))));
+		s += 16;
+		d += 16;
+	}
+	for (; w > 0; w--)
+	{
+		cmyk_to_rgb_pixel(d, s, 1);
+		d[3] = 255;
+		s += 4;
+		d += 4;
+	}
+}
+
+#if FZ_SIMD_AVX2
+
+/* Loads and stores of 16 bytes may go past the pixels a loop iteration
+ * converts, so these loops stop while there are at least 6 pixels left. */
+
+FZ_TARGET_AVX2 static void
+gray_to_rgb_row_avx2(unsigned char * FZ_RESTRICT d, const unsigned char * FZ_RESTRICT s, size_t w)
+{
+	const __m128i m0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+	const __m128i m1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+	const __m128i m2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+	for (; w >= 16; w -= 16)
+	{
+		__m128i g = _mm_loadu_si128((const __m128i *)s);
+		_mm_storeu_si128((__m128i *)d, _mm_shuffle_epi8(g, m0));
+		_mm_storeu_si128((__m128i *)(d + 16), _mm_shuffle_epi8(g, m1));
+		_mm_storeu_si128((__m128i *)(d + 32), _mm_shuffle_epi8(g, m2));
+		s += 16;
+		d += 48;
+	}
+	while (w--)
+	{
+		d[0] = s[0];
+		d[1] = s[0];
+		d[2] = s[0];
+		s++;
+		d += 3;
+	}
+}
+
+FZ_TARGET_AVX2 static void
+rgb_to_bgr_row_avx2(unsigned char * FZ_RESTRICT d, const unsigned char * FZ_RESTRICT s, size_t w)
+{
+	/* 5 pixels at a time, the 16th byte is rewritten by the next iteration */
+	const __m128i m = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+	for (; w >= 6; w -= 5)
+	{
+		_mm_storeu_si128((__m128i *)d, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)s), m));
+		s += 15;
+		d += 15;
+	}
+	while (w--)
+	{
+		d[0] = s[2];
+		d[1] = s[1];
+		d[2] = s[0];
+		s += 3;
+		d += 3;
+	}
+}
+
+FZ_TARGET_AVX2 static void
+rgb_to_bgra_row_avx2(unsigned char * FZ_RESTRICT d, const unsigned char * FZ_RESTRICT s, size_t w)
+{
+	const __m128i m = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	const __m128i a = _mm_set1_epi32((int)0xFF000000);
+	for (; w >= 6; w -= 4)
+	{
+		_mm_storeu_si128((__m128i *)d, _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)s), m), a));
+		s += 12;
+		d += 16;
+	}
+	while (w--)
+	{
+		d[0] = s[2];
+		d[1] = s[1];
+		d[2] = s[0];
+		d[3] = 255;
+		s += 3;
+		d += 4;
+	}
+}
+
+FZ_TARGET_AVX2 static inline void
+cmyk_to_rgb_row_avx2_imp(unsigned char * FZ_RESTRICT d, const unsigned char * FZ_RESTRICT s, size_t w, int bgr)
+{
+	const __m128i m = bgr ?
+		_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1) :
+		_mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	for (; w >= 6; w -= 4)
+	{
+		_mm_storeu_si128((__m128i *)d, _mm_shuffle_epi8(cmyk_to_rgba_sse2(_mm_loadu_si128((const __m128i *)s)), m));
+		s += 16;
+		d += 12;
+	}
+	for (; w > 0; w--)
+	{
+		cmyk_to_rgb_pixel(d, s, bgr);
+		s += 4;
+		d += 3;
+	}
+}
+
+FZ_TARGET_AVX2 static void
+cmyk_to_rgb_row_avx2(unsigned char * FZ_RESTRICT d, const unsigned char * FZ_RESTRICT s, size_t w)
+{
+	cmyk_to_rgb_row_avx2_imp(d, s, w, 0);
+}
+
+FZ_TARGET_AVX2 static void
+cmyk_to_bgr_row_avx2(unsigned char * FZ_RESTRICT d, const unsigned char * FZ_RESTRICT s, size_t w)
+{
+	cmyk_to_rgb_row_avx2_imp(d, s, w, 1);
+}
+
+#endif /* FZ_SIMD_AVX2 */
+
+/* the row converters for pixmaps without spots, NULL where there is none */
+
+static fast_row_fn *
+gray_to_rgb_row_simd(int sa, int da)
+{
+	int features = fz_cpu_features();
+	if (!(features & FZ_CPU_SSE2))
+		return NULL;
+	if (da)
+		return sa ? graya_to_rgba_row_sse2 : gray_to_rgba_row_sse2;
+#if FZ_SIMD_AVX2
+	if (features & FZ_CPU_AVX2)
+		return gray_to_rgb_row_avx2;
+#endif /* FZ_SIMD_AVX2 */
+	return NULL;
+}
+
+static fast_row_fn *
+rgb_to_bgr_row_simd(int sa, int da)
+{
+	int features = fz_cpu_features();
+	if (!(features & FZ_CPU_SSE2))
+		return NULL;
+	if (sa)
+		return rgba_to_bgra_row_sse2;
+#if FZ_SIMD_AVX2
+	if (features & FZ_CPU_AVX2)
+		return da ? rgb_to_bgra_row_avx2 : rgb_to_bgr_row_avx2;
+#endif /* FZ_SIMD_AVX2 */
+	return NULL;
+}
+
+/* only for source pixmaps without alpha */
+static fast_row_fn *
+cmyk_to_rgb_row_simd(int da, int bgr)
+{
+	int features = fz_cpu_features();
+	if (!(features & FZ_CPU_SSE2))
+		return NULL;
+	if (da)
+		return bgr ? cmyk_to_bgra_row_sse2 : cmyk_to_rgba_row_sse2;
+#if FZ_SIMD_AVX2
+	if (features & FZ_CPU_AVX2)
+		return bgr ? cmyk_to_bgr_row_avx2 : cmyk_to_rgb_row_avx2;
+#endif /* FZ_SIMD_AVX2 */
+	return NULL;
+}
+
+#endif /* FZ_SIMD_SSE2 */
+
 /* Fast pixmap color conversions */
 
 static void fast_gray_to_rgb(fz_context *ctx, const fz_pixmap *src, fz_pixmap *dst, int copy_spots)
@@ -237,6 +570,14 @@ static void fast_gray_to_rgb(fz_context *ctx, const fz_pixmap *src, fz_pixmap *d
 	if (ss == 0 && ds == 0)
 	{
 		/* Common, no spots case */
+#if FZ_SIMD_SSE2
+		fast_row_fn *row = gray_to_rgb_row_simd(sa, da);
+		if (row)
+		{
+			convert_rows_simd(row, d, s, w, h, sn, dn, d_line_inc, s_line_inc);
+			return;
+		}
+#endif /* FZ_SIMD_SSE2 */
 		if (da)
 		{
 			if (sa)
@@ -941,6 +1282,18 @@ static void fast_cmyk_to_rgb(fz_context *ctx, const fz_pixmap *src, fz_pixmap *d
 	if ((int)w < 0 || h < 0)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "integer overflow");
 
+#if FZ_SIMD_SSE2
+	if (ss == 0 && ds == 0 && !sa)
+	{
+		fast_row_fn *row = cmyk_to_rgb_row_simd(da, 0);
+		if (row)
+		{
+			convert_rows_simd(row, d, s, w, h, sn, dn, d_line_inc, s_line_inc);
+			return;
+		}
+	}
+#endif /* FZ_SIMD_SSE2 */
+
 	while (h--)
 	{
 		size_t ww = w;
@@ -1024,6 +1377,18 @@ static void fast_cmyk_to_bgr(fz_context *ctx, const fz_pixmap *src, fz_pixmap *d
 	if ((int)w < 0 || h < 0)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "integer overflow");
 
+#if FZ_SIMD_SSE2
+	if (ss == 0 && ds == 0 && !sa)
+	{
+		fast_row_fn *row = cmyk_to_rgb_row_simd(da, 1);
+		if (row)
+		{
+			convert_rows_simd(row, d, s, w, h, sn, dn, d_line_inc, s_line_inc);
+			return;
+		}
+	}
+#endif /* FZ_SIMD_SSE2 */
+
 	while (h--)
 	{
 		size_t ww = w;
@@ -1116,6 +1481,14 @@ static void fast_rgb_to_bgr(fz_context *ctx, const fz_pixmap *src, fz_pixmap *ds
 	if (ss == 0 && ds == 0)
 	{
 		/* Common, no spots case */
+#if FZ_SIMD_SSE2
+		fast_row_fn *row = rgb_to_bgr_row_simd(sa, da);
+		if (row)
+		{
+			convert_rows_simd(row, d, s, w, h, sn, dn, d_line_inc, s_line_inc);
+			return;
+		}
+#endif /* FZ_SIMD_SSE2 */
 		if (da)
 		{
 			if (sa)
@@ -1132,6 +1505,8 @@ static void fast_rgb_to_bgr(fz_context *ctx, const fz_pixmap *src, fz_pixmap *ds
 						s += 4;
 						d += 4;
 					}
+					d += d_line_inc;
+					s += s_line_inc;
 				}
 			}
 			else
@@ -1148,6 +1523,8 @@ static void fast_rgb_to_bgr(fz_context *ctx, const fz_pixmap *src, fz_pixmap *ds
 						s += 3;
 						d += 4;
 					}
+					d += d_line_inc;
+					s += s_line_inc;
 				}
 			}
 		}
@@ -1164,6 +1541,8 @@ static void fast_rgb_to_bgr(fz_context *ctx, const fz_pixmap *src, fz_pixmap *ds
 					s += 3;
 					d += 3;
 				}
+				d += d_line_inc;
+				s += s_line_inc;
 			}
 		}
 	}
@@ -1258,6 +1637,8 @@ static void fast_gray_to_gray(fz_context *ctx, const fz_pixmap *src, fz_pixmap *
 						s += 2;
 						d += 2;
 					}
+					d += d_line_inc;
+					s += s_line_inc;
 				}
 			}
 			else
@@ -1272,6 +1653,8 @@ static void fast_gray_to_gray(fz_context *ctx, const fz_pixmap *src, fz_pixmap *
 						s += 1;
 						d += 2;
 					}
+					d += d_line_inc;
+					s += s_line_inc;
 				}
 			}
 		}
@@ -1286,6 +1669,8 @@ static void fast_gray_to_gray(fz_context *ctx, const fz_pixmap *src, fz_pixmap *
 					s += 1;
 					d += 1;
 				}
+				d += d_line_inc;
+				s += s_line_inc;
 			}
 		}
 	}
@@ -1378,6 +1763,8 @@ static void fast_rgb_to_rgb(fz_context *ctx, const fz_pixmap *src, fz_pixmap *ds
 						s += 4;
 						d += 4;
 					}
+					d += d_line_inc;
+					s += s_line_inc;
 				}
 			}
 			else
@@ -1394,6 +1781,8 @@ static void fast_rgb_to_rgb(fz_context *ctx, const fz_pixmap *src, fz_pixmap *ds
 						s += 3;
 						d += 4;
 					}
+					d += d_line_inc;
+					s += s_line_inc;
 				}
 			}
 		}
@@ -1410,6 +1799,8 @@ static void fast_rgb_to_rgb(fz_context *ctx, const fz_pixmap *src, fz_pixmap *ds
 					s += 3;
 					d += 3;
 				}
+				d += d_line_inc;
+				s += s_line_inc;
 			}
 		}
 	}
@@ -1507,6 +1898,8 @@ static void fast_cmyk_to_cmyk(fz_context *ctx, const fz_pixmap *src, fz_pixmap *
 						s += 5;
 						d += 5;
 					}
+					d += d_line_inc;
+					s += s_line_inc;
 				}
 			}
 			else
@@ -1524,6 +1917,8 @@ static void fast_cmyk_to_cmyk(fz_context *ctx, const fz_pixmap *src, fz_pixmap *
 						s += 4;
 						d += 5;
 					}
+					d += d_line_inc;
+					s += s_line_inc;
 				}
 			}
 		}
@@ -1541,6 +1936,8 @@ static void fast_cmyk_to_cmyk(fz_context *ctx, const fz_pixmap *src, fz_pixmap *
 					s += 4;
 					d += 4;
 				}
+				d += d_line_inc;
+				s += s_line_inc;
 			}
 		}
 	}
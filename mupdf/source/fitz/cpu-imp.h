@@ -0,0 +1,59 @@
+#ifndef MUPDF_FITZ_CPU_IMP_H
+#define MUPDF_FITZ_CPU_IMP_H
+
+/*
+	SIMD code paths.
+
+	SSE2 is part of x64 and our x86 builds require it, so code using
+	it is selected at compile time (FZ_SIMD_SSE2). Code using newer
+	instruction sets is compiled with FZ_TARGET_AVX2 etc. and must only
+	be called if fz_cpu_features() reports support for it.
+*/
+
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define FZ_SIMD_SSE2 1
+#else
+#define FZ_SIMD_SSE2 0
+#endif
+
+#if FZ_SIMD_SSE2 && (defined(_MSC_VER) || defined(__GNUC__) || defined(__clang__))
+#define FZ_SIMD_AVX2 1
+#else
+#define FZ_SIMD_AVX2 0
+#endif
+
+#if FZ_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+#if FZ_SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define FZ_TARGET_AVX2
+#else
+#define FZ_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+enum
+{
+	FZ_CPU_SSE2 = 1,
+	FZ_CPU_AVX2 = 2
+};
+
+/*
+	Returns the FZ_CPU_* instruction sets which SIMD code paths may use.
+
+	Setting the environment variable FZ_DISABLE_SIMD to 1 disables all
+	of them (for comparing against the plain C code).
+*/
+int fz_cpu_features(void);
+
+/*
+	Restricts fz_cpu_features() to the features in mask (e.g. 0 for
+	plain C code or FZ_CPU_SSE2 to not use AVX2), for tests and
+	benchmarks. Only affects code paths selected afterwards.
+*/
+void fz_set_cpu_features_mask(int mask);
+
+#endif
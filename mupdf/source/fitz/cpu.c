@@ -0,0 +1,83 @@
+#include "mupdf/fitz.h"
+
+#include "cpu-imp.h"
+
+#include <stdlib.h>
+
+#if FZ_SIMD_AVX2 && defined(_MSC_VER)
+#include <intrin.h>
+#elif FZ_SIMD_AVX2
+#include <cpuid.h>
+#endif
+
+/* Both are only ever set to the same values, so racing threads are harmless. */
+static int cpu_features = -1;
+static int cpu_features_mask = ~0;
+
+#if FZ_SIMD_AVX2
+static void
+cpuid(int leaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+	__cpuidex((int *)regs, leaf, 0);
+#else
+	__cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+/* the OS saves the upper halves of the ymm registers on context switches */
+static int
+os_supports_avx(void)
+{
+#ifdef _MSC_VER
+	return (_xgetbv(0) & 6) == 6;
+#else
+	unsigned int eax, edx;
+	__asm__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+	return (eax & 6) == 6;
+#endif
+}
+#endif
+
+static int
+detect_cpu_features(void)
+{
+	int features = 0;
+	const char *env = getenv("FZ_DISABLE_SIMD");
+	if (env && fz_atoi(env))
+		return 0;
+#if FZ_SIMD_SSE2
+	features |= FZ_CPU_SSE2;
+#endif
+#if FZ_SIMD_AVX2
+	{
+		unsigned int regs[4];
+		cpuid(0, regs);
+		if (regs[0] >= 7)
+		{
+			int osxsave, avx;
+			cpuid(1, regs);
+			osxsave = (regs[2] >> 27) & 1;
+			avx = (regs[2] >> 28) & 1;
+			cpuid(7, regs);
+			if (osxsave && avx && ((regs[1] >> 5) & 1) && os_supports_avx())
+				features |= FZ_CPU_AVX2;
+		}
+	}
+#endif
+	return features;
+}
+
+int
+fz_cpu_features(void)
+{
+	if (cpu_features < 0)
+		cpu_features = detect_cpu_features();
+	return cpu_features & cpu_features_mask;
+}
+
+void
+fz_set_cpu_features_mask(int mask)
+{
+	cpu_features_mask = mask;
+}
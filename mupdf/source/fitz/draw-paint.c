@@ -1,6 +1,7 @@
 #include "mupdf/fitz.h"
 
 #include "draw-imp.h"
+#include "cpu-imp.h"
 #include "glyph-imp.h"
 #include "pixmap-imp.h"
 
@@ -79,6 +80,281 @@ and stick to using the premultiplied form.
 
 typedef unsigned char byte;
 
+/*
+
+SIMD painters
+
+For every byte of a pixel, the C templates below compute
+
+	d = FZ_BLEND(s, d, ma) = (d * 256 + (s - d) * ma) >> 8
+
+where s is either a constant color or the byte of a source pixel and ma
+(0..256) is the pixel's mask value, possibly combined with the color's
+alpha. This gives d for ma == 0 and s for ma == 256, so vectorized code
+doesn't need the special cases of the templates to produce bit-identical
+results. In 16 bit lanes, (s - d) * ma wraps around but the sum always
+fits, so no wider arithmetic is needed.
+
+Only pixels of 1, 2 and 4 bytes are vectorized (i.e. n == 1 and n == 4
+without alpha, n == 1 and n == 3 with alpha); whatever is left of a span
+after the last whole vector is painted by the C templates.
+
+*/
+
+#if FZ_SIMD_SSE2
+
+/* the pixel value repeated for every byte position of a 32-bit word */
+static inline uint32_t
+pixel_pattern(int bpp, int c0, int c1, int c2, int c3)
+{
+	if (bpp == 1)
+		return 0x01010101u * (uint32_t)c0;
+	if (bpp == 2)
+		return 0x00010001u * ((uint32_t)c0 | ((uint32_t)c1 << 8));
+	return (uint32_t)c0 | ((uint32_t)c1 << 8) | ((uint32_t)c2 << 16) | ((uint32_t)c3 << 24);
+}
+
+/* repeats the mask values of the pixels making up the next 16 bytes of a span for each of their bytes */
+static inline __m128i
+load_mask_sse2(const byte * FZ_RESTRICT mp, int bpp)
+{
+	__m128i m;
+	if (bpp == 4)
+	{
+		uint32_t v;
+		memcpy(&v, mp, 4);
+		m = _mm_cvtsi32_si128((int)v);
+		m = _mm_unpacklo_epi8(m, m);
+		return _mm_unpacklo_epi16(m, m);
+	}
+	if (bpp == 2)
+	{
+		m = _mm_loadl_epi64((const __m128i *)mp);
+		return _mm_unpacklo_epi8(m, m);
+	}
+	return _mm_loadu_si128((const __m128i *)mp);
+}
+
+/* clears the mask values of source pixels with alpha 0, which the templates skip */
+static inline __m128i
+mask_transparent_sse2(__m128i mb, __m128i s, int bpp)
+{
+	__m128i t;
+	if (bpp == 4)
+		t = _mm_cmpeq_epi32(_mm_and_si128(s, _mm_set1_epi32((int)0xFF000000)), _mm_setzero_si128());
+	else
+		t = _mm_cmpeq_epi16(_mm_and_si128(s, _mm_set1_epi16((short)0xFF00)), _mm_setzero_si128());
+	return _mm_andnot_si128(t, mb);
+}
+
+/* FZ_EXPAND of 16 bit mask values, FZ_COMBINE'd with sa unless that's 256 */
+static inline __m128i
+expand_mask_sse2(__m128i ma, int sa)
+{
+	ma = _mm_add_epi16(ma, _mm_srli_epi16(ma, 7));
+	if (sa != 256)
+		ma = _mm_srli_epi16(_mm_mullo_epi16(ma, _mm_set1_epi16((short)sa)), 8);
+	return ma;
+}
+
+static inline __m128i
+blend_epi16_sse2(__m128i s, __m128i d, __m128i ma)
+{
+	return _mm_srli_epi16(_mm_add_epi16(_mm_slli_epi16(d, 8), _mm_mullo_epi16(_mm_sub_epi16(s, d), ma)), 8);
+}
+
+/* FZ_BLEND(s, d, ma) of 16 bytes, with ma given as 2 x 8 16 bit values */
+static inline __m128i
+blend_sse2(__m128i s, __m128i d, __m128i mal, __m128i mah)
+{
+	const __m128i z = _mm_setzero_si128();
+	__m128i rl = blend_epi16_sse2(_mm_unpacklo_epi8(s, z), _mm_unpacklo_epi8(d, z), mal);
+	__m128i rh = blend_epi16_sse2(_mm_unpackhi_epi8(s, z), _mm_unpackhi_epi8(d, z), mah);
+	return _mm_packus_epi16(rl, rh);
+}
+
+static inline int
+all_bytes_eq_sse2(__m128i v, int c)
+{
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)c))) == 0xFFFF;
+}
+
+/* These return the number of pixels painted, always a multiple of 16/bpp. */
+
+static inline int
+solid_color_sse2(byte * FZ_RESTRICT dp, int w, int bpp, uint32_t color, int sa)
+{
+	const int ppv = 16 / bpp;
+	const __m128i c = _mm_set1_epi32((int)color);
+	const __m128i ma = _mm_set1_epi16((short)sa);
+	int i;
+	for (i = 0; i + ppv <= w; i += ppv)
+	{
+		__m128i *p = (__m128i *)(dp + i * bpp);
+		_mm_storeu_si128(p, blend_sse2(c, _mm_loadu_si128(p), ma, ma));
+	}
+	return i;
+}
+
+static inline int
+span_with_color_sse2(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int w, int bpp, uint32_t color, int sa)
+{
+	const int ppv = 16 / bpp;
+	const __m128i c = _mm_set1_epi32((int)color);
+	const __m128i z = _mm_setzero_si128();
+	int i;
+	for (i = 0; i + ppv <= w; i += ppv)
+	{
+		__m128i *p = (__m128i *)(dp + i * bpp);
+		__m128i mb = load_mask_sse2(mp + i, bpp);
+		if (all_bytes_eq_sse2(mb, 0))
+			continue;
+		if (sa == 256 && all_bytes_eq_sse2(mb, 255))
+			_mm_storeu_si128(p, c);
+		else
+			_mm_storeu_si128(p, blend_sse2(c, _mm_loadu_si128(p),
+				expand_mask_sse2(_mm_unpacklo_epi8(mb, z), sa),
+				expand_mask_sse2(_mm_unpackhi_epi8(mb, z), sa)));
+	}
+	return i;
+}
+
+static inline int
+span_with_mask_sse2(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int w, int bpp, int a)
+{
+	const int ppv = 16 / bpp;
+	const __m128i z = _mm_setzero_si128();
+	int i;
+	for (i = 0; i + ppv <= w; i += ppv)
+	{
+		__m128i *p = (__m128i *)(dp + i * bpp);
+		__m128i s = _mm_loadu_si128((const __m128i *)(sp + i * bpp));
+		__m128i mb = load_mask_sse2(mp + i, bpp);
+		if (a)
+			mb = mask_transparent_sse2(mb, s, bpp);
+		if (all_bytes_eq_sse2(mb, 0))
+			continue;
+		if (all_bytes_eq_sse2(mb, 255))
+			_mm_storeu_si128(p, s);
+		else
+			_mm_storeu_si128(p, blend_sse2(s, _mm_loadu_si128(p),
+				expand_mask_sse2(_mm_unpacklo_epi8(mb, z), 256),
+				expand_mask_sse2(_mm_unpackhi_epi8(mb, z), 256)));
+	}
+	return i;
+}
+
+#endif /* FZ_SIMD_SSE2 */
+
+#if FZ_SIMD_AVX2
+
+/* The AVX2 versions do the same for 32 bytes at a time. */
+
+FZ_TARGET_AVX2 static inline __m256i
+expand_mask_avx2(__m128i mb, int sa)
+{
+	__m256i ma = _mm256_cvtepu8_epi16(mb);
+	ma = _mm256_add_epi16(ma, _mm256_srli_epi16(ma, 7));
+	if (sa != 256)
+		ma = _mm256_srli_epi16(_mm256_mullo_epi16(ma, _mm256_set1_epi16((short)sa)), 8);
+	return ma;
+}
+
+FZ_TARGET_AVX2 static inline __m256i
+blend_epi16_avx2(__m128i s, __m128i d, __m256i ma)
+{
+	__m256i s16 = _mm256_cvtepu8_epi16(s);
+	__m256i d16 = _mm256_cvtepu8_epi16(d);
+	return _mm256_srli_epi16(_mm256_add_epi16(_mm256_slli_epi16(d16, 8), _mm256_mullo_epi16(_mm256_sub_epi16(s16, d16), ma)), 8);
+}
+
+/* FZ_BLEND(s, d, ma) of 32 bytes, with ma given as 2 x 16 16 bit values */
+FZ_TARGET_AVX2 static inline __m256i
+blend_avx2(__m256i s, __m256i d, __m256i mal, __m256i mah)
+{
+	__m256i rl = blend_epi16_avx2(_mm256_castsi256_si128(s), _mm256_castsi256_si128(d), mal);
+	__m256i rh = blend_epi16_avx2(_mm256_extracti128_si256(s, 1), _mm256_extracti128_si256(d, 1), mah);
+	/* packus works within 128 bit lanes */
+	return _mm256_permute4x64_epi64(_mm256_packus_epi16(rl, rh), 0xD8);
+}
+
+FZ_TARGET_AVX2 static inline int
+all_bytes_eq_avx2(__m128i ml, __m128i mh, int c)
+{
+	__m128i v = _mm_set1_epi8((char)c);
+	return _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(ml, v), _mm_cmpeq_epi8(mh, v))) == 0xFFFF;
+}
+
+FZ_TARGET_AVX2 static inline int
+solid_color_avx2(byte * FZ_RESTRICT dp, int w, int bpp, uint32_t color, int sa)
+{
+	const int ppv = 32 / bpp;
+	const __m256i c = _mm256_set1_epi32((int)color);
+	const __m256i ma = _mm256_set1_epi16((short)sa);
+	int i;
+	for (i = 0; i + ppv <= w; i += ppv)
+	{
+		__m256i *p = (__m256i *)(dp + i * bpp);
+		_mm256_storeu_si256(p, blend_avx2(c, _mm256_loadu_si256(p), ma, ma));
+	}
+	return i;
+}
+
+FZ_TARGET_AVX2 static inline int
+span_with_color_avx2(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int w, int bpp, uint32_t color, int sa)
+{
+	const int ppv = 32 / bpp;
+	const __m256i c = _mm256_set1_epi32((int)color);
+	int i;
+	for (i = 0; i + ppv <= w; i += ppv)
+	{
+		__m256i *p = (__m256i *)(dp + i * bpp);
+		__m128i ml = load_mask_sse2(mp + i, bpp);
+		__m128i mh = load_mask_sse2(mp + i + ppv / 2, bpp);
+		if (all_bytes_eq_avx2(ml, mh, 0))
+			continue;
+		if (sa == 256 && all_bytes_eq_avx2(ml, mh, 255))
+			_mm256_storeu_si256(p, c);
+		else
+			_mm256_storeu_si256(p, blend_avx2(c, _mm256_loadu_si256(p), expand_mask_avx2(ml, sa), expand_mask_avx2(mh, sa)));
+	}
+	return i;
+}
+
+FZ_TARGET_AVX2 static inline int
+span_with_mask_avx2(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int w, int bpp, int a)
+{
+	const int ppv = 32 / bpp;
+	int i;
+	for (i = 0; i + ppv <= w; i += ppv)
+	{
+		__m256i *p = (__m256i *)(dp + i * bpp);
+		__m256i s = _mm256_loadu_si256((const __m256i *)(sp + i * bpp));
+		__m128i ml = load_mask_sse2(mp + i, bpp);
+		__m128i mh = load_mask_sse2(mp + i + ppv / 2, bpp);
+		if (a)
+		{
+			ml = mask_transparent_sse2(ml, _mm256_castsi256_si128(s), bpp);
+			mh = mask_transparent_sse2(mh, _mm256_extracti128_si256(s, 1), bpp);
+		}
+		if (all_bytes_eq_avx2(ml, mh, 0))
+			continue;
+		if (all_bytes_eq_avx2(ml, mh, 255))
+			_mm256_storeu_si256(p, s);
+		else
+			_mm256_storeu_si256(p, blend_avx2(s, _mm256_loadu_si256(p), expand_mask_avx2(ml, 256), expand_mask_avx2(mh, 256)));
+	}
+	return i;
+}
+
+#endif /* FZ_SIMD_AVX2 */
+
+#if FZ_SIMD_AVX2
+#define SIMD_PAINTER(name) ((fz_cpu_features() & FZ_CPU_AVX2) ? name##_avx2 : name##_sse2)
+#else
+#define SIMD_PAINTER(name) name##_sse2
+#endif
+
 /* These are used by the non-aa scan converter */
 
 static inline void
@@ -571,6 +847,87 @@ static void paint_solid_color_N_da_op(byte * FZ_RESTRICT dp, int n, int w, const
 }
 #endif /* FZ_ENABLE_SPOT_RENDERING */
 
+#if FZ_SIMD_SSE2
+#define SOLID_COLOR_PAINTERS(ISA, TARGET) \
+TARGET static void \
+paint_solid_color_1_alpha_##ISA(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop) \
+{ \
+	int sa = FZ_EXPAND(color[1]); \
+	int i = solid_color_##ISA(dp, w, 1, pixel_pattern(1, color[0], 0, 0, 0), sa); \
+	if (i < w) \
+		template_solid_color_N_sa(dp + i, 1, w - i, color, 0, sa); \
+} \
+TARGET static void \
+paint_solid_color_1_da_##ISA(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop) \
+{ \
+	int sa = FZ_EXPAND(color[1]); \
+	int i = 0; \
+	if (sa == 0) \
+		return; \
+	if (sa != 256) \
+		i = solid_color_##ISA(dp, w, 2, pixel_pattern(2, color[0], 255, 0, 0), sa); \
+	if (i < w) \
+		template_solid_color_1_da(dp + i * 2, 2, w - i, color, 1); \
+} \
+TARGET static void \
+paint_solid_color_3_da_##ISA(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop) \
+{ \
+	int sa = FZ_EXPAND(color[3]); \
+	int i = 0; \
+	if (sa == 0) \
+		return; \
+	if (sa != 256) \
+		i = solid_color_##ISA(dp, w, 4, pixel_pattern(4, color[0], color[1], color[2], 255), sa); \
+	if (i < w) \
+		template_solid_color_3_da(dp + i * 4, 4, w - i, color, 1); \
+} \
+TARGET static void \
+paint_solid_color_4_alpha_##ISA(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop) \
+{ \
+	int sa = FZ_EXPAND(color[4]); \
+	int i = solid_color_##ISA(dp, w, 4, pixel_pattern(4, color[0], color[1], color[2], color[3]), sa); \
+	if (i < w) \
+		template_solid_color_N_sa(dp + i * 4, 4, w - i, color, 0, sa); \
+}
+
+SOLID_COLOR_PAINTERS(sse2, )
+#if FZ_SIMD_AVX2
+SOLID_COLOR_PAINTERS(avx2, FZ_TARGET_AVX2)
+#endif
+
+/* returns NULL for the cases without a SIMD painter */
+static fz_solid_color_painter_t *
+fz_get_solid_color_painter_simd(int n, const byte * FZ_RESTRICT color, int da)
+{
+	if (!(fz_cpu_features() & FZ_CPU_SSE2))
+		return NULL;
+	switch (n-da)
+	{
+#if FZ_PLOTTERS_G
+	case 1:
+		if (da)
+			return SIMD_PAINTER(paint_solid_color_1_da);
+		else if (color[1] != 255)
+			return SIMD_PAINTER(paint_solid_color_1_alpha);
+		break;
+#endif /* FZ_PLOTTERS_G */
+#if FZ_PLOTTERS_RGB
+	case 3:
+		if (da)
+			return SIMD_PAINTER(paint_solid_color_3_da);
+		break;
+#endif /* FZ_PLOTTERS_RGB */
+#if FZ_PLOTTERS_CMYK
+	case 4:
+		if (!da && color[4] != 255)
+			return SIMD_PAINTER(paint_solid_color_4_alpha);
+		break;
+#endif /* FZ_PLOTTERS_CMYK */
+	}
+	return NULL;
+}
+#endif /* FZ_SIMD_SSE2 */
+
 fz_solid_color_painter_t *
 fz_get_solid_color_painter(int n, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
@@ -585,6 +942,13 @@ fz_get_solid_color_painter(int n, const byte * FZ_RESTRICT color, int da, const
 			return paint_solid_color_N_alpha_op;
 	}
 #endif /* FZ_ENABLE_SPOT_RENDERING */
+#if FZ_SIMD_SSE2
+	{
+		fz_solid_color_painter_t *simd = fz_get_solid_color_painter_simd(n, color, da);
+		if (simd)
+			return simd;
+	}
+#endif /* FZ_SIMD_SSE2 */
 	switch (n-da)
 	{
 		case 0:
@@ -993,6 +1357,78 @@ paint_span_with_color_N_da_op(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp
 }
 #endif /* FZ_ENABLE_SPOT_RENDERING */
 
+#if FZ_SIMD_SSE2
+#define SPAN_COLOR_PAINTERS(ISA, TARGET) \
+TARGET static void \
+paint_span_with_color_1_##ISA(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop) \
+{ \
+	int sa = FZ_EXPAND(color[1]); \
+	int i; \
+	if (sa == 0) \
+		return; \
+	i = span_with_color_##ISA(dp, mp, w, 1, pixel_pattern(1, color[0], 0, 0, 0), sa); \
+	if (i < w) \
+		template_span_with_color_N_general(dp + i, mp + i, 1, w - i, color, 0); \
+} \
+TARGET static void \
+paint_span_with_color_1_da_##ISA(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop) \
+{ \
+	int sa = FZ_EXPAND(color[1]); \
+	int i; \
+	if (sa == 0) \
+		return; \
+	i = span_with_color_##ISA(dp, mp, w, 2, pixel_pattern(2, color[0], 255, 0, 0), sa); \
+	if (i < w) \
+		template_span_with_color_1_da(dp + i * 2, mp + i, 2, w - i, color, 1); \
+} \
+TARGET static void \
+paint_span_with_color_3_da_##ISA(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop) \
+{ \
+	int sa = FZ_EXPAND(color[3]); \
+	int i; \
+	if (sa == 0) \
+		return; \
+	i = span_with_color_##ISA(dp, mp, w, 4, pixel_pattern(4, color[0], color[1], color[2], 255), sa); \
+	if (i < w) \
+		template_span_with_color_3_da(dp + i * 4, mp + i, 4, w - i, color, 1); \
+} \
+TARGET static void \
+paint_span_with_color_4_##ISA(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop) \
+{ \
+	int sa = FZ_EXPAND(color[4]); \
+	int i; \
+	if (sa == 0) \
+		return; \
+	i = span_with_color_##ISA(dp, mp, w, 4, pixel_pattern(4, color[0], color[1], color[2], color[3]), sa); \
+	if (i < w) \
+		template_span_with_color_N_general(dp + i * 4, mp + i, 4, w - i, color, 0); \
+}
+
+SPAN_COLOR_PAINTERS(sse2, )
+#if FZ_SIMD_AVX2
+SPAN_COLOR_PAINTERS(avx2, FZ_TARGET_AVX2)
+#endif
+
+/* returns NULL for the cases without a SIMD painter */
+static fz_span_color_painter_t *
+fz_get_span_color_painter_simd(int n, int da)
+{
+	if (!(fz_cpu_features() & FZ_CPU_SSE2))
+		return NULL;
+	switch(n-da)
+	{
+	case 1: return da ? SIMD_PAINTER(paint_span_with_color_1_da) : SIMD_PAINTER(paint_span_with_color_1);
+#if FZ_PLOTTERS_RGB
+	case 3: return da ? SIMD_PAINTER(paint_span_with_color_3_da) : NULL;
+#endif /* FZ_PLOTTERS_RGB */
+#if FZ_PLOTTERS_CMYK
+	case 4: return da ? NULL : SIMD_PAINTER(paint_span_with_color_4);
+#endif /* FZ_PLOTTERS_CMYK */
+	}
+	return NULL;
+}
+#endif /* FZ_SIMD_SSE2 */
+
 fz_span_color_painter_t *
 fz_get_span_color_painter(int n, int da, const byte * FZ_RESTRICT color, const fz_overprint * FZ_RESTRICT eop)
 {
@@ -1002,6 +1438,13 @@ fz_get_span_color_painter(int n, int da, const byte * FZ_RESTRICT color, const f
 		return da ? paint_span_with_color_N_da_op : paint_span_with_color_N_op;
 	}
 #endif /* FZ_ENABLE_SPOT_RENDERING */
+#if FZ_SIMD_SSE2
+	{
+		fz_span_color_painter_t *simd = fz_get_span_color_painter_simd(n, da);
+		if (simd)
+			return simd;
+	}
+#endif /* FZ_SIMD_SSE2 */
 	switch(n-da)
 	{
 	case 0: return da ? paint_span_with_color_0_da : NULL;
@@ -1288,9 +1731,72 @@ paint_span_with_mask_N(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const
 
 typedef void (fz_span_mask_painter_t)(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int w, int n, int a, const fz_overprint * FZ_RESTRICT eop);
 
+#if FZ_SIMD_SSE2
+#define SPAN_MASK_PAINTERS(ISA, TARGET) \
+TARGET static void \
+paint_span_with_mask_1_##ISA(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int w, int n, int a, const fz_overprint * FZ_RESTRICT eop) \
+{ \
+	int i = span_with_mask_##ISA(dp, sp, mp, w, 1, 0); \
+	if (i < w) \
+		template_span_with_mask_1_general(dp + i, sp + i, 0, mp + i, w - i); \
+} \
+TARGET static void \
+paint_span_with_mask_1_a_##ISA(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int w, int n, int a, const fz_overprint * FZ_RESTRICT eop) \
+{ \
+	int i = span_with_mask_##ISA(dp, sp, mp, w, 2, 1); \
+	if (i < w) \
+		template_span_with_mask_1_general(dp + i * 2, sp + i * 2, 1, mp + i, w - i); \
+} \
+TARGET static void \
+paint_span_with_mask_3_a_##ISA(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int w, int n, int a, const fz_overprint * FZ_RESTRICT eop) \
+{ \
+	int i = span_with_mask_##ISA(dp, sp, mp, w, 4, 1); \
+	if (i < w) \
+		template_span_with_mask_3_general(dp + i * 4, sp + i * 4, 1, mp + i, w - i); \
+} \
+TARGET static void \
+paint_span_with_mask_4_##ISA(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, const byte * FZ_RESTRICT mp, int w, int n, int a, const fz_overprint * FZ_RESTRICT eop) \
+{ \
+	int i = span_with_mask_##ISA(dp, sp, mp, w, 4, 0); \
+	if (i < w) \
+		template_span_with_mask_4_general(dp + i * 4, sp + i * 4, 0, mp + i, w - i); \
+}
+
+SPAN_MASK_PAINTERS(sse2, )
+#if FZ_SIMD_AVX2
+SPAN_MASK_PAINTERS(avx2, FZ_TARGET_AVX2)
+#endif
+
+/* returns NULL for the cases without a SIMD painter */
+static fz_span_mask_painter_t *
+fz_get_span_mask_painter_simd(int a, int n)
+{
+	if (!(fz_cpu_features() & FZ_CPU_SSE2))
+		return NULL;
+	switch(n)
+	{
+	case 1: return a ? SIMD_PAINTER(paint_span_with_mask_1_a) : SIMD_PAINTER(paint_span_with_mask_1);
+#if FZ_PLOTTERS_RGB
+	case 3: return a ? SIMD_PAINTER(paint_span_with_mask_3_a) : NULL;
+#endif /* FZ_PLOTTERS_RGB */
+#if FZ_PLOTTERS_CMYK
+	case 4: return a ? NULL : SIMD_PAINTER(paint_span_with_mask_4);
+#endif /* FZ_PLOTTERS_CMYK */
+	}
+	return NULL;
+}
+#endif /* FZ_SIMD_SSE2 */
+
 static fz_span_mask_painter_t *
 fz_get_span_mask_painter(int a, int n)
 {
+#if FZ_SIMD_SSE2
+	{
+		fz_span_mask_painter_t *simd = fz_get_span_mask_painter_simd(a, n);
+		if (simd)
+			return simd;
+	}
+#endif /* FZ_SIMD_SSE2 */
 	switch(n)
 	{
 		case 0:
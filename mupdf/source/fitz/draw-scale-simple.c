@@ -14,6 +14,7 @@ intermediate results rather than ints.
 
 #include "draw-imp.h"
 #include "pixmap-imp.h"
+#include "cpu-imp.h"
 
 #include <math.h>
 #include <string.h>
@@ -1257,6 +1258,396 @@ scale_row_from_temp_alpha(unsigned char * FZ_RESTRICT dst, const unsigned char *
 }
 #endif
 
+#if FZ_SIMD_SSE2
+
+/*
+
+SIMD row scalers
+
+The weights of a destination pixel add up to at most 256, but after
+check_weights single weights can be negative for extreme downscales,
+so sums of products don't necessarily fit 16 bits. The C code only keeps
+bits 8..15 of every sum though (val >> 8 stored into a byte) and these
+come out the same when all arithmetic wraps around at 16 bits. The
+kernels below therefore multiply and add in 16 bit lanes (or in 32 bit
+lanes with the weights truncated to 16 bits) and produce bit-identical
+results to the C code for all weights.
+
+Horizontally, every destination pixel has its own weights, so SIMD code
+works on one destination pixel at a time (n == 1, 3 and 4 only).
+Vertically, all bytes of a row share the same weights and are scaled 16
+(SSE2) or 32 (AVX2) at a time. The last block of a row overlaps the one
+before it instead of falling back to C code.
+
+*/
+
+typedef void (row_scale_in_fn)(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights);
+typedef void (row_scale_out_fn)(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row);
+
+/* the low 16 bits of 4 weights as 16 bit values (in the low half) */
+static inline __m128i
+load_weights4_sse2(const int *contrib)
+{
+	__m128i w = _mm_loadu_si128((const __m128i *)contrib);
+	w = _mm_srai_epi32(_mm_slli_epi32(w, 16), 16);
+	return _mm_packs_epi32(w, w);
+}
+
+/* the low 16 bits of 8 weights as 16 bit values */
+static inline __m128i
+load_weights8_sse2(const int *contrib)
+{
+	__m128i lo = _mm_loadu_si128((const __m128i *)contrib);
+	__m128i hi = _mm_loadu_si128((const __m128i *)(contrib + 4));
+	lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+	hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+	return _mm_packs_epi32(lo, hi);
+}
+
+/* weight 0 in the low 4 and weight 1 in the high 4 16 bit lanes */
+static inline __m128i
+load_weights_pair_sse2(const int *contrib)
+{
+	__m128i w = _mm_loadl_epi64((const __m128i *)contrib);
+	w = _mm_unpacklo_epi32(w, w);
+	w = _mm_shufflelo_epi16(w, 0);
+	return _mm_shufflehi_epi16(w, 0);
+}
+
+/* one pixel of up to 4 bytes in the low 4 16 bit lanes. Pixels of 3 bytes
+ * are read with the byte after them, unless they are the last one in a row
+ * (then they're read with the byte before them, which must exist) */
+static inline __m128i
+load_pixel_sse2(const unsigned char *p, int n, int last)
+{
+	uint32_t v;
+	if (n == 3 && last)
+	{
+		memcpy(&v, p - 1, 4);
+		v >>= 8;
+	}
+	else
+		memcpy(&v, p, 4);
+	return _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)v), _mm_setzero_si128());
+}
+
+static void
+scale_row_to_temp1_sse2(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	const int *contrib = &weights->index[weights->index[0]];
+	const __m128i z = _mm_setzero_si128();
+	int len, i, step = 1;
+	const unsigned char *min;
+
+	assert(weights->n == 1);
+	if (weights->flip)
+	{
+		dst += weights->count-1;
+		step = -1;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		__m128i acc = z;
+		unsigned int val;
+		min = &src[*contrib++];
+		len = *contrib++;
+		for (; len >= 8; len -= 8)
+		{
+			__m128i p = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)min), z);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(p, load_weights8_sse2(contrib)));
+			min += 8;
+			contrib += 8;
+		}
+		if (len >= 4)
+		{
+			uint32_t v;
+			memcpy(&v, min, 4);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128((int)v), z), load_weights4_sse2(contrib)));
+			min += 4;
+			contrib += 4;
+			len -= 4;
+		}
+		acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+		acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+		val = 128 + (unsigned int)_mm_cvtsi128_si32(acc);
+		while (len-- > 0)
+			val += *min++ * (unsigned int)*contrib++;
+		*dst = (unsigned char)(val>>8);
+		dst += step;
+	}
+}
+
+/* n == 3 or n == 4 */
+static inline void
+scale_row_to_temp34_sse2(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int n)
+{
+	const int *contrib = &weights->index[weights->index[0]];
+	/* only added to the low half, as the two halves are added up at the end */
+	const __m128i round = _mm_set_epi16(0, 0, 0, 0, 128, 128, 128, 128);
+	int len, i, step = n;
+	const unsigned char *min;
+
+	if (weights->flip)
+	{
+		dst += n*(weights->count-1);
+		step = -n;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		__m128i acc = round;
+		uint32_t v;
+		min = &src[n * *contrib++];
+		len = *contrib++;
+		/* two pixels at a time (for n == 3, the 4th byte read for
+		 * each belongs to a neighbour and is scaled to no avail) */
+		for (; len >= 2; len -= 2)
+		{
+			__m128i p = _mm_unpacklo_epi64(load_pixel_sse2(min, n, 0), load_pixel_sse2(min + n, n, len == 2));
+			acc = _mm_add_epi16(acc, _mm_mullo_epi16(p, load_weights_pair_sse2(contrib)));
+			min += 2*n;
+			contrib += 2;
+		}
+		if (len > 0)
+		{
+			__m128i p;
+			if (n == 3 && min == src)
+				p = _mm_unpacklo_epi8(_mm_cvtsi32_si128(min[0] | (min[1] << 8) | (min[2] << 16)), _mm_setzero_si128());
+			else
+				p = load_pixel_sse2(min, n, 1);
+			acc = _mm_add_epi16(acc, _mm_mullo_epi16(p, _mm_set1_epi16((short)*contrib)));
+			contrib++;
+		}
+		acc = _mm_add_epi16(acc, _mm_srli_si128(acc, 8));
+		acc = _mm_srli_epi16(acc, 8);
+		v = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+		if (n == 4)
+			memcpy(dst, &v, 4);
+		else
+		{
+			dst[0] = (unsigned char)v;
+			dst[1] = (unsigned char)(v>>8);
+			dst[2] = (unsigned char)(v>>16);
+		}
+		dst += step;
+	}
+}
+
+static void
+scale_row_to_temp3_sse2(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	assert(weights->n == 3);
+	scale_row_to_temp34_sse2(dst, src, weights, 3);
+}
+
+static void
+scale_row_to_temp4_sse2(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	assert(weights->n == 4);
+	scale_row_to_temp34_sse2(dst, src, weights, 4);
+}
+
+/* 16 bytes of a destination row from the len rows of temp starting at src */
+static inline __m128i
+scale_col16_sse2(const unsigned char * FZ_RESTRICT src, const int * FZ_RESTRICT contrib, int len, int width)
+{
+	const __m128i z = _mm_setzero_si128();
+	__m128i lo = _mm_set1_epi16(128);
+	__m128i hi = lo;
+	while (len-- > 0)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i *)src);
+		__m128i c = _mm_set1_epi16((short)*contrib++);
+		lo = _mm_add_epi16(lo, _mm_mullo_epi16(_mm_unpacklo_epi8(p, z), c));
+		hi = _mm_add_epi16(hi, _mm_mullo_epi16(_mm_unpackhi_epi8(p, z), c));
+		src += width;
+	}
+	return _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+}
+
+static void
+scale_row_from_temp_sse2(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row)
+{
+	const int *contrib = &weights->index[weights->index[row]];
+	int len, x;
+	int width = w * n;
+
+	if (width < 16)
+	{
+		scale_row_from_temp(dst, src, weights, w, n, row);
+		return;
+	}
+	contrib++; /* Skip min */
+	len = *contrib++;
+	for (x = 0; x < width; x += 16)
+	{
+		if (x > width - 16)
+			x = width - 16;
+		_mm_storeu_si128((__m128i *)(dst + x), scale_col16_sse2(src + x, contrib, len, width));
+	}
+}
+
+/* writes count pixels of n bytes from src as n+1 bytes with an alpha of 255 */
+static inline void
+add_opaque_alpha(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, int count, int n)
+{
+	while (count-- > 0)
+	{
+		int k;
+		for (k = n; k > 0; k--)
+			*dst++ = *src++;
+		*dst++ = 255;
+	}
+}
+
+static void
+scale_row_from_temp_alpha_sse2(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row)
+{
+	const int *contrib = &weights->index[weights->index[row]];
+	unsigned char tmp[16 * FZ_MAX_COLORS];
+	int len, x, k;
+	int width = w * n;
+
+	if (w < 16 || n > FZ_MAX_COLORS)
+	{
+		scale_row_from_temp_alpha(dst, src, weights, w, n, row);
+		return;
+	}
+	contrib++; /* Skip min */
+	len = *contrib++;
+	/* 16 pixels at a time */
+	for (x = 0; x < w; x += 16)
+	{
+		if (x > w - 16)
+			x = w - 16;
+		if (n == 1)
+		{
+			const __m128i a = _mm_set1_epi8((char)255);
+			__m128i v = scale_col16_sse2(src + x, contrib, len, width);
+			_mm_storeu_si128((__m128i *)(dst + 2*x), _mm_unpacklo_epi8(v, a));
+			_mm_storeu_si128((__m128i *)(dst + 2*x + 16), _mm_unpackhi_epi8(v, a));
+			continue;
+		}
+		for (k = 0; k < n; k++)
+			_mm_storeu_si128((__m128i *)(tmp + 16*k), scale_col16_sse2(src + n*x + 16*k, contrib, len, width));
+		add_opaque_alpha(dst + (n+1)*x, tmp, 16, n);
+	}
+}
+
+#if FZ_SIMD_AVX2
+
+/* The AVX2 versions of the vertical scalers do the same for 32 bytes at a time. */
+
+FZ_TARGET_AVX2 static inline __m256i
+scale_col32_avx2(const unsigned char * FZ_RESTRICT src, const int * FZ_RESTRICT contrib, int len, int width)
+{
+	__m256i lo = _mm256_set1_epi16(128);
+	__m256i hi = lo;
+	while (len-- > 0)
+	{
+		__m256i c = _mm256_set1_epi16((short)*contrib++);
+		lo = _mm256_add_epi16(lo, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)src)), c));
+		hi = _mm256_add_epi16(hi, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + 16))), c));
+		src += width;
+	}
+	/* packus works within 128 bit lanes */
+	return _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8)), 0xD8);
+}
+
+FZ_TARGET_AVX2 static void
+scale_row_from_temp_avx2(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row)
+{
+	const int *contrib = &weights->index[weights->index[row]];
+	int len, x;
+	int width = w * n;
+
+	if (width < 32)
+	{
+		scale_row_from_temp_sse2(dst, src, weights, w, n, row);
+		return;
+	}
+	contrib++; /* Skip min */
+	len = *contrib++;
+	for (x = 0; x < width; x += 32)
+	{
+		if (x > width - 32)
+			x = width - 32;
+		_mm256_storeu_si256((__m256i *)(dst + x), scale_col32_avx2(src + x, contrib, len, width));
+	}
+}
+
+FZ_TARGET_AVX2 static void
+scale_row_from_temp_alpha_avx2(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row)
+{
+	const int *contrib = &weights->index[weights->index[row]];
+	unsigned char tmp[32 * FZ_MAX_COLORS];
+	int len, x, k;
+	int width = w * n;
+
+	if (w < 32 || n > FZ_MAX_COLORS)
+	{
+		scale_row_from_temp_alpha_sse2(dst, src, weights, w, n, row);
+		return;
+	}
+	contrib++; /* Skip min */
+	len = *contrib++;
+	/* 32 pixels at a time */
+	for (x = 0; x < w; x += 32)
+	{
+		if (x > w - 32)
+			x = w - 32;
+		if (n == 1)
+		{
+			const __m128i a = _mm_set1_epi8((char)255);
+			__m256i v = scale_col32_avx2(src + x, contrib, len, width);
+			__m128i vl = _mm256_castsi256_si128(v);
+			__m128i vh = _mm256_extracti128_si256(v, 1);
+			_mm_storeu_si128((__m128i *)(dst + 2*x), _mm_unpacklo_epi8(vl, a));
+			_mm_storeu_si128((__m128i *)(dst + 2*x + 16), _mm_unpackhi_epi8(vl, a));
+			_mm_storeu_si128((__m128i *)(dst + 2*x + 32), _mm_unpacklo_epi8(vh, a));
+			_mm_storeu_si128((__m128i *)(dst + 2*x + 48), _mm_unpackhi_epi8(vh, a));
+			continue;
+		}
+		for (k = 0; k < n; k++)
+			_mm256_storeu_si256((__m256i *)(tmp + 32*k), scale_col32_avx2(src + n*x + 32*k, contrib, len, width));
+		add_opaque_alpha(dst + (n+1)*x, tmp, 32, n);
+	}
+}
+
+#endif /* FZ_SIMD_AVX2 */
+
+/* replaces the C row scalers with SIMD ones where there are any */
+static void
+use_simd_row_scalers(const fz_weights *cols, int forcealpha, row_scale_in_fn **row_scale_in, row_scale_out_fn **row_scale_out)
+{
+	int features = fz_cpu_features();
+	if (!(features & FZ_CPU_SSE2))
+		return;
+	switch (cols->n)
+	{
+	case 1:
+		*row_scale_in = scale_row_to_temp1_sse2;
+		break;
+	case 3:
+		/* the C code is faster for short filters (downscales by less than 3) */
+		if (cols->max_len >= 6)
+			*row_scale_in = scale_row_to_temp3_sse2;
+		break;
+	case 4:
+		*row_scale_in = scale_row_to_temp4_sse2;
+		break;
+	}
+#if FZ_SIMD_AVX2
+	if (features & FZ_CPU_AVX2)
+	{
+		*row_scale_out = forcealpha ? scale_row_from_temp_alpha_avx2 : scale_row_from_temp_avx2;
+		return;
+	}
+#endif /* FZ_SIMD_AVX2 */
+	*row_scale_out = forcealpha ? scale_row_from_temp_alpha_sse2 : scale_row_from_temp_sse2;
+}
+
+#endif /* FZ_SIMD_SSE2 */
+
 #ifdef SINGLE_PIXEL_SPECIALS
 static void
 duplicate_single_pixel(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, int n, int forcealpha, int w, int h, int stride)
@@ -1790,6 +2181,9 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 			break;
 		}
 		row_scale_out = forcealpha ? scale_row_from_temp_alpha : scale_row_from_temp;
+#if FZ_SIMD_SSE2
+		use_simd_row_scalers(contrib_cols, forcealpha, &row_scale_in, &row_scale_out);
+#endif /* FZ_SIMD_SSE2 */
 		max_row = contrib_rows->index[contrib_rows->index[0]];
 		for (row = 0; row < contrib_rows->count; row++)
 		{
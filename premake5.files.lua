@@ -441,6 +441,7 @@ function sumatrapdf_files()
     "Notifications.*",
     "PagesLayoutDef.*",
     "PdfSync.*",
+    "PdfSyncIndex.*",
     "Print.*",
     "ProgressUpdateUI.*",
     "RenderCache.*",
@@ -540,6 +541,7 @@ function utils_files()
     "Log.*",
     "LzmaSimpleArchive.*",
     "MinHook.*",
+    "PaletteUtil.*",
     "PEB.h",
     "RegistryPaths.*",
     "Scoped.h",
@@ -555,6 +557,7 @@ function utils_files()
     "TempAllocator.*",
     "ThreadUtil.*",
     "TgaReader.*",
+    "Trace.*",
     "TrivialHtmlParser.*",
     "TxtParser.*",
     "UITask.*",
@@ -588,7 +591,7 @@ function mui_files()
     "SvgPath.*",
     "MuiDefs.*",
     "MuiFromText.*",
-    "TextRender.*",
+    "TextRender*",
   })
 end
 
@@ -655,6 +658,7 @@ function mupdf_files()
     "compress.c",
     "compressed-buffer.c",
     "context.c",
+    "cpu.c",
     "crypt-aes.c",
     "crypt-arc4.c",
     "crypt-md5.c",
@@ -893,7 +897,7 @@ function mutool_files()
 end
 
 function mudraw_files()
-  mudoc_files()
+  -- document handlers are part of mupdf
   files_in_dir("mupdf/source/tools", {
       "mudraw.c",
   })
@@ -934,6 +938,7 @@ function test_util_files()
     "HtmlPrettyPrint.*",
     "HtmlPullParser.*",
     "JsonParser.*",
+    "PaletteUtil.*",
     "Scoped.*",
     "SettingsUtil.*",
     "Log.*",
@@ -942,6 +947,7 @@ function test_util_files()
     "StringViewUtil.*",
     "StrUtil.*",
     "SquareTreeParser.*",
+    "Trace.*",
     "TrivialHtmlParser.*",
     "TempAllocator.*",
     "UtAssert.*",
@@ -956,10 +962,15 @@ function test_util_files()
     "AppUtil.*",
     "EngineBase.*",
     "DisplayMode.*",
+    "FileHistory.*",
     "Flags.*",
+    "GlobalPrefs.*",
+    "PdfSyncIndex.*",
     "SumatraConfig.*",
     "SettingsStructs.*",
     "SumatraUnitTests.cpp",
+    "SystemFontCatalog_ut.cpp",
+    "TextSelection.*",
     "mui/SvgPath*",
     "tools/test_util.cpp"
   })
@@ -970,7 +981,7 @@ function engine_dump_files()
     "EngineDump.cpp",
     "SumatraConfig.*",
     "mui/MiniMui.*",
-    "mui/TextRender.*"
+    "mui/TextRender*"
   })
 end
 
@@ -985,7 +996,7 @@ function pdf_preview_files()
     "utils/LogDbg.*",
     "utils/PalmDbReader.*",
     "mui/MiniMui.*",
-    "mui/TextRender.*",
+    "mui/TextRender*",
     "MUPDF_Exports.cpp",
     "EngineBase.*",
     "EngineFzUtil.*",
@@ -591,18 +591,6 @@ workspace "SumatraPDF"
     entrypoint "wmainCRTStartup"
 
 
-  project "mudraw"
-    kind "ConsoleApp"
-    language "C"
-    disablewarnings { "4100", "4267" }
-    includedirs { "ext/zlib", "ext/lzma/C", "ext/unarr", "mupdf/include" }
-    mudraw_files()
-    links { "mupdf" }
-    links { "windowscodecs" }
-    linkoptions { "/ENTRY:\"wmainCRTStartup\"" }
-    entrypoint "wmainCRTStartup"
-
-
   project "unarr"
     kind "ConsoleApp"
     language "C"
@@ -633,12 +621,37 @@ workspace "SumatraPDF"
     links { "shlwapi", "version", "comctl32" }
   --]]
 
+  -- used by scripts/simd-benchmark.py
+  project "mudraw"
+    kind "ConsoleApp"
+    language "C"
+    regconf()
+    disablewarnings { "4100", "4267" }
+    -- single-threaded, with its own main()
+    defines { "MUDRAW_STANDALONE", "DISABLE_MUTHREADS" }
+    includedirs { "mupdf/include" }
+    mudraw_files()
+    links { "mupdf" }
+    links { "windowscodecs" }
+
+  project "paint_bench"
+    kind "ConsoleApp"
+    language "C"
+    regconf()
+    disablewarnings { "4100" }
+    includedirs { "mupdf/include" }
+    files { "src/tools/paint_bench.c" }
+    links { "mupdf" }
+    links { "windowscodecs" }
+
   project "enginedump"
     kind "ConsoleApp"
     language "C++"
     cppdialect "C++latest"
     regconf()
     includedirs { "src", "src/wingui", "mupdf/include" }
+    -- for mui/TextRenderFreeType.cpp
+    includedirs { "mupdf/scripts/freetype", "ext/freetype/include", "ext/harfbuzz/src" }
     disablewarnings { "4100", "4267", "4457" }
     engine_dump_files()
     links { "engines", "utils", "unrar", "mupdf", "unarrlib", "libwebp", "libdjvu" }
@@ -654,8 +667,9 @@ workspace "SumatraPDF"
     regconf()
     disablewarnings { "4838" }
     defines { "NO_LIBMUPDF" }
-    includedirs { "src" }
+    includedirs { "src", "mupdf/include" }
     test_util_files()
+    links { "libmupdf" }
     links { "gdiplus", "comctl32", "shlwapi", "Version" }
 
   project "logview"
@@ -692,6 +706,8 @@ workspace "SumatraPDF"
       "src", "src/wingui", "mupdf/include",
       "ext/libdjvu", "ext/CHMLib/src", "ext/zlib"
     }
+    -- for mui/TextRenderFreeType.cpp
+    includedirs { "mupdf/scripts/freetype", "ext/freetype/include", "ext/harfbuzz/src" }
     pdf_preview_files()
     filter {"configurations:Debug"}
       defines {
@@ -716,6 +732,8 @@ workspace "SumatraPDF"
     entrypoint "WinMainCRTStartup"
     flags { "NoManifest" }
     includedirs { "src", "mupdf/include" }
+    -- for mui/TextRenderFreeType.cpp
+    includedirs { "mupdf/scripts/freetype", "ext/freetype/include", "ext/harfbuzz/src" }
 
     synctex_files()
     mui_files()
@@ -762,6 +780,8 @@ workspace "SumatraPDF"
     entrypoint "WinMainCRTStartup"
     flags { "NoManifest" }
     includedirs { "src", "mupdf/include" }
+    -- for mui/TextRenderFreeType.cpp
+    includedirs { "mupdf/scripts/freetype", "ext/freetype/include", "ext/harfbuzz/src" }
 
     synctex_files()
     mui_files()
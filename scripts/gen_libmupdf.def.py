@@ -116,6 +116,21 @@ EXPORTS
 
 	WebPDecodeBGRAInto
 	WebPGetInfo
+
+; harfbuzz and freetype exports (required for TextRenderFreeType)
+
+	FT_Set_Char_Size
+	hb_buffer_add_utf8
+	hb_buffer_clear_contents
+	hb_buffer_create
+	hb_buffer_destroy
+	hb_buffer_get_glyph_infos
+	hb_buffer_get_glyph_positions
+	hb_buffer_guess_segment_properties
+	hb_buffer_set_direction
+	hb_font_destroy
+	hb_ft_font_create
+	hb_shape
 """
 
 def main():
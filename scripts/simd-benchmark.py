@@ -0,0 +1,69 @@
+"""
+Compares mupdf rendering times with and without the SIMD paint kernels
+(see mupdf/source/fitz/cpu-imp.h) by running mudraw twice per file and
+colorspace, the second time with FZ_DISABLE_SIMD=1 set.
+
+Note: If mudraw.exe can't be found in either ..\obj-rel\ or %PATH%,
+      pass a path to it as the first argument.
+
+simd-benchmark.py obj-rel\mudraw.exe file1.pdf file2.xps
+
+For isolated numbers of the individual painters, run paint_bench.exe.
+"""
+
+import os, re, sys
+from subprocess import Popen, PIPE
+
+COLORSPACES = ["rgb", "rgba", "gray", "cmyk"]
+
+def log(str):
+	sys.stderr.write(str + "\n")
+
+def runMudraw(mudrawExe, file, colorspace, disableSimd, repeats):
+	env = dict(os.environ)
+	if disableSimd:
+		env["FZ_DISABLE_SIMD"] = "1"
+	else:
+		env.pop("FZ_DISABLE_SIMD", None)
+	times = []
+	for i in range(repeats):
+		proc = Popen([mudrawExe, "-q", "-s", "t", "-r", "150", "-c", colorspace, file], stdout=PIPE, stderr=PIPE, env=env)
+		output = proc.communicate()[1]
+		match = re.search(r"total (\d+)ms", output)
+		if match:
+			times.append(int(match.group(1)))
+	if not times:
+		return None
+	return min(times)
+
+def main():
+	if not sys.argv[1:]:
+		log("Usage: %s [<mudraw.exe>] <file1.pdf> [<file2.pdf> ...]" % (os.path.split(sys.argv[0])[1]))
+		sys.exit(0)
+	
+	if sys.argv[1].lower().endswith(".exe"):
+		mudrawExe = sys.argv.pop(1)
+	else:
+		mudrawExe = os.path.join(os.path.dirname(__file__), "..", "obj-rel", "mudraw.exe")
+		if not os.path.exists(mudrawExe):
+			mudrawExe = "mudraw.exe"
+	
+	log("Running benchmark with %s..." % os.path.relpath(mudrawExe))
+	print "Filename\tColorspace\tC (in ms)\tSIMD (in ms)\tSpeedup"
+	for file in sys.argv[1:]:
+		for colorspace in COLORSPACES:
+			log("-> %s (%s)" % (file, colorspace))
+			try:
+				plain = runMudraw(mudrawExe, file, colorspace, True, 5)
+				simd = runMudraw(mudrawExe, file, colorspace, False, 5)
+			except OSError:
+				log("Error: %s not found" % os.path.relpath(mudrawExe))
+				return
+			if plain is None or simd is None:
+				log("Ignoring data for failed run for %s" % file)
+				continue
+			speedup = float(plain) / max(simd, 1)
+			print "%(file)s\t%(colorspace)s\t%(plain)d\t%(simd)d\t%(speedup).2fx" % locals()
+
+if __name__ == "__main__":
+	main()
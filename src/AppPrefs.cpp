@@ -6,6 +6,7 @@
 #include "utils/FileWatcher.h"
 #include "utils/UITask.h"
 #include "utils/ScopedWin.h"
+#include "utils/ThreadUtil.h"
 
 #include "wingui/TreeModel.h"
 
@@ -35,6 +36,26 @@
 extern void RememberDefaultWindowPosition(WindowInfo* win);
 
 static WatchedFile* gWatchedSettingsFile = nullptr;
+static WatchedFile* gWatchedJournalFile = nullptr;
+
+/*
+Changes to the file history and the session state are appended to a journal
+(see AppendToJournal()) instead of rewriting the whole settings file on every
+save. Once the journal has grown beyond SETTINGS_JOURNAL_MAX_SIZE, it is merged
+back into the settings file: the journal is renamed, the settings are written
+on a background thread which then deletes the renamed journal.
+Changes to any other setting are still saved by rewriting the settings file.
+*/
+
+#define SETTINGS_JOURNAL_MAX_SIZE (128 * 1024)
+
+// serialization of the global preferences without the file history and the session
+// state (cf. SerializeGlobalPrefsWithoutHistory) as last loaded from or written to disk
+static std::span<u8> gSavedGlobalPrefs;
+// session state as last written to disk (cf. SerializeSessionRecord)
+static str::Str gSavedSessionRecord;
+// size of the journal as written by this process
+static i64 gJournalSize = 0;
 
 // number of weeks past since 2011-01-01
 static int GetWeekCount() {
@@ -64,6 +85,122 @@ WCHAR* GetSettingsPath() {
     return AppGenDataFilename(GetSettingsFileNameTemp());
 }
 
+static WCHAR* GetJournalPath() {
+    return AppGenDataFilename(L"SumatraPDF-settings-journal.txt");
+}
+
+// path of the journal while it's being merged into the settings file
+static WCHAR* GetOldJournalPath() {
+    return AppGenDataFilename(L"SumatraPDF-settings-journal-old.txt");
+}
+
+static i64 GetJournalSize() {
+    AutoFreeWstr path = GetJournalPath();
+    if (!file::Exists(path)) {
+        return 0;
+    }
+    auto pathA = ToUtf8Temp(path);
+    return file::GetSize(pathA.Get());
+}
+
+// writes the settings file and deletes the journal that has been merged into it
+class SettingsCompactThread : public ThreadBase {
+  public:
+    AutoFreeWstr path;
+    AutoFreeWstr oldJournalPath;
+    std::span<u8> data;
+    bool ok = false;
+    FILETIME modTime{};
+
+    SettingsCompactThread(WCHAR* path, WCHAR* oldJournalPath, std::span<u8> data)
+        : ThreadBase("SettingsCompactThread"), path(path), oldJournalPath(oldJournalPath), data(data) {
+    }
+    ~SettingsCompactThread() override {
+        str::Free(data.data());
+    }
+
+    void Run() override {
+        ok = file::WriteFile(path, data);
+        if (ok) {
+            modTime = file::GetModificationTime(path);
+            file::Delete(oldJournalPath);
+        }
+    }
+};
+
+static SettingsCompactThread* gCompactThread = nullptr;
+
+static void WaitForCompaction() {
+    if (!gCompactThread) {
+        return;
+    }
+    gCompactThread->Join();
+    if (gCompactThread->ok && gGlobalPrefs) {
+        // so that Reload() doesn't mistake this for a change by someone else
+        gGlobalPrefs->lastPrefUpdate = gCompactThread->modTime;
+    }
+    delete gCompactThread;
+    gCompactThread = nullptr;
+}
+
+static void RememberSavedGlobalPrefs() {
+    str::Free(gSavedGlobalPrefs.data());
+    gSavedGlobalPrefs = SerializeGlobalPrefsWithoutHistory(gGlobalPrefs);
+    gSavedSessionRecord.Reset();
+    SerializeSessionRecord(gSavedSessionRecord, gGlobalPrefs->sessionData);
+}
+
+// replays the changes recorded in a settings journal, returns its size
+static i64 ApplyJournal(const WCHAR* path) {
+    AutoFree data = file::ReadFile(path);
+    if (!data.data) {
+        return 0;
+    }
+    ApplySettingsJournal(data.data, gFileHistory, gGlobalPrefs->sessionData);
+    return (i64)data.len;
+}
+
+static bool AppendToFile(const WCHAR* path, std::string_view data) {
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE;
+    AutoCloseHandle h = CreateFileW(path, FILE_APPEND_DATA, share, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (!h.IsValid()) {
+        return false;
+    }
+    DWORD written = 0;
+    BOOL ok = WriteFile(h, data.data(), (DWORD)data.size(), &written, nullptr);
+    return ok && written == (DWORD)data.size();
+}
+
+// appends the file states changed since the last save and the session state
+// (if it has changed) to the journal
+static bool AppendToJournal() {
+    str::Str journal;
+    bool useDefaultState = !gGlobalPrefs->rememberStatePerDocument || !gGlobalPrefs->rememberOpenedFiles;
+    gFileHistory.SerializeChanges(journal, useDefaultState);
+
+    str::Str session;
+    SerializeSessionRecord(session, gGlobalPrefs->sessionData);
+    bool sessionChanged = !str::Eq(session.AsView(), gSavedSessionRecord.Get());
+    if (sessionChanged) {
+        journal.AppendView(session.AsView());
+    }
+
+    if (journal.size() == 0) {
+        return true;
+    }
+    AutoFreeWstr path = GetJournalPath();
+    if (!AppendToFile(path, journal.AsView())) {
+        return false;
+    }
+    gJournalSize += (i64)journal.size();
+    if (sessionChanged) {
+        gSavedSessionRecord.Reset();
+        gSavedSessionRecord.AppendView(session.AsView());
+    }
+    gFileHistory.ResetChanges();
+    return true;
+}
+
 /* Caller needs to prefs::CleanUp() */
 bool Load() {
     CrashIf(gGlobalPrefs);
@@ -75,6 +212,15 @@ bool Load() {
     CrashAlwaysIf(!gGlobalPrefs);
     auto* gprefs = gGlobalPrefs;
 
+    // TODO: verify that all states have a non-nullptr file path?
+    gFileHistory.UpdateStatesSource(gprefs->fileStates);
+    // an old journal is left behind if merging it into the settings file failed
+    AutoFreeWstr oldJournalPath = GetOldJournalPath();
+    AutoFreeWstr journalPath = GetJournalPath();
+    ApplyJournal(oldJournalPath);
+    gJournalSize = ApplyJournal(journalPath);
+    RememberSavedGlobalPrefs();
+
     // in pre-release builds between 3.1.10079 and 3.1.10377,
     // RestoreSession was a string with the additional option "auto"
     // TODO: remove this after 3.2 has been released
@@ -122,8 +268,6 @@ bool Load() {
         gprefs->zoomLevels->Pop();
     }
 
-    // TODO: verify that all states have a non-nullptr file path?
-    gFileHistory.UpdateStatesSource(gprefs->fileStates);
     auto fontName = ToWstrTemp(gprefs->ebookUI.fontName);
     SetDefaultEbookFont(fontName.Get(), gprefs->ebookUI.fontSize);
 
@@ -180,6 +324,56 @@ static void RememberSessionState() {
     }
 }
 
+// rewrites the settings file, merging the journal into it. If inBackground
+// is true, the file is written by a SettingsCompactThread
+static bool SaveSettingsFile(const WCHAR* path, bool inBackground) {
+    WaitForCompaction();
+
+    // remove entries which should (no longer) be remembered
+    gFileHistory.Purge(!gGlobalPrefs->rememberStatePerDocument);
+
+    std::span<u8> prevPrefs = file::ReadFile(path);
+    const char* prevPrefsData = (char*)prevPrefs.data();
+    std::span<u8> prefs = SerializeGlobalPrefs(gGlobalPrefs, prevPrefsData);
+    defer {
+        str::Free(prevPrefs.data());
+        str::Free(prefs.data());
+    };
+    CrashIf(prefs.empty());
+    if (prefs.empty()) {
+        return false;
+    }
+
+    AutoFreeWstr journalPath = GetJournalPath();
+    AutoFreeWstr oldJournalPath = GetOldJournalPath();
+    // an existing old journal hasn't been merged yet and must
+    // not be replaced before the settings file has been written
+    bool hasOldJournal = file::Exists(oldJournalPath);
+    if (inBackground && !hasOldJournal && MoveFileExW(journalPath, oldJournalPath, 0)) {
+        gCompactThread = new SettingsCompactThread(str::Dup(path), oldJournalPath.StealData(), prefs);
+        prefs = {};
+        gCompactThread->Start();
+    } else {
+        // only save if anything's changed at all (the journal always
+        // exists while being watched but is empty unless there are changes)
+        bool hasJournal = hasOldJournal || gJournalSize > 0 || GetJournalSize() > 0;
+        if (hasJournal || prevPrefs.size() != prefs.size() || !str::Eq(prefs, prevPrefs)) {
+            bool ok = file::WriteFile(path, prefs);
+            if (!ok) {
+                return false;
+            }
+            gGlobalPrefs->lastPrefUpdate = file::GetModificationTime(path);
+        }
+        file::Delete(oldJournalPath);
+        file::Delete(journalPath);
+    }
+
+    gJournalSize = 0;
+    gFileHistory.ResetChanges();
+    RememberSavedGlobalPrefs();
+    return true;
+}
+
 // called whenever global preferences change or a file is
 // added or removed from gFileHistory (in order to keep
 // the list of recently opened documents in sync)
@@ -197,8 +391,6 @@ bool Save() {
     }
     RememberSessionState();
 
-    // remove entries which should (no longer) be remembered
-    gFileHistory.Purge(!gGlobalPrefs->rememberStatePerDocument);
     // update display mode and zoom fields from internal values
     str::ReplaceWithCopy(&gGlobalPrefs->defaultDisplayMode, DisplayModeToString(gGlobalPrefs->defaultDisplayModeEnum));
     ZoomToString(&gGlobalPrefs->defaultZoom, gGlobalPrefs->defaultZoomFloat, nullptr);
@@ -208,29 +400,19 @@ bool Save() {
     if (!path.data) {
         return false;
     }
-    std::span<u8> prevPrefs = file::ReadFile(path.data);
-    const char* prevPrefsData = (char*)prevPrefs.data();
-    std::span<u8> prefs = SerializeGlobalPrefs(gGlobalPrefs, prevPrefsData);
-    defer {
-        str::Free(prevPrefs.data());
-        str::Free(prefs.data());
-    };
-    CrashIf(prefs.empty());
-    if (prefs.empty()) {
-        return false;
-    }
 
-    // only save if anything's changed at all
-    if (prevPrefs.size() == prefs.size() && str::Eq(prefs, prevPrefs)) {
+    // if only the file history or the session state have changed,
+    // it's enough to append those changes to the journal
+    std::span<u8> globalPrefs = SerializeGlobalPrefsWithoutHistory(gGlobalPrefs);
+    bool onlyHistoryChanged = str::Eq(globalPrefs, gSavedGlobalPrefs);
+    str::Free(globalPrefs.data());
+    if (onlyHistoryChanged && !gFileHistory.needsFullSave && file::Exists(path) && AppendToJournal()) {
+        if (gJournalSize > SETTINGS_JOURNAL_MAX_SIZE && !gCompactThread) {
+            SaveSettingsFile(path, true);
+        }
         return true;
     }
-
-    bool ok = file::WriteFile(path.Get(), prefs);
-    if (!ok) {
-        return false;
-    }
-    gGlobalPrefs->lastPrefUpdate = file::GetModificationTime(path.Get());
-    return true;
+    return SaveSettingsFile(path, false);
 }
 
 // refresh the preferences when a different SumatraPDF process saves them
@@ -256,8 +438,10 @@ bool Reload() {
 
     AutoCloseHandle hScope(h);
 
+    WaitForCompaction();
     FILETIME time = file::GetModificationTime(path);
-    if (FileTimeEq(time, gGlobalPrefs->lastPrefUpdate)) {
+    // the journal is also modified by other SumatraPDF processes
+    if (FileTimeEq(time, gGlobalPrefs->lastPrefUpdate) && GetJournalSize() == gJournalSize) {
         return true;
     }
 
@@ -298,6 +482,9 @@ bool Reload() {
 }
 
 void CleanUp() {
+    WaitForCompaction();
+    str::Free(gSavedGlobalPrefs.data());
+    gSavedGlobalPrefs = {};
     DeleteGlobalPrefs(gGlobalPrefs);
     gGlobalPrefs = nullptr;
 }
@@ -314,10 +501,15 @@ void RegisterForFileChanges() {
     CrashIf(gWatchedSettingsFile); // only call me once
     AutoFreeWstr path = GetSettingsPath();
     gWatchedSettingsFile = FileWatcherSubscribe(path, schedulePrefsReload);
+    // the journal must exist in order to be watched
+    AutoFreeWstr journalPath = GetJournalPath();
+    AppendToFile(journalPath, "");
+    gWatchedJournalFile = FileWatcherSubscribe(journalPath, schedulePrefsReload);
 }
 
 void UnregisterForFileChanges() {
     FileWatcherUnsubscribe(gWatchedSettingsFile);
+    FileWatcherUnsubscribe(gWatchedJournalFile);
 }
 
 }; // namespace prefs
@@ -868,7 +868,8 @@ static void DrawDocument(WindowInfo* win, HDC hdc, RECT* rcArea) {
     bool rendering = false;
     Rect screen(Point(), dm->GetViewPort().Size());
 
-    for (int pageNo = 1; pageNo <= dm->PageCount(); ++pageNo) {
+    // only the visible pages need painting
+    for (int pageNo : dm->visiblePageNos) {
         PageInfo* pageInfo = dm->GetPageInfo(pageNo);
         if (!pageInfo || 0.0f == pageInfo->visibleRatio) {
             continue;
@@ -878,10 +879,11 @@ static void DrawDocument(WindowInfo* win, HDC hdc, RECT* rcArea) {
             continue;
         }
 
-        Rect bounds = pageInfo->pageOnScreen.Intersect(screen);
+        Rect pageOnScreen = dm->GetPageOnScreen(pageNo);
+        Rect bounds = pageOnScreen.Intersect(screen);
         // don't paint the frame background for images
         if (!dm->GetEngine()->IsImageCollection()) {
-            Rect r = pageInfo->pageOnScreen;
+            Rect r = pageOnScreen;
             auto presMode = win->presentation;
             PaintPageFrameAndShadow(hdc, bounds, r, presMode);
         }
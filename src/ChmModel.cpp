@@ -582,10 +582,6 @@ float ChmModel::GetNextZoomStep(float towardsLevel) const {
 }
 
 void ChmModel::GetDisplayState(FileState* ds) {
-    if (!ds->filePath || !str::EqI(ds->filePath, fileName)) {
-        str::ReplaceWithCopy(&ds->filePath, fileName);
-    }
-
     ds->useDefaultState = !gGlobalPrefs->rememberStatePerDocument;
 
     str::ReplaceWithCopy(&ds->displayMode, DisplayModeToString(GetDisplayMode()));
@@ -126,6 +126,7 @@ Cmd* enum (e.g. CmdOpen) and a human-readable name (not used yet).
     V(CmdDebugTestApp, "Debug: Test App")                                 \
     V(CmdDebugShowNotif, "Debug: Show Notification")                      \
     V(CmdDebugMui, "Debug: Mui")                                          \
+    V(CmdDebugTraceRendering, "Debug: Trace Rendering")                   \
     V(CmdCreateAnnotText, "Create Text Annotation")                       \
     V(CmdCreateAnnotLink, "Create Link Annotation")                       \
     V(CmdCreateAnnotFreeText, "Create  Free Text Annotation")             \
@@ -21,8 +21,17 @@ struct ControllerCallback {
     virtual void Repaint() = 0;
     virtual void UpdateScrollbars(Size canvas) = 0;
     virtual void RequestRendering(int pageNo) = 0;
+    // render a page which is about to become visible, at a reduced zoom if needed
+    virtual void RequestPrefetch(int pageNo, float zoom) = 0;
+    virtual void CancelPrefetch(int pageNo) = 0;
     virtual void CleanUp(DisplayModel* dm) = 0;
     virtual void RenderThumbnail(DisplayModel* dm, Size size, const onBitmapRenderedCb&) = 0;
+    // called on a background thread when the engine has determined
+    // real sizes for pages whose size was only estimated
+    virtual void PageSizesChanged(DisplayModel* dm) = 0;
+    // called on a background thread once the ToC, page labels and
+    // properties are available (see Controller::IsDocInfoLoaded)
+    virtual void DocInfoLoaded(DisplayModel* dm) = 0;
     // ChmModel //
     // tell the UI to move focus back to the main window
     // (if always == false, then focus is only moved if it's inside
@@ -64,6 +73,12 @@ struct Controller {
     [[nodiscard]] virtual float GetNextZoomStep(float towards) const = 0;
     virtual void SetViewPortSize(Size size) = 0;
 
+    // false while the ToC, page labels and properties are still being loaded
+    // in the background (until then, the ToC and page labels are missing)
+    virtual bool IsDocInfoLoaded() {
+        return true;
+    }
+
     // table of contents
     bool HacToc() {
         auto* tree = GetToc();
@@ -74,6 +89,7 @@ struct Controller {
     virtual PageDestination* GetNamedDest(const WCHAR* name) = 0;
 
     // get display state (pageNo, zoom, scroll etc. of the document)
+    // ds->filePath isn't touched (see FileHistory::SetFilePath)
     virtual void GetDisplayState(FileState* ds) = 0;
     // asynchronously calls saveThumbnail (fails silently)
     virtual void CreateThumbnail(Size size, const std::function<void(RenderedBitmap*)>& saveThumbnail) = 0;
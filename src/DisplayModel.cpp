@@ -47,6 +47,7 @@
 #include "utils/WinUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/Log.h"
+#include "utils/Timer.h"
 
 #include "wingui/TreeModel.h"
 
@@ -64,8 +65,20 @@
 #include "TextSearch.h"
 
 // if true, we pre-render the pages right before and after the visible pages
+// (and further ahead in the direction of scrolling)
 static bool gPredictiveRender = true;
 
+// at most that many rows of pages are rendered ahead of time
+constexpr int kMaxPrefetchRows = 4;
+// how far ahead pages are rendered
+constexpr float kPrefetchLookaheadMs = 1000.f;
+// when scrolling faster, pages ahead are rendered at a reduced zoom
+// and pages behind aren't rendered at all
+constexpr float kFastScrollPagesPerSec = 3.f;
+constexpr float kFastScrollZoomFactor = 0.5f;
+// a pause after which scrolling is considered to start again
+constexpr double kScrollIdleMs = 300;
+
 static int ColumnsFromDisplayMode(DisplayMode displayMode) {
     if (!IsSingle(displayMode)) {
         return 2;
@@ -107,8 +120,14 @@ DisplayMode DisplayModel::GetDisplayMode() const {
     return displayMode;
 }
 
+bool DisplayModel::IsDocInfoLoaded() {
+    return engine->IsDocInfoLoaded();
+}
+
+// the ToC and page labels are only reported once they've been loaded
+// (the UI is updated through ControllerCallback::DocInfoLoaded)
 TocTree* DisplayModel::GetToc() {
-    if (!engine) {
+    if (!engine || !engine->IsDocInfoLoaded()) {
         return nullptr;
     }
     return engine->GetToc();
@@ -124,10 +143,16 @@ void DisplayModel::CreateThumbnail(Size size, const onBitmapRenderedCb& saveThum
 
 // page labels (optional)
 bool DisplayModel::HasPageLabels() const {
+    if (!engine->IsDocInfoLoaded()) {
+        return false;
+    }
     return engine->HasPageLabels();
 }
 
 WCHAR* DisplayModel::GetPageLabel(int pageNo) const {
+    if (!engine->IsDocInfoLoaded()) {
+        return Controller::GetPageLabel(pageNo);
+    }
     return engine->GetPageLabel(pageNo);
 }
 
@@ -207,10 +232,6 @@ bool DisplayModel::GetPresentationMode() const {
 }
 
 void DisplayModel::GetDisplayState(FileState* ds) {
-    if (!ds->filePath || !str::EqI(ds->filePath, engine->FileName())) {
-        str::ReplaceWithCopy(&ds->filePath, engine->FileName());
-    }
-
     ds->useDefaultState = !gGlobalPrefs->rememberStatePerDocument;
 
     str::ReplaceWithCopy(&ds->displayMode, DisplayModeToString(presentationMode ? presDisplayMode : GetDisplayMode()));
@@ -299,12 +320,25 @@ DisplayModel::DisplayModel(EngineBase* engine, ControllerCallback* cb) : Control
     textCache = new DocumentTextCache(engine);
     textSelection = new TextSelection(engine, textCache);
     textSearch = new TextSearch(engine, textCache);
+
+    engine->SetPageSizesChangedCb([this] { this->cb->PageSizesChanged(this); });
+    engine->SetDocInfoLoadedCb([this] { this->cb->DocInfoLoaded(this); });
 }
 
 DisplayModel::~DisplayModel() {
     dontRenderFlag = true;
+    // the engine might still be determining page sizes or loading
+    // the document info on a background thread
+    engine->SetPageSizesChangedCb(nullptr);
+    engine->SetDocInfoLoadedCb(nullptr);
     cb->CleanUp(this);
 
+    PrefetchStats& ps = prefetchStats;
+    if (ps.prefetched > 0) {
+        logf("DisplayModel: prefetched %d pages (%d canceled), hit rate: %.2f (%d hits, %d misses)\n", ps.prefetched,
+             ps.canceled, ps.HitRate(), ps.hits, ps.misses);
+    }
+
     delete pdfSync;
     delete textSearch;
     delete textSelection;
@@ -313,6 +347,21 @@ DisplayModel::~DisplayModel() {
     free(pagesInfo);
 }
 
+static float CalcVisibleRatio(const PageInfo* pageInfo, Rect viewPort) {
+    if (!pageInfo->shown) {
+        return 0.0;
+    }
+
+    Rect pageRect = pageInfo->pos;
+    Rect visiblePart = pageRect.Intersect(viewPort);
+    if (visiblePart.IsEmpty()) {
+        return 0.0;
+    }
+    CrashIf(pageRect.dx <= 0 || pageRect.dy <= 0);
+    // calculate with floating point precision to prevent an integer overflow
+    return 1.0f * visiblePart.dx * visiblePart.dy / ((float)pageRect.dx * pageRect.dy);
+}
+
 PageInfo* DisplayModel::GetPageInfo(int pageNo) const {
     if (!ValidPageNo(pageNo)) {
         return nullptr;
@@ -324,6 +373,18 @@ PageInfo* DisplayModel::GetPageInfo(int pageNo) const {
     return &(pagesInfo[pageNo - 1]);
 }
 
+// position of the page relative to the view port of the last RecalcVisibleParts().
+// Computed on demand so that it's safe to call from other threads.
+Rect DisplayModel::GetPageOnScreen(int pageNo) const {
+    PageInfo* pageInfo = GetPageInfo(pageNo);
+    if (!pageInfo) {
+        return Rect();
+    }
+    Rect r = pageInfo->pos;
+    r.Offset(-visiblePartsViewPort.x, -visiblePartsViewPort.y);
+    return r;
+}
+
 // Call this before the first Relayout
 void DisplayModel::SetInitialViewSettings(DisplayMode newDisplayMode, int newStartPage, Size viewPort, int screenDPI) {
     totalViewPortSize = viewPort;
@@ -361,6 +422,10 @@ void DisplayModel::SetInitialViewSettings(DisplayMode newDisplayMode, int newSta
     BuildPagesInfo();
 }
 
+// how many pages before and after the start page BuildPagesInfo() lays out
+// with their real size instead of an estimate
+constexpr int kExactPageSizesAroundStart = 16;
+
 void DisplayModel::BuildPagesInfo() {
     CrashIf(pagesInfo);
     int pageCount = PageCount();
@@ -380,9 +445,17 @@ void DisplayModel::BuildPagesInfo() {
         newStartPage--;
     }
 
+    // for huge documents, real page sizes might only become known later.
+    // the ones around the start page are needed right away, though
+    int firstExactPageNo = std::max(startPage - kExactPageSizesAroundStart, 1);
+    int lastExactPageNo = std::min(startPage + kExactPageSizesAroundStart, pageCount);
     for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
-        pageInfo->page = engine->PageMediabox(pageNo);
+        if (firstExactPageNo <= pageNo && pageNo <= lastExactPageNo) {
+            pageInfo->page = engine->PageMediabox(pageNo);
+        } else {
+            pageInfo->page = engine->PageMediaboxEstimate(pageNo);
+        }
         // layout pages with an empty mediabox as A4 size (resp. letter size)
         if (pageInfo->page.IsEmpty()) {
             pageInfo->page = defaultRect;
@@ -397,6 +470,140 @@ void DisplayModel::BuildPagesInfo() {
     }
 }
 
+void DisplayModel::UpdatePageSizes() {
+    if (!pagesInfo) {
+        return;
+    }
+
+    Vec<int> pageNos;
+    Vec<RectF> sizes;
+    engine->TakeChangedPageSizes(&pageNos, &sizes);
+    Vec<int> changedPageNos;
+    for (int i = 0; i < pageNos.isize(); i++) {
+        int pageNo = pageNos.at(i);
+        RectF mbox = sizes.at(i);
+        if (!mbox.IsEmpty() && mbox != GetPageInfo(pageNo)->page) {
+            changedPageNos.Append(pageNo);
+        }
+    }
+    if (changedPageNos.IsEmpty()) {
+        return;
+    }
+
+    bool isDocReady = ValidPageNo(startPage) && zoomReal != 0;
+    ScrollState ss;
+    if (isDocReady) {
+        ss = GetScrollState();
+    }
+    for (int i = 0; i < pageNos.isize(); i++) {
+        RectF mbox = sizes.at(i);
+        if (!mbox.IsEmpty()) {
+            GetPageInfo(pageNos.at(i))->page = mbox;
+        }
+    }
+    if (!isDocReady) {
+        return;
+    }
+    std::sort(changedPageNos.begin(), changedPageNos.end());
+    if (!RelayoutChangedPages(changedPageNos)) {
+        Relayout(zoomVirtual, rotation);
+    }
+    SetScrollState(ss);
+}
+
+// updates the layout after the sizes of the (sorted) pageNos have changed
+// without laying out all pages again. That's possible for a single continuous
+// column as long as the width of the column and the zoom remain the same and
+// the pages still don't fit into the view port. Returns false if Relayout()
+// is needed instead.
+bool DisplayModel::RelayoutChangedPages(const Vec<int>& pageNos) {
+    DisplayMode mode = GetDisplayMode();
+    if (!IsContinuous(mode) || ColumnsFromDisplayMode(mode) != 1 || ZOOM_FIT_CONTENT == zoomVirtual) {
+        return false;
+    }
+    bool isFitZoom = ZOOM_FIT_WIDTH == zoomVirtual || ZOOM_FIT_PAGE == zoomVirtual;
+
+    // in fit modes, each page has its own zoom and zoomReal is the smallest one
+    Vec<float> zooms;
+    Vec<Rect> newPos;
+    bool wasMinZoom = false, isMinZoom = false;
+    bool wasMaxDx = false, isMaxDx = false;
+    int deltaY = 0;
+    for (int pageNo : pageNos) {
+        PageInfo* pageInfo = GetPageInfo(pageNo);
+        float zoom = isFitZoom ? ZoomRealFromVirtualForPage(zoomVirtual, pageNo) : zoomReal;
+        if (zoom < zoomReal) {
+            return false;
+        }
+        wasMinZoom |= pageInfo->zoomReal == zoomReal;
+        isMinZoom |= zoom == zoomReal;
+
+        SizeF pageSize = PageSizeAfterRotation(pageNo);
+        Rect pos = pageInfo->pos;
+        pos.dx = (int)(pageSize.dx * zoom + 0.499);
+        pos.dy = (int)(pageSize.dy * zoom + 0.499);
+        if (pos.dx > columnMaxDx) {
+            return false;
+        }
+        wasMaxDx |= pageInfo->pos.dx == columnMaxDx;
+        isMaxDx |= pos.dx == columnMaxDx;
+        // keep the page centered in the column
+        pos.x = pageInfo->pos.x + (columnMaxDx - pos.dx) / 2 - (columnMaxDx - pageInfo->pos.dx) / 2;
+        deltaY += pos.dy - pageInfo->pos.dy;
+        zooms.Append(zoom);
+        newPos.Append(pos);
+    }
+    if (canvasSize.dy <= viewPort.dy || canvasSize.dy + deltaY <= viewPort.dy) {
+        return false;
+    }
+
+    // the smallest zoom and the widest page must remain the same, so if a changed
+    // page has determined them, another page must still do so
+    auto isChanged = [&pageNos](int pageNo) {
+        return std::binary_search(pageNos.begin(), pageNos.end(), pageNo);
+    };
+    if (wasMinZoom && !isMinZoom) {
+        bool found = false;
+        for (int pageNo = 1; !found && pageNo <= PageCount(); pageNo++) {
+            found = GetPageInfo(pageNo)->zoomReal == zoomReal && !isChanged(pageNo);
+        }
+        if (!found) {
+            return false;
+        }
+    }
+    if (wasMaxDx && !isMaxDx) {
+        bool found = false;
+        for (int pageNo = 1; !found && pageNo <= PageCount(); pageNo++) {
+            found = GetPageInfo(pageNo)->pos.dx == columnMaxDx && !isChanged(pageNo);
+        }
+        if (!found) {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < pageNos.isize(); i++) {
+        PageInfo* pageInfo = GetPageInfo(pageNos.at(i));
+        pageInfo->zoomReal = zooms.at(i);
+        pageInfo->pos = newPos.at(i);
+    }
+    // move the pages below the first changed one (all pages are shown in
+    // continuous mode, so shownPageNos has an entry for each page)
+    int idx = pageNos.at(0) - 1;
+    CrashIf(shownPageNos.at(idx) != pageNos.at(0));
+    int maxBottom = idx > 0 ? shownPagesMaxBottom.at(idx - 1) : 0;
+    for (int i = idx; i < shownPageNos.isize(); i++) {
+        PageInfo* pageInfo = GetPageInfo(shownPageNos.at(i));
+        if (i > idx) {
+            PageInfo* prev = GetPageInfo(shownPageNos.at(i - 1));
+            pageInfo->pos.y = prev->pos.y + prev->pos.dy + pageSpacing.dy;
+        }
+        maxBottom = std::max(maxBottom, pageInfo->pos.y + pageInfo->pos.dy);
+        shownPagesMaxBottom.at(i) = maxBottom;
+    }
+    canvasSize.dy += deltaY;
+    return true;
+}
+
 // TODO: a better name e.g. ShouldShow() to better distinguish between
 // before-layout info and after-layout visibility checks
 bool DisplayModel::PageShown(int pageNo) const {
@@ -417,6 +624,11 @@ bool DisplayModel::PageVisible(int pageNo) const {
 
 /* Return true if a page is visible or a page in a row below or above is visible */
 bool DisplayModel::PageVisibleNearby(int pageNo) const {
+    // pages rendered ahead in the direction of scrolling
+    if (prefetchFirstPageNo <= pageNo && pageNo <= prefetchLastPageNo) {
+        return true;
+    }
+
     DisplayMode mode = GetDisplayMode();
     int columns = ColumnsFromDisplayMode(mode);
 
@@ -526,15 +738,11 @@ int DisplayModel::FirstVisiblePageNo() const {
         return INVALID_PAGE_NO;
     }
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
-        if (pageInfo->visibleRatio > 0.0) {
-            return pageNo;
-        }
-    }
-
     /* If no pages are visible */
-    return INVALID_PAGE_NO;
+    if (visiblePageNos.IsEmpty()) {
+        return INVALID_PAGE_NO;
+    }
+    return visiblePageNos.at(0);
 }
 
 // we consider the most visible page the current one
@@ -552,7 +760,7 @@ int DisplayModel::CurrentPageNo() const {
     int mostVisiblePage = INVALID_PAGE_NO;
     float ratio = 0;
 
-    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+    for (int pageNo : visiblePageNos) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
         if (pageInfo->visibleRatio > ratio) {
             mostVisiblePage = pageNo;
@@ -834,6 +1042,21 @@ RestartLayout:
         }
     }
 
+    columnMaxDx = columnMaxWidth[0];
+    shownPageNos.Reset();
+    shownPagesMaxBottom.Reset();
+    int maxBottom = 0;
+    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
+        PageInfo* pageInfo = GetPageInfo(pageNo);
+        if (!pageInfo->shown) {
+            continue;
+        }
+        CrashIf(shownPageNos.size() > 0 && pageInfo->pos.y < GetPageInfo(shownPageNos.Last())->pos.y);
+        maxBottom = std::max(maxBottom, pageInfo->pos.y + pageInfo->pos.dy);
+        shownPageNos.Append(pageNo);
+        shownPagesMaxBottom.Append(maxBottom);
+    }
+
     canvasSize = Size(std::max(canvasDx, viewPort.dx), std::max(canvasDy, viewPort.dy));
 }
 
@@ -846,6 +1069,7 @@ void DisplayModel::ChangeStartPage(int newStartPage) {
     if (IsBookView(GetDisplayMode()) && newStartPage == 1 && columns > 1) {
         newStartPage--;
     }
+    ResetVisibleParts();
     for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
         if (IsContinuous(GetDisplayMode())) {
@@ -856,7 +1080,6 @@ void DisplayModel::ChangeStartPage(int newStartPage) {
         } else {
             pageInfo->shown = false;
         }
-        pageInfo->visibleRatio = 0.0;
     }
     Relayout(zoomVirtual, rotation);
 }
@@ -864,48 +1087,77 @@ void DisplayModel::ChangeStartPage(int newStartPage) {
 /* Given positions of each page in a large sheet that is continuous view and
    coordinates of a current view into that large sheet, calculate which
    parts of each page is visible on the screen.
-   Needs to be recalucated after scrolling the view. */
+   Needs to be recalucated after scrolling the view.
+   Only the pages intersecting the view port are looked at: visibleRatio
+   is 0 for every page not in visiblePageNos, so only the previously
+   visible pages have to be cleared. Must be called on the UI thread. */
 void DisplayModel::RecalcVisibleParts() const {
     CrashIf(!pagesInfo);
     if (!pagesInfo) {
         return;
     }
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
+    visiblePartsViewPort = viewPort;
+    Vec<int> prevVisiblePageNos(visiblePageNos);
+    visiblePageNos.Reset();
+
+    // the first page whose bottom edge is below the top of the view port
+    int* maxBottom = shownPagesMaxBottom.LendData();
+    int n = shownPagesMaxBottom.isize();
+    int i = (int)(std::upper_bound(maxBottom, maxBottom + n, viewPort.y) - maxBottom);
+    for (; i < n; i++) {
+        int pageNo = shownPageNos.at(i);
         PageInfo* pageInfo = GetPageInfo(pageNo);
-        if (!pageInfo->shown) {
-            CrashIf(0.0 != pageInfo->visibleRatio);
-            continue;
+        if (pageInfo->pos.y >= viewPort.y + viewPort.dy) {
+            break;
         }
-
-        Rect pageRect = pageInfo->pos;
-        Rect visiblePart = pageRect.Intersect(viewPort);
-
-        pageInfo->visibleRatio = 0.0;
-        if (!visiblePart.IsEmpty()) {
-            CrashIf(pageRect.dx <= 0 || pageRect.dy <= 0);
-            // calculate with floating point precision to prevent an integer overflow
-            pageInfo->visibleRatio = 1.0f * visiblePart.dx * visiblePart.dy / ((float)pageRect.dx * pageRect.dy);
+        pageInfo->visibleRatio = CalcVisibleRatio(pageInfo, viewPort);
+        if (pageInfo->visibleRatio > 0.0) {
+            visiblePageNos.Append(pageNo);
+        }
+    }
+    // pages are sorted and cleared only after the new ones are set, so that
+    // the render thread never sees a still visible page as invisible
+    std::sort(visiblePageNos.begin(), visiblePageNos.end());
+    for (int pageNo : prevVisiblePageNos) {
+        if (!std::binary_search(visiblePageNos.begin(), visiblePageNos.end(), pageNo)) {
+            GetPageInfo(pageNo)->visibleRatio = 0.0;
         }
-        pageInfo->pageOnScreen = pageRect;
-        pageInfo->pageOnScreen.Offset(-viewPort.x, -viewPort.y);
     }
 }
 
+/* marks all pages as not visible until the next call to RecalcVisibleParts() */
+void DisplayModel::ResetVisibleParts() {
+    for (int pageNo : visiblePageNos) {
+        GetPageInfo(pageNo)->visibleRatio = 0.0;
+    }
+    visiblePageNos.Reset();
+}
+
+// index into shownPageNos of the first page reaching down to y
+// (in canvas coordinates) or below
+static int FirstShownPageIdxAtY(const Vec<int>& shownPagesMaxBottom, int y) {
+    int* maxBottom = shownPagesMaxBottom.LendData();
+    int n = shownPagesMaxBottom.isize();
+    return (int)(std::lower_bound(maxBottom, maxBottom + n, y) - maxBottom);
+}
+
 int DisplayModel::GetPageNoByPoint(Point pt) const {
     // no reasonable answer possible, if zoom hasn't been set yet
     if (zoomReal <= 0) {
         return -1;
     }
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
+    // only pages in the row(s) at pt.y can contain pt
+    int y = pt.y + visiblePartsViewPort.y;
+    int n = shownPageNos.isize();
+    for (int i = FirstShownPageIdxAtY(shownPagesMaxBottom, y); i < n; i++) {
+        int pageNo = shownPageNos.at(i);
         PageInfo* pageInfo = GetPageInfo(pageNo);
-        CrashIf(!(0.0 == pageInfo->visibleRatio || pageInfo->shown));
-        if (!pageInfo->shown) {
-            continue;
+        if (pageInfo->pos.y > y) {
+            break;
         }
-
-        if (pageInfo->pageOnScreen.Contains(pt)) {
+        if (GetPageOnScreen(pageNo).Contains(pt)) {
             return pageNo;
         }
     }
@@ -918,26 +1170,44 @@ int DisplayModel::GetPageNextToPoint(Point pt) const {
         return startPage;
     }
 
+    int pageNoAtPt = GetPageNoByPoint(pt);
+    if (pageNoAtPt != -1) {
+        return pageNoAtPt;
+    }
+
     unsigned int maxDist = UINT_MAX;
     int closest = startPage;
-
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
-        CrashIf(0.0 != pageInfo->visibleRatio && !pageInfo->shown);
-        if (!pageInfo->shown) {
-            continue;
-        }
-
-        if (pageInfo->pageOnScreen.Contains(pt)) {
-            return pageNo;
-        }
-
-        Rect r = pageInfo->pageOnScreen;
+    auto checkPage = [&](int pageNo) {
+        Rect r = GetPageOnScreen(pageNo);
         unsigned int dist = distSq(pt.x - r.x - r.dx / 2, pt.y - r.y - r.dy / 2);
-        if (dist < maxDist) {
+        // prefer the lower page number for pages at the same distance
+        if (dist < maxDist || dist == maxDist && pageNo < closest) {
             closest = pageNo;
             maxDist = dist;
         }
+    };
+    // distances between far away rows don't fit into distSq's result
+    auto isFarther = [&](int dy) { return (i64)dy * dy > (i64)maxDist; };
+
+    // starting from the rows at pt.y, look at rows above and below until they're
+    // farther away (vertically) than the closest page center found so far
+    int y = pt.y + visiblePartsViewPort.y;
+    int n = shownPageNos.isize();
+    int split = FirstShownPageIdxAtY(shownPagesMaxBottom, y);
+    for (int i = split; i < n; i++) {
+        int pageNo = shownPageNos.at(i);
+        int top = GetPageInfo(pageNo)->pos.y;
+        if (top > y && isFarther(top - y)) {
+            break;
+        }
+        checkPage(pageNo);
+    }
+    for (int i = split - 1; i >= 0; i--) {
+        int bottom = shownPagesMaxBottom.at(i);
+        if (isFarther(y - bottom)) {
+            break;
+        }
+        checkPage(shownPageNos.at(i));
     }
 
     return closest;
@@ -986,7 +1256,7 @@ Point DisplayModel::CvtToScreen(int pageNo, PointF pt) {
 
     PointF p = engine->Transform(pt, pageNo, zoom, rotation);
     // don't add the full 0.5 for rounding to account for precision errors
-    Rect r = pageInfo->pageOnScreen;
+    Rect r = GetPageOnScreen(pageNo);
     p.x += 0.499 + r.x;
     p.y += 0.499 + r.y;
 
@@ -1011,7 +1281,7 @@ PointF DisplayModel::CvtFromScreen(Point pt, int pageNo) {
     }
 
     // don't add the full 0.5 for rounding to account for precision errors
-    Rect r = pageInfo->pageOnScreen;
+    Rect r = GetPageOnScreen(pageNo);
     PointF p = PointF(pt.x - 0.499 - r.x, pt.y - 0.499 - r.y);
 
     float zoom = getZoomSafe(this, pageNo, pageInfo);
@@ -1079,25 +1349,115 @@ bool DisplayModel::IsOverText(Point pt) {
     return textSelection->IsOverGlyph(pageNo, pos.x, pos.y);
 }
 
-void DisplayModel::RenderVisibleParts() {
-    int firstVisiblePage = 0;
-    int lastVisiblePage = 0;
+// position of the top of the view port, in pages
+float DisplayModel::ScrollPosInPages(int firstVisiblePage) const {
+    float pos = (float)firstVisiblePage;
+    PageInfo* pageInfo = GetPageInfo(firstVisiblePage);
+    if (IsContinuous(GetDisplayMode()) && pageInfo && pageInfo->pos.dy > 0) {
+        int columns = ColumnsFromDisplayMode(GetDisplayMode());
+        pos += columns * (float)(viewPort.y - pageInfo->pos.y) / (float)pageInfo->pos.dy;
+    }
+    return pos;
+}
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
-        if (pageInfo->visibleRatio > 0.0) {
-            CrashIf(!pageInfo->shown);
-            if (0 == firstVisiblePage) {
-                firstVisiblePage = pageNo;
-            }
-            lastVisiblePage = pageNo;
+void DisplayModel::UpdateScrollVelocity(int firstVisiblePage) {
+    float pos = ScrollPosInPages(firstVisiblePage);
+    float delta = pos - scrollPos;
+    double dt = TimeSinceInMs(scrollTime);
+    int columns = ColumnsFromDisplayMode(GetDisplayMode());
+    if (delta == 0 && dt <= kScrollIdleMs) {
+        return;
+    }
+    if (dt > kScrollIdleMs || fabsf(delta) > (float)(kMaxPrefetchRows * columns)) {
+        // scrolling (re)starts or we've jumped to a different page
+        scrollVelocity = 0;
+        scrollDir = fabsf(delta) > (float)(kMaxPrefetchRows * columns) ? 0 : (delta > 0) - (delta < 0);
+    } else {
+        // smooth out uneven intervals between scroll events
+        scrollVelocity = (scrollVelocity + delta / (float)std::max(dt, 1.0)) / 2;
+        scrollDir = delta > 0 ? 1 : -1;
+    }
+    scrollPos = pos;
+    scrollTime = TimeGet();
+}
+
+// requests the pages about to become visible, further ahead when scrolling faster
+void DisplayModel::PrefetchPages(int firstVisiblePage, int lastVisiblePage) {
+    int columns = ColumnsFromDisplayMode(GetDisplayMode());
+    float pagesPerSec = fabsf(scrollVelocity) * 1000.f;
+    bool isFast = pagesPerSec > kFastScrollPagesPerSec;
+    int rowsAhead = 1 + (int)(pagesPerSec / columns * kPrefetchLookaheadMs / 1000.f);
+    int ahead = std::min(rowsAhead, kMaxPrefetchRows) * columns;
+    int behind = isFast ? 0 : columns;
+    int first = std::max(firstVisiblePage - (scrollDir < 0 ? ahead : behind), 1);
+    int last = std::min(lastVisiblePage + (scrollDir > 0 ? ahead : behind), PageCount());
+
+    // count the newly visible pages (ignoring jumps to distant pages)
+    int maxDist = kMaxPrefetchRows * columns;
+    for (int pageNo = firstVisiblePage; pageNo <= lastVisiblePage && prefetchLastVisible > 0; pageNo++) {
+        if (prefetchFirstVisible <= pageNo && pageNo <= prefetchLastVisible) {
+            continue;
+        }
+        if (prefetchFirstPageNo <= pageNo && pageNo <= prefetchLastPageNo) {
+            prefetchStats.hits++;
+        } else if (prefetchFirstVisible - maxDist <= pageNo && pageNo <= prefetchLastVisible + maxDist) {
+            prefetchStats.misses++;
         }
     }
+
+    // don't waste the rendering queue on pages no longer ahead
+    for (int pageNo = prefetchFirstPageNo; pageNo <= prefetchLastPageNo && pageNo > 0; pageNo++) {
+        bool wasVisible = prefetchFirstVisible <= pageNo && pageNo <= prefetchLastVisible;
+        if (!wasVisible && (pageNo < first || pageNo > last) && !PageVisible(pageNo)) {
+            cb->CancelPrefetch(pageNo);
+            prefetchStats.canceled++;
+        }
+    }
+
+    // rendering happens LIFO, so request the pages behind and the
+    // pages furthest ahead first, if the queue still has place for them
+    auto prefetch = [&](int pageNo) {
+        if (firstVisiblePage <= pageNo && pageNo <= lastVisiblePage) {
+            return;
+        }
+        bool wasPrefetched = prefetchFirstPageNo <= pageNo && pageNo <= prefetchLastPageNo;
+        bool wasVisible = prefetchFirstVisible <= pageNo && pageNo <= prefetchLastVisible;
+        if (!wasPrefetched || wasVisible) {
+            prefetchStats.prefetched++;
+        }
+        float zoom = GetZoomReal(pageNo);
+        cb->RequestPrefetch(pageNo, isFast ? zoom * kFastScrollZoomFactor : zoom);
+    };
+    if (scrollDir < 0) {
+        for (int pageNo = last; pageNo > lastVisiblePage; pageNo--) {
+            prefetch(pageNo);
+        }
+        for (int pageNo = first; pageNo < firstVisiblePage; pageNo++) {
+            prefetch(pageNo);
+        }
+    } else {
+        for (int pageNo = first; pageNo < firstVisiblePage; pageNo++) {
+            prefetch(pageNo);
+        }
+        for (int pageNo = last; pageNo > lastVisiblePage; pageNo--) {
+            prefetch(pageNo);
+        }
+    }
+
+    prefetchFirstPageNo = first;
+    prefetchLastPageNo = last;
+    prefetchFirstVisible = firstVisiblePage;
+    prefetchLastVisible = lastVisiblePage;
+}
+
+void DisplayModel::RenderVisibleParts() {
     // no page is visible if e.g. the window is resized
     // vertically until only the title bar remains visible
-    if (0 == firstVisiblePage) {
+    if (visiblePageNos.IsEmpty()) {
         return;
     }
+    int firstVisiblePage = visiblePageNos.at(0);
+    int lastVisiblePage = visiblePageNos.Last();
 
     // rendering happens LIFO except if the queue is currently
     // empty, so request the visible pages first and last to
@@ -1107,22 +1467,8 @@ void DisplayModel::RenderVisibleParts() {
     }
 
     if (gPredictiveRender) {
-        // prerender two more pages in facing and book view modes
-        // if the rendering queue still has place for them
-        if (!IsSingle(GetDisplayMode())) {
-            if (firstVisiblePage > 2) {
-                cb->RequestRendering(firstVisiblePage - 2);
-            }
-            if (lastVisiblePage + 1 < PageCount()) {
-                cb->RequestRendering(lastVisiblePage + 2);
-            }
-        }
-        if (firstVisiblePage > 1) {
-            cb->RequestRendering(firstVisiblePage - 1);
-        }
-        if (lastVisiblePage < PageCount()) {
-            cb->RequestRendering(lastVisiblePage + 1);
-        }
+        UpdateScrollVelocity(firstVisiblePage);
+        PrefetchPages(firstVisiblePage, lastVisiblePage);
     }
 
     // request the visible pages last so that the above requested
@@ -1211,9 +1557,9 @@ void DisplayModel::GoToPage(int pageNo, int scrollY, bool addNavPt, int scrollX)
     } else if (ZOOM_FIT_CONTENT == zoomVirtual) {
         // make sure that CalcZoomReal uses the correct page to calculate
         // the zoom level for (visibility will be recalculated below anyway)
-        for (int i = PageCount(); i > 0; i--) {
-            GetPageInfo(i)->visibleRatio = (i == pageNo ? 1.0f : 0);
-        }
+        ResetVisibleParts();
+        GetPageInfo(pageNo)->visibleRatio = 1.0f;
+        visiblePageNos.Append(pageNo);
         Relayout(zoomVirtual, rotation);
     }
     // lf("DisplayModel::GoToPage(pageNo=%d, scrollY=%d)", pageNo, scrollY);
@@ -1295,10 +1641,10 @@ void DisplayModel::SetDisplayMode(DisplayMode newDisplayMode, bool keepContinuou
         /* mark all pages as shown but not yet visible. The equivalent code
            for non-continuous mode is in DisplayModel::changeStartPage() called
            from DisplayModel::GoToPage() */
+        ResetVisibleParts();
         for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
-            PageInfo* pageInfo = &(pagesInfo[pageNo - 1]);
+            PageInfo* pageInfo = GetPageInfo(pageNo);
             pageInfo->shown = true;
-            pageInfo->visibleRatio = 0.0;
         }
         Relayout(zoomVirtual, rotation);
     }
@@ -1366,10 +1712,10 @@ bool DisplayModel::GoToPrevPage(int scrollY) {
         top = GetContentStart(currPageNo);
     }
 
-    PageInfo* pageInfo = GetPageInfo(currPageNo);
-    if (zoomVirtual == ZOOM_FIT_CONTENT && -pageInfo->pageOnScreen.y <= top.y) {
+    Rect pageOnScreen = GetPageOnScreen(currPageNo);
+    if (zoomVirtual == ZOOM_FIT_CONTENT && -pageOnScreen.y <= top.y) {
         scrollY = 0; // continue, even though the current page isn't fully visible
-    } else if (std::max(-pageInfo->pageOnScreen.y, 0) > scrollY && IsContinuous(GetDisplayMode())) {
+    } else if (std::max(-pageOnScreen.y, 0) > scrollY && IsContinuous(GetDisplayMode())) {
         /* the current page isn't fully visible, so show it first */
         GoToPage(currPageNo, scrollY);
         return true;
@@ -1382,7 +1728,7 @@ bool DisplayModel::GoToPrevPage(int scrollY) {
 
     // scroll to the bottom of the page
     if (-1 == scrollY) {
-        scrollY = GetPageInfo(firstPageInNewRow)->pageOnScreen.dy;
+        scrollY = GetPageOnScreen(firstPageInNewRow).dy;
     }
 
     GoToPage(firstPageInNewRow, scrollY);
@@ -1660,7 +2006,7 @@ void DisplayModel::RotateBy(int newRotation) {
 /* Given <region> (in user coordinates ) on page <pageNo>, copies text in that region
  * into a newly allocated buffer (which the caller needs to free()). */
 WCHAR* DisplayModel::GetTextInRegion(int pageNo, RectF region) const {
-    Rect* coords;
+    Vec<Rect> coords;
     const WCHAR* pageText = textCache->GetTextForPage(pageNo, nullptr, &coords);
     if (str::IsEmpty(pageText)) {
         return nullptr;
@@ -1670,7 +2016,7 @@ WCHAR* DisplayModel::GetTextInRegion(int pageNo, RectF region) const {
     Rect regionI = region.Round();
     for (const WCHAR* src = pageText; *src; src++) {
         if (*src != '\n') {
-            Rect rect = coords[src - pageText];
+            Rect rect = coords.at((int)(src - pageText));
             Rect isect = regionI.Intersect(rect);
             if (!isect.IsEmpty() && 1.0 * isect.dx * isect.dy / (rect.dx * rect.dy) >= 0.3) {
                 result.Append(*src);
@@ -1700,7 +2046,7 @@ bool DisplayModel::ShowResultRectToScreen(TextSel* res) {
         return false;
     }
 
-    PageInfo* pageInfo = GetPageInfo(res->pages[0]);
+    Rect pageOnScreen = GetPageOnScreen(res->pages[0]);
     int sx = 0, sy = 0;
 
     // vertically, we try to position the search result between 40%
@@ -1718,10 +2064,10 @@ bool DisplayModel::ShowResultRectToScreen(TextSel* res) {
     // center of the screen, but don't scroll further than page
     // boundaries, so that as much context as possible remains visible
     if (extremes.x < 0) {
-        sx = std::max(extremes.x + extremes.dx / 2 - viewPort.dx / 2, pageInfo->pageOnScreen.x);
+        sx = std::max(extremes.x + extremes.dx / 2 - viewPort.dx / 2, pageOnScreen.x);
     } else if (extremes.x + extremes.dx >= viewPort.dx) {
         sx = std::min(extremes.x + extremes.dx / 2 - viewPort.dx / 2,
-                      pageInfo->pageOnScreen.x + pageInfo->pageOnScreen.dx - viewPort.dx);
+                      pageOnScreen.x + pageOnScreen.dx - viewPort.dx);
     }
 
     if (sx != 0) {
@@ -1740,23 +2086,26 @@ ScrollState DisplayModel::GetScrollState() {
         state.page = CurrentPageNo();
     }
 
-    PageInfo* pageInfo = GetPageInfo(state.page);
+    if (!GetPageInfo(state.page)) {
+        return state;
+    }
+    Rect pageOnScreen = GetPageOnScreen(state.page);
     // Shortcut: don't calculate precise positions, if the
     // page wasn't scrolled right/down at all
-    if (!pageInfo || pageInfo->pageOnScreen.x > 0 && pageInfo->pageOnScreen.y > 0) {
+    if (pageOnScreen.x > 0 && pageOnScreen.y > 0) {
         return state;
     }
 
     Rect screen(Point(), viewPort.Size());
-    Rect pageVis = pageInfo->pageOnScreen.Intersect(screen);
+    Rect pageVis = pageOnScreen.Intersect(screen);
     state.page = GetPageNextToPoint(pageVis.TL());
     PointF ptD = CvtFromScreen(pageVis.TL(), state.page);
 
     // Remember to show the margin, if it's currently visible
-    if (pageInfo->pageOnScreen.x <= 0) {
+    if (pageOnScreen.x <= 0) {
         state.x = ptD.x;
     }
-    if (pageInfo->pageOnScreen.y <= 0) {
+    if (pageOnScreen.y <= 0) {
         state.y = ptD.y;
     }
 
@@ -1859,7 +2208,8 @@ bool DisplayModel::ShouldCacheRendering(int pageNo) const {
     // them for every UI update (WM_PAINT) can cause notable lags, and also
     // for smaller images which are scaled up
     PageInfo* info = GetPageInfo(pageNo);
-    return info->page.dx * info->page.dy > 1024 * 1024 || info->pageOnScreen.dx * info->pageOnScreen.dy > 1024 * 1024;
+    Rect pageOnScreen = GetPageOnScreen(pageNo);
+    return info->page.dx * info->page.dy > 1024 * 1024 || pageOnScreen.dx * pageOnScreen.dy > 1024 * 1024;
 }
 
 void DisplayModel::ScrollToLink(PageDestination* dest) {
@@ -1891,8 +2241,7 @@ void DisplayModel::ScrollToLink(PageDestination* dest) {
             scroll.x = -1;
         }
         if (DEST_USE_DEFAULT == rect.y) {
-            PageInfo* pageInfo = GetPageInfo(CurrentPageNo());
-            scroll.y = -(pageInfo->pageOnScreen.y - windowMargin.top);
+            scroll.y = -(GetPageOnScreen(CurrentPageNo()).y - windowMargin.top);
         }
         // logf("DisplayModel::ScrollToLink /XYZ END [zoom] real=%f virtual=%f\n", zoomReal, zoomVirtual);
         // logf("DisplayModel::ScrollToLink /XYZ END [scroll] x=%d y=%d\n", scroll.x, scroll.y);
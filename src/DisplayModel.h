@@ -25,10 +25,9 @@ struct PageInfo {
        Calculated in DisplayModel::Relayout() */
     Rect pos{};
 
-    /* data that changes due to scrolling. Calculated in DisplayModel::RecalcVisibleParts() */
+    /* data that changes due to scrolling. Calculated in DisplayModel::RecalcVisibleParts(),
+       0 for all pages not in DisplayModel::visiblePageNos */
     float visibleRatio; /* (0.0 = invisible, 1.0 = fully visible) */
-    /* position of page relative to visible view port: pos.Offset(-viewPort.x, -viewPort.y) */
-    Rect pageOnScreen{};
 
     // when zoomVirtual in DisplayMode is ZOOM_FIT_PAGE, ZOOM_FIT_WIDTH
     // or ZOOM_FIT_CONTENT, this is per-page zoom level
@@ -47,6 +46,23 @@ struct ScrollState {
     double y = 0;
 };
 
+/* Counts how well prefetching predicted the pages becoming visible next
+   (see DisplayModel::PrefetchPages) */
+struct PrefetchStats {
+    // pages requested ahead of becoming visible
+    int prefetched = 0;
+    // prefetched pages no longer requested, e.g. after a change of direction
+    int canceled = 0;
+    // pages which had been prefetched when they became visible
+    int hits = 0;
+    // pages which became visible while scrolling without having been prefetched
+    int misses = 0;
+
+    [[nodiscard]] float HitRate() const {
+        return hits + misses > 0 ? (float)hits / (float)(hits + misses) : 0.f;
+    }
+};
+
 struct DocumentTextCache;
 struct TextSelection;
 class TextSearch;
@@ -90,6 +106,7 @@ struct DisplayModel : public Controller {
     void SetViewPortSize(Size size) override;
 
     // table of contents
+    bool IsDocInfoLoaded() override;
     TocTree* GetToc() override;
     void ScrollToLink(PageDestination* dest) override;
     PageDestination* GetNamedDest(const WCHAR* name) override;
@@ -129,11 +146,16 @@ struct DisplayModel : public Controller {
     TextSearch* textSearch{nullptr};
 
     [[nodiscard]] PageInfo* GetPageInfo(int pageNo) const;
+    /* position of page relative to visible view port: pos.Offset(-viewPort.x, -viewPort.y) */
+    [[nodiscard]] Rect GetPageOnScreen(int pageNo) const;
 
     /* current rotation selected by user */
     [[nodiscard]] int GetRotation() const;
     [[nodiscard]] float GetZoomReal(int pageNo) const;
     void Relayout(float zoomVirtual, int rotation);
+    // re-reads page sizes after the engine has replaced estimated ones
+    void UpdatePageSizes();
+    bool RelayoutChangedPages(const Vec<int>& pageNos);
 
     [[nodiscard]] Rect GetViewPort() const;
     [[nodiscard]] bool IsHScrollbarVisible() const;
@@ -187,6 +209,8 @@ struct DisplayModel : public Controller {
     /* allow resizing a window without triggering a new rendering (needed for window destruction) */
     bool dontRenderFlag = false;
 
+    PrefetchStats prefetchStats;
+
     [[nodiscard]] bool GetPresentationMode() const;
 
     void BuildPagesInfo();
@@ -195,7 +219,11 @@ struct DisplayModel : public Controller {
     void ChangeStartPage(int startPage);
     Point GetContentStart(int pageNo) const;
     void RecalcVisibleParts() const;
+    void ResetVisibleParts();
     void RenderVisibleParts();
+    float ScrollPosInPages(int firstVisiblePage) const;
+    void UpdateScrollVelocity(int firstVisiblePage);
+    void PrefetchPages(int firstVisiblePage, int lastVisiblePage);
     void AddNavPoint();
     RectF GetContentBox(int pageNo) const;
     void CalcZoomReal(float zoomVirtual);
@@ -208,6 +236,33 @@ struct DisplayModel : public Controller {
     /* an array of PageInfo, len of array is pageCount */
     PageInfo* pagesInfo{nullptr};
 
+    /* page numbers of shown pages in layout order and, for each of them, the
+       largest bottom edge (pos.y + pos.dy) up to that page. pos.y never decreases
+       in layout order, so pages can be looked up by y coordinate with a binary search.
+       Calculated in DisplayModel::Relayout() */
+    Vec<int> shownPageNos;
+    Vec<int> shownPagesMaxBottom;
+    /* width of the widest page in the first column. Calculated in DisplayModel::Relayout() */
+    int columnMaxDx{0};
+    /* pages with visibleRatio > 0 in ascending order. Calculated in DisplayModel::RecalcVisibleParts() */
+    mutable Vec<int> visiblePageNos;
+    /* view port as of the last DisplayModel::RecalcVisibleParts() */
+    mutable Rect visiblePartsViewPort;
+
+    /* scroll position (in pages), velocity (in pages per ms, negative when
+       scrolling towards the start) and direction for rendering pages ahead
+       of time. Updated in DisplayModel::RenderVisibleParts() */
+    float scrollPos{0};
+    float scrollVelocity{0};
+    int scrollDir{0};
+    LARGE_INTEGER scrollTime{};
+    /* pages which may be rendered ahead of becoming visible
+       and the pages which were visible when they were requested */
+    int prefetchFirstPageNo{0};
+    int prefetchLastPageNo{0};
+    int prefetchFirstVisible{0};
+    int prefetchLastVisible{0};
+
     DisplayMode displayMode{DisplayMode::Automatic};
     /* In non-continuous mode is the first page from a file that we're
        displaying.
@@ -874,10 +874,6 @@ int EbookController::CurrentTocPageNo() const {
 }
 
 void EbookController::GetDisplayState(FileState* ds) {
-    if (!ds->filePath || !str::EqI(ds->filePath, doc.GetFilePath())) {
-        str::ReplaceWithCopy(&ds->filePath, doc.GetFilePath());
-    }
-
     ds->useDefaultState = !gGlobalPrefs->rememberStatePerDocument;
 
     // don't modify any of the other FileState values
@@ -3,12 +3,14 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/Archive.h"
+#include "utils/Dict.h"
 #include "utils/FileUtil.h"
 #include "utils/GuessFileType.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
 #include "utils/PalmDbReader.h"
+#include "utils/ThreadUtil.h"
 #include "utils/TrivialHtmlParser.h"
 #include "utils/WinUtil.h"
 #include "utils/ScopedWin.h"
@@ -319,6 +321,45 @@ static bool isImageMediaType(const WCHAR* mediatype) {
     return str::Eq(mediatype, L"image/png") || str::Eq(mediatype, L"image/jpeg") || str::Eq(mediatype, L"image/gif");
 }
 
+constexpr int kMaxEpubChapterLoadThreads = 8;
+
+// decompresses paths[i] and converts it to UTF-8 into chapters[i],
+// taking the next chapter until all of them have been loaded
+static void LoadEpubChapters(MultiFormatArchive* zip, WStrVec* paths, Vec<char*>* chapters, LONG* nextChapter) {
+    for (;;) {
+        int idx = (int)InterlockedIncrement(nextChapter) - 1;
+        if (idx >= paths->isize()) {
+            return;
+        }
+        AutoFree html = zip->GetFileDataByName(paths->at(idx));
+        if (html.data) {
+            chapters->at(idx) = DecodeTextToUtf8(html.data, true);
+        }
+    }
+}
+
+// helps loading chapters with its own copy of the archive
+// (which can't be used from several threads at once)
+class EpubChapterLoadThread : public ThreadBase {
+  public:
+    const WCHAR* archivePath = nullptr;
+    WStrVec* paths = nullptr;
+    Vec<char*>* chapters = nullptr;
+    LONG* nextChapter = nullptr;
+
+    EpubChapterLoadThread() : ThreadBase("EpubChapterLoadThread") {
+    }
+    ~EpubChapterLoadThread() override = default;
+
+    void Run() override {
+        MultiFormatArchive* zip = OpenZipArchive(archivePath, true);
+        if (zip) {
+            LoadEpubChapters(zip, paths, chapters, nextChapter);
+        }
+        delete zip;
+    }
+};
+
 bool EpubDoc::Load() {
     if (!zip) {
         return false;
@@ -381,7 +422,9 @@ bool EpubDoc::Load() {
         *contentPath = '\0';
     }
 
-    WStrList idList, pathList;
+    // maps manifest item ids to their index in pathList
+    dict::MapWStrToInt idToPath(256);
+    WStrVec pathList;
 
     for (node = node->down; node; node = node->next) {
         AutoFreeWstr mediatype(node->GetAttribute("media-type"));
@@ -417,8 +460,8 @@ bool EpubDoc::Load() {
             if (encList.size() > 0 && encList.Contains(fullContentPath)) {
                 continue;
             }
-            if (htmlPath && htmlId) {
-                idList.Append(htmlId.StealData());
+            // for duplicate ids, the first item wins
+            if (htmlPath && htmlId && idToPath.Insert(htmlId, pathList.isize(), nullptr)) {
                 pathList.Append(htmlPath.StealData());
             }
         }
@@ -431,8 +474,9 @@ bool EpubDoc::Load() {
 
     // EPUB 2 ToC
     AutoFreeWstr tocId(node->GetAttribute("toc"));
-    if (tocId && !tocPath && idList.Contains(tocId)) {
-        tocPath.Set(str::Join(contentPath, pathList.at(idList.Find(tocId))));
+    int tocIdx = -1;
+    if (tocId && !tocPath && idToPath.Get(tocId, &tocIdx)) {
+        tocPath.Set(str::Join(contentPath, pathList.at(tocIdx)));
         isNcxToc = true;
     }
     AutoFreeWstr readingDir(node->GetAttribute("page-progression-direction"));
@@ -440,29 +484,53 @@ bool EpubDoc::Load() {
         isRtlDoc = str::EqI(readingDir, L"rtl");
     }
 
+    WStrVec chapterPaths;
     for (node = node->down; node; node = node->next) {
         if (!node->NameIsNS("itemref", EPUB_OPF_NS)) {
             continue;
         }
         AutoFreeWstr idref = node->GetAttribute("idref");
-        if (!idref || !idList.Contains(idref)) {
-            continue;
-        }
-
-        const WCHAR* fileName = pathList.at(idList.Find(idref));
-        AutoFreeWstr fullPath = str::Join(contentPath, fileName);
-        AutoFree html = zip->GetFileDataByName(fullPath);
-        if (!html.data) {
+        int pathIdx = -1;
+        if (!idref || !idToPath.Get(idref, &pathIdx)) {
             continue;
         }
-        char* decoded = DecodeTextToUtf8(html.data, true);
-        html.TakeOwnershipOf(decoded);
+        chapterPaths.Append(str::Join(contentPath, pathList.at(pathIdx)));
+    }
+
+    // decompressing and decoding chapters is independent of each other, so
+    // it's done on several threads (each with its own copy of the archive)
+    Vec<char*> chapters;
+    chapters.AppendBlanks(chapterPaths.size());
+    LONG nextChapter = 0;
+    Vec<EpubChapterLoadThread*> threads;
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    int nThreads = std::min((int)si.dwNumberOfProcessors, kMaxEpubChapterLoadThreads);
+    nThreads = std::min(nThreads, chapterPaths.isize());
+    // documents loaded from a stream can't be re-opened
+    for (int i = 1; fileName && i < nThreads; i++) {
+        auto thread = new EpubChapterLoadThread();
+        thread->archivePath = fileName;
+        thread->paths = &chapterPaths;
+        thread->chapters = &chapters;
+        thread->nextChapter = &nextChapter;
+        thread->Start();
+        threads.Append(thread);
+    }
+    LoadEpubChapters(zip, &chapterPaths, &chapters, &nextChapter);
+    for (EpubChapterLoadThread* thread : threads) {
+        thread->Join();
+        delete thread;
+    }
+
+    for (int i = 0; i < chapterPaths.isize(); i++) {
+        AutoFree html = chapters.at(i);
         if (!html.data) {
             continue;
         }
         // insert explicit page-breaks between sections including
         // an anchor with the file name at the top (for internal links)
-        auto pathA = ToUtf8Temp(fullPath);
+        auto pathA = ToUtf8Temp(chapterPaths.at(i));
         ReportIf(str::FindChar(pathA.Get(), '"'));
         str::TransCharsInPlace(pathA.Get(), "\"", "'");
         htmlData.AppendFmt("<pagebreak page_path=\"%s\" page_marker />", pathA.Get());
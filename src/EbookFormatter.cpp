@@ -9,6 +9,7 @@
 #include "utils/PalmDbReader.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
+#include "utils/ThreadUtil.h"
 #include "mui/Mui.h"
 
 #include "wingui/TreeModel.h"
@@ -164,7 +165,7 @@ void EpubFormatter::HandleTagPagebreak(HtmlToken* t) {
         currPage->instructions.Append(DrawInstr::Anchor(attr->val, attr->valLen, bbox));
         pagePath.Set(str::Dup(attr->val, attr->valLen));
         // reset CSS style rules for the new document
-        styleRules.Reset();
+        ResetStyleRules();
     }
 }
 
@@ -237,6 +238,132 @@ bool EpubFormatter::IgnoreText() {
     return hiddenDepth > 0 || HtmlFormatter::IgnoreText();
 }
 
+// chapters are laid out together with the following ones until
+// they're at least this big so that setting up an EpubFormatter
+// doesn't dominate for documents with many tiny chapters
+constexpr size_t kMinEpubLayoutChunkSize = 64 * 1024;
+constexpr int kMaxEpubLayoutThreads = 8;
+
+struct EpubLayoutChunk {
+    // offset and size within HtmlFormatterArgs::htmlStr
+    size_t start = 0;
+    size_t len = 0;
+    Vec<HtmlPage*>* pages = nullptr;
+    // text of the pages not pointing into htmlStr, must outlive the pages
+    PoolAllocator* textAllocator = nullptr;
+};
+
+static void FormatEpubChunk(HtmlFormatterArgs* args, EpubDoc* doc, EpubLayoutChunk* chunk, bool skipEmptyPages) {
+    HtmlFormatterArgs chunkArgs;
+    chunkArgs.pageDx = args->pageDx;
+    chunkArgs.pageDy = args->pageDy;
+    chunkArgs.SetFontName(args->GetFontName());
+    chunkArgs.fontSize = args->fontSize;
+    chunkArgs.textAllocator = chunk->textAllocator = new PoolAllocator();
+    chunkArgs.threadFonts = mui::AllocThreadFonts();
+    chunkArgs.textRenderMethod = args->textRenderMethod;
+    chunkArgs.htmlStr = args->htmlStr.subspan(chunk->start, chunk->len);
+
+    chunk->pages = EpubFormatter(&chunkArgs, doc).FormatAllPages(skipEmptyPages);
+    for (HtmlPage* page : *chunk->pages) {
+        // reparse points are relative to the start of the chunk
+        page->reparseIdx += (int)chunk->start;
+        // the pages are drawn on other threads, so they must use the shared fonts
+        for (DrawInstr& i : page->instructions) {
+            if (DrawInstrType::SetFont == i.type) {
+                i.font = mui::GetCachedFont(i.font->GetName(), i.font->GetSize(), i.font->GetStyle());
+            }
+        }
+    }
+    mui::FreeThreadFonts(chunkArgs.threadFonts);
+}
+
+// lays out chunks until all of them have been taken by one of the threads
+class EpubLayoutThread : public ThreadBase {
+  public:
+    HtmlFormatterArgs* args = nullptr;
+    EpubDoc* doc = nullptr;
+    bool skipEmptyPages = false;
+    Vec<EpubLayoutChunk>* chunks = nullptr;
+    LONG* nextChunk = nullptr;
+
+    EpubLayoutThread() : ThreadBase("EpubLayoutThread") {
+    }
+    ~EpubLayoutThread() override = default;
+
+    void Run() override {
+        for (;;) {
+            int idx = (int)InterlockedIncrement(nextChunk) - 1;
+            if (idx >= chunks->isize()) {
+                return;
+            }
+            FormatEpubChunk(args, doc, &chunks->at(idx), skipEmptyPages);
+        }
+    }
+};
+
+static int GetLayoutThreadsCount(int nChunks) {
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    int n = std::min((int)si.dwNumberOfProcessors, kMaxEpubLayoutThreads);
+    return std::min(n, nChunks);
+}
+
+// Formats the whole EPUB document. Every chapter starts on a new page
+// (EpubDoc::Load separates them with <pagebreak page_path="..." />), so
+// chapters are laid out concurrently, each chunk by its own EpubFormatter,
+// text measurer, fonts and text allocator, and the pages are then
+// concatenated in spine order. The text allocators of the chunks are
+// appended to chunkAllocators and must be kept alive as long as the pages.
+Vec<HtmlPage*>* EpubFormatAllPages(HtmlFormatterArgs* args, EpubDoc* doc, Vec<PoolAllocator*>& chunkAllocators,
+                                   bool skipEmptyPages) {
+    Vec<EpubLayoutChunk> chunks;
+    if (0 == args->reparseIdx && mui::CanMeasureTextConcurrently()) {
+        std::string_view html{(const char*)args->htmlStr.data(), args->htmlStr.size()};
+        std::string_view chapterStart = "<pagebreak page_path=";
+        size_t start = 0;
+        size_t pos = html.find(chapterStart, 1);
+        while (pos != std::string_view::npos) {
+            if (pos - start >= kMinEpubLayoutChunkSize) {
+                chunks.Append({start, pos - start});
+                start = pos;
+            }
+            pos = html.find(chapterStart, pos + 1);
+        }
+        chunks.Append({start, html.size() - start});
+    }
+
+    int nThreads = GetLayoutThreadsCount(chunks.isize());
+    if (nThreads < 2) {
+        return EpubFormatter(args, doc).FormatAllPages(skipEmptyPages);
+    }
+
+    LONG nextChunk = 0;
+    Vec<EpubLayoutThread*> threads;
+    for (int i = 0; i < nThreads; i++) {
+        auto thread = new EpubLayoutThread();
+        thread->args = args;
+        thread->doc = doc;
+        thread->skipEmptyPages = skipEmptyPages;
+        thread->chunks = &chunks;
+        thread->nextChunk = &nextChunk;
+        thread->Start();
+        threads.Append(thread);
+    }
+    for (EpubLayoutThread* thread : threads) {
+        thread->Join();
+        delete thread;
+    }
+
+    auto pages = new Vec<HtmlPage*>();
+    for (EpubLayoutChunk& chunk : chunks) {
+        pages->Append(chunk.pages->LendData(), chunk.pages->size());
+        delete chunk.pages;
+        chunkAllocators.Append(chunk.textAllocator);
+    }
+    return pages;
+}
+
 /* FictionBook-specific formatting methods */
 
 Fb2Formatter::Fb2Formatter(HtmlFormatterArgs* args, Fb2Doc* doc)
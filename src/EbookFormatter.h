@@ -40,6 +40,9 @@ class EpubFormatter : public HtmlFormatter {
     }
 };
 
+Vec<HtmlPage*>* EpubFormatAllPages(HtmlFormatterArgs* args, EpubDoc* doc, Vec<PoolAllocator*>& chunkAllocators,
+                                   bool skipEmptyPages = true);
+
 /* formatting extensions for FictionBook */
 
 class Fb2Doc;
@@ -317,6 +317,7 @@ static void WndCloseHandler(EditAnnotationsWindow* ew, WindowCloseEvent* ev) {
 }
 
 extern bool SaveAnnotationsToMaybeNewPdfFile(TabInfo* tab);
+extern void SaveAnnotationsInBackground(TabInfo* tab, const char* dstPath, const std::function<void()>& onSaved);
 static void GetAnnotationsFromEngine(EditAnnotationsWindow* ew, TabInfo* tab);
 static void UpdateUIForSelectedAnnotation(EditAnnotationsWindow* ew, int itemNo);
 
@@ -328,23 +329,11 @@ static void ButtonSaveToNewFileHandler(EditAnnotationsWindow* ew) {
     }
 }
 
-static void ButtonSaveToCurrentPDFHandler(EditAnnotationsWindow* ew) {
-    TabInfo* tab = ew->tab;
-    EnginePdf* engine = GetEnginePdf(ew);
-    TempStr path = ToUtf8Temp(engine->FileName());
-    bool ok = EnginePdfSaveUpdated(engine, {}, [&tab, &path](std::string_view mupdfErr) {
-        str::Str msg;
-        // TODO: duplicated message
-        msg.AppendFmt(_TRA("Saving of '%s' failed with: '%s'"), path.Get(), mupdfErr.data());
-        tab->win->ShowNotification(msg.AsView(), NotificationOptions::Warning);
-    });
-    if (!ok) {
+static void ReloadAfterSavingToCurrentPDF(TabInfo* tab) {
+    EditAnnotationsWindow* ew = tab->editAnnotsWindow;
+    if (!ew || tab->win->currentTab != tab) {
         return;
     }
-    str::Str msg;
-    msg.AppendFmt(_TRA("Saved annotations to '%s'"), path.Get());
-    tab->win->ShowNotification(msg.AsView());
-
     // TODO: hacky: set tab->editAnnotsWindow to nullptr to
     // disable a check in ReloadDocuments. Could pass additional argument
     auto tmpWin = tab->editAnnotsWindow;
@@ -357,6 +346,12 @@ static void ButtonSaveToCurrentPDFHandler(EditAnnotationsWindow* ew) {
     UpdateUIForSelectedAnnotation(ew, -1);
 }
 
+static void ButtonSaveToCurrentPDFHandler(EditAnnotationsWindow* ew) {
+    TabInfo* tab = ew->tab;
+    // the edit window might be closed by the time saving has finished
+    SaveAnnotationsInBackground(tab, nullptr, [tab] { ReloadAfterSavingToCurrentPDF(tab); });
+}
+
 static void ItemsFromSeqstrings(Vec<std::string_view>& items, const char* strings) {
     while (*strings) {
         items.Append(strings);
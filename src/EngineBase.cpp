@@ -4,6 +4,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/Trace.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/TreeModel.h"
@@ -30,6 +31,7 @@ RenderedBitmap* RenderedBitmap::Clone() const {
 
 // render the bitmap into the target rectangle (streching and skewing as requird)
 bool RenderedBitmap::StretchDIBits(HDC hdc, Rect target) const {
+    trace::Scope traceScope("StretchDIBits");
     return BlitHBITMAP(hbmp, hdc, target);
 }
 
@@ -231,11 +233,16 @@ TocItem::~TocItem() {
     free(engineFilePath);
 }
 
+// the parent's children array (if any) is out of date after adding
+// an item, so it falls back to walking the list of children
 void TocItem::AddSibling(TocItem* sibling) {
     TocItem* currNext = next;
     next = sibling;
     sibling->next = currNext;
     sibling->parent = parent;
+    if (parent) {
+        parent->children = nullptr;
+    }
 }
 
 void TocItem::AddSiblingAtEnd(TocItem* sibling) {
@@ -245,6 +252,9 @@ void TocItem::AddSiblingAtEnd(TocItem* sibling) {
     }
     item->next = sibling;
     sibling->parent = item->parent;
+    if (item->parent) {
+        item->parent->children = nullptr;
+    }
 }
 
 void TocItem::AddChild(TocItem* newChild) {
@@ -252,6 +262,7 @@ void TocItem::AddChild(TocItem* newChild) {
     child = newChild;
     newChild->parent = this;
     newChild->next = currChild;
+    children = nullptr;
 }
 
 // TODO: pick a better name. I think it's used to expand root-level item
@@ -333,6 +344,9 @@ TreeItem* TocItem::Parent() {
 }
 
 int TocItem::ChildCount() {
+    if (children) {
+        return nChildren;
+    }
     int n = 0;
     auto node = child;
     while (node) {
@@ -343,16 +357,9 @@ int TocItem::ChildCount() {
 }
 
 TreeItem* TocItem::ChildAt(int n) {
-    if (n == 0) {
-        currChild = child;
-        currChildNo = 0;
-        return child;
-    }
-    // speed up sequential iteration over children
-    if (currChild != nullptr && n == currChildNo + 1) {
-        currChild = currChild->next;
-        ++currChildNo;
-        return currChild;
+    if (children) {
+        CrashIf(n < 0 || n >= nChildren);
+        return children[n];
     }
     auto node = child;
     while (n > 0) {
@@ -397,23 +404,74 @@ TocTree::~TocTree() {
     delete root;
 }
 
+void TocTree::BuildIndex() {
+    items.Reset();
+    for (TocItem* ti = root; ti; ti = ti->next) {
+        items.Append(ti);
+    }
+    nRootItems = items.isize();
+    // the children of each item are appended after those
+    // of all items before it (i.e. breadth first)
+    for (int i = 0; i < items.isize(); i++) {
+        TocItem* item = items.at(i);
+        int nBefore = items.isize();
+        for (TocItem* ti = item->child; ti; ti = ti->next) {
+            items.Append(ti);
+        }
+        item->nChildren = items.isize() - nBefore;
+    }
+    // items no longer grows, so pointers into it remain valid
+    TocItem** data = items.LendData();
+    int start = nRootItems;
+    for (TocItem* item : items) {
+        item->children = item->nChildren > 0 ? data + start : nullptr;
+        start += item->nChildren;
+    }
+
+    itemsByPageNo.Reset();
+    SortTocItemsByPageNo(root, itemsByPageNo);
+}
+
+int TocTree::ItemsCount() {
+    if (root && items.IsEmpty()) {
+        BuildIndex();
+    }
+    return items.isize();
+}
+
+// returns the item closest to pageNo in the same way as visiting all items
+// in tree order would: the first item for pageNo or else the last item for
+// the closest page before pageNo (or the first item if there's none)
+TocItem* TocTree::FindItemForPageNo(int pageNo) {
+    if (ItemsCount() == 0) {
+        return nullptr;
+    }
+    auto cmpPageNo = [](int pageNo, TocItem* ti) { return pageNo < ti->pageNo; };
+    auto it = std::upper_bound(itemsByPageNo.begin(), itemsByPageNo.end(), pageNo, cmpPageNo);
+    if (it == itemsByPageNo.begin() || (*(it - 1))->pageNo < 1) {
+        return root;
+    }
+    TocItem* res = *(it - 1);
+    if (res->pageNo == pageNo) {
+        auto cmpItem = [](TocItem* ti, int pageNo) { return ti->pageNo < pageNo; };
+        res = *std::lower_bound(itemsByPageNo.begin(), itemsByPageNo.end(), pageNo, cmpItem);
+    }
+    return res;
+}
+
 int TocTree::RootCount() {
-    int n = 0;
-    auto node = root;
-    while (node) {
-        n++;
-        node = node->next;
+    if (root && items.IsEmpty()) {
+        BuildIndex();
     }
-    return n;
+    return nRootItems;
 }
 
 TreeItem* TocTree::RootAt(int n) {
-    auto node = root;
-    while (n > 0) {
-        n--;
-        node = node->next;
+    if (root && items.IsEmpty()) {
+        BuildIndex();
     }
-    return node;
+    CrashIf(n < 0 || n >= nRootItems);
+    return items.at(n);
 }
 
 TocTree* CloneTocTree(TocTree* tree, bool removeUnchecked) {
@@ -422,6 +480,22 @@ TocTree* CloneTocTree(TocTree* tree, bool removeUnchecked) {
     return res;
 }
 
+static void CollectTocItemsRecur(TocItem* ti, Vec<TocItem*>& v) {
+    while (ti) {
+        v.Append(ti);
+        CollectTocItemsRecur(ti->child, v);
+        ti = ti->next;
+    }
+}
+
+// collects ti, its siblings and all their descendants, sorted by pageNo
+// (items with the same pageNo remain in tree order)
+void SortTocItemsByPageNo(TocItem* ti, Vec<TocItem*>& items) {
+    CollectTocItemsRecur(ti, items);
+    auto cmpByPageNo = [](TocItem* ti1, TocItem* ti2) { return ti1->pageNo < ti2->pageNo; };
+    std::stable_sort(items.begin(), items.end(), cmpByPageNo);
+}
+
 // TODO: speed up by removing recursion
 bool VisitTocTree(TocItem* ti, const std::function<bool(TocItem*)>& f) {
     bool cont;
@@ -486,6 +560,16 @@ int EngineBase::PageCount() const {
     return pageCount;
 }
 
+RectF EngineBase::PageMediaboxEstimate(int pageNo) {
+    return PageMediabox(pageNo);
+}
+
+void EngineBase::SetPageSizesChangedCb(__unused const std::function<void()>& cb) {
+}
+
+void EngineBase::TakeChangedPageSizes(__unused Vec<int>* pageNos, __unused Vec<RectF>* sizes) {
+}
+
 RectF EngineBase::PageContentBox(int pageNo, __unused RenderTarget target) {
     return PageMediabox(pageNo);
 }
@@ -514,6 +598,13 @@ PageDestination* EngineBase::GetNamedDest(__unused const WCHAR* name) {
     return nullptr;
 }
 
+bool EngineBase::IsDocInfoLoaded() {
+    return true;
+}
+
+void EngineBase::SetDocInfoLoadedCb(__unused const std::function<void()>& cb) {
+}
+
 bool EngineBase::HacToc() {
     TocTree* tree = GetToc();
     return tree != nullptr;
@@ -225,9 +225,10 @@ struct TocItem : TreeItem {
     // next sibling
     TocItem* next{nullptr};
 
-    // caching to speed up ChildAt
-    TocItem* currChild{nullptr};
-    int currChildNo{0};
+    // children in order, set by TocTree::BuildIndex() to make
+    // ChildCount() and ChildAt() O(1) (points into TocTree::items)
+    TocItem** children{nullptr};
+    int nChildren{0};
 
     // -- only for .EngineMulti
     // marks a node that represents a file
@@ -268,16 +269,30 @@ TocItem* CloneTocItemRecur(TocItem*, bool);
 struct TocTree : TreeModel {
     TocItem* root{nullptr};
 
+    // built on first use by BuildIndex(), which must only
+    // be called once the tree has been fully constructed:
+    // all items, with the children of each item stored contiguously
+    // (root items first)
+    Vec<TocItem*> items;
+    int nRootItems{0};
+    // all items sorted by pageNo (in tree order for the same pageNo)
+    Vec<TocItem*> itemsByPageNo;
+
     TocTree() = default;
     explicit TocTree(TocItem* root);
     ~TocTree() override;
 
+    void BuildIndex();
+    int ItemsCount();
+    TocItem* FindItemForPageNo(int pageNo);
+
     // TreeModel
     int RootCount() override;
     TreeItem* RootAt(int n) override;
 };
 
 TocTree* CloneTocTree(TocTree*, bool removeUnchecked);
+void SortTocItemsByPageNo(TocItem* ti, Vec<TocItem*>& items);
 bool VisitTocTree(TocItem* ti, const std::function<bool(TocItem*)>& f);
 bool VisitTocTreeWithParent(TocItem* ti, const std::function<bool(TocItem* ti, TocItem* parent)>& f);
 void SetTocTreeParents(TocItem* treeRoot);
@@ -332,6 +347,15 @@ class EngineBase {
 
     // the box containing the visible page content (usually RectF(0, 0, pageWidth, pageHeight))
     virtual RectF PageMediabox(int pageNo) = 0;
+    // like PageMediabox but may return an estimate instead of determining the
+    // real size (which is expensive for all pages of very large documents)
+    virtual RectF PageMediaboxEstimate(int pageNo);
+    // engines returning estimates from PageMediaboxEstimate call cb (on a
+    // background thread) whenever some of them have been replaced with real sizes
+    virtual void SetPageSizesChangedCb(const std::function<void()>& cb);
+    // appends the pages whose PageMediaboxEstimate has changed since the last
+    // call (in no particular order) to pageNos and their new sizes to sizes
+    virtual void TakeChangedPageSizes(Vec<int>* pageNos, Vec<RectF>* sizes);
     // the box inside PageMediabox that actually contains any relevant content
     // (used for auto-cropping in Fit Content mode, can be PageMediabox)
     virtual RectF PageContentBox(int pageNo, RenderTarget target = RenderTarget::View);
@@ -394,6 +418,13 @@ class EngineBase {
     // caller must delete the result
     virtual PageDestination* GetNamedDest(const WCHAR* name);
 
+    // some engines load the ToC, page labels and properties in the background
+    // (the methods returning them block until that's done). returns false
+    // while that's still in progress
+    virtual bool IsDocInfoLoaded();
+    // cb is called (on a background thread) once IsDocInfoLoaded turns true
+    virtual void SetDocInfoLoadedCb(const std::function<void()>& cb);
+
     // checks whether this document has an associated Table of Contents
     bool HacToc();
 
@@ -403,7 +434,7 @@ class EngineBase {
 
     // checks whether this document has explicit labels for pages (such as
     // roman numerals) instead of the default plain arabic numbering
-    [[nodiscard]] bool HasPageLabels() const;
+    [[nodiscard]] virtual bool HasPageLabels() const;
 
     // returns a label to be displayed instead of the page number
     // caller must free() the result
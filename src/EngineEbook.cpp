@@ -113,6 +113,8 @@ class EngineEbook : public EngineBase {
     Vec<DrawInstr*> baseAnchors;
     // needed so that memory allocated by ResolveHtmlEntities isn't leaked
     PoolAllocator allocator;
+    // same for documents laid out in several chunks concurrently
+    Vec<PoolAllocator*> chunkAllocators;
     // TODO: still needed?
     CRITICAL_SECTION pagesAccess;
     // page dimensions can vary between filetypes
@@ -186,6 +188,7 @@ EngineEbook::~EngineEbook() {
         DeleteVecMembers(*pages);
     }
     delete pages;
+    DeleteVecMembers(chunkAllocators);
 
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
@@ -762,7 +765,7 @@ bool EngineEpub::FinishLoading() {
     args.textAllocator = &allocator;
     args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
 
-    pages = EpubFormatter(&args, doc).FormatAllPages(false);
+    pages = EpubFormatAllPages(&args, doc, chunkAllocators, false);
 
     // must set pageCount before ExtractPageAnchors
     pageCount = (int)pages->size();
@@ -1288,7 +1291,7 @@ void ChmFormatter::HandleTagPagebreak(HtmlToken* t) {
         currPage->instructions.Append(DrawInstr::Anchor(attr->val, attr->valLen, bbox));
         pagePath.Set(str::Dup(attr->val, attr->valLen));
         // reset CSS style rules for the new document
-        styleRules.Reset();
+        ResetStyleRules();
     }
 }
 
@@ -13,6 +13,8 @@ extern "C" {
 #include "utils/FileUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
+#include "utils/PaletteUtil.h"
+#include "utils/Trace.h"
 #include "utils/TrivialHtmlParser.h"
 #include "utils/WinUtil.h"
 #include "utils/ZipUtil.h"
@@ -263,79 +265,125 @@ void fz_stream_fingerprint(fz_context* ctx, fz_stream* stm, u8 digest[16]) {
     fz_md5_final(&md5, digest);
 }
 
-// try to produce an 8-bit palette for saving some memory
-static RenderedBitmap* try_render_as_palette_image(fz_pixmap* pixmap) {
-    int w = pixmap->w;
-    int h = pixmap->h;
-    int rows8 = ((w + 3) / 4) * 4;
-    u8* bmpData = (u8*)calloc(rows8, h);
-    if (!bmpData) {
-        return nullptr;
-    }
-
+// creates a top-down DIB section of w x h pixels with bitCount bits per pixel
+// (and paletteSize colors for 8bpp). Its memory is returned in bitsOut
+static HBITMAP CreateTopDownDib(int w, int h, int bitCount, const u32* palette, int paletteSize, HANDLE* hMapOut,
+                                void** bitsOut) {
     ScopedMem<BITMAPINFO> bmi((BITMAPINFO*)calloc(1, sizeof(BITMAPINFO) + 255 * sizeof(RGBQUAD)));
-
-    u8* dest = bmpData;
-    u8* source = pixmap->samples;
-    u32* palette = (u32*)bmi.Get()->bmiColors;
-    u8 grayIdxs[256] = {0};
-
-    int paletteSize = 0;
-    RGBQUAD c;
-    for (int j = 0; j < h; j++) {
-        for (int i = 0; i < w; i++) {
-            c.rgbRed = *source++;
-            c.rgbGreen = *source++;
-            c.rgbBlue = *source++;
-            c.rgbReserved = 0;
-            source++;
-
-            /* find this color in the palette */
-            int k;
-            bool isGray = c.rgbRed == c.rgbGreen && c.rgbRed == c.rgbBlue;
-            if (isGray) {
-                k = grayIdxs[c.rgbRed] || palette[0] == *(u32*)&c ? grayIdxs[c.rgbRed] : paletteSize;
-            } else {
-                for (k = 0; k < paletteSize && palette[k] != *(u32*)&c; k++) {
-                    ;
-                }
-            }
-            /* add it to the palette if it isn't in there and if there's still space left */
-            if (k == paletteSize) {
-                if (++paletteSize > 256) {
-                    free(bmpData);
-                    return nullptr;
-                }
-                if (isGray) {
-                    grayIdxs[c.rgbRed] = (BYTE)k;
-                }
-                palette[k] = *(u32*)&c;
-            }
-            /* 8-bit data consists of indices into the color palette */
-            *dest++ = k;
-        }
-        dest += rows8 - w;
+    if (!bmi) {
+        return nullptr;
     }
-
+    int stride = ((w * bitCount + 31) / 32) * 4;
     BITMAPINFOHEADER* bmih = &bmi.Get()->bmiHeader;
     bmih->biSize = sizeof(*bmih);
     bmih->biWidth = w;
     bmih->biHeight = -h;
     bmih->biPlanes = 1;
     bmih->biCompression = BI_RGB;
-    bmih->biBitCount = 8;
-    bmih->biSizeImage = h * rows8;
+    bmih->biBitCount = bitCount;
+    bmih->biSizeImage = stride * h;
     bmih->biClrUsed = paletteSize;
+    if (paletteSize > 0) {
+        memcpy(bmi.Get()->bmiColors, palette, paletteSize * sizeof(u32));
+    }
+
+    *bitsOut = nullptr;
+    HANDLE hMap = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, bmih->biSizeImage, nullptr);
+    HBITMAP hbmp = CreateDIBSection(nullptr, bmi, DIB_RGB_COLORS, bitsOut, hMap, 0);
+    if (!hbmp || !*bitsOut) {
+        DeleteObject(hbmp);
+        if (hMap) {
+            CloseHandle(hMap);
+        }
+        return nullptr;
+    }
+    *hMapOut = hMap;
+    return hbmp;
+}
 
+// try to produce an 8-bit palette for saving some memory
+static RenderedBitmap* try_render_as_palette_image(const u8* bgra, int w, int h, int stride) {
+    int rows8 = ((w + 3) / 4) * 4;
+    ScopedMem<u8> idxs((u8*)malloc((size_t)rows8 * h));
+    if (!idxs) {
+        return nullptr;
+    }
+    u32 palette[256];
+    int paletteSize = PaletteFromBgrx(bgra, w, h, stride, idxs, rows8, palette);
+    if (paletteSize < 0) {
+        return nullptr;
+    }
+
+    HANDLE hMap = nullptr;
     void* data = nullptr;
-    HANDLE hMap = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, bmih->biSizeImage, nullptr);
-    HBITMAP hbmp = CreateDIBSection(nullptr, bmi, DIB_RGB_COLORS, &data, hMap, 0);
+    HBITMAP hbmp = CreateTopDownDib(w, h, 8, palette, paletteSize, &hMap, &data);
     if (!hbmp) {
-        free(bmpData);
         return nullptr;
     }
-    memcpy(data, bmpData, bmih->biSizeImage);
-    free(bmpData);
+    memcpy(data, idxs, (size_t)rows8 * h);
+    return new RenderedBitmap(hbmp, Size(w, h), hMap);
+}
+
+// creates a BGRA pixmap for the draw device to render into. If hbmpOut is given,
+// the samples are the memory of a 32bpp DIB section (returned in *hbmpOut and
+// *hMapOut, which the caller must free) so that the result can be used by GDI
+// without converting or copying it. Otherwise (or if the DIB section can't be
+// created) the pixmap owns its samples.
+fz_pixmap* fz_new_bgra_pixmap(fz_context* ctx, fz_irect bbox, HBITMAP* hbmpOut, HANDLE* hMapOut) {
+    int w = bbox.x1 - bbox.x0;
+    int h = bbox.y1 - bbox.y0;
+    void* data = nullptr;
+    HBITMAP hbmp = nullptr;
+    HANDLE hMap = nullptr;
+    if (hbmpOut && w > 0 && h > 0) {
+        hbmp = CreateTopDownDib(w, h, 32, nullptr, 0, &hMap, &data);
+    }
+    if (!hbmp) {
+        return fz_new_pixmap_with_bbox(ctx, fz_device_bgr(ctx), bbox, nullptr, 1);
+    }
+
+    fz_pixmap* pix = nullptr;
+    fz_try(ctx) {
+        // rows of a 32bpp DIB are w * 4 bytes, same as the pixmap's stride
+        pix = fz_new_pixmap_with_bbox_and_data(ctx, fz_device_bgr(ctx), bbox, nullptr, 1, (u8*)data);
+    }
+    fz_catch(ctx) {
+        DeleteObject(hbmp);
+        CloseHandle(hMap);
+        fz_rethrow(ctx);
+    }
+    *hbmpOut = hbmp;
+    *hMapOut = hMap;
+    return pix;
+}
+
+// creates a RenderedBitmap from a pixmap created with fz_new_bgra_pixmap.
+// Takes ownership of hbmp and hMap (which can be nullptr)
+RenderedBitmap* new_rendered_bgra_pixmap(fz_pixmap* pix, HBITMAP hbmp, HANDLE hMap) {
+    trace::Scope traceScope("new_rendered_bgra_pixmap");
+    int w = pix->w;
+    int h = pix->h;
+    RenderedBitmap* res = try_render_as_palette_image(pix->samples, w, h, (int)pix->stride);
+    if (res) {
+        DeleteObject(hbmp);
+        if (hMap) {
+            CloseHandle(hMap);
+        }
+        return res;
+    }
+    if (hbmp) {
+        return new RenderedBitmap(hbmp, Size(w, h), hMap);
+    }
+
+    void* data = nullptr;
+    hbmp = CreateTopDownDib(w, h, 32, nullptr, 0, &hMap, &data);
+    if (!hbmp) {
+        // return a RenderedBitmap even if hbmp is nullptr so that callers can
+        // distinguish rendering errors from GDI resource exhaustion
+        // (and in the latter case retry using smaller target rectangles)
+        return new RenderedBitmap(nullptr, Size(w, h));
+    }
+    memcpy(data, pix->samples, (size_t)pix->stride * h);
     return new RenderedBitmap(hbmp, Size(w, h), hMap);
 }
 
@@ -372,15 +420,11 @@ fz_pixmap* fz_convert_pixmap2(fz_context* ctx, fz_pixmap* pix, fz_colorspace* ds
 }
 
 RenderedBitmap* new_rendered_fz_pixmap(fz_context* ctx, fz_pixmap* pixmap) {
-    if (pixmap->n == 4 && fz_colorspace_is_rgb(ctx, pixmap->colorspace)) {
-        RenderedBitmap* res = try_render_as_palette_image(pixmap);
-        if (res) {
-            return res;
-        }
+    trace::Scope traceScope("new_rendered_fz_pixmap");
+    if (pixmap->n == 4 && pixmap->alpha && pixmap->colorspace == fz_device_bgr(ctx)) {
+        return new_rendered_bgra_pixmap(pixmap, nullptr, nullptr);
     }
 
-    ScopedMem<BITMAPINFO> bmi((BITMAPINFO*)calloc(1, sizeof(BITMAPINFO) + 255 * sizeof(RGBQUAD)));
-
     fz_pixmap* bgrPixmap = nullptr;
     fz_var(bgrPixmap);
 
@@ -395,43 +439,12 @@ RenderedBitmap* new_rendered_fz_pixmap(fz_context* ctx, fz_pixmap* pixmap) {
     }
 
     if (!bgrPixmap || !bgrPixmap->samples) {
+        fz_drop_pixmap(ctx, bgrPixmap);
         return nullptr;
     }
-
-    int w = bgrPixmap->w;
-    int h = bgrPixmap->h;
-    int n = bgrPixmap->n;
-    int imgSize = bgrPixmap->stride * h;
-    int bitsCount = n * 8;
-
-    BITMAPINFOHEADER* bmih = &bmi.Get()->bmiHeader;
-    bmih->biSize = sizeof(*bmih);
-    bmih->biWidth = w;
-    bmih->biHeight = -h;
-    bmih->biPlanes = 1;
-    bmih->biCompression = BI_RGB;
-    bmih->biBitCount = bitsCount;
-    bmih->biSizeImage = imgSize;
-    bmih->biClrUsed = 0;
-
-    void* data = nullptr;
-    HANDLE hFile = INVALID_HANDLE_VALUE;
-    DWORD fl = PAGE_READWRITE;
-    HANDLE hMap = CreateFileMappingW(hFile, nullptr, fl, 0, imgSize, nullptr);
-    uint usage = DIB_RGB_COLORS;
-    HBITMAP hbmp = CreateDIBSection(nullptr, bmi, usage, &data, hMap, 0);
-    if (data) {
-        u8* samples = bgrPixmap->samples;
-        memcpy(data, samples, imgSize);
-    }
+    RenderedBitmap* res = new_rendered_bgra_pixmap(bgrPixmap, nullptr, nullptr);
     fz_drop_pixmap(ctx, bgrPixmap);
-    if (!hbmp) {
-        return nullptr;
-    }
-    // return a RenderedBitmap even if hbmp is nullptr so that callers can
-    // distinguish rendering errors from GDI resource exhaustion
-    // (and in the latter case retry using smaller target rectangles)
-    return new RenderedBitmap(hbmp, Size(w, h), hMap);
+    return res;
 }
 
 static inline int wchars_per_rune(int rune) {
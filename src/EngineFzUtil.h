@@ -38,6 +38,9 @@ struct FzPageInfo {
     Vec<IPageElement*> comments;
 
     RectF mediabox{};
+    // if true, mediabox is a guess (copied from an earlier page)
+    // until the real size has been loaded
+    bool mediaboxEstimated{false};
     Vec<FitzImagePos> images;
 
     // if false, only loaded page (fast)
@@ -67,6 +70,8 @@ fz_stream* fz_open_file2(fz_context* ctx, const WCHAR* filePath);
 void fz_stream_fingerprint(fz_context* ctx, fz_stream* stm, u8 digest[16]);
 std::span<u8> fz_extract_stream_data(fz_context* ctx, fz_stream* stream);
 
+fz_pixmap* fz_new_bgra_pixmap(fz_context* ctx, fz_irect bbox, HBITMAP* hbmpOut, HANDLE* hMapOut);
+RenderedBitmap* new_rendered_bgra_pixmap(fz_pixmap* pix, HBITMAP hbmp, HANDLE hMap);
 RenderedBitmap* new_rendered_fz_pixmap(fz_context* ctx, fz_pixmap* pixmap);
 
 WCHAR* fz_text_page_to_str(fz_stext_page* text, Rect** coordsOut);
@@ -249,26 +249,13 @@ int EngineMulti::GetPageByLabel(const WCHAR* label) const {
     return -1;
 }
 
-static void CollectTocItemsRecur(TocItem* ti, Vec<TocItem*>& v) {
-    while (ti) {
-        v.Append(ti);
-        CollectTocItemsRecur(ti->child, v);
-        ti = ti->next;
-    }
-}
-
-static bool cmpByPageNo(TocItem* ti1, TocItem* ti2) {
-    return ti1->pageNo < ti2->pageNo;
-}
-
 void CalcEndPageNo(TocItem* root, int nPages) {
     Vec<TocItem*> tocItems;
-    CollectTocItemsRecur(root, tocItems);
+    SortTocItemsByPageNo(root, tocItems);
     size_t n = tocItems.size();
     if (n < 1) {
         return;
     }
-    std::sort(tocItems.begin(), tocItems.end(), cmpByPageNo);
     TocItem* prev = tocItems[0];
     for (size_t i = 1; i < n; i++) {
         TocItem* next = tocItems[i];
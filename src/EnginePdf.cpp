@@ -13,6 +13,8 @@ extern "C" {
 #include "utils/GuessFileType.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
+#include "utils/ThreadUtil.h"
+#include "utils/Trace.h"
 #include "utils/TrivialHtmlParser.h"
 #include "utils/WinUtil.h"
 #include "utils/ZipUtil.h"
@@ -25,6 +27,7 @@ extern "C" {
 #include "EngineFzUtil.h"
 #include "EnginePdfImpl.h"
 #include "EnginePdf.h"
+#include "ProgressUpdateUI.h"
 
 #include "utils/Log.h"
 
@@ -363,6 +366,18 @@ EnginePdf::EnginePdf() {
 }
 
 EnginePdf::~EnginePdf() {
+    EnginePdfWaitForSaves(this);
+    if (docInfoThread) {
+        docInfoThread->Join();
+        delete docInfoThread;
+        CloseHandle(docInfoLoadedEvent);
+    }
+    if (pageSizesThread) {
+        pageSizesThread->RequestCancel();
+        pageSizesThread->Join();
+        delete pageSizesThread;
+    }
+
     EnterCriticalSection(&pagesAccess);
 
     // TODO: remove this lock and see what happens
@@ -717,27 +732,120 @@ static bool IsLinearizedFile(EnginePdf* e) {
     return isLinear;
 }
 
-bool EnginePdf::FinishLoading() {
-    pageCount = 0;
+// for documents with at least that many pages, FinishLoading only loads
+// the size of the first page and uses it as estimate for the rest until
+// PdfPageSizesThread has determined them in the background (the pages
+// around the start page are determined by DisplayModel via PageMediabox)
+constexpr int kLazyPageSizesMinPages = 1024;
+// how many page sizes PdfPageSizesThread determines per ctxAccess lock
+constexpr int kPageSizesPerLock = 64;
+// min. time between two notifications about changed page sizes
+constexpr DWORD kPageSizesNotifyDelayMs = 250;
+
+// loads the size of the page with the 0-based index pageIdx without loading
+// the page (i.e. what pdf_bound_page does). ctxAccess must be held.
+static fz_rect LoadPdfPageMediabox(fz_context* ctx, pdf_document* doc, int pageIdx) {
+    fz_rect mbox{};
+    fz_matrix page_ctm{};
     fz_try(ctx) {
-        // this call might throw the first time
-        pageCount = fz_count_pages(ctx, _doc);
+        pdf_obj* pageref = pdf_lookup_page_obj(ctx, doc, pageIdx);
+        pdf_page_obj_transform(ctx, pageref, &mbox, &page_ctm);
+        mbox = fz_transform_rect(mbox, page_ctm);
     }
     fz_catch(ctx) {
-        return false;
     }
-    if (pageCount == 0) {
-        fz_warn(ctx, "document has no pages");
-        return false;
+    if (fz_is_empty_rect(mbox)) {
+        fz_warn(ctx, "cannot find page size for page %d", pageIdx);
+        mbox.x0 = 0;
+        mbox.y0 = 0;
+        mbox.x1 = 612;
+        mbox.y1 = 792;
     }
+    return mbox;
+}
 
-    pdf_document* doc = (pdf_document*)_doc;
+class PdfPageSizesThread : public ThreadBase {
+    EnginePdf* engine;
 
-    preferredLayout = GetPreferredLayout(ctx, doc);
-    allowsPrinting = fz_has_permission(ctx, _doc, FZ_PERMISSION_PRINT);
-    allowsCopyingText = fz_has_permission(ctx, _doc, FZ_PERMISSION_COPY);
+  public:
+    explicit PdfPageSizesThread(EnginePdf* engine) : ThreadBase("PdfPageSizesThread"), engine(engine) {
+    }
+    ~PdfPageSizesThread() override = default;
 
-    ScopedCritSec scope(ctxAccess);
+    void Run() override {
+        fz_context* ctx = engine->ctx;
+        pdf_document* doc = pdf_document_from_fz_document(ctx, engine->_doc);
+        int pageCount = engine->pageCount;
+
+        fz_rect mboxes[kPageSizesPerLock];
+        bool changed = false;
+        DWORD lastNotify = GetTickCount();
+        for (int start = 1; start < pageCount; start += kPageSizesPerLock) {
+            if (WasCancelRequested()) {
+                return;
+            }
+            int n = std::min(kPageSizesPerLock, pageCount - start);
+            // only hold ctxAccess briefly so that rendering isn't blocked
+            // (and never ask for pagesAccess while holding it)
+            {
+                ScopedCritSec scope(engine->ctxAccess);
+                for (int i = 0; i < n; i++) {
+                    mboxes[i] = LoadPdfPageMediabox(ctx, doc, start + i);
+                }
+            }
+
+            ScopedCritSec scope(&engine->pagesAccess);
+            int nChanged = engine->changedPageSizes.isize();
+            for (int i = 0; i < n; i++) {
+                FzPageInfo* pageInfo = &engine->_pages[start + i];
+                // (unless already loaded by PageMediabox)
+                if (pageInfo->mediaboxEstimated) {
+                    engine->SetRealPageSize(pageInfo, ToRectFl(mboxes[i]));
+                }
+            }
+            changed |= engine->changedPageSizes.isize() > nChanged;
+            if (changed && GetTickCount() - lastNotify >= kPageSizesNotifyDelayMs) {
+                engine->NotifyPageSizesChanged();
+                changed = false;
+                lastNotify = GetTickCount();
+            }
+        }
+
+        if (changed) {
+            ScopedCritSec scope(&engine->pagesAccess);
+            engine->NotifyPageSizesChanged();
+        }
+        if (WasCancelRequested()) {
+            return;
+        }
+
+        // the page tree speeds up looking up page numbers for links
+        ScopedCritSec scope(engine->ctxAccess);
+        fz_try(ctx) {
+            pdf_load_page_tree(ctx, doc);
+        }
+        fz_catch(ctx) {
+            fz_warn(ctx, "pdf_load_page_tree() failed");
+        }
+    }
+};
+
+class PdfDocInfoThread : public ThreadBase {
+    EnginePdf* engine;
+
+  public:
+    explicit PdfDocInfoThread(EnginePdf* engine) : ThreadBase("PdfDocInfoThread"), engine(engine) {
+    }
+    ~PdfDocInfoThread() override = default;
+
+    void Run() override {
+        engine->LoadDocInfo();
+    }
+};
+
+// loads the sizes of all pages. ctxAccess must be held.
+bool EnginePdf::LoadPageSizes() {
+    pdf_document* doc = pdf_document_from_fz_document(ctx, _doc);
 
     bool loadPageTreeFailed = false;
     fz_try(ctx) {
@@ -807,90 +915,185 @@ bool EnginePdf::FinishLoading() {
         }
     }
 
+    return true;
+}
+
+bool EnginePdf::FinishLoading() {
+    pageCount = 0;
     fz_try(ctx) {
-        outline = fz_load_outline(ctx, _doc);
+        // this call might throw the first time
+        pageCount = fz_count_pages(ctx, _doc);
     }
     fz_catch(ctx) {
-        // ignore errors from pdf_load_outline()
-        // this information is not critical and checking the
-        // error might prevent loading some pdfs that would
-        // otherwise get displayed
-        fz_warn(ctx, "Couldn't load outline");
+        return false;
+    }
+    if (pageCount == 0) {
+        fz_warn(ctx, "document has no pages");
+        return false;
     }
 
-    fz_try(ctx) {
-        attachments = pdf_load_attachments(ctx, doc);
+    pdf_document* doc = (pdf_document*)_doc;
+
+    preferredLayout = GetPreferredLayout(ctx, doc);
+    allowsPrinting = fz_has_permission(ctx, _doc, FZ_PERMISSION_PRINT);
+    allowsCopyingText = fz_has_permission(ctx, _doc, FZ_PERMISSION_COPY);
+
+    ScopedCritSec scope(ctxAccess);
+
+    if (pageCount >= kLazyPageSizesMinPages) {
+        // loading the page tree and the sizes of all pages is slow for huge
+        // documents, so only determine the first one and estimate the rest
+        _pages.AppendBlanks(pageCount);
+        RectF mbox = ToRectFl(LoadPdfPageMediabox(ctx, doc, 0));
+        for (int i = 0; i < pageCount; i++) {
+            FzPageInfo* pageInfo = &_pages[i];
+            pageInfo->pageNo = i + 1;
+            pageInfo->mediaboxEstimated = i > 0;
+            pageInfo->mediabox = mbox;
+        }
+        pageSizesThread = new PdfPageSizesThread(this);
+        pageSizesThread->Start();
+    } else if (!LoadPageSizes()) {
+        return false;
     }
-    fz_catch(ctx) {
-        fz_warn(ctx, "Couldn't load attachments");
+
+    docInfoLoadedEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    docInfoThread = new PdfDocInfoThread(this);
+    docInfoThread->Start();
+
+    // TODO: support javascript
+    CrashIf(pdf_js_supported(ctx, doc));
+
+    return true;
+}
+
+// loads the data not needed for displaying pages (outline, attachments,
+// properties and page labels) on PdfDocInfoThread. ctxAccess is only held
+// for one step at a time so that rendering the first pages isn't blocked
+void EnginePdf::LoadDocInfo() {
+    pdf_document* doc = pdf_document_from_fz_document(ctx, _doc);
+
+    {
+        ScopedCritSec scope(ctxAccess);
+        fz_try(ctx) {
+            outline = fz_load_outline(ctx, _doc);
+        }
+        fz_catch(ctx) {
+            // ignore errors from pdf_load_outline()
+            // this information is not critical and checking the
+            // error might prevent loading some pdfs that would
+            // otherwise get displayed
+            fz_warn(ctx, "Couldn't load outline");
+        }
     }
 
-    pdf_obj* orig_info = nullptr;
-    fz_try(ctx) {
-        // keep a copy of the Info dictionary, as accessing the original
-        // isn't thread safe and we don't want to block for this when
-        // displaying document properties
-        orig_info = pdf_dict_gets(ctx, pdf_trailer(ctx, doc), "Info");
-
-        if (orig_info) {
-            _info = pdf_copy_str_dict(ctx, doc, orig_info);
-        }
-        if (!_info) {
-            _info = pdf_new_dict(ctx, doc, 4);
-        }
-        // also remember linearization and tagged states at this point
-        if (IsLinearizedFile(this)) {
-            pdf_dict_puts_drop(ctx, _info, "Linearized", PDF_TRUE);
-        }
-        pdf_obj* trailer = pdf_trailer(ctx, doc);
-        pdf_obj* marked = pdf_dict_getp(ctx, trailer, "Root/MarkInfo/Marked");
-        bool isMarked = pdf_to_bool(ctx, marked);
-        if (isMarked) {
-            pdf_dict_puts_drop(ctx, _info, "Marked", PDF_TRUE);
-        }
-        // also remember known output intents (PDF/X, etc.)
-        pdf_obj* intents = pdf_dict_getp(ctx, trailer, "Root/OutputIntents");
-        if (pdf_is_array(ctx, intents)) {
-            int n = pdf_array_len(ctx, intents);
-            pdf_obj* list = pdf_new_array(ctx, doc, n);
-            for (int i = 0; i < n; i++) {
-                pdf_obj* intent = pdf_dict_gets(ctx, pdf_array_get(ctx, intents, i), "S");
-                if (pdf_is_name(ctx, intent) && !pdf_is_indirect(ctx, intent) &&
-                    str::StartsWith(pdf_to_name(ctx, intent), "GTS_PDF")) {
-                    pdf_array_push(ctx, list, intent);
+    {
+        ScopedCritSec scope(ctxAccess);
+        fz_try(ctx) {
+            attachments = pdf_load_attachments(ctx, doc);
+        }
+        fz_catch(ctx) {
+            fz_warn(ctx, "Couldn't load attachments");
+        }
+    }
+
+    {
+        ScopedCritSec scope(ctxAccess);
+        pdf_obj* orig_info = nullptr;
+        fz_try(ctx) {
+            // keep a copy of the Info dictionary, as accessing the original
+            // isn't thread safe and we don't want to block for this when
+            // displaying document properties
+            orig_info = pdf_dict_gets(ctx, pdf_trailer(ctx, doc), "Info");
+
+            if (orig_info) {
+                _info = pdf_copy_str_dict(ctx, doc, orig_info);
+            }
+            if (!_info) {
+                _info = pdf_new_dict(ctx, doc, 4);
+            }
+            // also remember linearization and tagged states at this point
+            if (IsLinearizedFile(this)) {
+                pdf_dict_puts_drop(ctx, _info, "Linearized", PDF_TRUE);
+            }
+            pdf_obj* trailer = pdf_trailer(ctx, doc);
+            pdf_obj* marked = pdf_dict_getp(ctx, trailer, "Root/MarkInfo/Marked");
+            bool isMarked = pdf_to_bool(ctx, marked);
+            if (isMarked) {
+                pdf_dict_puts_drop(ctx, _info, "Marked", PDF_TRUE);
+            }
+            // also remember known output intents (PDF/X, etc.)
+            pdf_obj* intents = pdf_dict_getp(ctx, trailer, "Root/OutputIntents");
+            if (pdf_is_array(ctx, intents)) {
+                int n = pdf_array_len(ctx, intents);
+                pdf_obj* list = pdf_new_array(ctx, doc, n);
+                for (int i = 0; i < n; i++) {
+                    pdf_obj* intent = pdf_dict_gets(ctx, pdf_array_get(ctx, intents, i), "S");
+                    if (pdf_is_name(ctx, intent) && !pdf_is_indirect(ctx, intent) &&
+                        str::StartsWith(pdf_to_name(ctx, intent), "GTS_PDF")) {
+                        pdf_array_push(ctx, list, intent);
+                    }
                 }
+                pdf_dict_puts_drop(ctx, _info, "OutputIntents", list);
+            }
+            // also note common unsupported features (such as XFA forms)
+            pdf_obj* xfa = pdf_dict_getp(ctx, pdf_trailer(ctx, doc), "Root/AcroForm/XFA");
+            if (pdf_is_array(ctx, xfa)) {
+                pdf_dict_puts_drop(ctx, _info, "Unsupported_XFA", PDF_TRUE);
             }
-            pdf_dict_puts_drop(ctx, _info, "OutputIntents", list);
         }
-        // also note common unsupported features (such as XFA forms)
-        pdf_obj* xfa = pdf_dict_getp(ctx, pdf_trailer(ctx, doc), "Root/AcroForm/XFA");
-        if (pdf_is_array(ctx, xfa)) {
-            pdf_dict_puts_drop(ctx, _info, "Unsupported_XFA", PDF_TRUE);
+        fz_catch(ctx) {
+            fz_warn(ctx, "Couldn't load document properties");
+            pdf_drop_obj(ctx, _info);
+            _info = nullptr;
         }
     }
-    fz_catch(ctx) {
-        fz_warn(ctx, "Couldn't load document properties");
-        pdf_drop_obj(ctx, _info);
-        _info = nullptr;
-    }
 
-    fz_try(ctx) {
-        pdf_obj* pageLabels = pdf_dict_getp(ctx, pdf_trailer(ctx, doc), "Root/PageLabels");
-        if (pageLabels) {
-            _pageLabels = BuildPageLabelVec(ctx, pageLabels, PageCount());
+    {
+        ScopedCritSec scope(ctxAccess);
+        fz_try(ctx) {
+            pdf_obj* pageLabels = pdf_dict_getp(ctx, pdf_trailer(ctx, doc), "Root/PageLabels");
+            if (pageLabels) {
+                _pageLabels = BuildPageLabelVec(ctx, pageLabels, PageCount());
+            }
+        }
+        fz_catch(ctx) {
+            fz_warn(ctx, "Couldn't load page labels");
         }
     }
-    fz_catch(ctx) {
-        fz_warn(ctx, "Couldn't load page labels");
-    }
+
+    ScopedCritSec scope(&pagesAccess);
     if (_pageLabels) {
         hasPageLabels = true;
     }
+    SetEvent(docInfoLoadedEvent);
+    if (onDocInfoLoaded) {
+        onDocInfoLoaded();
+    }
+}
 
-    // TODO: support javascript
-    CrashIf(pdf_js_supported(ctx, doc));
+// blocks until PdfDocInfoThread is done
+void EnginePdf::WaitForDocInfo() const {
+    if (docInfoLoadedEvent) {
+        WaitForSingleObject(docInfoLoadedEvent, INFINITE);
+    }
+}
 
-    return true;
+bool EnginePdf::IsDocInfoLoaded() {
+    if (!docInfoLoadedEvent) {
+        return true;
+    }
+    return WaitForSingleObject(docInfoLoadedEvent, 0) == WAIT_OBJECT_0;
+}
+
+void EnginePdf::SetDocInfoLoadedCb(const std::function<void()>& cb) {
+    ScopedCritSec scope(&pagesAccess);
+    onDocInfoLoaded = cb;
+}
+
+bool EnginePdf::HasPageLabels() const {
+    WaitForDocInfo();
+    return hasPageLabels;
 }
 
 PageDestination* destFromAttachment(EnginePdf* engine, fz_outline* outline) {
@@ -967,6 +1170,7 @@ TocItem* EnginePdf::BuildTocTree(TocItem* parent, fz_outline* outline, int& idCo
 
 // TODO: maybe build in FinishLoading
 TocTree* EnginePdf::GetToc() {
+    WaitForDocInfo();
     if (tocTree) {
         return tocTree;
     }
@@ -1212,10 +1416,71 @@ FzPageInfo* EnginePdf::GetFzPageInfo(int pageNo, bool loadQuick) {
 }
 
 RectF EnginePdf::PageMediabox(int pageNo) {
+    EnterCriticalSection(&pagesAccess);
     FzPageInfo* pi = &_pages[pageNo - 1];
+    RectF mbox = pi->mediabox;
+    bool isEstimate = pi->mediaboxEstimated;
+    LeaveCriticalSection(&pagesAccess);
+    if (!isEstimate) {
+        return mbox;
+    }
+
+    // don't wait for PdfPageSizesThread
+    fz_rect rect;
+    {
+        ScopedCritSec scope(ctxAccess);
+        pdf_document* doc = pdf_document_from_fz_document(ctx, _doc);
+        rect = LoadPdfPageMediabox(ctx, doc, pageNo - 1);
+    }
+    mbox = ToRectFl(rect);
+
+    ScopedCritSec scope(&pagesAccess);
+    if (pi->mediaboxEstimated) {
+        int nChanged = changedPageSizes.isize();
+        SetRealPageSize(pi, mbox);
+        if (changedPageSizes.isize() > nChanged) {
+            NotifyPageSizesChanged();
+        }
+    }
     return pi->mediabox;
 }
 
+RectF EnginePdf::PageMediaboxEstimate(int pageNo) {
+    ScopedCritSec scope(&pagesAccess);
+    return _pages[pageNo - 1].mediabox;
+}
+
+void EnginePdf::SetPageSizesChangedCb(const std::function<void()>& cb) {
+    ScopedCritSec scope(&pagesAccess);
+    onPageSizesChanged = cb;
+}
+
+void EnginePdf::TakeChangedPageSizes(Vec<int>* pageNos, Vec<RectF>* sizes) {
+    ScopedCritSec scope(&pagesAccess);
+    for (int pageNo : changedPageSizes) {
+        pageNos->Append(pageNo);
+        sizes->Append(_pages[pageNo - 1].mediabox);
+    }
+    changedPageSizes.Reset();
+}
+
+// replaces the estimated size of a page. must be called with pagesAccess held
+void EnginePdf::SetRealPageSize(FzPageInfo* pageInfo, RectF mbox) {
+    CrashIf(!pageInfo->mediaboxEstimated);
+    pageInfo->mediaboxEstimated = false;
+    if (mbox != pageInfo->mediabox) {
+        pageInfo->mediabox = mbox;
+        changedPageSizes.Append(pageInfo->pageNo);
+    }
+}
+
+// must be called with pagesAccess held
+void EnginePdf::NotifyPageSizesChanged() {
+    if (onPageSizesChanged) {
+        onPageSizesChanged();
+    }
+}
+
 RectF EnginePdf::PageContentBox(int pageNo, RenderTarget target) {
     FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false);
     if (!pageInfo) {
@@ -1239,6 +1504,7 @@ RectF EnginePdf::PageContentBox(int pageNo, RenderTarget target) {
 
     RectF mediabox = pageInfo->mediabox;
 
+    trace::Scope traceScope("EnginePdf: display list", pageNo);
     fz_try(ctx) {
         list = fz_new_display_list_from_page(ctx, pageInfo->page);
         if (list) {
@@ -1326,17 +1592,20 @@ RenderedBitmap* EnginePdf::RenderPage(RenderPageArgs& args) {
     fz_matrix ctm = viewctm(page, zoom, rotation);
     fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
 
-    fz_colorspace* colorspace = fz_device_rgb(ctx);
     fz_irect ibounds = bbox;
     fz_rect cliprect = fz_rect_from_irect(bbox);
 
     fz_pixmap* pix = nullptr;
     fz_device* dev = nullptr;
     RenderedBitmap* bitmap = nullptr;
+    HBITMAP hbmp = nullptr;
+    HANDLE hMap = nullptr;
 
     fz_var(dev);
     fz_var(pix);
     fz_var(bitmap);
+    fz_var(hbmp);
+    fz_var(hMap);
 
     const char* usage = "View";
     switch (args.target) {
@@ -1345,8 +1614,10 @@ RenderedBitmap* EnginePdf::RenderPage(RenderPageArgs& args) {
             break;
     }
 
+    trace::Scope traceScope("EnginePdf::RenderPage", pageNo);
     fz_try(ctx) {
-        pix = fz_new_pixmap_with_bbox(ctx, colorspace, ibounds, nullptr, 1);
+        // render straight into the memory of the DIB section that ends up in the RenderedBitmap
+        pix = fz_new_bgra_pixmap(ctx, ibounds, &hbmp, &hMap);
         // initialize with white background
         fz_clear_pixmap_with_value(ctx, pix, 0xff);
         // TODO: in printing different style. old code use pdf_run_page_with_usage(), with usage ="View"
@@ -1354,8 +1625,10 @@ RenderedBitmap* EnginePdf::RenderPage(RenderPageArgs& args) {
         dev = fz_new_draw_device(ctx, fz_identity, pix);
         pdf_document* doc = pdf_document_from_fz_document(ctx, _doc);
         pdf_run_page_with_usage(ctx, pdfpage, dev, ctm, usage, fzcookie);
-        bitmap = new_rendered_fz_pixmap(ctx, pix);
         fz_close_device(ctx, dev);
+        bitmap = new_rendered_bgra_pixmap(pix, hbmp, hMap);
+        hbmp = nullptr;
+        hMap = nullptr;
     }
     fz_always(ctx) {
         if (dev) {
@@ -1364,6 +1637,10 @@ RenderedBitmap* EnginePdf::RenderPage(RenderPageArgs& args) {
         fz_drop_pixmap(ctx, pix);
     }
     fz_catch(ctx) {
+        DeleteObject(hbmp);
+        if (hMap) {
+            CloseHandle(hMap);
+        }
         delete bitmap;
         return nullptr;
     }
@@ -1643,6 +1920,7 @@ WCHAR* EnginePdf::GetProperty(DocumentProperty prop) {
     if (!_doc) {
         return nullptr;
     }
+    WaitForDocInfo();
 
     pdf_document* doc = pdf_document_from_fz_document(ctx, _doc);
 
@@ -1782,11 +2060,298 @@ const pdf_write_options pdf_default_write_options2 = {
     "", /* upwd_utf8[128] */
 };
 
+// fz_output collecting the saved document in memory while ctxAccess is held.
+// The first base bytes are already in fp (the copy of the original for
+// incremental saves), data holds everything mupdf writes after them and is
+// written to fp by PdfSaveOutputWriteToFile() once ctxAccess has been released
+struct PdfSaveOutput {
+    FILE* fp = nullptr;
+    i64 base = 0;
+    i64 pos = 0;
+    str::Str data;
+    ProgressUpdateUI* progressUI = nullptr;
+};
+
+static void PdfSaveOutputWrite(fz_context* ctx, void* opaque, const void* data, size_t n) {
+    PdfSaveOutput* so = (PdfSaveOutput*)opaque;
+    if (so->progressUI && so->progressUI->WasCanceled()) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "saving was canceled");
+    }
+    if (so->pos < so->base) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "cannot overwrite the copy of the original");
+    }
+    size_t off = (size_t)(so->pos - so->base);
+    while (so->data.size() < off) {
+        so->data.AppendChar(0);
+    }
+    size_t nOverwrite = std::min(n, so->data.size() - off);
+    memcpy(so->data.Get() + off, data, nOverwrite);
+    so->data.Append((const char*)data + nOverwrite, n - nOverwrite);
+    so->pos += (i64)n;
+}
+
+static void PdfSaveOutputSeek(fz_context* ctx, void* opaque, i64 off, int whence) {
+    PdfSaveOutput* so = (PdfSaveOutput*)opaque;
+    i64 pos = off;
+    if (whence == SEEK_CUR) {
+        pos += so->pos;
+    } else if (whence == SEEK_END) {
+        pos += so->base + (i64)so->data.size();
+    }
+    if (pos < 0) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "cannot seek to %lld", pos);
+    }
+    so->pos = pos;
+}
+
+static i64 PdfSaveOutputTell(__unused fz_context* ctx, void* opaque) {
+    PdfSaveOutput* so = (PdfSaveOutput*)opaque;
+    return so->pos;
+}
+
+static void PdfSaveOutputTruncate(__unused fz_context* ctx, void* opaque) {
+    PdfSaveOutput* so = (PdfSaveOutput*)opaque;
+    i64 len = std::max(so->pos - so->base, (i64)0);
+    if (len < (i64)so->data.size()) {
+        so->data.RemoveAt((size_t)len, so->data.size() - (size_t)len);
+    }
+}
+
+// writes data after the first base bytes of fp and truncates the file there
+static bool PdfSaveOutputWriteToFile(PdfSaveOutput* so, ProgressUpdateUI* progressUI) {
+    if (_fseeki64(so->fp, so->base, SEEK_SET) < 0) {
+        return false;
+    }
+    const size_t kChunkSize = 256 * 1024;
+    size_t total = so->data.size();
+    int lastPercent = -1;
+    for (size_t off = 0; off < total; off += kChunkSize) {
+        if (progressUI && progressUI->WasCanceled()) {
+            return false;
+        }
+        size_t n = std::min(kChunkSize, total - off);
+        if (fwrite(so->data.Get() + off, 1, n, so->fp) != n) {
+            return false;
+        }
+        int percent = (int)((off + n) * 100 / total);
+        if (progressUI && percent != lastPercent) {
+            lastPercent = percent;
+            progressUI->UpdateProgress(percent, 100);
+        }
+    }
+    return fflush(so->fp) == 0 && _chsize_s(_fileno(so->fp), so->base + (i64)total) == 0;
+}
+
+// mupdf reads back what has been written for verifying the copy of
+// the original for incremental saves and for signing
+static fz_stream* PdfSaveOutputAsStream(fz_context* ctx, void* opaque) {
+    PdfSaveOutput* so = (PdfSaveOutput*)opaque;
+    if (!PdfSaveOutputWriteToFile(so, nullptr)) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "cannot write: %s", strerror(errno));
+    }
+    return fz_open_file_ptr_no_close(ctx, so->fp);
+}
+
+static bool FlushAndCloseFile(FILE* fp) {
+    bool ok = fflush(fp) == 0;
+    // make sure the data is on disk before it replaces the original
+    HANDLE h = (HANDLE)_get_osfhandle(_fileno(fp));
+    ok = ok && FlushFileBuffers(h);
+    return (fclose(fp) == 0) && ok;
+}
+
+// appends the content of srcPath after offset off to dstPath,
+// which must be off bytes long. The tail is copied in chunks so that
+// it never has to be in memory as a whole. If anything fails, dstPath
+// is truncated back to its original size.
+static bool AppendFileTail(const WCHAR* dstPath, const WCHAR* srcPath, i64 off) {
+    constexpr DWORD kChunkSize = 256 * 1024;
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE;
+    AutoCloseHandle hSrc = CreateFileW(srcPath, GENERIC_READ, share, nullptr, OPEN_EXISTING,
+                                       FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (!hSrc.IsValid()) {
+        return false;
+    }
+    LARGE_INTEGER size{};
+    LARGE_INTEGER pos{};
+    pos.QuadPart = off;
+    if (!GetFileSizeEx(hSrc, &size) || size.QuadPart < off || !SetFilePointerEx(hSrc, pos, nullptr, FILE_BEGIN)) {
+        return false;
+    }
+    i64 left = size.QuadPart - off;
+
+    AutoCloseHandle h =
+        CreateFileW(dstPath, GENERIC_WRITE, share, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (!h.IsValid()) {
+        return false;
+    }
+    if (!GetFileSizeEx(h, &size) || size.QuadPart != off) {
+        // the file has been modified since it's been loaded
+        return false;
+    }
+    if (!SetFilePointerEx(h, pos, nullptr, FILE_BEGIN)) {
+        return false;
+    }
+
+    ScopedMem<u8> buf(AllocArray<u8>(kChunkSize));
+    bool ok = buf.Get() != nullptr;
+    while (ok && left > 0) {
+        DWORD toCopy = (DWORD)std::min(left, (i64)kChunkSize);
+        DWORD nRead = 0;
+        DWORD nWritten = 0;
+        ok = ReadFile(hSrc, buf.Get(), toCopy, &nRead, nullptr) && nRead == toCopy;
+        ok = ok && WriteFile(h, buf.Get(), toCopy, &nWritten, nullptr) && nWritten == toCopy;
+        left -= toCopy;
+    }
+    ok = ok && FlushFileBuffers(h);
+    if (!ok) {
+        // don't leave a partial update behind
+        if (SetFilePointerEx(h, pos, nullptr, FILE_BEGIN) && SetEndOfFile(h)) {
+            FlushFileBuffers(h);
+        }
+    }
+    return ok;
+}
+
+// saves the document to path (or the file it was loaded from if path is nullptr)
+// without ever leaving a partially written file behind: the data is written to
+// a temporary file which then atomically replaces the destination.
+// ctxAccess is only held while mupdf serializes the document into memory, the
+// data is written to disk afterwards. For incremental saves, the original is
+// copied to the temporary file first so that only the changed objects have
+// to be kept in memory.
+static bool SavePdfDocument(EnginePdf* engine, const char* path, ProgressUpdateUI* progressUI, str::Str& errOut) {
+    fz_context* ctx = engine->ctx;
+    pdf_document* doc = pdf_document_from_fz_document(ctx, engine->_doc);
+    const WCHAR* srcPath = engine->FileName();
+    AutoFreeWstr dstPath = path ? strconv::Utf8ToWstr(path) : str::Dup(srcPath);
+    AutoFreeWstr tmpPath = str::Join(dstPath, L".tmp");
+
+    pdf_write_options opts{};
+    opts = pdf_default_write_options2;
+    opts.do_compress = 1;
+    opts.do_compress_images = 1;
+    opts.do_compress_fonts = 1;
+    i64 srcSize = 0;
+    {
+        ScopedCritSec scope(engine->ctxAccess);
+        opts.do_incremental = pdf_can_be_saved_incrementally(ctx, doc);
+        if (doc->redacted) {
+            opts.do_garbage = 1;
+        }
+        srcSize = doc->file_size;
+    }
+
+    // mupdf only has to verify the copy instead of writing it
+    bool hasCopy = opts.do_incremental && srcPath && file::Copy(tmpPath, srcPath, false);
+    FILE* fp = _wfopen(tmpPath, hasCopy ? L"r+b" : L"w+b");
+    if (!fp) {
+        errOut.AppendFmt("cannot create '%s'", ToUtf8Temp(tmpPath).Get());
+        return false;
+    }
+
+    PdfSaveOutput so;
+    so.fp = fp;
+    so.base = hasCopy ? srcSize : 0;
+    so.progressUI = progressUI;
+
+    bool ok = false;
+    {
+        ScopedCritSec scope(engine->ctxAccess);
+        fz_output* out = nullptr;
+        fz_var(out);
+        fz_try(ctx) {
+            out = fz_new_output(ctx, 8192, &so, PdfSaveOutputWrite, nullptr, nullptr);
+            out->seek = PdfSaveOutputSeek;
+            out->tell = PdfSaveOutputTell;
+            out->as_stream = PdfSaveOutputAsStream;
+            out->truncate = PdfSaveOutputTruncate;
+            pdf_write_document(ctx, doc, out, &opts);
+            fz_close_output(ctx, out);
+            ok = true;
+        }
+        fz_always(ctx) {
+            fz_drop_output(ctx, out);
+        }
+        fz_catch(ctx) {
+            errOut.Append(fz_caught_message(ctx));
+        }
+    }
+
+    if (ok && !PdfSaveOutputWriteToFile(&so, progressUI)) {
+        bool wasCanceled = progressUI && progressUI->WasCanceled();
+        errOut.Append(wasCanceled ? "saving was canceled" : "cannot write the saved document");
+        ok = false;
+    }
+    ok = FlushAndCloseFile(fp) && ok;
+    if (ok) {
+        ok = MoveFileExW(tmpPath, dstPath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+        if (!ok && opts.do_incremental && str::Eq(dstPath, srcPath)) {
+            // the original can't be replaced while it's open (i.e. when it
+            // hasn't been loaded into memory), so append the update instead
+            ok = AppendFileTail(dstPath, tmpPath, srcSize);
+        }
+        if (!ok) {
+            errOut.AppendFmt("cannot replace '%s'", ToUtf8Temp(dstPath).Get());
+        }
+    }
+    file::Delete(tmpPath);
+    return ok;
+}
+
+struct PdfSaveRequest {
+    char* path = nullptr;
+    ProgressUpdateUI* progressUI = nullptr;
+    PdfSaveDoneCb onDone;
+
+    ~PdfSaveRequest() {
+        free(path);
+    }
+};
+
+// executes the queued save requests of a document one after the other
+class PdfSaveThread : public ThreadBase {
+  public:
+    EnginePdf* engine;
+    // protects queue and isDone
+    Mutex mutex;
+    Vec<PdfSaveRequest*> queue;
+    bool isDone = false;
+
+    explicit PdfSaveThread(EnginePdf* engine) : ThreadBase("PdfSaveThread"), engine(engine) {
+    }
+    ~PdfSaveThread() override = default;
+
+    void Run() override {
+        for (;;) {
+            mutex.Lock();
+            if (queue.size() == 0) {
+                isDone = true;
+                mutex.Unlock();
+                return;
+            }
+            PdfSaveRequest* req = queue.PopAt(0);
+            mutex.Unlock();
+
+            str::Str err;
+            bool ok = SavePdfDocument(engine, req->path, req->progressUI, err);
+            if (ok) {
+                logf("Saved annotations to '%s'\n", req->path ? req->path : ToUtf8Temp(engine->FileName()).Get());
+            } else {
+                logf("Saving annotations failed with: '%s'\n", err.Get());
+            }
+            if (req->onDone) {
+                req->onDone(ok ? PdfSaveStatus::Saved : PdfSaveStatus::Failed, err.AsView());
+            }
+            delete req;
+        }
+    }
+};
+
 // re-save current pdf document using mupdf (as opposed to just saving the data)
 // this is used after the PDF was modified by the user (e.g. by adding / changing
 // annotations).
 // if filePath is not given, we save under the same name
-// TODO: if the file is locked, this might fail.
 bool EnginePdfSaveUpdated(EngineBase* engine, std::string_view path,
                           std::function<void(std::string_view)> showErrorFunc) {
     CrashIf(!engine);
@@ -1794,37 +2359,81 @@ bool EnginePdfSaveUpdated(EngineBase* engine, std::string_view path,
         return false;
     }
     EnginePdf* enginePdf = (EnginePdf*)engine;
-    TempStr currPath = ToUtf8Temp(engine->FileName());
-    if (path.empty()) {
-        path = {currPath.Get()};
+    // a pending background save would overwrite this one
+    EnginePdfWaitForSaves(engine);
+
+    str::Str err;
+    bool ok = SavePdfDocument(enginePdf, path.empty() ? nullptr : path.data(), nullptr, err);
+    if (!ok && showErrorFunc) {
+        showErrorFunc(err.AsView());
     }
-    fz_context* ctx = enginePdf->ctx;
-    pdf_document* doc = pdf_document_from_fz_document(ctx, enginePdf->_doc);
+    return ok;
+}
 
-    pdf_write_options save_opts{};
-    save_opts = pdf_default_write_options2;
-    save_opts.do_incremental = pdf_can_be_saved_incrementally(ctx, doc);
-    save_opts.do_compress = 1;
-    save_opts.do_compress_images = 1;
-    save_opts.do_compress_fonts = 1;
-    if (doc->redacted) {
-        save_opts.do_garbage = 1;
+// like EnginePdfSaveUpdated but saves on a background thread. progressUI (can
+// be nullptr) is updated from that thread and can cancel the save. onDone is
+// called on that thread once saving has finished.
+// A request for the same path as the last one still waiting for an earlier
+// save to finish replaces it (as it'd save the same changes). The superseded
+// request's onDone is then called on the calling thread with PdfSaveStatus::Superseded.
+void EnginePdfSaveUpdatedAsync(EngineBase* engine, std::string_view path, ProgressUpdateUI* progressUI,
+                               const PdfSaveDoneCb& onDone) {
+    EnginePdf* enginePdf = AsEnginePdf(engine);
+    CrashIf(!enginePdf);
+
+    auto req = new PdfSaveRequest();
+    req->path = path.empty() ? nullptr : str::Dup(path);
+    req->progressUI = progressUI;
+    req->onDone = onDone;
+
+    PdfSaveThread* thread = enginePdf->saveThread;
+    if (thread) {
+        thread->mutex.Lock();
+        if (!thread->isDone) {
+            PdfSaveRequest* superseded = nullptr;
+            int n = thread->queue.isize();
+            if (n > 0 && str::Eq(thread->queue.at(n - 1)->path, req->path)) {
+                superseded = thread->queue.Pop();
+            }
+            thread->queue.Append(req);
+            thread->mutex.Unlock();
+            if (superseded && superseded->onDone) {
+                superseded->onDone(PdfSaveStatus::Superseded, {});
+            }
+            delete superseded;
+            return;
+        }
+        thread->mutex.Unlock();
+        thread->Join();
+        delete thread;
     }
 
-    bool ok = false;
-    fz_try(ctx) {
-        pdf_save_document(ctx, doc, path.data(), &save_opts);
-        ok = true;
-        logf("Saved annotations to '%s'\n", path.data());
+    thread = new PdfSaveThread(enginePdf);
+    thread->queue.Append(req);
+    enginePdf->saveThread = thread;
+    thread->Start();
+}
+
+bool EnginePdfIsSaving(EngineBase* engine) {
+    EnginePdf* enginePdf = AsEnginePdf(engine);
+    PdfSaveThread* thread = enginePdf ? enginePdf->saveThread : nullptr;
+    if (!thread) {
+        return false;
     }
-    fz_catch(ctx) {
-        const char* mupdfErr = fz_caught_message(enginePdf->ctx);
-        logf("Saving '%s' failed with: '%s'\n", path.data(), mupdfErr);
-        if (showErrorFunc) {
-            showErrorFunc(mupdfErr);
-        }
+    thread->mutex.Lock();
+    bool isSaving = !thread->isDone;
+    thread->mutex.Unlock();
+    return isSaving;
+}
+
+void EnginePdfWaitForSaves(EngineBase* engine) {
+    EnginePdf* enginePdf = AsEnginePdf(engine);
+    if (!enginePdf || !enginePdf->saveThread) {
+        return;
     }
-    return ok;
+    enginePdf->saveThread->Join();
+    delete enginePdf->saveThread;
+    enginePdf->saveThread = nullptr;
 }
 
 // https://github.com/sumatrapdfreader/sumatrapdf/issues/1336
@@ -1868,6 +2477,7 @@ bool EnginePdf::HasClipOptimizations(int pageNo) {
 }
 
 WCHAR* EnginePdf::GetPageLabel(int pageNo) const {
+    WaitForDocInfo();
     if (!_pageLabels || pageNo < 1 || PageCount() < pageNo) {
         return EngineBase::GetPageLabel(pageNo);
     }
@@ -1876,6 +2486,7 @@ WCHAR* EnginePdf::GetPageLabel(int pageNo) const {
 }
 
 int EnginePdf::GetPageByLabel(const WCHAR* label) const {
+    WaitForDocInfo();
     int pageNo = 0;
     if (_pageLabels) {
         pageNo = _pageLabels->Find(label) + 1;
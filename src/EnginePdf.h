@@ -12,4 +12,12 @@ int EnginePdfGetAnnotations(EngineBase*, Vec<Annotation*>*);
 bool EnginePdfHasUnsavedAnnotations(EngineBase*);
 bool EnginePdfSaveUpdated(EngineBase* engine, std::string_view path,
                           std::function<void(std::string_view)> showErrorFunc);
+struct ProgressUpdateUI;
+// Superseded: a later request for the same path has replaced the save request
+enum class PdfSaveStatus { Saved, Failed, Superseded };
+using PdfSaveDoneCb = std::function<void(PdfSaveStatus status, std::string_view err)>;
+void EnginePdfSaveUpdatedAsync(EngineBase* engine, std::string_view path, ProgressUpdateUI* progressUI,
+                               const PdfSaveDoneCb& onDone);
+bool EnginePdfIsSaving(EngineBase*);
+void EnginePdfWaitForSaves(EngineBase*);
 Annotation* EnginePdfGetAnnotationAtPos(EngineBase*, int pageNo, PointF pos, AnnotationType* allowedAnnots);
@@ -6,6 +6,9 @@ class EnginePdf : public EngineBase {
     EngineBase* Clone() override;
 
     RectF PageMediabox(int pageNo) override;
+    RectF PageMediaboxEstimate(int pageNo) override;
+    void SetPageSizesChangedCb(const std::function<void()>& cb) override;
+    void TakeChangedPageSizes(Vec<int>* pageNos, Vec<RectF>* sizes) override;
     RectF PageContentBox(int pageNo, RenderTarget target = RenderTarget::View) override;
 
     RenderedBitmap* RenderPage(RenderPageArgs& args) override;
@@ -32,6 +35,9 @@ class EnginePdf : public EngineBase {
     PageDestination* GetNamedDest(const WCHAR* name) override;
     TocTree* GetToc() override;
 
+    bool IsDocInfoLoaded() override;
+    void SetDocInfoLoadedCb(const std::function<void()>& cb) override;
+    [[nodiscard]] bool HasPageLabels() const override;
     [[nodiscard]] WCHAR* GetPageLabel(int pageNo) const override;
     int GetPageByLabel(const WCHAR* label) const override;
 
@@ -61,12 +67,34 @@ class EnginePdf : public EngineBase {
 
     TocTree* tocTree = nullptr;
 
+    // determines the real page sizes for large documents (see FinishLoading)
+    class PdfPageSizesThread* pageSizesThread = nullptr;
+    // protected by pagesAccess
+    std::function<void()> onPageSizesChanged;
+    // pages whose estimated size has been replaced with a different real one
+    // since the last TakeChangedPageSizes(). protected by pagesAccess
+    Vec<int> changedPageSizes;
+
+    // loads outline, attachments, properties and page labels (see LoadDocInfo)
+    class PdfDocInfoThread* docInfoThread = nullptr;
+    HANDLE docInfoLoadedEvent = nullptr;
+    // protected by pagesAccess
+    std::function<void()> onDocInfoLoaded;
+
+    // saves the document in the background (see EnginePdfSaveUpdatedAsync)
+    class PdfSaveThread* saveThread = nullptr;
+
     bool Load(const WCHAR* filePath, PasswordUI* pwdUI = nullptr);
     bool Load(IStream* stream, PasswordUI* pwdUI = nullptr);
     // TODO(port): fz_stream can no-longer be re-opened (fz_clone_stream)
     // bool Load(fz_stream* stm, PasswordUI* pwdUI = nullptr);
     bool LoadFromStream(fz_stream* stm, PasswordUI* pwdUI = nullptr);
     bool FinishLoading();
+    bool LoadPageSizes();
+    void LoadDocInfo();
+    void WaitForDocInfo() const;
+    void SetRealPageSize(FzPageInfo* pageInfo, RectF mbox);
+    void NotifyPageSizesChanged();
 
     FzPageInfo* GetFzPageInfoFast(int pageNo);
     FzPageInfo* GetFzPageInfo(int pageNo, bool loadQuick);
@@ -640,20 +640,24 @@ RenderedBitmap* EngineXps::RenderPage(RenderPageArgs& args) {
     fz_matrix ctm = viewctm(page, args.zoom, args.rotation);
     fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
 
-    fz_colorspace* colorspace = fz_device_rgb(ctx);
     fz_irect ibounds = bbox;
     fz_rect cliprect = fz_rect_from_irect(bbox);
 
     fz_pixmap* pix = nullptr;
     fz_device* dev = nullptr;
     RenderedBitmap* bitmap = nullptr;
+    HBITMAP hbmp = nullptr;
+    HANDLE hMap = nullptr;
 
     fz_var(dev);
     fz_var(pix);
     fz_var(bitmap);
+    fz_var(hbmp);
+    fz_var(hMap);
 
     fz_try(ctx) {
-        pix = fz_new_pixmap_with_bbox(ctx, colorspace, ibounds, nullptr, 1);
+        // render straight into the memory of the DIB section that ends up in the RenderedBitmap
+        pix = fz_new_bgra_pixmap(ctx, ibounds, &hbmp, &hMap);
         // initialize with white background
         fz_clear_pixmap_with_value(ctx, pix, 0xff);
 
@@ -662,8 +666,10 @@ RenderedBitmap* EngineXps::RenderPage(RenderPageArgs& args) {
         dev = fz_new_draw_device(ctx, fz_identity, pix);
         // TODO: use fz_infinite_rect instead of cliprect?
         fz_run_page(ctx, page, dev, ctm, fzcookie);
-        bitmap = new_rendered_fz_pixmap(ctx, pix);
         fz_close_device(ctx, dev);
+        bitmap = new_rendered_bgra_pixmap(pix, hbmp, hMap);
+        hbmp = nullptr;
+        hMap = nullptr;
     }
     fz_always(ctx) {
         if (dev) {
@@ -672,6 +678,10 @@ RenderedBitmap* EngineXps::RenderPage(RenderPageArgs& args) {
         fz_drop_pixmap(ctx, pix);
     }
     fz_catch(ctx) {
+        DeleteObject(hbmp);
+        if (hMap) {
+            CloseHandle(hMap);
+        }
         delete bitmap;
         return nullptr;
     }
@@ -219,6 +219,7 @@ void Favorites::AddOrReplace(const WCHAR* filePath, int pageNo, const WCHAR* nam
         fav->favorites->Append(fn);
         fav->favorites->Sort(SortByPageNo);
     }
+    gFileHistory.MarkChanged(fav);
 }
 
 void Favorites::Remove(const WCHAR* filePath, int pageNo) {
@@ -237,6 +238,8 @@ void Favorites::Remove(const WCHAR* filePath, int pageNo) {
     if (!gGlobalPrefs->rememberOpenedFiles && 0 == fav->favorites->size()) {
         gFileHistory.Remove(fav);
         DeleteDisplayState(fav);
+    } else {
+        gFileHistory.MarkChanged(fav);
     }
 }
 
@@ -254,6 +257,8 @@ void Favorites::RemoveAllForFile(const WCHAR* filePath) {
     if (!gGlobalPrefs->rememberOpenedFiles) {
         gFileHistory.Remove(fav);
         DeleteDisplayState(fav);
+    } else {
+        gFileHistory.MarkChanged(fav);
     }
 }
 
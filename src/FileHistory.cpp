@@ -31,8 +31,12 @@ Window State = 2
 ]
 etc...
 
-We deserialize this info at startup and serialize when the application
-quits.
+We deserialize this info at startup. Changes are appended to a journal
+(see prefs::Save()) which is merged back into the preferences file
+once it has grown large enough.
+
+Lookups by path go through two hash indexes (by full path and by file name)
+so that opening a file doesn't have to scan the whole history.
 */
 
 // maximum number of files to remember in total
@@ -59,20 +63,132 @@ static int cmpOpenCount(const void* a, const void* b) {
     return dsA->index < dsB->index ? -1 : 1;
 }
 
-void FileHistory::Append(FileState* state) const {
+static int cmpIndex(const void* a, const void* b) {
+    FileState* dsA = *(FileState**)a;
+    FileState* dsB = *(FileState**)b;
+    return dsA->index < dsB->index ? -1 : dsA->index > dsB->index ? 1 : 0;
+}
+
+// marks slots of removed states in pathIdx and nameIdx
+static FileState gRemovedSlot{};
+
+// case-insensitive (in the same way as str::EqI) FNV-1a hash
+static u32 HashPathI(const WCHAR* s) {
+    u32 h = 2166136261u;
+    for (; *s; s++) {
+        h = (h ^ (u32)towlower(*s)) * 16777619u;
+    }
+    return h;
+}
+
+static void IndexInsert(Vec<FileState*>& idx, FileState* state, u32 hash) {
+    size_t mask = idx.size() - 1;
+    size_t i = hash & mask;
+    while (idx.at(i)) {
+        i = (i + 1) & mask;
+    }
+    idx.at(i) = state;
+}
+
+static void IndexErase(Vec<FileState*>& idx, FileState* state, u32 hash) {
+    size_t mask = idx.size() - 1;
+    for (size_t i = hash & mask; idx.at(i); i = (i + 1) & mask) {
+        if (idx.at(i) == state) {
+            idx.at(i) = &gRemovedSlot;
+            return;
+        }
+    }
+}
+
+FileHistory::~FileHistory() {
+    removed.FreeMembers();
+}
+
+void FileHistory::BuildIndex() {
+    size_t n = states ? states->size() : 0;
+    size_t size = 64;
+    while (size < n * 2) {
+        size *= 2;
+    }
+    pathIdx.Reset();
+    nameIdx.Reset();
+    pathIdx.AppendBlanks(size);
+    nameIdx.AppendBlanks(size);
+    idxUsed = 0;
+    for (size_t i = 0; i < n; i++) {
+        IndexAdd(states->at(i));
+    }
+}
+
+void FileHistory::IndexAdd(FileState* state) {
+    if (pathIdx.size() == 0) {
+        // the whole index is built on first use
+        return;
+    }
+    if ((idxUsed + 1) * 2 > pathIdx.size()) {
+        BuildIndex();
+        return;
+    }
+    IndexInsert(pathIdx, state, HashPathI(state->filePath));
+    IndexInsert(nameIdx, state, HashPathI(path::GetBaseNameTemp(state->filePath)));
+    idxUsed++;
+}
+
+void FileHistory::IndexRemove(FileState* state) {
+    if (pathIdx.size() == 0) {
+        return;
+    }
+    IndexErase(pathIdx, state, HashPathI(state->filePath));
+    IndexErase(nameIdx, state, HashPathI(path::GetBaseNameTemp(state->filePath)));
+}
+
+// removes all references to a state which is about to be deleted
+void FileHistory::Forget(FileState* state) {
+    IndexRemove(state);
+    changed.Remove(state);
+    removed.Append(str::Dup(state->filePath));
+}
+
+void FileHistory::Append(FileState* state) {
     CrashIf(!state->filePath);
     states->Append(state);
+    IndexAdd(state);
+    MarkChanged(state);
 }
 
-void FileHistory::Remove(FileState* state) const {
+void FileHistory::Remove(FileState* state) {
     states->Remove(state);
+    Forget(state);
+}
+
+void FileHistory::MarkChanged(FileState* state) {
+    if (!changed.Contains(state)) {
+        changed.Append(state);
+    }
+}
+
+void FileHistory::SetFilePath(FileState* state, const WCHAR* filePath) {
+    Forget(state);
+    str::ReplaceWithCopy(&state->filePath, filePath);
+    IndexAdd(state);
+    MarkChanged(state);
 }
 
 void FileHistory::UpdateStatesSource(Vec<FileState*>* states) {
     this->states = states;
+    pathIdx.Reset();
+    nameIdx.Reset();
+    idxUsed = 0;
+    ResetChanges();
 }
 
-void FileHistory::Clear(bool keepFavorites) const {
+void FileHistory::ResetChanges() {
+    changed.Reset();
+    removed.FreeMembers();
+    needsFullSave = false;
+}
+
+void FileHistory::Clear(bool keepFavorites) {
     if (!states) {
         return;
     }
@@ -86,6 +202,8 @@ void FileHistory::Clear(bool keepFavorites) const {
         }
     }
     *states = keep;
+    UpdateStatesSource(states);
+    needsFullSave = true;
 }
 
 FileState* FileHistory::Get(size_t index) const {
@@ -95,33 +213,58 @@ FileState* FileHistory::Get(size_t index) const {
     return nullptr;
 }
 
-FileState* FileHistory::Find(const WCHAR* filePath, size_t* idxOut) const {
-    int idxExact = -1;
-    int idxFileNameMatch = -1;
-    const WCHAR* fileName = path::GetBaseNameTemp(filePath);
-    int n = states->isize();
-    for (int i = 0; i < n; i++) {
-        FileState* state = states->at(i);
-        if (str::EqI(state->filePath, filePath)) {
-            idxExact = i;
-        } else if (str::EndsWithI(state->filePath, fileName)) {
-            idxFileNameMatch = i;
+FileState* FileHistory::FindExact(const WCHAR* filePath) {
+    if (pathIdx.size() == 0) {
+        BuildIndex();
+    }
+    size_t mask = pathIdx.size() - 1;
+    for (size_t i = HashPathI(filePath) & mask; pathIdx.at(i); i = (i + 1) & mask) {
+        FileState* state = pathIdx.at(i);
+        if (state != &gRemovedSlot && str::EqI(state->filePath, filePath)) {
+            return state;
         }
     }
-    int idFound = idxExact;
-    if (idFound == -1) {
-        idFound = idxFileNameMatch;
+    return nullptr;
+}
+
+// finds the state for filePath or, failing that, the least recently
+// used state for a file of the same name
+FileState* FileHistory::Find(const WCHAR* filePath, size_t* idxOut) {
+    FileState* found = FindExact(filePath);
+    int idxFound = -1;
+    if (!found) {
+        size_t mask = nameIdx.size() - 1;
+        const WCHAR* fileName = path::GetBaseNameTemp(filePath);
+        for (size_t i = HashPathI(fileName) & mask; nameIdx.at(i); i = (i + 1) & mask) {
+            FileState* state = nameIdx.at(i);
+            if (state == &gRemovedSlot || !str::EqI(path::GetBaseNameTemp(state->filePath), fileName)) {
+                continue;
+            }
+            if (!found) {
+                found = state;
+                continue;
+            }
+            // prefer the match closest to the end of the list
+            if (idxFound == -1) {
+                idxFound = states->Find(found);
+            }
+            int idx = states->Find(state);
+            if (idx > idxFound) {
+                idxFound = idx;
+                found = state;
+            }
+        }
     }
-    if (idFound == -1) {
+    if (!found) {
         return nullptr;
     }
     if (idxOut) {
-        *idxOut = (size_t)idFound;
+        *idxOut = (size_t)(idxFound != -1 ? idxFound : states->Find(found));
     }
-    return states->at(idFound);
+    return found;
 }
 
-FileState* FileHistory::MarkFileLoaded(const WCHAR* filePath) const {
+FileState* FileHistory::MarkFileLoaded(const WCHAR* filePath) {
     CrashIf(!filePath);
     // if a history entry with the same name already exists,
     // then reuse it. That way we don't have duplicates and
@@ -130,16 +273,23 @@ FileState* FileHistory::MarkFileLoaded(const WCHAR* filePath) const {
     if (!state) {
         state = NewDisplayState(filePath);
         state->useDefaultState = true;
+        states->InsertAt(0, state);
+        IndexAdd(state);
     } else {
         states->Remove(state);
         state->isMissing = false;
+        states->InsertAt(0, state);
+        // the file might have been moved since it was last opened
+        if (!str::EqI(state->filePath, filePath)) {
+            SetFilePath(state, filePath);
+        }
     }
-    states->InsertAt(0, state);
     state->openCount++;
+    MarkChanged(state);
     return state;
 }
 
-bool FileHistory::MarkFileInexistent(const WCHAR* filePath, bool hide) const {
+bool FileHistory::MarkFileInexistent(const WCHAR* filePath, bool hide) {
     CrashIf(!filePath);
     FileState* state = Find(filePath, nullptr);
     if (!state) {
@@ -166,6 +316,7 @@ bool FileHistory::MarkFileInexistent(const WCHAR* filePath, bool hide) const {
     state->thumbnail = nullptr;
     state->openCount >>= 2;
     state->isMissing = hide;
+    MarkChanged(state);
     return true;
 }
 
@@ -187,7 +338,7 @@ void FileHistory::GetFrequencyOrder(Vec<FileState*>& list) const {
 
 // removes file history entries which shouldn't be saved anymore
 // (see the loop below for the details)
-void FileHistory::Purge(bool alwaysUseDefaultState) const {
+void FileHistory::Purge(bool alwaysUseDefaultState) {
     // minOpenCount is set to the number of times a file must have been
     // opened to be kept (provided that there is no other valuable
     // information about the file to be remembered)
@@ -219,6 +370,78 @@ void FileHistory::Purge(bool alwaysUseDefaultState) const {
         } else {
             continue;
         }
+        Forget(state);
+        DeleteDisplayState(state);
+    }
+}
+
+// replays a record of the settings journal: state replaces the state
+// remembered for the same path (if any) at position pos in the list
+// (or is deleted if isRemoved)
+void FileHistory::ApplyJournalRecord(FileState* state, int pos, bool isRemoved) {
+    CrashIf(!state->filePath);
+    FileState* prev = FindExact(state->filePath);
+    if (prev) {
+        states->Remove(prev);
+        IndexRemove(prev);
+        DeleteDisplayState(prev);
+    }
+    if (isRemoved) {
         DeleteDisplayState(state);
+        return;
+    }
+    pos = std::clamp(pos, 0, states->isize());
+    states->InsertAt((size_t)pos, state);
+    IndexAdd(state);
+}
+
+// appends records for the paths removed and the states changed since
+// the last ResetChanges() to a settings journal
+void FileHistory::SerializeChanges(str::Str& out, bool useDefaultState) {
+    for (WCHAR* path : removed) {
+        FileState* ds = NewDisplayState(path);
+        SerializeFileStateRecord(out, ds, 0, true);
+        DeleteDisplayState(ds);
+    }
+
+    // records are replayed in order, which only restores the
+    // order of the file history if they're sorted by position
+    Vec<FileState*> sorted;
+    for (FileState* ds : changed) {
+        int idx = states->Find(ds);
+        if (idx >= 0) {
+            ds->index = (size_t)idx;
+            sorted.Append(ds);
+        }
+    }
+    sorted.Sort(cmpIndex);
+    for (FileState* ds : sorted) {
+        if (useDefaultState) {
+            ds->useDefaultState = true;
+        }
+        SerializeFileStateRecord(out, ds, (int)ds->index, false);
+    }
+}
+
+// replays the records of a settings journal on top of the file history
+// and the session state they have been loaded with
+void ApplySettingsJournal(const char* data, FileHistory& fileHistory, Vec<SessionData*>* sessionData) {
+    SettingsJournal* journal = NewSettingsJournal(data);
+    for (FileStateRecord* rec : *journal->fileStates) {
+        FileState* ds = rec->state->size() > 0 ? rec->state->Pop() : nullptr;
+        if (ds && ds->filePath) {
+            fileHistory.ApplyJournalRecord(ds, rec->pos, rec->isRemoved);
+        } else if (ds) {
+            DeleteDisplayState(ds);
+        }
+    }
+    if (journal->sessions->size() > 0) {
+        Vec<SessionData*>* lastSession = journal->sessions->Last()->sessionData;
+        ResetSessionState(sessionData);
+        for (SessionData* sd : *lastSession) {
+            sessionData->Append(sd);
+        }
+        lastSession->Reset();
     }
+    DeleteSettingsJournal(journal);
 }
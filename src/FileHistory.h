@@ -14,17 +14,46 @@ struct FileHistory {
     // owned by gGlobalPrefs->fileStates
     Vec<FileState*>* states = nullptr;
 
+    // hash indexes of states by full path and by file name
+    // (open addressing, built on first use)
+    Vec<FileState*> pathIdx;
+    Vec<FileState*> nameIdx;
+    // number of used slots in each index (including removed ones)
+    size_t idxUsed = 0;
+
+    // states changed and paths removed since the last time they have been
+    // saved, for the settings journal (see prefs::Save())
+    Vec<FileState*> changed;
+    Vec<WCHAR*> removed;
+    // set if changes can't be expressed in the settings journal
+    bool needsFullSave = false;
+
     FileHistory() = default;
-    ~FileHistory() = default;
+    ~FileHistory();
 
-    void Clear(bool keepFavorites) const;
-    void Append(FileState* state) const;
-    void Remove(FileState* state) const;
+    void Clear(bool keepFavorites);
+    void Append(FileState* state);
+    void Remove(FileState* state);
     [[nodiscard]] FileState* Get(size_t index) const;
-    FileState* Find(const WCHAR* filePath, size_t* idxOut) const;
-    FileState* MarkFileLoaded(const WCHAR* filePath) const;
-    bool MarkFileInexistent(const WCHAR* filePath, bool hide = false) const;
+    FileState* Find(const WCHAR* filePath, size_t* idxOut);
+    FileState* MarkFileLoaded(const WCHAR* filePath);
+    bool MarkFileInexistent(const WCHAR* filePath, bool hide = false);
+    void MarkChanged(FileState* state);
+    void SetFilePath(FileState* state, const WCHAR* filePath);
     void GetFrequencyOrder(Vec<FileState*>& list) const;
-    void Purge(bool alwaysUseDefaultState = false) const;
+    void Purge(bool alwaysUseDefaultState = false);
     void UpdateStatesSource(Vec<FileState*>* states);
+
+    void ApplyJournalRecord(FileState* state, int pos, bool isRemoved);
+    void SerializeChanges(str::Str& out, bool useDefaultState);
+    void ResetChanges();
+
+  private:
+    FileState* FindExact(const WCHAR* filePath);
+    void BuildIndex();
+    void IndexAdd(FileState* state);
+    void IndexRemove(FileState* state);
+    void Forget(FileState* state);
 };
+
+void ApplySettingsJournal(const char* data, FileHistory& fileHistory, Vec<SessionData*>* sessionData);
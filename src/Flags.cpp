@@ -24,6 +24,7 @@ Flags::~Flags() {
     str::Free(destName);
     str::Free(pluginURL);
     str::Free(appdataDir);
+    str::Free(traceFile);
     str::Free(inverseSearchCmdLine);
     str::Free(stressTestPath);
     str::Free(stressTestFilter);
@@ -447,6 +448,11 @@ void ParseCommandLine(const WCHAR* cmdLine, Flags& i) {
             ++n;
             continue;
         }
+        if (isArg(L"trace")) {
+            i.traceFile = str::Dup(param);
+            ++n;
+            continue;
+        }
         if (isArg(L"plugin")) {
             // -plugin [<URL>] <parent HWND>
             if (argCount > n + 2 && !str::IsDigit(*args.at(n + 1)) && *args.at(n + 2) != '-') {
@@ -36,6 +36,8 @@ struct Flags {
     bool exitImmediately{false};
     bool silent{false};
     WCHAR* appdataDir{nullptr};
+    // -trace <file> : record the render pipeline and save it as Chrome trace JSON on exit
+    WCHAR* traceFile{nullptr};
     WCHAR* inverseSearchCmdLine{nullptr};
     bool invertColors{false};
     bool regress{false};
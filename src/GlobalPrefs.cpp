@@ -71,6 +71,94 @@ std::span<u8> SerializeGlobalPrefs(GlobalPrefs* prefs, const char* prevData) {
     return serialized;
 }
 
+// serializes everything but the file history and the session state,
+// which can be saved to the settings journal instead
+std::span<u8> SerializeGlobalPrefsWithoutHistory(GlobalPrefs* prefs) {
+    Vec<FileState*> noFileStates;
+    Vec<SessionData*> noSessionData;
+    Vec<FileState*>* fileStates = prefs->fileStates;
+    Vec<SessionData*>* sessionData = prefs->sessionData;
+    prefs->fileStates = &noFileStates;
+    prefs->sessionData = &noSessionData;
+    std::span<u8> serialized = SerializeStruct(&gGlobalPrefsInfo, prefs, nullptr);
+    prefs->fileStates = fileStates;
+    prefs->sessionData = sessionData;
+    return serialized;
+}
+
+/*
+The settings journal is a sequence of records of the form
+
+FileState [
+    Pos = 3
+    IsRemoved = false
+    State [
+        [
+            FilePath = ...
+        ]
+    ]
+]
+Session [
+    SessionData [
+        ...
+    ]
+]
+
+which are deserialized as repeated values of SettingsJournal's arrays.
+*/
+
+static const FieldInfo gFileStateRecordFields[] = {
+    {offsetof(FileStateRecord, pos), SettingType::Int, 0},
+    {offsetof(FileStateRecord, isRemoved), SettingType::Bool, false},
+    {offsetof(FileStateRecord, state), SettingType::Array, (intptr_t)&gFileStateInfo},
+};
+static const StructInfo gFileStateRecordInfo = {sizeof(FileStateRecord), 3, gFileStateRecordFields,
+                                                "Pos\0IsRemoved\0State"};
+
+static const FieldInfo gSessionRecordFields[] = {
+    {offsetof(SessionRecord, sessionData), SettingType::Array, (intptr_t)&gSessionDataInfo},
+};
+static const StructInfo gSessionRecordInfo = {sizeof(SessionRecord), 1, gSessionRecordFields, "SessionData"};
+
+static const FieldInfo gSettingsJournalFields[] = {
+    {offsetof(SettingsJournal, fileStates), SettingType::Array, (intptr_t)&gFileStateRecordInfo},
+    {offsetof(SettingsJournal, sessions), SettingType::Array, (intptr_t)&gSessionRecordInfo},
+};
+static const StructInfo gSettingsJournalInfo = {sizeof(SettingsJournal), 2, gSettingsJournalFields,
+                                                "FileState\0Session"};
+
+static void AppendJournalRecord(str::Str& out, const char* name, std::span<u8> data) {
+    std::string_view sv{(const char*)data.data(), data.size()};
+    if (str::StartsWith(sv, UTF8_BOM)) {
+        sv.remove_prefix(str::Len(UTF8_BOM));
+    }
+    out.Append(name);
+    out.Append(" [\r\n");
+    out.AppendView(sv);
+    out.Append("]\r\n");
+    str::Free(data.data());
+}
+
+void SerializeFileStateRecord(str::Str& out, FileState* ds, int pos, bool isRemoved) {
+    Vec<FileState*> state;
+    state.Append(ds);
+    FileStateRecord rec{pos, isRemoved, &state};
+    AppendJournalRecord(out, "FileState", SerializeStruct(&gFileStateRecordInfo, &rec, nullptr));
+}
+
+void SerializeSessionRecord(str::Str& out, Vec<SessionData*>* sessionData) {
+    SessionRecord rec{sessionData};
+    AppendJournalRecord(out, "Session", SerializeStruct(&gSessionRecordInfo, &rec, nullptr));
+}
+
+SettingsJournal* NewSettingsJournal(const char* data) {
+    return (SettingsJournal*)DeserializeStruct(&gSettingsJournalInfo, data);
+}
+
+void DeleteSettingsJournal(SettingsJournal* journal) {
+    FreeStruct(&gSettingsJournalInfo, journal);
+}
+
 void DeleteGlobalPrefs(GlobalPrefs* gp) {
     if (!gp) {
         return;
@@ -13,6 +13,31 @@ GlobalPrefs* NewGlobalPrefs(const char* data);
 std::span<u8> SerializeGlobalPrefs(GlobalPrefs* prefs, const char* prevData);
 void DeleteGlobalPrefs(GlobalPrefs* gp);
 
+// records of the settings journal (see prefs::Save())
+struct FileStateRecord {
+    // position of the state in the file history
+    int pos;
+    // if true, the state for this path is to be forgotten
+    bool isRemoved;
+    // contains a single FileState
+    Vec<FileState*>* state;
+};
+
+struct SessionRecord {
+    Vec<SessionData*>* sessionData;
+};
+
+struct SettingsJournal {
+    Vec<FileStateRecord*>* fileStates;
+    Vec<SessionRecord*>* sessions;
+};
+
+std::span<u8> SerializeGlobalPrefsWithoutHistory(GlobalPrefs* prefs);
+void SerializeFileStateRecord(str::Str& out, FileState* ds, int pos, bool isRemoved);
+void SerializeSessionRecord(str::Str& out, Vec<SessionData*>* sessionData);
+SettingsJournal* NewSettingsJournal(const char* data);
+void DeleteSettingsJournal(SettingsJournal* journal);
+
 SessionData* NewSessionData();
 TabState* NewTabState(FileState* ds);
 void ResetSessionState(Vec<SessionData*>* sessionData);
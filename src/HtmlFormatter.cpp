@@ -2,6 +2,7 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
+#include "utils/Dict.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/CssParser.h"
@@ -157,19 +158,23 @@ void StyleRule::Merge(StyleRule& source) {
 }
 
 HtmlFormatter::HtmlFormatter(HtmlFormatterArgs* args)
-    : pageDx(args->pageDx), pageDy(args->pageDy), textAllocator(args->textAllocator) {
+    : pageDx(args->pageDx),
+      pageDy(args->pageDy),
+      textAllocator(args->textAllocator),
+      threadFonts(args->threadFonts) {
     currReparseIdx = args->reparseIdx;
     htmlParser = new HtmlPullParser((const char*)args->htmlStr.data(), args->htmlStr.size());
     htmlParser->SetCurrPosOff(currReparseIdx);
     CrashIf(!ValidReparseIdx(currReparseIdx, htmlParser));
 
     gfx = mui::AllocGraphicsForMeasureText();
-    textMeasure = CreateTextRender(args->textRenderMethod, gfx, 10, 10);
+    // widths of words are remembered across layouts of the same (or other) documents
+    textMeasure = mui::TextRenderCachedMeasure::Create(CreateTextRender(args->textRenderMethod, gfx, 10, 10));
     defaultFontName.SetCopy(args->GetFontName());
     defaultFontSize = args->fontSize;
 
     DrawStyle style;
-    style.font = mui::GetCachedFont(defaultFontName, defaultFontSize, FontStyleRegular);
+    style.font = GetFont(defaultFontName, defaultFontSize, FontStyleRegular);
     style.align = AlignAttr::Justify;
     style.dirRtl = false;
     styleStack.Append(style);
@@ -194,6 +199,7 @@ HtmlFormatter::~HtmlFormatter() {
     delete textMeasure;
     mui::FreeGraphicsForMeasureText(gfx);
     delete htmlParser;
+    delete computedStyleRulesIdx;
 }
 
 void HtmlFormatter::AppendInstr(DrawInstr di) {
@@ -204,11 +210,18 @@ void HtmlFormatter::AppendInstr(DrawInstr di) {
     }
 }
 
+mui::CachedFont* HtmlFormatter::GetFont(const WCHAR* fontName, float fontSize, FontStyle fs) {
+    if (threadFonts) {
+        return mui::GetThreadFont(threadFonts, fontName, fontSize, fs);
+    }
+    return mui::GetCachedFont(fontName, fontSize, fs);
+}
+
 void HtmlFormatter::SetFont(const WCHAR* fontName, FontStyle fs, float fontSize) {
     if (fontSize < 0) {
         fontSize = CurrFont()->GetSize();
     }
-    mui::CachedFont* newFont = mui::GetCachedFont(fontName, fontSize, fs);
+    mui::CachedFont* newFont = GetFont(fontName, fontSize, fs);
     if (CurrFont() != newFont) {
         AppendInstr(DrawInstr::SetFont(newFont));
     }
@@ -969,52 +982,142 @@ void HtmlFormatter::HandleTagPre(HtmlToken* t) {
     }
 }
 
-StyleRule* HtmlFormatter::FindStyleRule(HtmlTag tag, const char* clazz, size_t clazzLen) {
-    u32 classHash = clazz ? MurmurHash2(clazz, clazzLen) : 0;
-    for (size_t i = 0; i < styleRules.size(); i++) {
-        StyleRule& rule = styleRules.at(i);
+static size_t StyleRuleHash(HtmlTag tag, u32 classHash) {
+    return (size_t)(classHash ^ ((u32)tag * 2654435761u));
+}
+
+StyleRule* HtmlFormatter::FindStyleRule(HtmlTag tag, u32 classHash) {
+    if (styleRulesIndex.size() == 0) {
+        return nullptr;
+    }
+    size_t mask = styleRulesIndex.size() - 1;
+    for (size_t i = StyleRuleHash(tag, classHash) & mask;; i = (i + 1) & mask) {
+        int idx = styleRulesIndex.at(i);
+        if (idx == 0) {
+            return nullptr;
+        }
+        StyleRule& rule = styleRules.at(idx - 1);
         if (tag == rule.tag && classHash == rule.classHash) {
             return &rule;
         }
     }
-    return nullptr;
 }
 
-StyleRule HtmlFormatter::ComputeStyleRule(HtmlToken* t) {
-    StyleRule rule;
-    // get style rules ordered by specificity
-    StyleRule* prevRule = FindStyleRule(Tag_Body, nullptr, 0);
-    if (prevRule) {
-        rule.Merge(*prevRule);
-    }
-    prevRule = FindStyleRule(Tag_Any, nullptr, 0);
-    if (prevRule) {
-        rule.Merge(*prevRule);
+StyleRule* HtmlFormatter::FindStyleRule(HtmlTag tag, const char* clazz, size_t clazzLen) {
+    u32 classHash = clazz ? MurmurHash2(clazz, clazzLen) : 0;
+    return FindStyleRule(tag, classHash);
+}
+
+// rule must not be in styleRules yet
+void HtmlFormatter::AddStyleRule(StyleRule& rule) {
+    styleRules.Append(rule);
+    size_t nRules = styleRules.size();
+    // keep the table at most half full
+    if (nRules * 2 > styleRulesIndex.size()) {
+        size_t size = std::max(styleRulesIndex.size() * 2, (size_t)64);
+        styleRulesIndex.Reset();
+        styleRulesIndex.AppendBlanks(size);
+        nRules = 0;
+    } else {
+        nRules--;
+    }
+    size_t mask = styleRulesIndex.size() - 1;
+    for (; nRules < styleRules.size(); nRules++) {
+        StyleRule& r = styleRules.at(nRules);
+        size_t i = StyleRuleHash(r.tag, r.classHash) & mask;
+        while (styleRulesIndex.at(i) != 0) {
+            i = (i + 1) & mask;
+        }
+        styleRulesIndex.at(i) = (int)nRules + 1;
     }
-    prevRule = FindStyleRule(t->tag, nullptr, 0);
-    if (prevRule) {
-        rule.Merge(*prevRule);
+    delete computedStyleRulesIdx;
+    computedStyleRulesIdx = nullptr;
+}
+
+void HtmlFormatter::ResetStyleRules() {
+    styleRules.Reset();
+    styleRulesIndex.Reset();
+    delete computedStyleRulesIdx;
+    computedStyleRulesIdx = nullptr;
+}
+
+static void MergeStyleRule(StyleRule& rule, StyleRule* source) {
+    if (source) {
+        rule.Merge(*source);
     }
-    // TODO: support multiple class names
-    AttrInfo* attr = t->GetAttrByName("class");
-    if (attr) {
-        prevRule = FindStyleRule(Tag_Any, attr->val, attr->valLen);
-        if (prevRule) {
-            rule.Merge(*prevRule);
+}
+
+StyleRule HtmlFormatter::ComputeStyleRuleUncached(HtmlTag tag, AttrInfo* classAttr, AttrInfo* styleAttr) {
+    StyleRule rule;
+    // get style rules ordered by specificity
+    MergeStyleRule(rule, FindStyleRule(Tag_Body, 0));
+    MergeStyleRule(rule, FindStyleRule(Tag_Any, 0));
+    MergeStyleRule(rule, FindStyleRule(tag, 0));
+    if (classAttr) {
+        // class is a whitespace separated list of class names. Rules for
+        // .class are less specific than those for tag.class
+        Vec<u32> classHashes;
+        const char* s = classAttr->val;
+        const char* end = s + classAttr->valLen;
+        while (s < end) {
+            const char* name = s;
+            while (s < end && !str::IsWs(*s)) {
+                s++;
+            }
+            if (s > name) {
+                classHashes.Append(MurmurHash2(name, s - name));
+            }
+            while (s < end && str::IsWs(*s)) {
+                s++;
+            }
         }
-        prevRule = FindStyleRule(t->tag, attr->val, attr->valLen);
-        if (prevRule) {
-            rule.Merge(*prevRule);
+        for (u32 classHash : classHashes) {
+            MergeStyleRule(rule, FindStyleRule(Tag_Any, classHash));
+        }
+        for (u32 classHash : classHashes) {
+            MergeStyleRule(rule, FindStyleRule(tag, classHash));
         }
     }
-    attr = t->GetAttrByName("style");
-    if (attr) {
-        StyleRule newRule = StyleRule::Parse(attr->val, attr->valLen);
+    if (styleAttr) {
+        StyleRule newRule = StyleRule::Parse(styleAttr->val, styleAttr->valLen);
         rule.Merge(newRule);
     }
     return rule;
 }
 
+StyleRule HtmlFormatter::ComputeStyleRule(HtmlToken* t) {
+    AttrInfo* classAttr = t->GetAttrByName("class");
+    AttrInfo* styleAttr = t->GetAttrByName("style");
+    if (!classAttr && !styleAttr) {
+        return ComputeStyleRuleUncached(t->tag, nullptr, nullptr);
+    }
+
+    // ebooks tend to repeat the same few combinations of class and style
+    // attributes many times, so remember the results
+    computedStyleKey.Reset();
+    size_t classLen = classAttr ? classAttr->valLen : 0;
+    size_t styleLen = styleAttr ? styleAttr->valLen : 0;
+    computedStyleKey.AppendFmt("%d:%d:%d:", (int)t->tag, (int)classLen, (int)styleLen);
+    if (classAttr) {
+        computedStyleKey.Append(classAttr->val, classLen);
+    }
+    if (styleAttr) {
+        computedStyleKey.Append(styleAttr->val, styleLen);
+    }
+    if (!computedStyleRulesIdx) {
+        computedStyleRulesIdx = new dict::MapStrToInt(256);
+        computedStyleRules.Reset();
+    }
+    int idx;
+    if (computedStyleRulesIdx->Get(computedStyleKey.Get(), &idx)) {
+        return computedStyleRules.at(idx);
+    }
+    StyleRule rule = ComputeStyleRuleUncached(t->tag, classAttr, styleAttr);
+    computedStyleRulesIdx->Insert(computedStyleKey.Get(), computedStyleRules.isize());
+    computedStyleRules.Append(rule);
+    return rule;
+}
+
 void HtmlFormatter::ParseStyleSheet(const char* data, size_t len) {
     CssPullParser parser(data, len);
     while (parser.NextRule()) {
@@ -1030,10 +1133,13 @@ void HtmlFormatter::ParseStyleSheet(const char* data, size_t len) {
             } else {
                 rule.tag = sel->tag;
                 rule.classHash = sel->clazz ? MurmurHash2(sel->clazz, sel->clazzLen) : 0;
-                styleRules.Append(rule);
+                AddStyleRule(rule);
             }
         }
     }
+    // merging into existing rules also changes computed styles
+    delete computedStyleRulesIdx;
+    computedStyleRulesIdx = nullptr;
 }
 
 void HtmlFormatter::HandleTagStyle(HtmlToken* t) {
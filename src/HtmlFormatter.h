@@ -103,6 +103,9 @@ struct DrawInstr {
 };
 
 class CssPullParser;
+namespace dict {
+class MapStrToInt;
+}
 
 struct StyleRule {
     HtmlTag tag = Tag_NotFound;
@@ -164,6 +167,10 @@ struct HtmlFormatterArgs {
        used to allocate this text. */
     Allocator* textAllocator{nullptr};
 
+    // if set, fonts are created in (and only used from) it instead of
+    // the shared font cache. Needed when laying out on several threads
+    mui::ThreadFonts* threadFonts{nullptr};
+
     mui::TextRenderMethod textRenderMethod = mui::TextRenderMethod::Gdiplus;
 
     std::span<u8> htmlStr;
@@ -230,6 +237,7 @@ class HtmlFormatter {
     mui::CachedFont* CurrFont() {
         return CurrStyle()->font;
     }
+    mui::CachedFont* GetFont(const WCHAR* fontName, float fontSize, FontStyle fs);
     void SetFont(const WCHAR* fontName, FontStyle fs, float fontSize = -1);
     void SetFontBasedOn(mui::CachedFont* origFont, FontStyle fs, float fontSize = -1);
     void ChangeFontStyle(FontStyle fs, bool addStyle);
@@ -237,8 +245,12 @@ class HtmlFormatter {
     void RevertStyleChange();
 
     void ParseStyleSheet(const char* data, size_t len);
+    void AddStyleRule(StyleRule& rule);
+    void ResetStyleRules();
+    StyleRule* FindStyleRule(HtmlTag tag, u32 classHash);
     StyleRule* FindStyleRule(HtmlTag tag, const char* clazz, size_t clazzLen);
     StyleRule ComputeStyleRule(HtmlToken* t);
+    StyleRule ComputeStyleRuleUncached(HtmlTag tag, AttrInfo* classAttr, AttrInfo* styleAttr);
 
     void AppendInstr(DrawInstr di);
     bool IsCurrLineEmpty();
@@ -255,6 +267,7 @@ class HtmlFormatter {
     AutoFreeWstr defaultFontName;
     float defaultFontSize{0};
     Allocator* textAllocator{nullptr};
+    mui::ThreadFonts* threadFonts{nullptr};
     mui::ITextRender* textMeasure{nullptr};
 
     // style stack of the current line
@@ -276,9 +289,6 @@ class HtmlFormatter {
     // list of currently opened tags for auto-closing when needed
     Vec<HtmlTag> tagNesting;
     bool keepTagNesting{false};
-    // set from CSS and to be checked by the individual tag handlers
-    Vec<StyleRule> styleRules;
-
     // isntructions for the current line
     Vec<DrawInstr> currLineInstr;
     // reparse point of the first instructions in a current line
@@ -301,6 +311,19 @@ class HtmlFormatter {
     // for detection of cover image duplicates in mobi formatting
     int pageCount{0};
 
+  private:
+    // set from CSS, only to be changed through AddStyleRule() and ResetStyleRules()
+    // so that the indexes below stay in sync
+    Vec<StyleRule> styleRules;
+    // open addressing hash table of (index + 1) of styleRules by (tag, classHash),
+    // 0 marks an empty slot. The size is a power of 2
+    Vec<int> styleRulesIndex;
+    // results of ComputeStyleRule() by (tag, class and style attributes),
+    // reset whenever styleRules change
+    dict::MapStrToInt* computedStyleRulesIdx{nullptr};
+    Vec<StyleRule> computedStyleRules;
+    str::Str computedStyleKey;
+
   public:
     explicit HtmlFormatter(HtmlFormatterArgs* args);
     HtmlFormatter(HtmlFormatter const&) = delete;
@@ -11,6 +11,7 @@
 #include "utils/GdiPlusUtil.h"
 #include "mui/Mui.h"
 #include "utils/WinUtil.h"
+#include "utils/Trace.h"
 
 #include "wingui/TreeModel.h"
 
@@ -550,6 +551,10 @@ static MenuDef menuDefDebug[] = {
         "Show notification",
         CmdDebugShowNotif,
     },
+    {
+        "Trace rendering",
+        CmdDebugTraceRendering,
+    },
     {
         nullptr,
         0,
@@ -1499,6 +1504,7 @@ static void MenuUpdateStateForWindow(WindowInfo* win) {
     win::menu::SetChecked(win->menu, CmdDebugShowLinks, gDebugShowLinks);
     win::menu::SetChecked(win->menu, CmdDebugEbookUI, gGlobalPrefs->ebookUI.useFixedPageUI);
     win::menu::SetChecked(win->menu, CmdDebugMui, mui::IsDebugPaint());
+    win::menu::SetChecked(win->menu, CmdDebugTraceRendering, trace::IsEnabled());
     win::menu::SetEnabled(win->menu, CmdDebugAnnotations,
                           tab && tab->selectionOnPage && win->showSelection && EngineSupportsAnnotations(engine));
 }
@@ -1538,6 +1544,7 @@ void OnAboutContextMenu(WindowInfo* win, int x, int y) {
 
     if (CmdPinSelectedDocument == cmd) {
         state->isPinned = !state->isPinned;
+        gFileHistory.MarkChanged(state);
         win->HideToolTip();
         win->RedrawAll(true);
         return;
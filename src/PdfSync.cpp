@@ -5,11 +5,13 @@
 #include <synctex_parser.h>
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
 
 #include "wingui/TreeModel.h"
 
 #include "EngineBase.h"
 #include "PdfSync.h"
+#include "PdfSyncIndex.h"
 
 // size of the mark highlighting the location calculated by forward-search
 #define MARK_SIZE 10
@@ -19,96 +21,168 @@
 #define PDFSYNC_EPSILON_SQUARE 800
 // Minimal vertical distance
 #define PDFSYNC_EPSILON_Y 20
+// maximum coordinate distance of a point within PDFSYNC_EPSILON_SQUARE (28^2 < 800 < 29^2)
+#define PDFSYNC_EPSILON_XY 28
 
 #define PDFSYNC_EXTENSION L".pdfsync"
 
 #define SYNCTEX_EXTENSION L".synctex"
 #define SYNCTEXGZ_EXTENSION L".synctex.gz"
 
-struct PdfsyncFileIndex {
-    size_t start, end; // first and one-after-last index of lines associated with a file
-};
-
-struct PdfsyncLine {
-    UINT record; // index for mapping line(s) to point(s)
-    size_t file; // index into srcfiles
-    UINT line, column;
-};
-
-struct PdfsyncPoint {
-    UINT record; // index for mapping point(s) to line(s)
-    UINT page, x, y;
-};
-
 // Synchronizer based on .pdfsync file generated with the pdfsync tex package
 class Pdfsync : public Synchronizer {
   public:
     Pdfsync(const WCHAR* syncfilename, EngineBase* engine) : Synchronizer(syncfilename), engine(engine) {
         CrashIf(!str::EndsWithI(syncfilename, PDFSYNC_EXTENSION));
     }
+    ~Pdfsync() override {
+        WaitForIndexRebuild();
+    }
 
     int DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) override;
     int SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) override;
+    SyncIndex* BuildIndex() override;
 
   private:
-    int RebuildIndex();
-    UINT SourceToRecord(const WCHAR* srcfilename, UINT line, UINT col, Vec<size_t>& records);
-
-    EngineBase* engine;              // needed for converting between coordinate systems
-    WStrVec srcfiles;                // source file names
-    Vec<PdfsyncLine> lines;          // record-to-line mapping
-    Vec<PdfsyncPoint> points;        // record-to-point mapping
-    Vec<PdfsyncFileIndex> fileIndex; // start and end of entries for a file in <lines>
-    Vec<size_t> sheetIndex;          // start of entries for a sheet in <points>
+    UINT SourceToRecord(PdfsyncIndex* idx, const WCHAR* srcfilename, UINT line, UINT col, Vec<size_t>& records);
+
+    EngineBase* engine; // needed for converting between coordinate systems
+};
+
+struct SyncTexIndex : SyncIndex {
+    synctex_scanner_t scanner = nullptr;
+
+    ~SyncTexIndex() override {
+        synctex_scanner_free(scanner);
+    }
 };
 
 // Synchronizer based on .synctex file generated with SyncTex
 class SyncTex : public Synchronizer {
   public:
-    SyncTex(const WCHAR* syncfilename, EngineBase* engine)
-        : Synchronizer(syncfilename), engine(engine), scanner(nullptr) {
+    SyncTex(const WCHAR* syncfilename, EngineBase* engine) : Synchronizer(syncfilename), engine(engine) {
         CrashIf(!str::EndsWithI(syncfilename, SYNCTEX_EXTENSION));
     }
     ~SyncTex() override {
-        synctex_scanner_free(scanner);
+        WaitForIndexRebuild();
     }
 
     int DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) override;
     int SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) override;
+    SyncIndex* BuildIndex() override;
 
   private:
-    int RebuildIndex();
-
     EngineBase* engine; // needed for converting between coordinate systems
-    synctex_scanner_t scanner;
 };
 
-Synchronizer::Synchronizer(const WCHAR* syncfilepath) : indexDiscarded(true), syncfilepath(str::Dup(syncfilepath)) {
-    _wstat(syncfilepath, &syncfileTimestamp);
+// state for (re)building the index of a Synchronizer in the background
+struct SyncIndexBuilder {
+    Mutex mutex;
+    SyncIndex* index = nullptr;     // index used for lookups
+    time_t indexTimestamp = 0;      // time stamp of sync file when <index> was built
+    SyncIndex* nextIndex = nullptr; // built in the background, not yet swapped in
+    time_t nextTimestamp = 0;
+    class SyncIndexThread* thread = nullptr;
+    bool threadDone = false;
+
+    ~SyncIndexBuilder() {
+        delete index;
+        delete nextIndex;
+    }
+};
+
+static time_t GetSyncFileTimestamp(const WCHAR* path) {
+    struct _stat stamp;
+    if (_wstat(path, &stamp) != 0) {
+        return 0;
+    }
+    return stamp.st_mtime;
 }
 
-bool Synchronizer::IsIndexDiscarded() const {
-    // was the index manually discarded?
-    if (indexDiscarded) {
-        return true;
+class SyncIndexThread : public ThreadBase {
+    Synchronizer* sync;
+    SyncIndexBuilder* builder;
+
+  public:
+    SyncIndexThread(Synchronizer* sync, SyncIndexBuilder* builder)
+        : ThreadBase("SyncIndexThread"), sync(sync), builder(builder) {
     }
+    ~SyncIndexThread() override = default;
 
-    // has the synchronization file been changed on disk?
-    struct _stat newstamp;
-    if (_wstat(syncfilepath, &newstamp) == 0 && difftime(newstamp.st_mtime, syncfileTimestamp.st_mtime) > 0) {
-        // update time stamp
-        memcpy((void*)&syncfileTimestamp, &newstamp, sizeof(syncfileTimestamp));
-        return true; // the file has changed!
+    void Run() override {
+        SyncIndex* index = sync->BuildIndex();
+        builder->mutex.Lock();
+        delete builder->nextIndex;
+        builder->nextIndex = index;
+        builder->threadDone = true;
+        builder->mutex.Unlock();
     }
+};
 
-    return false;
+Synchronizer::Synchronizer(const WCHAR* syncfilepath) : syncfilepath(str::Dup(syncfilepath)) {
+    builder = new SyncIndexBuilder();
 }
 
-int Synchronizer::RebuildIndex() {
-    indexDiscarded = false;
-    // save sync file timestamp
-    _wstat(syncfilepath, &syncfileTimestamp);
-    return PDFSYNCERR_SUCCESS;
+Synchronizer::~Synchronizer() {
+    WaitForIndexRebuild();
+    delete builder;
+}
+
+// must be called from the destructors of subclasses, as BuildIndex
+// can't be called on a partially destroyed object
+void Synchronizer::WaitForIndexRebuild() {
+    if (builder->thread) {
+        builder->thread->Join();
+        delete builder->thread;
+        builder->thread = nullptr;
+    }
+}
+
+void Synchronizer::StartIndexRebuild() {
+    if (builder->thread) {
+        return;
+    }
+    builder->threadDone = false;
+    // take the time stamp before parsing so that a change during
+    // parsing triggers another rebuild
+    builder->nextTimestamp = GetSyncFileTimestamp(syncfilepath);
+    builder->thread = new SyncIndexThread(this, builder);
+    builder->thread->Start();
+}
+
+SyncIndex* Synchronizer::GetIndex() {
+    auto b = builder;
+    b->mutex.Lock();
+    bool threadDone = b->threadDone;
+    b->mutex.Unlock();
+
+    // without an index, there's nothing to do but wait for the rebuild
+    if (b->thread && (threadDone || !b->index)) {
+        b->thread->Join();
+        delete b->thread;
+        b->thread = nullptr;
+        // swap in the new index, if it could be built
+        if (b->nextIndex) {
+            delete b->index;
+            b->index = b->nextIndex;
+            b->indexTimestamp = b->nextTimestamp;
+            b->nextIndex = nullptr;
+        }
+    }
+
+    if (!b->index) {
+        // (re)try synchronously
+        time_t timestamp = GetSyncFileTimestamp(syncfilepath);
+        b->index = BuildIndex();
+        b->indexTimestamp = timestamp;
+        return b->index;
+    }
+
+    // has the synchronization file been changed on disk?
+    if (!b->thread && difftime(GetSyncFileTimestamp(syncfilepath), b->indexTimestamp) > 0) {
+        StartIndexRebuild();
+    }
+    return b->index;
 }
 
 WCHAR* Synchronizer::PrependDir(const WCHAR* filename) const {
@@ -135,7 +209,9 @@ int Synchronizer::Create(const WCHAR* pdffilename, EngineBase* engine, Synchroni
     AutoFreeWstr syncFile(str::Join(baseName, PDFSYNC_EXTENSION));
     if (file::Exists(syncFile)) {
         *sync = new Pdfsync(syncFile, engine);
-        return *sync ? PDFSYNCERR_SUCCESS : PDFSYNCERR_OUTOFMEMORY;
+        // parse the sync file in the background before the first search
+        (*sync)->StartIndexRebuild();
+        return PDFSYNCERR_SUCCESS;
     }
 
     // check if SYNCTEX or compressed SYNCTEX file is present
@@ -146,7 +222,8 @@ int Synchronizer::Create(const WCHAR* pdffilename, EngineBase* engine, Synchroni
         // due to a bug with synctex_parser.c, this must always be
         // the path to the .synctex file (even if a .synctex.gz file is used instead)
         *sync = new SyncTex(texFile, engine);
-        return *sync ? PDFSYNCERR_SUCCESS : PDFSYNCERR_OUTOFMEMORY;
+        (*sync)->StartIndexRebuild();
+        return PDFSYNCERR_SUCCESS;
     }
 
     return PDFSYNCERR_SYNCFILE_NOTFOUND;
@@ -193,10 +270,10 @@ static char* Advance0Line(char* line, char* end) {
 }
 
 // see http://itexmac.sourceforge.net/pdfsync.html for the specification
-int Pdfsync::RebuildIndex() {
+SyncIndex* Pdfsync::BuildIndex() {
     AutoFree data(file::ReadFile(syncfilepath));
     if (!data.data) {
-        return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
+        return nullptr;
     }
     // convert the file data into a list of zero-terminated strings
     str::TransCharsInPlace(data.data, "\r\n", "\0\0");
@@ -214,15 +291,15 @@ int Pdfsync::RebuildIndex() {
     line = Advance0Line(line, dataEnd);
     UINT versionNumber = 0;
     if (!line || !str::Parse(line, "version %u", &versionNumber) || versionNumber != 1) {
-        return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
+        return nullptr;
     }
 
-    // reset synchronizer database
-    srcfiles.Reset();
-    lines.Reset();
-    points.Reset();
-    fileIndex.Reset();
-    sheetIndex.Reset();
+    auto idx = new PdfsyncIndex();
+    WStrVec& srcfiles = idx->srcfiles;
+    Vec<PdfsyncLine>& lines = idx->lines;
+    Vec<PdfsyncPoint>& points = idx->points;
+    Vec<PdfsyncFileIndex>& fileIndex = idx->fileIndex;
+    Vec<size_t>& sheetIndex = idx->sheetIndex;
 
     Vec<size_t> filestack;
     UINT page = 1;
@@ -317,26 +394,29 @@ int Pdfsync::RebuildIndex() {
     fileIndex.at(0).end = lines.size();
     ReportIf(filestack.size() != 1);
 
-    return Synchronizer::RebuildIndex();
+    idx->BuildPageGrids();
+    idx->BuildLineHash();
+    idx->BuildPointsByRecord();
+    return idx;
 }
 
-// convert a coordinate from the sync file into a PDF coordinate
-#define SYNC_TO_PDF_COORDINATE(c) (c / 65781.76)
-
 static int cmpLineRecords(const void* a, const void* b) {
     return ((PdfsyncLine*)a)->record - ((PdfsyncLine*)b)->record;
 }
 
+static int FloorDiv(int a, int b) {
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
 int Pdfsync::DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) {
-    if (IsIndexDiscarded()) {
-        if (RebuildIndex() != PDFSYNCERR_SUCCESS) {
-            return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
-        }
+    auto idx = (PdfsyncIndex*)GetIndex();
+    if (!idx) {
+        return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
     }
 
     // find the entry in the index corresponding to this page
     UINT nPages = (UINT)engine->PageCount();
-    if (pageNo == 0 || pageNo >= sheetIndex.size() || pageNo > nPages) {
+    if (pageNo == 0 || pageNo >= idx->sheetIndex.size() || pageNo > nPages) {
         return PDFSYNCERR_INVALID_PAGE_NUMBER;
     }
 
@@ -346,49 +426,67 @@ int Pdfsync::DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* li
 
     // distance to the closest pdf location (in the range <PDFSYNC_EPSILON_SQUARE)
     UINT closest_xydist = UINT_MAX;
-    UINT selected_record = UINT_MAX;
+    size_t closest_xydist_idx = (size_t)-1;
     // If no record is found within a distance^2 of PDFSYNC_EPSILON_SQUARE
-    // (selected_record == -1) then we pick up the record that is closest
-    // vertically to the hit-point.
-    UINT closest_ydist = UINT_MAX;        // vertical distance between the hit point and the vertically-closest record
-    UINT closest_xdist = UINT_MAX;        // horizontal distance between the hit point and the vertically-closest record
-    UINT closest_ydist_record = UINT_MAX; // vertically-closest record
-
-    // read all the sections of 'p' declarations for this pdf sheet
-    for (size_t i = sheetIndex.at((size_t)pageNo); i < points.size() && points.at(i).page == pageNo; i++) {
-        // check whether it is closer than the closest point found so far
-        UINT dx = abs(pt.x - (int)SYNC_TO_PDF_COORDINATE(points.at(i).x));
-        UINT dy = abs(pt.y - (int)SYNC_TO_PDF_COORDINATE(points.at(i).y));
-        UINT dist = dx * dx + dy * dy;
-        if (dist < PDFSYNC_EPSILON_SQUARE && dist < closest_xydist) {
-            selected_record = points.at(i).record;
-            closest_xydist = dist;
-        } else if ((closest_xydist == UINT_MAX) && dy < PDFSYNC_EPSILON_Y &&
-                   (dy < closest_ydist || (dy == closest_ydist && dx < closest_xdist))) {
-            closest_ydist_record = points.at(i).record;
-            closest_ydist = dy;
-            closest_xdist = dx;
+    // then we pick up the record that is closest vertically to the hit-point.
+    UINT closest_ydist = UINT_MAX;          // vertical distance between the hit point and the vertically-closest record
+    UINT closest_xdist = UINT_MAX;          // horizontal distance between the hit point and the vertically-closest record
+    size_t closest_ydist_idx = (size_t)-1; // vertically-closest record
+
+    // only look at the cells of this page's grid which can contain points
+    // close enough to the hit point. Ties are resolved in favor of the point
+    // declared first in the sync file
+    const PdfsyncPageGrid& grid = idx->pageGrids.at(pageNo - 1);
+    int rowMin = std::max(0, FloorDiv(pt.y - PDFSYNC_EPSILON_XY - grid.y0, grid.cellSize));
+    int rowMax = std::min(grid.rows - 1, FloorDiv(pt.y + PDFSYNC_EPSILON_XY - grid.y0, grid.cellSize));
+    int colMin = std::max(0, FloorDiv(pt.x - PDFSYNC_EPSILON_XY - grid.x0, grid.cellSize));
+    int colMax = std::min(grid.cols - 1, FloorDiv(pt.x + PDFSYNC_EPSILON_XY - grid.x0, grid.cellSize));
+    for (int row = rowMin; row <= rowMax; row++) {
+        // the vertically-closest record can be anywhere in the row
+        for (int c = 0; c < grid.cols; c++) {
+            size_t cell = grid.firstCell + (size_t)row * grid.cols + c;
+            bool nearCell = colMin <= c && c <= colMax;
+            for (size_t j = idx->cellStart.at(cell); j < idx->cellStart.at(cell + 1); j++) {
+                size_t i = idx->cellPoints.at(j);
+                Point ptRec = idx->pointPos.at(i);
+                UINT dx = abs(pt.x - ptRec.x);
+                UINT dy = abs(pt.y - ptRec.y);
+                UINT dist = dx * dx + dy * dy;
+                if (nearCell && dist < PDFSYNC_EPSILON_SQUARE &&
+                    (dist < closest_xydist || (dist == closest_xydist && i < closest_xydist_idx))) {
+                    closest_xydist_idx = i;
+                    closest_xydist = dist;
+                }
+                if (dy < PDFSYNC_EPSILON_Y &&
+                    (dy < closest_ydist || (dy == closest_ydist && dx < closest_xdist) ||
+                     (dy == closest_ydist && dx == closest_xdist && i < closest_ydist_idx))) {
+                    closest_ydist_idx = i;
+                    closest_ydist = dy;
+                    closest_xdist = dx;
+                }
+            }
         }
     }
 
-    if (selected_record == UINT_MAX) {
-        selected_record = closest_ydist_record;
+    size_t selected = closest_xydist_idx;
+    if (selected == (size_t)-1) {
+        selected = closest_ydist_idx;
     }
-    if (selected_record == UINT_MAX) {
+    if (selected == (size_t)-1) {
         return PDFSYNCERR_NO_SYNC_AT_LOCATION; // no record was found close enough to the hit point
     }
 
     // We have a record number, we need to find its declaration ('l ...') in the syncfile
     PdfsyncLine cmp;
-    cmp.record = selected_record;
+    cmp.record = idx->points.at(selected).record;
     PdfsyncLine* found =
-        (PdfsyncLine*)bsearch(&cmp, lines.LendData(), lines.size(), sizeof(PdfsyncLine), cmpLineRecords);
+        (PdfsyncLine*)bsearch(&cmp, idx->lines.LendData(), idx->lines.size(), sizeof(PdfsyncLine), cmpLineRecords);
     CrashIf(!found);
     if (!found) {
         return PDFSYNCERR_NO_SYNC_AT_LOCATION;
     }
 
-    filename.SetCopy(srcfiles.at(found->file));
+    filename.SetCopy(idx->srcfiles.at(found->file));
     *line = found->line;
     *col = found->column;
 
@@ -405,7 +503,8 @@ int Pdfsync::DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* li
 // (within a range of EPSILON_LINE)
 //
 // The function returns PDFSYNCERR_SUCCESS if a matching record was found.
-UINT Pdfsync::SourceToRecord(const WCHAR* srcfilename, UINT line, __unused UINT col, Vec<size_t>& records) {
+UINT Pdfsync::SourceToRecord(PdfsyncIndex* idx, const WCHAR* srcfilename, UINT line, __unused UINT col,
+                             Vec<size_t>& records) {
     if (!srcfilename) {
         return PDFSYNCERR_INVALID_ARGUMENT;
     }
@@ -423,37 +522,28 @@ UINT Pdfsync::SourceToRecord(const WCHAR* srcfilename, UINT line, __unused UINT
 
     // find the source file entry
     size_t isrc;
-    for (isrc = 0; isrc < srcfiles.size(); isrc++) {
-        if (path::IsSame(srcfilepath, srcfiles.at(isrc))) {
+    for (isrc = 0; isrc < idx->srcfiles.size(); isrc++) {
+        if (path::IsSame(srcfilepath, idx->srcfiles.at(isrc))) {
             break;
         }
     }
-    if (isrc == srcfiles.size()) {
+    if (isrc == idx->srcfiles.size()) {
         return PDFSYNCERR_UNKNOWN_SOURCEFILE;
     }
 
-    if (fileIndex.at(isrc).start == fileIndex.at(isrc).end) {
+    if (idx->fileIndex.at(isrc).start == idx->fileIndex.at(isrc).end) {
         return PDFSYNCERR_NORECORD_IN_SOURCEFILE; // there is not any record declaration for that particular source file
     }
 
-    // look for sections belonging to the specified file
-    // starting with the first section that is declared within the scope of the file.
-    UINT min_distance = EPSILON_LINE; // distance to the closest record
-    size_t lineIx = (size_t)-1;       // closest record-line index
-
-    for (size_t isec = fileIndex.at(isrc).start; isec < fileIndex.at(isrc).end; isec++) {
-        // does this section belong to the desired file?
-        if (lines.at(isec).file != isrc) {
-            continue;
+    // look for the closest line (within EPSILON_LINE) which has a record.
+    // If lines above and below are equally close, the one declared first wins
+    size_t lineIx = (size_t)-1; // closest record-line index
+    for (UINT d = 0; d < EPSILON_LINE && lineIx == (size_t)-1; d++) {
+        if (d <= line) {
+            lineIx = idx->FindLine(isrc, line - d);
         }
-
-        UINT d = abs((int)lines.at(isec).line - (int)line);
-        if (d < min_distance) {
-            min_distance = d;
-            lineIx = isec;
-            if (0 == d) {
-                break; // We have found a record for the requested line!
-            }
+        if (d > 0) {
+            lineIx = std::min(lineIx, idx->FindLine(isrc, line + d));
         }
     }
     if (lineIx == (size_t)-1) {
@@ -461,6 +551,7 @@ UINT Pdfsync::SourceToRecord(const WCHAR* srcfilename, UINT line, __unused UINT
     }
 
     // we read all the consecutive records until we reach a record belonging to another line
+    Vec<PdfsyncLine>& lines = idx->lines;
     for (size_t i = lineIx; i < lines.size() && lines.at(i).line == lines.at(lineIx).line; i++) {
         records.Append(lines.at(i).record);
     }
@@ -469,14 +560,13 @@ UINT Pdfsync::SourceToRecord(const WCHAR* srcfilename, UINT line, __unused UINT
 }
 
 int Pdfsync::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) {
-    if (IsIndexDiscarded()) {
-        if (RebuildIndex() != PDFSYNCERR_SUCCESS) {
-            return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
-        }
+    auto idx = (PdfsyncIndex*)GetIndex();
+    if (!idx) {
+        return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
     }
 
     Vec<size_t> found_records;
-    UINT ret = SourceToRecord(srcfilename, line, col, found_records);
+    UINT ret = SourceToRecord(idx, srcfilename, line, col, found_records);
     if (ret != PDFSYNCERR_SUCCESS || found_records.size() == 0) {
         return ret;
     }
@@ -485,16 +575,17 @@ int Pdfsync::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* pa
 
     // records have been found for the desired source position:
     // we now find the page and positions in the PDF corresponding to these found records
+    Vec<u64> found_points;
+    idx->FindPoints(found_records, found_points);
+
     UINT firstPage = UINT_MAX;
-    for (size_t i = 0; i < points.size(); i++) {
-        if (!found_records.Contains(points.at(i).record)) {
+    for (u64 i : found_points) {
+        PdfsyncPoint& pt = idx->points.at((size_t)i);
+        if (firstPage != UINT_MAX && firstPage != pt.page) {
             continue;
         }
-        if (firstPage != UINT_MAX && firstPage != points.at(i).page) {
-            continue;
-        }
-        firstPage = *page = points.at(i).page;
-        RectF rc(SYNC_TO_PDF_COORDINATE(points.at(i).x), SYNC_TO_PDF_COORDINATE(points.at(i).y), MARK_SIZE, MARK_SIZE);
+        firstPage = *page = pt.page;
+        RectF rc(SYNC_TO_PDF_COORDINATE(pt.x), SYNC_TO_PDF_COORDINATE(pt.y), MARK_SIZE, MARK_SIZE);
         // PdfSync coordinates are y-inversed
         RectF mbox = engine->PageMediabox(firstPage);
         rc.y = mbox.dy - (rc.y + rc.dy);
@@ -510,43 +601,42 @@ int Pdfsync::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* pa
 
 // SYNCTEX synchronizer
 
-int SyncTex::RebuildIndex() {
-    synctex_scanner_free(scanner);
-    scanner = nullptr;
-
+SyncIndex* SyncTex::BuildIndex() {
     AutoFree syncfname(strconv::WstrToAnsiV(syncfilepath));
     if (!syncfname.Get()) {
-        return PDFSYNCERR_OUTOFMEMORY;
+        return nullptr;
     }
 
-    scanner = synctex_scanner_new_with_output_file(syncfname.Get(), nullptr, 1);
+    synctex_scanner_t scanner = synctex_scanner_new_with_output_file(syncfname.Get(), nullptr, 1);
     if (!scanner) {
-        return PDFSYNCERR_SYNCFILE_NOTFOUND; // cannot rebuild the index
+        return nullptr; // cannot rebuild the index
     }
 
-    return Synchronizer::RebuildIndex();
+    auto idx = new SyncTexIndex();
+    idx->scanner = scanner;
+    return idx;
 }
 
 int SyncTex::DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) {
-    if (IsIndexDiscarded()) {
-        if (RebuildIndex() != PDFSYNCERR_SUCCESS) {
-            return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
-        }
+    auto idx = (SyncTexIndex*)GetIndex();
+    if (!idx) {
+        return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
     }
-    CrashIf(!this->scanner);
+    synctex_scanner_t scanner = idx->scanner;
+    CrashIf(!scanner);
 
-    // Coverity: at this point, this->scanner->flags.has_parsed == 1 and thus
+    // Coverity: at this point, scanner->flags.has_parsed == 1 and thus
     // synctex_scanner_parse never gets the chance to freeing the scanner
-    if (synctex_edit_query(this->scanner, pageNo, (float)pt.x, (float)pt.y) <= 0) {
+    if (synctex_edit_query(scanner, pageNo, (float)pt.x, (float)pt.y) <= 0) {
         return PDFSYNCERR_NO_SYNC_AT_LOCATION;
     }
 
-    synctex_node_t node = synctex_next_result(this->scanner);
+    synctex_node_t node = synctex_next_result(scanner);
     if (!node) {
         return PDFSYNCERR_NO_SYNC_AT_LOCATION;
     }
 
-    const char* name = synctex_scanner_get_name(this->scanner, synctex_node_tag(node));
+    const char* name = synctex_scanner_get_name(scanner, synctex_node_tag(node));
     if (!name) {
         return PDFSYNCERR_UNKNOWN_SOURCEFILE;
     }
@@ -579,12 +669,12 @@ TryAgainAnsi:
 }
 
 int SyncTex::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) {
-    if (IsIndexDiscarded()) {
-        if (RebuildIndex() != PDFSYNCERR_SUCCESS) {
-            return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
-        }
+    auto idx = (SyncTexIndex*)GetIndex();
+    if (!idx) {
+        return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
     }
-    CrashIf(!this->scanner);
+    synctex_scanner_t scanner = idx->scanner;
+    CrashIf(!scanner);
 
     AutoFreeWstr srcfilepath;
     // convert the source file to an absolute path
@@ -603,7 +693,7 @@ TryAgainAnsi:
     if (!mb_srcfilepath) {
         return PDFSYNCERR_OUTOFMEMORY;
     }
-    int ret = synctex_display_query(this->scanner, mb_srcfilepath, line, col);
+    int ret = synctex_display_query(scanner, mb_srcfilepath, line, col);
     str::Free(mb_srcfilepath);
     // recent SyncTeX versions encode in UTF-8 instead of ANSI
     if (isUtf8 && -1 == ret) {
@@ -623,7 +713,7 @@ TryAgainAnsi:
     int firstpage = -1;
     rects.Reset();
 
-    while ((node = synctex_next_result(this->scanner)) != nullptr) {
+    while ((node = synctex_next_result(scanner)) != nullptr) {
         if (firstpage == -1) {
             firstpage = synctex_node_page(node);
             if (firstpage <= 0 || firstpage > engine->PageCount()) {
@@ -20,10 +20,17 @@ enum {
 
 class EngineBase;
 
+// parsed content of a synchronization file, specific to a Synchronizer
+struct SyncIndex {
+    virtual ~SyncIndex() = default;
+};
+
+struct SyncIndexBuilder;
+
 class Synchronizer {
   public:
     explicit Synchronizer(const WCHAR* syncfilepath);
-    virtual ~Synchronizer() = default;
+    virtual ~Synchronizer();
 
     // Inverse-search:
     //  - pageNo: page number in the PDF (starting from 1)
@@ -41,14 +48,20 @@ class Synchronizer {
     // the caller must free() the command line
     WCHAR* PrepareCommandline(const WCHAR* pattern, const WCHAR* filename, UINT line, UINT col);
 
+    // parses the synchronization file. Called on a background thread,
+    // returns nullptr if the file can't be parsed
+    virtual SyncIndex* BuildIndex() = 0;
+
   private:
-    bool indexDiscarded; // true if the index needs to be recomputed (needs to be set to true when a change to the
-                         // pdfsync file is detected)
-    struct _stat syncfileTimestamp; // time stamp of sync file when index was last built
+    SyncIndexBuilder* builder = nullptr;
 
   protected:
-    [[nodiscard]] bool IsIndexDiscarded() const;
-    int RebuildIndex();
+    // returns the most recent index (nullptr if it can't be built). If the
+    // synchronization file changes, a new index is built on a background thread
+    // and swapped in once it's complete, the previous index is used until then
+    SyncIndex* GetIndex();
+    void StartIndexRebuild();
+    void WaitForIndexRebuild();
     WCHAR* PrependDir(const WCHAR* filename) const;
 
     AutoFreeWstr syncfilepath; // path to the synchronization file
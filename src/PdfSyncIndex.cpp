@@ -0,0 +1,162 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+
+#include "PdfSync.h"
+#include "PdfSyncIndex.h"
+
+// minimum size of a cell of the per-page point grid (must be > PDFSYNC_EPSILON_XY in PdfSync.cpp)
+#define PDFSYNC_GRID_CELL_SIZE 32
+// maximum number of columns and rows of the per-page point grid
+#define PDFSYNC_GRID_MAX_CELLS 256
+
+void PdfsyncIndex::BuildPageGrids() {
+    for (size_t i = 0; i < points.size(); i++) {
+        int x = (int)SYNC_TO_PDF_COORDINATE(points.at(i).x);
+        int y = (int)SYNC_TO_PDF_COORDINATE(points.at(i).y);
+        pointPos.Append(Point(x, y));
+    }
+
+    // DocToSource looks at the points following the start of sheet <pageNo>
+    // for as long as they are on page <pageNo>
+    Vec<size_t> cellCount;
+    for (size_t pageNo = 1; pageNo < sheetIndex.size(); pageNo++) {
+        PdfsyncPageGrid grid{};
+        grid.start = grid.end = sheetIndex.at(pageNo);
+        while (grid.end < points.size() && points.at(grid.end).page == pageNo) {
+            grid.end++;
+        }
+
+        int minX = INT_MAX, minY = INT_MAX, maxX = INT_MIN, maxY = INT_MIN;
+        for (size_t i = grid.start; i < grid.end; i++) {
+            Point pt = pointPos.at(i);
+            minX = std::min(minX, pt.x);
+            minY = std::min(minY, pt.y);
+            maxX = std::max(maxX, pt.x);
+            maxY = std::max(maxY, pt.y);
+        }
+        if (grid.start == grid.end) {
+            minX = minY = maxX = maxY = 0;
+        }
+        int extent = std::max(maxX - minX, maxY - minY);
+        grid.cellSize = std::max(PDFSYNC_GRID_CELL_SIZE, extent / PDFSYNC_GRID_MAX_CELLS + 1);
+        grid.x0 = minX;
+        grid.y0 = minY;
+        grid.cols = (maxX - minX) / grid.cellSize + 1;
+        grid.rows = (maxY - minY) / grid.cellSize + 1;
+        grid.firstCell = cellStart.size();
+
+        // counting sort of the page's points into cells, keeping points in file order
+        size_t nCells = (size_t)grid.cols * grid.rows;
+        cellCount.Reset();
+        memset(cellCount.AppendBlanks(nCells), 0, nCells * sizeof(size_t));
+        for (size_t i = grid.start; i < grid.end; i++) {
+            Point pt = pointPos.at(i);
+            int col = (pt.x - grid.x0) / grid.cellSize;
+            int row = (pt.y - grid.y0) / grid.cellSize;
+            cellCount.at(row * grid.cols + col)++;
+        }
+        size_t offset = cellPoints.size();
+        for (size_t c = 0; c < nCells; c++) {
+            cellStart.Append(offset);
+            offset += cellCount.at(c);
+            cellCount.at(c) = cellStart.Last();
+        }
+        cellStart.Append(offset);
+        cellPoints.AppendBlanks(grid.end - grid.start);
+        for (size_t i = grid.start; i < grid.end; i++) {
+            Point pt = pointPos.at(i);
+            int col = (pt.x - grid.x0) / grid.cellSize;
+            int row = (pt.y - grid.y0) / grid.cellSize;
+            cellPoints.at(cellCount.at(row * grid.cols + col)++) = i;
+        }
+        pageGrids.Append(grid);
+    }
+}
+
+static u32 HashSyncLine(size_t file, UINT line) {
+    u32 key[2] = {(u32)file, (u32)line};
+    return MurmurHash2(key, sizeof(key));
+}
+
+void PdfsyncIndex::BuildLineHash() {
+    size_t nSlots = 16;
+    while (nSlots < lines.size() * 2) {
+        nSlots *= 2;
+    }
+    lineHash.AppendBlanks(nSlots);
+    for (size_t i = 0; i < nSlots; i++) {
+        lineHash.at(i) = (size_t)-1;
+    }
+    for (size_t i = 0; i < lines.size(); i++) {
+        PdfsyncLine& l = lines.at(i);
+        size_t slot = HashSyncLine(l.file, l.line) & (nSlots - 1);
+        while (lineHash.at(slot) != (size_t)-1) {
+            PdfsyncLine& other = lines.at(lineHash.at(slot));
+            if (other.file == l.file && other.line == l.line) {
+                break;
+            }
+            slot = (slot + 1) & (nSlots - 1);
+        }
+        // only remember the first record for a given line
+        if (lineHash.at(slot) == (size_t)-1) {
+            lineHash.at(slot) = i;
+        }
+    }
+}
+
+// returns the first index into <lines> for the given file and line or (size_t)-1
+size_t PdfsyncIndex::FindLine(size_t file, UINT line) const {
+    size_t nSlots = lineHash.size();
+    size_t slot = HashSyncLine(file, line) & (nSlots - 1);
+    while (lineHash.at(slot) != (size_t)-1) {
+        PdfsyncLine& l = lines.at(lineHash.at(slot));
+        if (l.file == file && l.line == line) {
+            return lineHash.at(slot);
+        }
+        slot = (slot + 1) & (nSlots - 1);
+    }
+    return (size_t)-1;
+}
+
+static int cmpU64(const u64* a, const u64* b) {
+    return *a < *b ? -1 : *a > *b ? 1 : 0;
+}
+
+void PdfsyncIndex::BuildPointsByRecord() {
+    for (size_t i = 0; i < points.size(); i++) {
+        pointsByRecord.Append(((u64)points.at(i).record << 32) | (u32)i);
+    }
+    pointsByRecord.SortTyped(cmpU64);
+}
+
+// collects the indexes into <points> of all points of the given records,
+// without duplicates and in the order in which they're declared
+void PdfsyncIndex::FindPoints(const Vec<size_t>& records, Vec<u64>& found) const {
+    for (size_t record : records) {
+        // binary search for the first point of this record
+        size_t lo = 0, hi = pointsByRecord.size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if ((pointsByRecord.at(mid) >> 32) < record) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        for (; lo < pointsByRecord.size() && (pointsByRecord.at(lo) >> 32) == record; lo++) {
+            found.Append(pointsByRecord.at(lo) & 0xFFFFFFFF);
+        }
+    }
+
+    // a record can be listed more than once, so sort and drop the duplicates
+    found.SortTyped(cmpU64);
+    size_t n = 0;
+    for (size_t i = 0; i < found.size(); i++) {
+        if (n == 0 || found.at(i) != found.at(n - 1)) {
+            found.at(n++) = found.at(i);
+        }
+    }
+    found.RemoveAt(n, found.size() - n);
+}
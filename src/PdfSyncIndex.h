@@ -0,0 +1,57 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+// lookup tables built over the records of a .pdfsync file
+
+// convert a coordinate from the sync file into a PDF coordinate
+#define SYNC_TO_PDF_COORDINATE(c) (c / 65781.76)
+
+struct PdfsyncFileIndex {
+    size_t start, end; // first and one-after-last index of lines associated with a file
+};
+
+struct PdfsyncLine {
+    UINT record; // index for mapping line(s) to point(s)
+    size_t file; // index into srcfiles
+    UINT line, column;
+};
+
+struct PdfsyncPoint {
+    UINT record; // index for mapping point(s) to line(s)
+    UINT page, x, y;
+};
+
+// uniform grid over the points of a page, for quickly finding the points
+// close to a given position
+struct PdfsyncPageGrid {
+    size_t start, end; // first and one-after-last index of the page's points
+    int x0, y0;        // PDF coordinates of the top-left corner of the first cell
+    int cellSize;
+    int cols, rows;
+    size_t firstCell; // index into PdfsyncIndex::cellStart
+};
+
+struct PdfsyncIndex : SyncIndex {
+    WStrVec srcfiles;                // source file names
+    Vec<PdfsyncLine> lines;          // record-to-line mapping
+    Vec<PdfsyncPoint> points;        // record-to-point mapping
+    Vec<PdfsyncFileIndex> fileIndex; // start and end of entries for a file in <lines>
+    Vec<size_t> sheetIndex;          // start of entries for a sheet in <points>
+
+    // points in PDF coordinates (same order as <points>)
+    Vec<Point> pointPos;
+    // pageGrids[pageNo - 1] is the grid for page pageNo
+    Vec<PdfsyncPageGrid> pageGrids;
+    // cell c of a grid contains cellPoints[cellStart[c]] to cellPoints[cellStart[c + 1] - 1]
+    Vec<size_t> cellStart;
+    Vec<size_t> cellPoints;
+    // open addressing hash table mapping (file, line) to the first index into <lines>
+    Vec<size_t> lineHash;
+    // (record << 32 | index into <points>) for all points, sorted
+    Vec<u64> pointsByRecord;
+
+    void BuildPageGrids();
+    void BuildLineHash();
+    void BuildPointsByRecord();
+    [[nodiscard]] size_t FindLine(size_t file, UINT line) const;
+    void FindPoints(const Vec<size_t>& records, Vec<u64>& found) const;
+};
@@ -2,9 +2,11 @@
    License: GPLv3 */
 
 #include "utils/BaseUtil.h"
+#include <zlib.h>
 #include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
 #include "utils/Timer.h"
+#include "utils/Trace.h"
 
 #include "wingui/TreeModel.h"
 
@@ -54,6 +56,7 @@ RenderCache::~RenderCache() {
     CloseHandle(renderThread);
     CloseHandle(startRendering);
     CrashIf(curReq || 0 != requestCount || 0 != cacheCount);
+    DropCompressed();
 
     LeaveCriticalSection(&cacheAccess);
     DeleteCriticalSection(&cacheAccess);
@@ -135,6 +138,7 @@ static bool FreeIfFull(RenderCache* rc, const PageRenderRequest& req) {
     for (int i = 0; i < n; i++) {
         auto entry = rc->cache[i];
         if (entry->dm == dm && !dm->PageVisibleNearby(entry->pageNo)) {
+            rc->KeepCompressed(entry);
             bool didDrop = rc->DropCacheEntry(entry);
             if (didDrop) {
                 return true;
@@ -152,6 +156,7 @@ static bool FreeIfFull(RenderCache* rc, const PageRenderRequest& req) {
             // in a different window, but it's harder to detect
             continue;
         }
+        rc->KeepCompressed(entry);
         bool didDrop = rc->DropCacheEntry(entry);
         if (didDrop) {
             return true;
@@ -181,6 +186,15 @@ void RenderCache::Add(PageRenderRequest& req, RenderedBitmap* bmp) {
     cacheCount++;
 }
 
+// adds a tile without content which is painted in fillColor
+void RenderCache::AddBlank(PageRenderRequest& req, COLORREF fillColor) {
+    ScopedCritSec scope(&cacheAccess);
+    Add(req, nullptr);
+    BitmapCacheEntry* entry = cache[cacheCount - 1];
+    entry->isBlank = true;
+    entry->fillColor = fillColor;
+}
+
 static RectF GetTileRect(RectF pagerect, TilePosition tile) {
     CrashIf(tile.res > 30);
     RectF rect;
@@ -224,7 +238,7 @@ static bool IsTileVisible(DisplayModel* dm, int pageNo, TilePosition tile, float
     }
     int rotation = dm->GetRotation();
     float zoom = dm->GetZoomReal(pageNo);
-    Rect r = pageInfo->pageOnScreen;
+    Rect r = dm->GetPageOnScreen(pageNo);
     Rect tileOnScreen = GetTileOnScreen(engine, pageNo, rotation, zoom, tile, r);
     // consider nearby tiles visible depending on the fuzz factor
     tileOnScreen.x -= (int)(tileOnScreen.dx * fuzz * 0.5);
@@ -267,6 +281,9 @@ void RenderCache::FreePage(DisplayModel* dm, int pageNo, TilePosition* tile) {
             }
         }
         if (shouldFree) {
+            if (!dm) {
+                KeepCompressed(entry);
+            }
             DropCacheEntry(entry);
         }
     }
@@ -274,16 +291,411 @@ void RenderCache::FreePage(DisplayModel* dm, int pageNo, TilePosition* tile) {
 
 void RenderCache::FreeForDisplayModel(DisplayModel* dm) {
     FreePage(dm);
+    DropCompressed(dm);
+    DropContentBoxes(dm);
 }
 
 void RenderCache::FreeNotVisible() {
     FreePage();
 }
 
+static size_t CompressedBitmapSize(CompressedBitmap* cb) {
+    return sizeof(CompressedBitmap) + cb->dataLen;
+}
+
+// hands the bitmap of an up-to-date entry which is about to be dropped
+// over to the rendering thread for compression
+void RenderCache::KeepCompressed(BitmapCacheEntry* entry) {
+    ScopedCritSec scope(&cacheAccess);
+    // only keep bitmaps which are actually deleted when dropping the entry
+    if (entry->refs != 1 || entry->outOfDate || !entry->bitmap || entry->zoom == INVALID_ZOOM) {
+        return;
+    }
+    if (FindCompressed(entry->dm, entry->pageNo, entry->rotation, entry->zoom, entry->tile) >= 0) {
+        return;
+    }
+    int nPending = 0;
+    for (CompressedBitmap* cb : compressed) {
+        nPending += cb->bitmap ? 1 : 0;
+    }
+    if (nPending >= MAX_BITMAPS_TO_COMPRESS) {
+        return;
+    }
+
+    auto cb = new CompressedBitmap();
+    cb->dm = entry->dm;
+    cb->pageNo = entry->pageNo;
+    cb->rotation = entry->rotation;
+    cb->zoom = entry->zoom;
+    cb->tile = entry->tile;
+    cb->textColor = textColor;
+    cb->backgroundColor = backgroundColor;
+    cb->bitmap = entry->bitmap;
+    entry->bitmap = nullptr;
+    compressed.Append(cb);
+    SetEvent(startRendering);
+}
+
+// returns the index of a compressed bitmap rendered with the current colors (or -1)
+int RenderCache::FindCompressed(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition tile) {
+    ScopedCritSec scope(&cacheAccess);
+    for (int i = 0; i < compressed.isize(); i++) {
+        CompressedBitmap* cb = compressed.at(i);
+        if (cb->dm == dm && cb->pageNo == pageNo && cb->rotation == rotation && cb->zoom == zoom &&
+            cb->tile == tile && cb->textColor == textColor && cb->backgroundColor == backgroundColor) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// stores bitmaps with at most 256 colors as palette indices
+// packed into as few bits as possible (lowest bits first)
+static bool CompressAsPalette(CompressedBitmap* cb, const u32* pixels, size_t nPixels) {
+    // hash table mapping colors to palette indices
+    constexpr int kSlots = 1024;
+    u32 keys[kSlots];
+    i16 slotIdxs[kSlots];
+    for (int i = 0; i < kSlots; i++) {
+        slotIdxs[i] = -1;
+    }
+
+    ScopedMem<u8> idxs(AllocArray<u8>(nPixels));
+    if (!idxs) {
+        return false;
+    }
+    int paletteSize = 0;
+    u32 lastColor = 0;
+    int lastIdx = -1;
+    for (size_t i = 0; i < nPixels; i++) {
+        u32 c = pixels[i];
+        if (c != lastColor || lastIdx < 0) {
+            uint slot = (c * 2654435761u) >> 22;
+            while (slotIdxs[slot] >= 0 && keys[slot] != c) {
+                slot = (slot + 1) & (kSlots - 1);
+            }
+            if (slotIdxs[slot] < 0) {
+                if (paletteSize == 256) {
+                    return false;
+                }
+                keys[slot] = c;
+                slotIdxs[slot] = (i16)paletteSize;
+                cb->palette[paletteSize++] = c;
+            }
+            lastColor = c;
+            lastIdx = slotIdxs[slot];
+        }
+        idxs.Get()[i] = (u8)lastIdx;
+    }
+
+    int bpp = paletteSize <= 2 ? 1 : paletteSize <= 4 ? 2 : paletteSize <= 16 ? 4 : 8;
+    if (bpp == 8) {
+        cb->data = idxs.StealData();
+        cb->dataLen = nPixels;
+    } else {
+        size_t dataLen = (nPixels * bpp + 7) / 8;
+        u8* data = AllocArray<u8>(dataLen);
+        if (!data) {
+            return false;
+        }
+        for (size_t i = 0; i < nPixels; i++) {
+            size_t bit = i * bpp;
+            data[bit >> 3] |= (u8)(idxs.Get()[i] << (bit & 7));
+        }
+        cb->data = data;
+        cb->dataLen = dataLen;
+    }
+    cb->bitsPerPixel = bpp;
+    cb->paletteSize = paletteSize;
+    return true;
+}
+
+static bool CompressAsDeflate(CompressedBitmap* cb, const u32* pixels, size_t nPixels) {
+    size_t srcLen = nPixels * sizeof(u32);
+    // not worth keeping if it doesn't compress at least by half
+    size_t maxLen = srcLen / 2;
+    u8* data = AllocArray<u8>(maxLen);
+    if (!data) {
+        return false;
+    }
+    z_stream zs{};
+    if (deflateInit(&zs, Z_BEST_SPEED) != Z_OK) {
+        free(data);
+        return false;
+    }
+    zs.next_in = (Bytef*)pixels;
+    zs.avail_in = (uInt)srcLen;
+    zs.next_out = data;
+    zs.avail_out = (uInt)maxLen;
+    int res = deflate(&zs, Z_FINISH);
+    deflateEnd(&zs);
+    if (res != Z_STREAM_END) {
+        free(data);
+        return false;
+    }
+    cb->dataLen = zs.total_out;
+    cb->data = (u8*)realloc(data, cb->dataLen);
+    if (!cb->data) {
+        cb->data = data;
+    }
+    cb->bitsPerPixel = 32;
+    return true;
+}
+
+static bool CompressBitmap(CompressedBitmap* cb) {
+    Size size = cb->bitmap->Size();
+    size_t nPixels = (size_t)size.dx * (size_t)size.dy;
+    if (nPixels == 0 || nPixels > INT_MAX / sizeof(u32)) {
+        return false;
+    }
+    ScopedMem<u32> pixels(AllocArray<u32>(nPixels));
+    if (!pixels) {
+        return false;
+    }
+
+    BITMAPINFO bmi{};
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = size.dx;
+    bmi.bmiHeader.biHeight = -size.dy;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    HDC hdc = GetDC(nullptr);
+    int nLines = GetDIBits(hdc, cb->bitmap->GetBitmap(), 0, size.dy, pixels.Get(), &bmi, DIB_RGB_COLORS);
+    ReleaseDC(nullptr, hdc);
+    if (nLines != size.dy) {
+        return false;
+    }
+    // ignore the (unused) alpha channel
+    for (size_t i = 0; i < nPixels; i++) {
+        pixels.Get()[i] &= 0xFFFFFF;
+    }
+
+    cb->size = size;
+    return CompressAsPalette(cb, pixels.Get(), nPixels) || CompressAsDeflate(cb, pixels.Get(), nPixels);
+}
+
+static RenderedBitmap* DecompressBitmap(CompressedBitmap* cb) {
+    int w = cb->size.dx;
+    int h = cb->size.dy;
+    bool isPalette = cb->bitsPerPixel <= 8;
+    int stride = isPalette ? ((w + 3) / 4) * 4 : w * 4;
+
+    ScopedMem<BITMAPINFO> bmi((BITMAPINFO*)calloc(1, sizeof(BITMAPINFO) + 255 * sizeof(RGBQUAD)));
+    BITMAPINFOHEADER* bmih = &bmi.Get()->bmiHeader;
+    bmih->biSize = sizeof(*bmih);
+    bmih->biWidth = w;
+    bmih->biHeight = -h;
+    bmih->biPlanes = 1;
+    bmih->biCompression = BI_RGB;
+    bmih->biBitCount = isPalette ? 8 : 32;
+    bmih->biSizeImage = (DWORD)stride * h;
+    if (isPalette) {
+        bmih->biClrUsed = cb->paletteSize;
+        memcpy(bmi.Get()->bmiColors, cb->palette, cb->paletteSize * sizeof(u32));
+    }
+
+    void* bits = nullptr;
+    HBITMAP hbmp = CreateDIBSection(nullptr, bmi, DIB_RGB_COLORS, &bits, nullptr, 0);
+    if (!hbmp) {
+        return nullptr;
+    }
+
+    bool ok = true;
+    if (isPalette) {
+        int bpp = cb->bitsPerPixel;
+        u8 mask = (u8)((1 << bpp) - 1);
+        size_t bit = 0;
+        for (int y = 0; y < h; y++) {
+            u8* row = (u8*)bits + (size_t)y * stride;
+            for (int x = 0; x < w; x++) {
+                row[x] = (cb->data[bit >> 3] >> (bit & 7)) & mask;
+                bit += bpp;
+            }
+        }
+    } else {
+        z_stream zs{};
+        ok = inflateInit(&zs) == Z_OK;
+        if (ok) {
+            zs.next_in = cb->data;
+            zs.avail_in = (uInt)cb->dataLen;
+            zs.next_out = (Bytef*)bits;
+            zs.avail_out = bmih->biSizeImage;
+            ok = inflate(&zs, Z_FINISH) == Z_STREAM_END;
+            inflateEnd(&zs);
+        }
+    }
+    if (!ok) {
+        DeleteObject(hbmp);
+        return nullptr;
+    }
+    return new RenderedBitmap(hbmp, cb->size);
+}
+
+// returns a bitmap for req if it has been dropped from the cache before
+RenderedBitmap* RenderCache::RestoreCompressed(PageRenderRequest& req) {
+    CompressedBitmap* cb = nullptr;
+    int gen = 0;
+    {
+        ScopedCritSec scope(&cacheAccess);
+        int idx = FindCompressed(req.dm, req.pageNo, NormalizeRotation(req.rotation), req.zoom, req.tile);
+        if (idx < 0) {
+            return nullptr;
+        }
+        cb = compressed.PopAt(idx);
+        if (cb->bitmap) {
+            // not compressed yet
+            RenderedBitmap* bmp = cb->bitmap;
+            cb->bitmap = nullptr;
+            delete cb;
+            return bmp;
+        }
+        compressedSize -= CompressedBitmapSize(cb);
+        gen = compressedGen;
+    }
+
+    // don't block painting while decompressing
+    RenderedBitmap* bmp;
+    {
+        trace::Scope traceScope("RenderCache: decompress", cb->pageNo);
+        bmp = DecompressBitmap(cb);
+    }
+
+    ScopedCritSec scope(&cacheAccess);
+    if (!bmp || gen != compressedGen) {
+        delete cb;
+        return bmp;
+    }
+    // keep it as the most recently used, for when it's dropped again
+    compressed.Append(cb);
+    compressedSize += CompressedBitmapSize(cb);
+    return bmp;
+}
+
+// compresses the least recently dropped bitmap, returns false if there's none
+bool RenderCache::CompressNextBitmap() {
+    CompressedBitmap* cb = nullptr;
+    int gen = 0;
+    {
+        ScopedCritSec scope(&cacheAccess);
+        for (int i = 0; i < compressed.isize() && !cb; i++) {
+            if (compressed.at(i)->bitmap) {
+                cb = compressed.PopAt(i);
+            }
+        }
+        if (!cb) {
+            return false;
+        }
+        gen = compressedGen;
+    }
+
+    bool ok;
+    {
+        trace::Scope traceScope("RenderCache: compress", cb->pageNo);
+        ok = CompressBitmap(cb);
+    }
+    delete cb->bitmap;
+    cb->bitmap = nullptr;
+
+    ScopedCritSec scope(&cacheAccess);
+    if (!ok || gen != compressedGen || FindCompressed(cb->dm, cb->pageNo, cb->rotation, cb->zoom, cb->tile) >= 0) {
+        delete cb;
+        return true;
+    }
+    compressed.Append(cb);
+    compressedSize += CompressedBitmapSize(cb);
+
+    // drop the least recently used bitmaps when over budget
+    for (int i = 0; compressedSize > MAX_COMPRESSED_CACHE_SIZE && i < compressed.isize();) {
+        CompressedBitmap* old = compressed.at(i);
+        if (old->bitmap) {
+            i++;
+            continue;
+        }
+        compressed.RemoveAt(i);
+        compressedSize -= CompressedBitmapSize(old);
+        delete old;
+    }
+    return true;
+}
+
+// drops the compressed bitmaps of a page, of a DisplayModel or all of them
+void RenderCache::DropCompressed(DisplayModel* dm, int pageNo) {
+    ScopedCritSec scope(&cacheAccess);
+    compressedGen++;
+    for (int i = compressed.isize() - 1; i >= 0; i--) {
+        CompressedBitmap* cb = compressed.at(i);
+        if (dm && (cb->dm != dm || (pageNo != INVALID_PAGE_NO && cb->pageNo != pageNo))) {
+            continue;
+        }
+        compressed.RemoveAt(i);
+        if (!cb->bitmap) {
+            compressedSize -= CompressedBitmapSize(cb);
+        }
+        delete cb;
+    }
+}
+
+// PageContentBox is expensive, so remember it for the most recently rendered pages
+RectF RenderCache::GetContentBox(DisplayModel* dm, int pageNo) {
+    int gen = 0;
+    {
+        ScopedCritSec scope(&cacheAccess);
+        for (CachedContentBox& cb : contentBoxes) {
+            if (cb.dm == dm && cb.pageNo == pageNo) {
+                return cb.box;
+            }
+        }
+        gen = contentBoxesGen;
+    }
+
+    RectF box = dm->GetEngine()->PageContentBox(pageNo);
+
+    ScopedCritSec scope(&cacheAccess);
+    if (gen == contentBoxesGen) {
+        if (contentBoxes.isize() >= MAX_CONTENT_BOXES_CACHED) {
+            contentBoxes.RemoveAt(0);
+        }
+        contentBoxes.Append({dm, pageNo, box});
+    }
+    return box;
+}
+
+// tiles of zoomed in pages often only cover the page's margin and
+// don't have to be rendered at all
+bool RenderCache::IsBlankTile(PageRenderRequest& req) {
+    // only engines with clip optimizations have precise content boxes
+    if (req.tile.res == 0 || req.tile.res == INVALID_TILE_RES ||
+        !req.dm->GetEngine()->HasClipOptimizations(req.pageNo)) {
+        return false;
+    }
+    RectF contentBox = GetContentBox(req.dm, req.pageNo);
+    if (contentBox.IsEmpty()) {
+        return true;
+    }
+    // leave room for anti-aliasing at the content's edges
+    float margin = 2.f / req.zoom;
+    contentBox.Inflate(margin, margin);
+    return contentBox.Intersect(req.pageRect).IsEmpty();
+}
+
+void RenderCache::DropContentBoxes(DisplayModel* dm, int pageNo) {
+    ScopedCritSec scope(&cacheAccess);
+    contentBoxesGen++;
+    for (int i = contentBoxes.isize() - 1; i >= 0; i--) {
+        CachedContentBox& cb = contentBoxes.at(i);
+        if (cb.dm == dm && (pageNo == INVALID_PAGE_NO || cb.pageNo == pageNo)) {
+            contentBoxes.RemoveAt(i);
+        }
+    }
+}
+
 // keep the cached bitmaps for visible pages to avoid flickering during a reload.
 // mark invisible pages as out-of-date to prevent inconsistencies
 void RenderCache::KeepForDisplayModel(DisplayModel* oldDm, DisplayModel* newDm) {
     ScopedCritSec scope(&cacheAccess);
+    DropCompressed(oldDm);
+    DropContentBoxes(oldDm);
     for (int i = 0; i < cacheCount; i++) {
         BitmapCacheEntry* entry = cache[i];
         if (entry->dm != oldDm) {
@@ -308,6 +720,8 @@ void RenderCache::Invalidate(DisplayModel* dm, int pageNo, RectF rect) {
     }
 
     ScopedCritSec scopeCache(&cacheAccess);
+    DropCompressed(dm, pageNo);
+    DropContentBoxes(dm, pageNo);
 
     RectF mediabox = dm->GetEngine()->PageMediabox(pageNo);
     for (int i = 0; i < cacheCount; i++) {
@@ -410,6 +824,33 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo) {
     }
 }
 
+/* Render a page which is about to become visible. If zoom is lower than the
+   page's zoom or the page would be split into several tiles, only a single
+   tile is rendered at a (further) reduced zoom, to be painted as a
+   preview until the page has been rendered for real */
+void RenderCache::RequestPrefetch(DisplayModel* dm, int pageNo, float zoom) {
+    USHORT res = GetTileRes(dm, pageNo);
+    float pageZoom = dm->GetZoomReal(pageNo);
+    if (zoom >= pageZoom && res <= 1) {
+        RequestRendering(dm, pageNo);
+        return;
+    }
+    zoom = std::min(zoom, pageZoom / (float)(1 << res));
+
+    ScopedCritSec scope(&requestAccess);
+    if (dm->dontRenderFlag) {
+        return;
+    }
+    TilePosition tile(0, 0, 0);
+    int rotation = NormalizeRotation(dm->GetRotation());
+    // any rendering of the whole page will do as a preview
+    if (GetRenderDelay(dm, pageNo, tile) != RENDER_DELAY_UNDEFINED ||
+        Exists(dm, pageNo, rotation, INVALID_ZOOM, &tile)) {
+        return;
+    }
+    Render(dm, pageNo, rotation, zoom, &tile);
+}
+
 /* Render a bitmap for page <pageNo> in <dm>. */
 void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition tile, bool clearQueueForPage) {
     logf("RenderCache::RequestRendering(): pageNo %d\n", pageNo);
@@ -523,6 +964,7 @@ bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
     newRequest->abortCookie = nullptr;
     newRequest->timestamp = GetTickCount();
     newRequest->renderCb = renderCb;
+    trace::Instant("RenderCache: enqueue", pageNo);
 
     SetEvent(startRendering);
 
@@ -557,6 +999,7 @@ bool RenderCache::GetNextRequest(PageRenderRequest* req) {
     requestCount--;
     *req = requests[requestCount];
     curReq = req;
+    trace::Instant("RenderCache: dequeue", req->pageNo);
     CrashIf(requestCount < 0);
     CrashIf(req->abort);
 
@@ -634,9 +1077,14 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
     RenderCache* cache = (RenderCache*)data;
     PageRenderRequest req;
     RenderedBitmap* bmp;
+    trace::SetThreadName("RenderCache");
 
     for (;;) {
         if (cache->ClearCurrentRequest()) {
+            // use the idle time for compressing dropped bitmaps
+            if (cache->CompressNextBitmap()) {
+                continue;
+            }
             DWORD waitResult = WaitForSingleObject(cache->startRendering, INFINITE);
             // Is it not a page render request?
             if (WAIT_OBJECT_0 != waitResult) {
@@ -668,8 +1116,31 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
 
         CrashIf(req.abortCookie != nullptr);
         EngineBase* engine = req.dm->GetEngine();
+        if (!req.renderCb && cache->IsBlankTile(req)) {
+            bool keepColors = engine->IsImageCollection();
+            cache->AddBlank(req, keepColors ? WIN_COL_WHITE : cache->backgroundColor);
+            cache->blankTilesElided++;
+            req.dm->RepaintDisplay();
+            continue;
+        }
+        if (!req.renderCb) {
+            // bitmaps dropped from the cache don't have to be rendered again
+            bmp = cache->RestoreCompressed(req);
+            if (bmp && req.abort) {
+                delete bmp;
+                continue;
+            }
+            if (bmp) {
+                cache->Add(req, bmp);
+                req.dm->RepaintDisplay();
+                continue;
+            }
+        }
         RenderPageArgs args(req.pageNo, req.zoom, req.rotation, &req.pageRect, RenderTarget::View, &req.abortCookie);
-        bmp = engine->RenderPage(args);
+        {
+            trace::Scope traceScope("RenderPage", req.pageNo);
+            bmp = engine->RenderPage(args);
+        }
         if (req.abort) {
             delete bmp;
             if (req.renderCb) {
@@ -715,8 +1186,9 @@ int RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, T
     }
     RenderedBitmap* renderedBmp = entry ? entry->bitmap : nullptr;
     HBITMAP hbmp = renderedBmp ? renderedBmp->GetBitmap() : nullptr;
+    bool isBlank = entry && entry->isBlank;
 
-    if (!hbmp) {
+    if (!hbmp && !isBlank) {
         if (entry && !(renderedBmp && ReduceTileSize())) {
             renderDelay = RENDER_DELAY_FAILED;
         } else if (0 == renderDelay) {
@@ -729,13 +1201,20 @@ int RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, T
         return renderDelay;
     }
 
-    HDC bmpDC = CreateCompatibleDC(hdc);
+    if (isBlank) {
+        AutoDeleteBrush brush(CreateSolidBrush(entry->fillColor));
+        RECT rc = ToRECT(bounds);
+        FillRect(hdc, &rc, brush);
+    }
+
+    HDC bmpDC = hbmp ? CreateCompatibleDC(hdc) : nullptr;
     if (bmpDC) {
         Size bmpSize = renderedBmp->Size();
         int xSrc = -std::min(tileOnScreen.x, 0);
         int ySrc = -std::min(tileOnScreen.y, 0);
         float factor = std::min(1.0f * bmpSize.dx / tileOnScreen.dx, 1.0f * bmpSize.dy / tileOnScreen.dy);
 
+        trace::Scope traceScope("RenderCache: blit tile", pageNo);
         HGDIOBJ prevBmp = SelectObject(bmpDC, hbmp);
         int xDst = bounds.x;
         int yDst = bounds.y;
@@ -781,6 +1260,7 @@ static int cmpTilePosition(const void* a, const void* b) {
 int RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageInfo* pageInfo,
                        bool* renderOutOfDateCue) {
     CrashIf(!pageInfo->shown || 0.0 == pageInfo->visibleRatio);
+    trace::Scope traceScope("RenderCache::Paint", pageNo);
 
 #if 0
     auto timeStart = TimeGet();
@@ -791,13 +1271,14 @@ int RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageI
     };
 #endif
 
+    Rect pageOnScreen = dm->GetPageOnScreen(pageNo);
     if (!dm->ShouldCacheRendering(pageNo)) {
         int rotation = dm->GetRotation();
         float zoom = dm->GetZoomReal(pageNo);
-        bounds = pageInfo->pageOnScreen.Intersect(bounds);
+        bounds = pageOnScreen.Intersect(bounds);
 
         RectF area = ToRectFl(bounds);
-        area.Offset(-pageInfo->pageOnScreen.x, -pageInfo->pageOnScreen.y);
+        area.Offset(-pageOnScreen.x, -pageOnScreen.y);
         area = dm->GetEngine()->Transform(area, pageNo, zoom, rotation, true);
 
         RenderPageArgs args(pageNo, zoom, rotation, &area);
@@ -823,13 +1304,13 @@ int RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageI
 
     while (queue.size() > 0) {
         TilePosition tile = queue.PopAt(0);
-        Rect tileOnScreen = GetTileOnScreen(dm->GetEngine(), pageNo, rotation, zoom, tile, pageInfo->pageOnScreen);
+        Rect tileOnScreen = GetTileOnScreen(dm->GetEngine(), pageNo, rotation, zoom, tile, pageOnScreen);
         if (tileOnScreen.IsEmpty()) {
             // display an error message when only empty tiles should be drawn (i.e. on page loading errors)
             renderDelayMin = std::min(RENDER_DELAY_FAILED, renderDelayMin);
             continue;
         }
-        tileOnScreen = pageInfo->pageOnScreen.Intersect(tileOnScreen);
+        tileOnScreen = pageOnScreen.Intersect(tileOnScreen);
         Rect isect = bounds.Intersect(tileOnScreen);
         if (isect.IsEmpty()) {
             continue;
@@ -12,6 +12,13 @@ constexpr int RENDER_DELAY_UNDEFINED = std::numeric_limits<int>::max() - 2;
 // TODO: this should be based on amount of memory taken by rendered pages
 // i.e. one big page can use as much memory as lots of small pages
 #define MAX_BITMAPS_CACHED 64
+// memory budget for bitmaps kept in compressed form after
+// having been dropped from the cache (see CompressedBitmap)
+#define MAX_COMPRESSED_CACHE_SIZE (64 * 1024 * 1024)
+// at most that many dropped bitmaps wait for being compressed
+#define MAX_BITMAPS_TO_COMPRESS 8
+// number of page content boxes remembered for detecting blank tiles
+#define MAX_CONTENT_BOXES_CACHED 32
 
 class RenderingCallback {
   public:
@@ -52,6 +59,9 @@ struct BitmapCacheEntry {
     RenderedBitmap* bitmap = nullptr;
     bool outOfDate = false;
     int refs = 1;
+    // tile without any content, painted with fillColor instead of a bitmap
+    bool isBlank = false;
+    COLORREF fillColor = 0;
 
     BitmapCacheEntry(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition tile,
                      RenderedBitmap* bitmap) {
@@ -67,6 +77,43 @@ struct BitmapCacheEntry {
     }
 };
 
+struct CachedContentBox {
+    DisplayModel* dm = nullptr;
+    int pageNo = 0;
+    RectF box;
+};
+
+/* A bitmap which has been dropped from the cache while still being up-to-date.
+   It is kept in compressed form so that scrolling back to it doesn't require
+   rendering it again: bitmaps with at most 256 colors (e.g. scanned pages) as
+   1, 2, 4 or 8 bit indices into a palette, all others as deflated BGRA data. */
+struct CompressedBitmap {
+    DisplayModel* dm = nullptr;
+    int pageNo = 0;
+    int rotation = 0;
+    float zoom = 0.f;
+    TilePosition tile;
+    // the colors the bitmap has been rendered with
+    COLORREF textColor = 0;
+    COLORREF backgroundColor = 0;
+
+    // the uncompressed bitmap until the rendering thread gets to compress it
+    RenderedBitmap* bitmap = nullptr;
+
+    Size size;
+    // 1, 2, 4 or 8 for palette indices, 32 for deflated BGRA data
+    int bitsPerPixel = 0;
+    int paletteSize = 0;
+    u32 palette[256]{};
+    u8* data = nullptr;
+    size_t dataLen = 0;
+
+    ~CompressedBitmap() {
+        delete bitmap;
+        free(data);
+    }
+};
+
 /* Even though this looks a lot like a BitmapCacheEntry, we keep it
    separate for clarity in the code (PageRenderRequests are reused,
    while BitmapCacheEntries are ref-counted) */
@@ -93,6 +140,17 @@ class RenderCache {
     // make sure to never ask for requestAccess in a cacheAccess
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION cacheAccess;
+    // second cache tier for dropped bitmaps (least recently used first),
+    // also protected by cacheAccess
+    Vec<CompressedBitmap*> compressed;
+    size_t compressedSize = 0;
+    // incremented whenever compressed bitmaps are invalidated
+    int compressedGen = 0;
+    // content boxes of recently rendered pages, also protected by cacheAccess
+    Vec<CachedContentBox> contentBoxes;
+    int contentBoxesGen = 0;
+    // number of tiles which didn't have to be rendered because they were blank
+    int blankTilesElided = 0;
 
     PageRenderRequest requests[MAX_PAGE_REQUESTS]{};
     int requestCount = 0;
@@ -115,6 +173,7 @@ class RenderCache {
     ~RenderCache();
 
     void RequestRendering(DisplayModel* dm, int pageNo);
+    void RequestPrefetch(DisplayModel* dm, int pageNo, float zoom);
     void Render(DisplayModel* dm, int pageNo, int rotation, float zoom, RectF pageRect, RenderingCallback& callback);
     void CancelRendering(DisplayModel* dm);
     bool Exists(DisplayModel* dm, int pageNo, int rotation, float zoom = INVALID_ZOOM, TilePosition* tile = nullptr);
@@ -129,6 +188,7 @@ class RenderCache {
     bool ClearCurrentRequest();
     bool GetNextRequest(PageRenderRequest* req);
     void Add(PageRenderRequest& req, RenderedBitmap* bmp);
+    void AddBlank(PageRenderRequest& req, COLORREF fillColor);
 
     USHORT GetTileRes(DisplayModel* dm, int pageNo) const;
     USHORT GetMaxTileRes(DisplayModel* dm, int pageNo, int rotation);
@@ -152,6 +212,16 @@ class RenderCache {
     void FreePage(DisplayModel* dm = nullptr, int pageNo = -1, TilePosition* tile = nullptr);
     void FreeNotVisible();
 
+    void KeepCompressed(BitmapCacheEntry* entry);
+    int FindCompressed(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition tile);
+    RenderedBitmap* RestoreCompressed(PageRenderRequest& req);
+    bool CompressNextBitmap();
+    void DropCompressed(DisplayModel* dm = nullptr, int pageNo = INVALID_PAGE_NO);
+
+    RectF GetContentBox(DisplayModel* dm, int pageNo);
+    bool IsBlankTile(PageRenderRequest& req);
+    void DropContentBoxes(DisplayModel* dm, int pageNo = INVALID_PAGE_NO);
+
     int PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, TilePosition tile, Rect tileOnScreen,
                   bool renderMissing, bool* renderOutOfDateCue, bool* renderedReplacement);
 };
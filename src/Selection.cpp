@@ -59,7 +59,7 @@ Vec<SelectionOnPage>* SelectionOnPage::FromRectangle(DisplayModel* dm, Rect rect
             continue;
         }
 
-        Rect intersect = rect.Intersect(pageInfo->pageOnScreen);
+        Rect intersect = rect.Intersect(dm->GetPageOnScreen(pageNo));
         if (intersect.IsEmpty()) {
             continue;
         }
@@ -235,9 +235,8 @@ void ZoomToSelection(WindowInfo* win, float factor, bool scrollToFit, bool relat
         // or towards the top-left-most part of the first visible page
         else {
             int page = dm->FirstVisiblePageNo();
-            PageInfo* pageInfo = dm->GetPageInfo(page);
-            if (pageInfo) {
-                Rect visible = pageInfo->pageOnScreen.Intersect(win->canvasRc);
+            if (dm->GetPageInfo(page)) {
+                Rect visible = dm->GetPageOnScreen(page).Intersect(win->canvasRc);
                 pt = visible.TL();
 
                 int pageNo = dm->GetPageNoByPoint(pt);
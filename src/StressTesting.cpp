@@ -8,6 +8,7 @@
 #include "utils/GuessFileType.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
+#include "utils/HtmlPullParser.h"
 #include "utils/HtmlWindow.h"
 #include "mui/Mui.h"
 #include "utils/Timer.h"
@@ -122,6 +123,32 @@ static int TimeOneMethod(Doc& doc, TextRenderMethod method, const WCHAR* methodN
     return nPages;
 }
 
+// measures the throughput of HtmlPullParser (and resolving entities in text)
+// over the html of the document, as that's done for every load and layout
+static void BenchHtmlParsing(Doc& doc) {
+    std::span<u8> html = doc.GetHtmlData();
+    if (html.empty()) {
+        return;
+    }
+    const int nRuns = 5;
+    int nTokens = 0;
+    auto t = TimeGet();
+    for (int i = 0; i < nRuns; i++) {
+        PoolAllocator allocator;
+        HtmlPullParser parser((const char*)html.data(), html.size());
+        nTokens = 0;
+        for (HtmlToken* tok = parser.Next(); tok && !tok->IsError(); tok = parser.Next()) {
+            if (tok->IsText()) {
+                ResolveHtmlEntities(tok->s, tok->s + tok->sLen, &allocator);
+            }
+            nTokens++;
+        }
+    }
+    double timeMs = TimeSinceInMs(t) / nRuns;
+    double mbPerSec = timeMs > 0 ? (double)html.size() / (1024.0 * 1024.0) / (timeMs / 1000.0) : 0;
+    logf(L"html parse: %.2f ms, %d tokens, %.1f MB/s\n", timeMs, nTokens, mbPerSec);
+}
+
 // this is to compare the time it takes to layout a whole ebook file
 // using different text measurement method (since the time is mostly
 // dominated by text measure)
@@ -142,15 +169,19 @@ void BenchEbookLayout(const WCHAR* filePath) {
     double timeMs = TimeSinceInMs(t);
     logf(L"load: %.2f ms\n", timeMs);
 
+    BenchHtmlParsing(doc);
+
     int nPages = TimeOneMethod(doc, TextRenderMethod::Gdi, L"gdi       ");
     TimeOneMethod(doc, TextRenderMethod::Gdiplus, L"gdi+      ");
     TimeOneMethod(doc, TextRenderMethod::GdiplusQuick, L"gdi+ quick");
+    TimeOneMethod(doc, TextRenderMethod::FreeType, L"freetype  ");
 
     // do it twice because the first run is very unfair to the first version that runs
     // (probably because of font caching)
     TimeOneMethod(doc, TextRenderMethod::Gdi, L"gdi       ");
     TimeOneMethod(doc, TextRenderMethod::Gdiplus, L"gdi+      ");
     TimeOneMethod(doc, TextRenderMethod::GdiplusQuick, L"gdi+ quick");
+    TimeOneMethod(doc, TextRenderMethod::FreeType, L"freetype  ");
 
     doc.Delete();
 
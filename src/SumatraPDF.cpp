@@ -14,6 +14,7 @@
 #include "utils/HttpUtil.h"
 #include "utils/SquareTreeParser.h"
 #include "utils/ThreadUtil.h"
+#include "utils/Trace.h"
 #include "utils/UITask.h"
 #include "utils/WinUtil.h"
 #include "utils/GdiPlusUtil.h"
@@ -162,6 +163,10 @@ static void UpdatePageInfoHelper(WindowInfo*, NotificationWnd* wnd = nullptr, in
 static void OnSidebarSplitterMove(SplitterMoveEvent*);
 static void OnFavSplitterMove(SplitterMoveEvent*);
 static void DownloadDebugSymbols();
+static void ToggleRenderTracing(WindowInfo* win);
+static void SetFrameTitleForTab(TabInfo*, bool needRefresh);
+static void ShowUnsupportedFeatures(WindowInfo*);
+static void CancelSavingAnnotations(WindowInfo*);
 
 void SetCurrentLang(const char* langCode) {
     if (!langCode) {
@@ -480,9 +485,14 @@ void UpdateTabFileDisplayStateForTab(TabInfo* tab) {
     if (!ds) {
         return;
     }
+    // Find() might have matched a file of the same name in another directory
+    if (!str::EqI(ds->filePath, tab->ctrl->FilePath())) {
+        gFileHistory.SetFilePath(ds, tab->ctrl->FilePath());
+    }
     tab->ctrl->GetDisplayState(ds);
     UpdateDisplayStateWindowRect(win, *ds, false);
     UpdateSidebarDisplayState(tab, ds);
+    gFileHistory.MarkChanged(ds);
 }
 
 bool IsUIRightToLeft() {
@@ -624,8 +634,12 @@ struct ControllerCallbackHandler : ControllerCallback {
     void PageNoChanged(Controller* ctrl, int pageNo) override;
     void UpdateScrollbars(Size canvas) override;
     void RequestRendering(int pageNo) override;
+    void RequestPrefetch(int pageNo, float zoom) override;
+    void CancelPrefetch(int pageNo) override;
     void CleanUp(DisplayModel* dm) override;
     void RenderThumbnail(DisplayModel* dm, Size size, const onBitmapRenderedCb&) override;
+    void PageSizesChanged(DisplayModel* dm) override;
+    void DocInfoLoaded(DisplayModel* dm) override;
     void GotoLink(PageDestination* dest) override {
         win->linkHandler->GotoLink(dest);
     }
@@ -707,6 +721,20 @@ void ControllerCallbackHandler::RequestRendering(int pageNo) {
     }
 }
 
+void ControllerCallbackHandler::RequestPrefetch(int pageNo, float zoom) {
+    DisplayModel* dm = win->AsFixed();
+    if (dm && dm->ShouldCacheRendering(pageNo)) {
+        gRenderCache.RequestPrefetch(dm, pageNo, zoom);
+    }
+}
+
+void ControllerCallbackHandler::CancelPrefetch(int pageNo) {
+    DisplayModel* dm = win->AsFixed();
+    if (dm) {
+        gRenderCache.ClearQueueForDisplayModel(dm, pageNo);
+    }
+}
+
 void ControllerCallbackHandler::CleanUp(DisplayModel* dm) {
     gRenderCache.CancelRendering(dm);
     gRenderCache.FreeForDisplayModel(dm);
@@ -735,6 +763,46 @@ void ControllerCallbackHandler::HandleLayoutedPages(EbookController* ctrl, Ebook
     });
 }
 
+void ControllerCallbackHandler::PageSizesChanged(DisplayModel* dm) {
+    uitask::Post([=] {
+        if (FindWindowInfoByController(dm)) {
+            dm->UpdatePageSizes();
+        }
+    });
+}
+
+void ControllerCallbackHandler::DocInfoLoaded(DisplayModel* dm) {
+    uitask::Post([=] {
+        WindowInfo* win = FindWindowInfoByController(dm);
+        if (!win) {
+            return;
+        }
+        TabInfo* tab = nullptr;
+        for (auto& t : win->tabs) {
+            if (t->ctrl == dm) {
+                tab = t;
+            }
+        }
+        SetFrameTitleForTab(tab, false);
+        if (win->currentTab != tab) {
+            // the remaining UI is updated when switching to the tab
+            return;
+        }
+        win::SetText(win->hwndFrame, tab->frameTitle);
+        if (dm->HasPageLabels()) {
+            AutoFreeWstr label(dm->GetPageLabel(dm->CurrentPageNo()));
+            win::SetText(win->hwndPageBox, label);
+        }
+        UpdateToolbarPageText(win, dm->PageCount());
+        if (win->presentation != PM_DISABLED) {
+            SetSidebarVisibility(win, tab->showTocPresentation, gGlobalPrefs->showFavorites);
+        } else {
+            SetSidebarVisibility(win, tab->showToc, gGlobalPrefs->showFavorites);
+        }
+        ShowUnsupportedFeatures(win);
+    });
+}
+
 void ControllerCallbackHandler::RequestDelayedLayout(int delay) {
     SetTimer(win->hwndCanvas, EBOOK_LAYOUT_TIMER_ID, delay, nullptr);
 }
@@ -935,6 +1003,15 @@ static Controller* CreateControllerForFile(const WCHAR* path, PasswordUI* pwdUI,
     return ctrl;
 }
 
+static void ShowUnsupportedFeatures(WindowInfo* win) {
+    AutoFreeWstr unsupported(win->ctrl->GetProperty(DocumentProperty::UnsupportedFeatures));
+    if (unsupported) {
+        unsupported.Set(str::Format(_TR("This document uses unsupported features (%s) and might not render properly"),
+                                    unsupported.Get()));
+        win->ShowNotification(unsupported, NotificationOptions::Warning, NG_PERSISTENT_WARNING);
+    }
+}
+
 static void SetFrameTitleForTab(TabInfo* tab, bool needRefresh) {
     const WCHAR* titlePath = tab->filePath;
     if (!gGlobalPrefs->fullPathInTitle) {
@@ -942,7 +1019,8 @@ static void SetFrameTitleForTab(TabInfo* tab, bool needRefresh) {
     }
 
     AutoFreeWstr docTitle(str::Dup(L""));
-    if (tab->ctrl) {
+    // the title is updated once it's been loaded (see ControllerCallbackHandler::DocInfoLoaded)
+    if (tab->ctrl && tab->ctrl->IsDocInfoLoaded()) {
         WCHAR* title = tab->ctrl->GetProperty(DocumentProperty::Title);
         if (title != nullptr) {
             str::NormalizeWSInPlace(title);
@@ -1198,11 +1276,8 @@ static void LoadDocIntoCurrentTab(const LoadArgs& args, Controller* ctrl, FileSt
         return;
     }
 
-    AutoFreeWstr unsupported(win->ctrl->GetProperty(DocumentProperty::UnsupportedFeatures));
-    if (unsupported) {
-        unsupported.Set(str::Format(_TR("This document uses unsupported features (%s) and might not render properly"),
-                                    unsupported.Get()));
-        win->ShowNotification(unsupported, NotificationOptions::Warning, NG_PERSISTENT_WARNING);
+    if (win->ctrl->IsDocInfoLoaded()) {
+        ShowUnsupportedFeatures(win);
     }
 
     // This should only happen after everything else is ready
@@ -1294,6 +1369,7 @@ void ReloadDocument(WindowInfo* win, bool autoRefresh) {
             if (state && !str::Eq(state->decryptionKey, decryptionKey)) {
                 free(state->decryptionKey);
                 state->decryptionKey = decryptionKey.Release();
+                gFileHistory.MarkChanged(state);
             }
         }
     }
@@ -1454,6 +1530,7 @@ WindowInfo* CreateAndShowWindowInfo(SessionData* data) {
 
 void DeleteWindowInfo(WindowInfo* win) {
     DeletePropertiesWindow(win->hwndFrame);
+    CancelSavingAnnotations(win);
 
     gWindows.Remove(win);
 
@@ -1487,7 +1564,7 @@ static void RenameFileInHistory(const WCHAR* oldPath, const WCHAR* newPath) {
     }
     ds = gFileHistory.Find(oldPath, nullptr);
     if (ds) {
-        str::ReplaceWithCopy(&ds->filePath, newPath);
+        gFileHistory.SetFilePath(ds, newPath);
         // merge Frequently Read data, so that a file
         // doesn't accidentally vanish from there
         ds->isPinned = ds->isPinned || oldIsPinned;
@@ -2078,6 +2155,102 @@ static void CloseDocumentInTab(WindowInfo* win, bool keepUIEnabled, bool deleteM
     // SetFocus(win->hwndFrame);
 }
 
+class SaveAnnotationsProgress;
+// only accessed on the ui thread
+static Vec<SaveAnnotationsProgress*> gSaveAnnotationsProgress;
+
+// shows the progress of saving annotations in the background.
+// closing the notification or the window cancels saving
+class SaveAnnotationsProgress : public ProgressUpdateUI {
+  public:
+    WindowInfo* win = nullptr;
+    NotificationWnd* wnd = nullptr;
+    // set on the ui thread, read on the saving thread
+    std::atomic<bool> isCanceled = false;
+
+    explicit SaveAnnotationsProgress(WindowInfo* win) {
+        this->win = win;
+        wnd = new NotificationWnd(win->hwndCanvas, 0);
+        wnd->wndRemovedCb = [this](NotificationWnd* wnd) { this->RemoveNotification(wnd); };
+        wnd->Create(L"", _TR("Saving annotations (%d%%)..."));
+        win->notifications->Add(wnd, nullptr);
+        gSaveAnnotationsProgress.Append(this);
+    }
+    SaveAnnotationsProgress(SaveAnnotationsProgress const&) = delete;
+    SaveAnnotationsProgress& operator=(SaveAnnotationsProgress const&) = delete;
+
+    ~SaveAnnotationsProgress() override {
+        gSaveAnnotationsProgress.Remove(this);
+        RemoveNotification(wnd);
+    }
+
+    void RemoveNotification(NotificationWnd* wnd) {
+        isCanceled = true;
+        this->wnd = nullptr;
+        if (WindowInfoStillValid(win)) {
+            win->notifications->RemoveNotification(wnd);
+        }
+    }
+
+    void UpdateProgress(int current, int total) override {
+        uitask::Post([=] {
+            if (WindowInfoStillValid(win) && win->notifications->Contains(wnd)) {
+                wnd->UpdateProgress(current, total);
+            }
+        });
+    }
+
+    bool WasCanceled() override {
+        return isCanceled;
+    }
+};
+
+// called on the ui thread before win is deleted
+static void CancelSavingAnnotations(WindowInfo* win) {
+    for (SaveAnnotationsProgress* progress : gSaveAnnotationsProgress) {
+        if (progress->win == win) {
+            progress->isCanceled = true;
+        }
+    }
+}
+
+// saves the annotations of tab to dstPath (or the file they were loaded from if
+// dstPath is nullptr) without blocking the ui.
+// onSaved is called on the ui thread if saving succeeded and the tab is still open
+void SaveAnnotationsInBackground(TabInfo* tab, const char* dstPath, const std::function<void()>& onSaved) {
+    WindowInfo* win = tab->win;
+    EngineBase* engine = tab->AsFixed()->GetEngine();
+    char* path = dstPath ? str::Dup(dstPath) : strconv::WstrToUtf8(engine->FileName());
+    auto progress = new SaveAnnotationsProgress(win);
+    std::string_view dst = dstPath ? dstPath : "";
+    EnginePdfSaveUpdatedAsync(engine, dst, progress, [=](PdfSaveStatus status, std::string_view err) {
+        // called on the saving thread (or the ui thread if superseded)
+        bool ok = status == PdfSaveStatus::Saved;
+        bool superseded = status == PdfSaveStatus::Superseded;
+        char* errMsg = str::Dup(err);
+        uitask::Post([=] {
+            delete progress;
+            // the request that replaced this one reports the result
+            if (!superseded && WindowInfoStillValid(win)) {
+                str::Str msg;
+                if (ok) {
+                    msg.AppendFmt(_TRA("Saved annotations to '%s'"), path);
+                    win->ShowNotification(msg.AsView());
+                } else {
+                    // TODO: duplicated message
+                    msg.AppendFmt(_TRA("Saving of '%s' failed with: '%s'"), path, errMsg);
+                    win->ShowNotification(msg.AsView(), NotificationOptions::Warning);
+                }
+                if (ok && onSaved && win->tabs.Contains(tab)) {
+                    onSaved();
+                }
+            }
+            str::Free(errMsg);
+            str::Free(path);
+        });
+    });
+}
+
 bool SaveAnnotationsToMaybeNewPdfFile(TabInfo* tab) {
     WCHAR dstFileName[MAX_PATH + 1] = {0};
 
@@ -2205,6 +2378,8 @@ static void MaybeSaveAnnotations(TabInfo* tab) {
         return;
     }
     EngineBase* engine = dm->GetEngine();
+    // annotations that are being saved in the background are not unsaved
+    EnginePdfWaitForSaves(engine);
     // shouldn't really happen but did happen.
     // don't block stress testing if opening a document flags it hasving unsaved annotations
     if (IsStressTesting()) {
@@ -4108,6 +4283,8 @@ void SetSidebarVisibility(WindowInfo* win, bool tocVisible, bool showFavorites)
         showFavorites = false;
     }
 
+    // while the ToC is still being loaded, the user's choice is remembered
+    bool tocPending = win->IsDocLoaded() && !win->ctrl->IsDocInfoLoaded();
     if (!win->IsDocLoaded() || !win->ctrl->HacToc()) {
         tocVisible = false;
     }
@@ -4128,6 +4305,8 @@ void SetSidebarVisibility(WindowInfo* win, bool tocVisible, bool showFavorites)
 
     if (!win->currentTab) {
         CrashIf(tocVisible);
+    } else if (tocPending) {
+        // keep showToc resp. showTocPresentation
     } else if (!win->presentation) {
         win->currentTab->showToc = tocVisible;
     } else if (PM_ENABLED == win->presentation) {
@@ -4207,23 +4386,10 @@ static int TestBigNew()
 #endif
 
 static void SaveAnnotationsAndCloseEditAnnowtationsWindow(TabInfo* tab) {
-    EngineBase* engine = tab->AsFixed()->GetEngine();
-    auto path = ToUtf8Temp(engine->FileName());
-    bool ok = EnginePdfSaveUpdated(engine, {}, [&tab, &path](std::string_view mupdfErr) {
-        str::Str msg;
-        // TODO: duplicated message
-        msg.AppendFmt(_TRA("Saving of '%s' failed with: '%s'"), path.Get(), mupdfErr.data());
-        tab->win->ShowNotification(msg.AsView(), NotificationOptions::Warning);
+    SaveAnnotationsInBackground(tab, nullptr, [tab] {
+        CloseAndDeleteEditAnnotationsWindow(tab->editAnnotsWindow);
+        tab->editAnnotsWindow = nullptr;
     });
-    if (!ok) {
-        return;
-    }
-    str::Str msg;
-    msg.AppendFmt(_TRA("Saved annotations to '%s'"), path.Get());
-    tab->win->ShowNotification(msg.AsView());
-
-    CloseAndDeleteEditAnnotationsWindow(tab->editAnnotsWindow);
-    tab->editAnnotsWindow = nullptr;
 }
 
 // To avoid including mui/Mui.h, which conflicts with wingui/Layout.h
@@ -4732,6 +4898,10 @@ static LRESULT FrameOnCommand(WindowInfo* win, HWND hwnd, UINT msg, WPARAM wp, L
             FrameOnChar(win, 'h');
             break;
 
+        case CmdDebugTraceRendering:
+            ToggleRenderTracing(win);
+            break;
+
 #if defined(DEBUG)
         case CmdDebugTestApp:
             extern void TestApp(HINSTANCE hInstance);
@@ -5111,6 +5281,22 @@ static WCHAR* GetSymbolsDir() {
     return path::Join(dir.Get(), GetAppNameTemp(), L"crashinfo");
 }
 
+// records trace events until called again, then saves them for
+// chrome://tracing or ui.perfetto.dev
+static void ToggleRenderTracing(WindowInfo* win) {
+    if (!trace::IsEnabled()) {
+        trace::SetThreadName("UI");
+        trace::Enable(true);
+        win->ShowNotification(L"Tracing rendering...");
+        return;
+    }
+    trace::Enable(false);
+    AutoFreeWstr path = AppGenDataFilename(L"trace.json");
+    bool ok = path && trace::SaveChromeJson(ToUtf8Temp(path));
+    AutoFreeWstr msg = str::Format(ok ? L"Saved trace to %s" : L"Failed to save trace to %s", path.Get());
+    win->ShowNotification(msg);
+}
+
 static void DownloadDebugSymbols() {
     // over-ride the default symbols directory to be more useful
     WCHAR* symDir = GetSymbolsDir();
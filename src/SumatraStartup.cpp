@@ -77,6 +77,7 @@
 #include "AppColors.h"
 
 #include "utils/Log.h"
+#include "utils/Trace.h"
 
 // gFileExistenceChecker is initialized at startup and should
 // terminate and delete itself asynchronously while the UI is
@@ -811,6 +812,7 @@ static void testLogf() {
 
 // in mupdf_load_system_font.c
 extern "C" void destroy_system_font_list();
+extern "C" void pdf_set_system_font_catalog_path(const char* path);
 
 // in MemLeakDetect.cpp
 extern bool MemLeakInit();
@@ -978,6 +980,11 @@ int APIENTRY WinMain(HINSTANCE hInstance, __unused HINSTANCE hPrevInstance, __un
 
     log("Starting SumatraPDF\n");
 
+    if (i.traceFile) {
+        trace::SetThreadName("UI");
+        trace::Enable(true);
+    }
+
     VerifyNoLibmupdfMismatch();
 
     // do this before running installer etc. so that we have disk / net permissions
@@ -1015,6 +1022,14 @@ int APIENTRY WinMain(HINSTANCE hInstance, __unused HINSTANCE hPrevInstance, __un
 
     prefs::Load();
     UpdateGlobalPrefs(i);
+
+    {
+        // cache parsed system font names so that only new fonts have to be parsed
+        AutoFreeWstr fontCatalogPath = AppGenDataFilename(L"fontcatalog.bin");
+        if (fontCatalogPath) {
+            pdf_set_system_font_catalog_path(ToUtf8Temp(fontCatalogPath).Get());
+        }
+    }
     SetCurrentLang(i.lang ? i.lang : gGlobalPrefs->uiLanguage);
 
     // This allows ad-hoc comparison of gdi, gdi+ and gdi+ quick when used
@@ -1242,6 +1257,11 @@ Exit:
 
     HandleRedirectedConsoleOnShutdown();
 
+    if (i.traceFile) {
+        trace::Enable(false);
+        trace::SaveChromeJson(ToUtf8Temp(i.traceFile));
+    }
+
     if (fastExit) {
         // leave all the remaining clean-up to the OS
         // (as recommended for a quick exit)
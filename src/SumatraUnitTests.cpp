@@ -12,9 +12,13 @@
 
 #include "DisplayMode.h"
 #include "EngineBase.h"
+#include "TextSelection.h"
 #include "SettingsStructs.h"
+#include "FileHistory.h"
 #include "GlobalPrefs.h"
 #include "Flags.h"
+#include "PdfSync.h"
+#include "PdfSyncIndex.h"
 
 #include <float.h>
 #include <math.h>
@@ -248,9 +252,283 @@ void EngineUtilitiesTest() {
     utassert(page == 0);
 }
 
+static void CheckCompactCoords(Vec<Rect>& rects, bool isCompact) {
+    CompactCoords* cc = NewCompactCoords(rects.LendData(), rects.isize());
+    utassert(isCompact == !cc->rects);
+    if (isCompact) {
+        utassert(CompactCoordsSize(cc) < rects.size() * sizeof(Rect));
+    }
+    Vec<Rect> decoded;
+    DecodeCompactCoords(cc, decoded.AppendBlanks(rects.size()));
+    // selection rects are computed from these, so they must be identical
+    for (size_t i = 0; i < rects.size(); i++) {
+        utassert(rects.at(i) == decoded.at(i));
+    }
+    DeleteCompactCoords(cc);
+}
+
+static void CompactCoordsTest() {
+    Vec<Rect> rects;
+    CheckCompactCoords(rects, false);
+
+    // lines of glyphs with the same y and dy, separated by line breaks
+    for (int line = 0; line < 20; line++) {
+        int x = 72;
+        for (int i = 0; i < 40; i++) {
+            int dx = 5 + (i * 7) % 4;
+            rects.Append(Rect(x, 100 + line * 14, dx, 12));
+            x += dx + (i % 5 == 4 ? 3 : 0);
+        }
+        rects.Append(Rect());
+    }
+    // a superscript
+    rects.Append(Rect(300, 95, 4, 7));
+    // glyphs sharing the same bbox (as for some DjVu documents)
+    for (int i = 0; i < 3; i++) {
+        rects.Append(Rect(310, 100, 20, 12));
+    }
+    // x offsets which don't fit into 16 bits
+    rects.Append(Rect(50000, 100, 5, 12));
+    rects.Append(Rect(-20, 100, 5, 12));
+    CheckCompactCoords(rects, true);
+
+    // glyphs too wide for 16 bits
+    rects.Append(Rect(0, 100, 40000, 12));
+    CheckCompactCoords(rects, false);
+}
+
+// the glyph a linear scan over all glyphs finds (i.e. what the GlyphGrid must find)
+static int FindGlyphLinear(const Vec<Rect>& coords, Point pti, Point pt, bool mustContain) {
+    int result = -1;
+    uint minDist = UINT_MAX;
+    for (int i = 0; i < coords.isize(); i++) {
+        const Rect& coord = coords.at(i);
+        // skip line breaks
+        if (!coord.x && !coord.dx) {
+            continue;
+        }
+        if (mustContain && !coord.Contains(pti)) {
+            continue;
+        }
+        uint dist = distSq(pt.x - coord.x - coord.dx / 2, pt.y - coord.y - coord.dy / 2);
+        if (-1 == result || dist < minDist) {
+            result = i;
+            minDist = dist;
+        }
+    }
+    return result;
+}
+
+static void CheckGlyphGrid(const Vec<Rect>& coords) {
+    GlyphGrid* grid = NewGlyphGrid(coords.LendData(), coords.isize());
+    for (int y = -60; y < 900; y += 7) {
+        for (int x = -60; x < 700; x += 5) {
+            Point pt(x, y);
+            // pti (which glyphs must contain) and pt (which distances are
+            // measured from) can differ due to rounding
+            Point pti(x + (x % 2), y + (y % 3 == 0 ? 1 : 0));
+            utassert(FindGlyphAt(grid, coords.LendData(), pti, pt) == FindGlyphLinear(coords, pti, pt, true));
+            utassert(FindGlyphNextTo(grid, coords.LendData(), pt) == FindGlyphLinear(coords, pt, pt, false));
+        }
+    }
+    DeleteGlyphGrid(grid);
+}
+
+static void GlyphGridTest() {
+    Vec<Rect> coords;
+    CheckGlyphGrid(coords);
+    // only line breaks
+    coords.Append(Rect());
+    coords.Append(Rect());
+    CheckGlyphGrid(coords);
+
+    // lines of glyphs of varying width, separated by line breaks
+    uint seed = 1;
+    auto rnd = [&seed](int n) {
+        seed = seed * 1103515245 + 12345;
+        return (int)((seed >> 16) % n);
+    };
+    for (int line = 0; line < 40; line++) {
+        int x = 50 + rnd(20);
+        int y = 40 + line * 18 + rnd(3);
+        for (int i = 0; i < 60 && x < 600; i++) {
+            int dx = 3 + rnd(8);
+            coords.Append(Rect(x, y, dx, 12));
+            x += dx + (rnd(6) == 0 ? 4 : 0);
+        }
+        coords.Append(Rect());
+    }
+    // glyphs sharing the same bbox (as for some DjVu documents)
+    for (int i = 0; i < 3; i++) {
+        coords.Append(Rect(310, 100, 20, 12));
+    }
+    // zero-width, mirrored and overlapping glyphs
+    coords.Append(Rect(200, 300, 0, 12));
+    coords.Append(Rect(420, 500, -8, 12));
+    coords.Append(Rect(415, 498, 10, 16));
+    // a scattered column of glyphs far from the rest
+    for (int i = 0; i < 10; i++) {
+        coords.Append(Rect(680, 30 + i * 85, 6, 12));
+    }
+    CheckGlyphGrid(coords);
+
+    // glyphs spanning many grid cells
+    coords.Append(Rect(40, 20, 560, 700));
+    coords.Append(Rect(100, 400, 300, 14));
+    CheckGlyphGrid(coords);
+}
+
+static void CheckSameFileStates(Vec<FileState*>* expected, Vec<FileState*>* states) {
+    utassert(expected->size() == states->size());
+    if (expected->size() != states->size()) {
+        return;
+    }
+    for (size_t i = 0; i < states->size(); i++) {
+        FileState* ds1 = expected->at(i);
+        FileState* ds2 = states->at(i);
+        utassert(str::Eq(ds1->filePath, ds2->filePath));
+        utassert(ds1->pageNo == ds2->pageNo);
+        utassert(ds1->openCount == ds2->openCount);
+        utassert(ds1->useDefaultState == ds2->useDefaultState);
+    }
+}
+
+static void PdfsyncIndexTest() {
+    PdfsyncIndex idx;
+    // record, file, line, column; line 12 of the first file has two records
+    idx.lines.Append({1, 0, 10, 0});
+    idx.lines.Append({2, 0, 12, 0});
+    idx.lines.Append({3, 0, 12, 0});
+    idx.lines.Append({4, 1, 10, 0});
+    // record, page, x, y (in sync file units, 65781.76 per PDF point)
+    idx.sheetIndex.Append(0);
+    idx.sheetIndex.Append(0);
+    idx.points.Append({2, 1, 6578176, 6578176});
+    idx.points.Append({1, 1, 32890880, 6578176});
+    idx.points.Append({2, 1, 6578176, 52625408});
+    idx.sheetIndex.Append(idx.points.size());
+    idx.points.Append({3, 2, 6578176, 6578176});
+    idx.points.Append({2, 2, 13156352, 6578176});
+    idx.BuildPageGrids();
+    idx.BuildLineHash();
+    idx.BuildPointsByRecord();
+
+    // FindLine returns the first record declared for a line
+    utassert(idx.FindLine(0, 10) == 0);
+    utassert(idx.FindLine(0, 12) == 1);
+    utassert(idx.FindLine(1, 10) == 3);
+    utassert(idx.FindLine(0, 11) == (size_t)-1);
+    utassert(idx.FindLine(1, 12) == (size_t)-1);
+    utassert(idx.FindLine(2, 10) == (size_t)-1);
+
+    // FindPoints returns the points of all records once, in declaration order
+    Vec<size_t> records;
+    records.Append(3);
+    records.Append(2);
+    records.Append(3);
+    Vec<u64> found;
+    idx.FindPoints(records, found);
+    u64 expected[] = {0, 2, 3, 4};
+    utassert(found.size() == dimof(expected));
+    for (size_t i = 0; i < found.size() && i < dimof(expected); i++) {
+        utassert(found.at(i) == expected[i]);
+    }
+    records.Reset();
+    records.Append(5);
+    found.Reset();
+    idx.FindPoints(records, found);
+    utassert(found.size() == 0);
+
+    // every point of a page is in exactly one cell of that page's grid
+    utassert(idx.pageGrids.size() == 2);
+    for (PdfsyncPageGrid& grid : idx.pageGrids) {
+        size_t nCells = (size_t)grid.cols * grid.rows;
+        size_t first = idx.cellStart.at(grid.firstCell);
+        size_t last = idx.cellStart.at(grid.firstCell + nCells);
+        utassert(last - first == grid.end - grid.start);
+        for (size_t j = first; j < last; j++) {
+            size_t i = idx.cellPoints.at(j);
+            utassert(grid.start <= i && i < grid.end);
+            Point pt = idx.pointPos.at(i);
+            int cell = ((pt.y - grid.y0) / grid.cellSize) * grid.cols + (pt.x - grid.x0) / grid.cellSize;
+            utassert(idx.cellStart.at(grid.firstCell + cell) <= j && j < idx.cellStart.at(grid.firstCell + cell + 1));
+        }
+    }
+    utassert(idx.pageGrids.at(1).start == 3 && idx.pageGrids.at(1).end == 5);
+}
+
+// the file history must survive being saved as settings file plus journal
+// (see prefs::Save()) and the journal being merged into the settings file
+static void SettingsJournalTest() {
+    GlobalPrefs* prefs = NewGlobalPrefs(nullptr);
+    FileHistory history;
+    history.UpdateStatesSource(prefs->fileStates);
+    const WCHAR* paths[] = {L"C:\\docs\\a.pdf", L"C:\\docs\\b.pdf", L"C:\\docs\\c.pdf", L"C:\\docs\\d.pdf"};
+    for (const WCHAR* path : paths) {
+        history.Append(NewDisplayState(path));
+    }
+    std::span<u8> saved = SerializeGlobalPrefs(prefs, nullptr);
+    history.ResetChanges();
+
+    // an empty journal doesn't change anything
+    GlobalPrefs* loaded = NewGlobalPrefs((const char*)saved.data());
+    FileHistory loadedHistory;
+    loadedHistory.UpdateStatesSource(loaded->fileStates);
+    ApplySettingsJournal("", loadedHistory, loaded->sessionData);
+    CheckSameFileStates(prefs->fileStates, loaded->fileStates);
+
+    // changes recorded by two saves
+    str::Str journal;
+    FileState* ds = history.MarkFileLoaded(L"C:\\docs\\c.pdf");
+    ds->pageNo = 7;
+    ds = history.Find(L"C:\\docs\\b.pdf", nullptr);
+    history.Remove(ds);
+    DeleteDisplayState(ds);
+    history.SerializeChanges(journal, false);
+    history.ResetChanges();
+
+    // d.pdf has been moved, which replaces its old path
+    ds = history.MarkFileLoaded(L"D:\\moved\\d.pdf");
+    utassert(str::Eq(ds->filePath, L"D:\\moved\\d.pdf"));
+    utassert(history.Find(L"D:\\moved\\d.pdf", nullptr) == ds);
+    history.MarkFileLoaded(L"C:\\docs\\e.pdf");
+    // moves a.pdf to the end of the list
+    history.MarkFileInexistent(L"C:\\docs\\a.pdf");
+    SessionData* session = NewSessionData();
+    session->tabIndex = 2;
+    prefs->sessionData->Append(session);
+    SerializeSessionRecord(journal, prefs->sessionData);
+    history.SerializeChanges(journal, false);
+    history.ResetChanges();
+
+    // replaying the journal on top of the settings file restores the history
+    ApplySettingsJournal(journal.Get(), loadedHistory, loaded->sessionData);
+    CheckSameFileStates(prefs->fileStates, loaded->fileStates);
+    utassert(loaded->sessionData->size() == 1 && loaded->sessionData->at(0)->tabIndex == 2);
+    utassert(loadedHistory.Find(L"C:\\docs\\b.pdf", nullptr) == nullptr);
+    utassert(loadedHistory.Find(L"C:\\docs\\e.pdf", nullptr) == loaded->fileStates->at(0));
+    utassert(str::Eq(loaded->fileStates->at(1)->filePath, L"D:\\moved\\d.pdf"));
+
+    // as does the settings file the journal has been merged into
+    std::span<u8> compacted = SerializeGlobalPrefs(loaded, (const char*)saved.data());
+    GlobalPrefs* reloaded = NewGlobalPrefs((const char*)compacted.data());
+    CheckSameFileStates(prefs->fileStates, reloaded->fileStates);
+    utassert(reloaded->sessionData->size() == 1 && reloaded->sessionData->at(0)->tabIndex == 2);
+
+    str::Free(saved.data());
+    str::Free(compacted.data());
+    DeleteGlobalPrefs(reloaded);
+    DeleteGlobalPrefs(loaded);
+    DeleteGlobalPrefs(prefs);
+}
+
 void SumatraPDF_UnitTests() {
     colorTest();
     BenchRangeTest();
+    CompactCoordsTest();
+    GlyphGridTest();
+    SettingsJournalTest();
+    PdfsyncIndexTest();
     EngineUtilitiesTest();
     ParseCommandLineTest();
     versioncheck_test();
@@ -0,0 +1,121 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/FileUtil.h"
+
+extern "C" {
+#include <mupdf/fitz.h>
+}
+
+// in mupdf_load_system_font.c
+extern "C" void destroy_system_font_list();
+extern "C" void pdf_set_system_font_dir(const char* dir);
+extern "C" void pdf_set_system_font_catalog_path(const char* path);
+extern "C" const char* pdf_lookup_system_font_path(fz_context* ctx, const char* fontname);
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+static void AppendU16BE(str::Str& s, u16 v) {
+    s.AppendChar((char)(v >> 8));
+    s.AppendChar((char)(v & 0xff));
+}
+
+static void AppendU32BE(str::Str& s, u32 v) {
+    AppendU16BE(s, (u16)(v >> 16));
+    AppendU16BE(s, (u16)(v & 0xffff));
+}
+
+// writes a TrueType font with nothing but a 'name' table, which is
+// all that is parsed for the font catalog
+static bool WriteNameOnlyFont(const WCHAR* path, const char* family, const char* style, const char* psName) {
+    const char* names[] = {family, style, psName};
+    const u16 nameIds[] = {1, 2, 6}; // family, subfamily, PostScript name
+    str::Str strings;
+    str::Str records;
+    for (size_t i = 0; i < dimof(names); i++) {
+        // platform Microsoft, encoding Unicode BMP, language en-US
+        AppendU16BE(records, 3);
+        AppendU16BE(records, 1);
+        AppendU16BE(records, 0x409);
+        AppendU16BE(records, nameIds[i]);
+        AppendU16BE(records, (u16)(str::Len(names[i]) * 2));
+        AppendU16BE(records, (u16)strings.size());
+        for (const char* c = names[i]; *c; c++) {
+            AppendU16BE(strings, (u8)*c);
+        }
+    }
+    u16 storageOffset = (u16)(6 + records.size());
+
+    str::Str data;
+    // offset table with a single table directory entry
+    AppendU32BE(data, 0x00010000);
+    AppendU16BE(data, 1);
+    AppendU16BE(data, 16);
+    AppendU16BE(data, 0);
+    AppendU16BE(data, 0);
+    AppendU32BE(data, 0x6e616d65); // 'name'
+    AppendU32BE(data, 0);
+    AppendU32BE(data, 28);
+    AppendU32BE(data, (u32)(storageOffset + strings.size()));
+    // name table
+    AppendU16BE(data, 0);
+    AppendU16BE(data, (u16)dimof(names));
+    AppendU16BE(data, storageOffset);
+    data.Append(records.Get(), records.size());
+    data.Append(strings.Get(), strings.size());
+    return file::WriteFile(path, data.AsSpan());
+}
+
+static void CheckFontFile(fz_context* ctx, const char* fontName, const char* fileName) {
+    const char* path = pdf_lookup_system_font_path(ctx, fontName);
+    utassert(path && str::EndsWithI(path, fileName));
+}
+
+void SystemFontCatalog_UnitTests() {
+    AutoFreeWstr dir(path::GetTempFilePath(L"Fnt"));
+    if (!dir) {
+        return;
+    }
+    // GetTempFilePath creates an empty file, use its name for a directory instead
+    file::Delete(dir);
+    utassert(dir::Create(dir));
+    AutoFreeWstr regular(path::Join(dir, L"arial.ttf"));
+    AutoFreeWstr bold(path::Join(dir, L"arialbd.ttf"));
+    AutoFreeWstr italic(path::Join(dir, L"ariali.ttf"));
+    AutoFreeWstr catalog(path::Join(dir, L"fontcatalog.bin"));
+    utassert(WriteNameOnlyFont(regular, "Arial", "Regular", "ArialMT"));
+    utassert(WriteNameOnlyFont(bold, "Arial", "Bold", "Arial-BoldMT"));
+    utassert(WriteNameOnlyFont(italic, "Arial", "Italic", "Arial-ItalicMT"));
+
+    fz_context* ctx = fz_new_context(nullptr, nullptr, FZ_STORE_DEFAULT);
+    pdf_set_system_font_dir(ToUtf8Temp(dir).Get());
+    pdf_set_system_font_catalog_path(ToUtf8Temp(catalog).Get());
+
+    // the first lookup parses all font files and writes the catalog
+    CheckFontFile(ctx, "ArialMT", "arial.ttf");
+    CheckFontFile(ctx, "Arial", "arial.ttf");
+    CheckFontFile(ctx, "Arial,Bold", "arialbd.ttf");
+    CheckFontFile(ctx, "Arial,Italic", "ariali.ttf");
+    CheckFontFile(ctx, "ArialItalic", "ariali.ttf");
+    CheckFontFile(ctx, "Helvetica-Bold", "arialbd.ttf");
+    // without a font for the style, the regular font is used
+    CheckFontFile(ctx, "Arial,BoldItalic", "arial.ttf");
+    utassert(!pdf_lookup_system_font_path(ctx, "Courier"));
+    utassert(file::Exists(catalog));
+
+    // the second time, names come from the catalog, minus the removed font file
+    destroy_system_font_list();
+    file::Delete(italic);
+    CheckFontFile(ctx, "ArialMT", "arial.ttf");
+    CheckFontFile(ctx, "Arial,Bold", "arialbd.ttf");
+    CheckFontFile(ctx, "Arial,Italic", "arial.ttf");
+    CheckFontFile(ctx, "ArialItalic", "arial.ttf");
+
+    destroy_system_font_list();
+    pdf_set_system_font_dir(nullptr);
+    pdf_set_system_font_catalog_path(nullptr);
+    fz_drop_context(ctx);
+    dir::RemoveAll(dir);
+}
@@ -247,41 +247,17 @@ void ToggleTocBox(WindowInfo* win) {
 
 // find the closest item in tree view to a given page number
 static TreeItem* TreeItemForPageNo(TreeCtrl* treeCtrl, int pageNo) {
-    TocItem* bestMatch = nullptr;
-    int bestMatchPageNo = 0;
-
-    TreeModel* tm = treeCtrl->treeModel;
-    if (!tm) {
+    // the ToC tree view only ever shows a TocTree
+    auto* tocTree = (TocTree*)treeCtrl->treeModel;
+    if (!tocTree) {
         return nullptr;
     }
-    int nItems = 0;
-    VisitTreeModelItems(tm, [&](TreeItem* ti) {
-        auto* docItem = (TocItem*)ti;
-        if (!docItem) {
-            return true;
-        }
-        if (!bestMatch) {
-            // if nothing else matches, match the root node
-            bestMatch = docItem;
-        }
-        ++nItems;
-        int page = docItem->pageNo;
-        if ((page <= pageNo) && (page >= bestMatchPageNo) && (page >= 1)) {
-            bestMatch = docItem;
-            bestMatchPageNo = page;
-            if (pageNo == bestMatchPageNo) {
-                // we can stop earlier if we found the exact match
-                return false;
-            }
-        }
-        return true;
-    });
     // if there's only one item, we want to unselect it so that it can
     // be selected by the user
-    if (nItems < 2) {
+    if (tocTree->ItemsCount() < 2) {
         return nullptr;
     }
-    return bestMatch;
+    return tocTree->FindItemForPageNo(pageNo);
 }
 
 // TODO: I can't use TreeItem->IsExpanded() because it's not in sync with
@@ -17,10 +17,95 @@ bool isWordChar(WCHAR c) {
     return IsCharAlphaNumeric(c) || c == '_';
 }
 
+static bool FitsInI16(int n) {
+    return INT16_MIN <= n && n <= INT16_MAX;
+}
+
+CompactCoords* NewCompactCoords(const Rect* rects, int len) {
+    auto cc = new CompactCoords();
+    cc->len = len;
+    cc->xOffsets = AllocArray<i16>(len);
+    cc->widths = AllocArray<i16>(len);
+
+    Vec<GlyphRun> runs;
+    bool fits = true;
+    int prevX = 0;
+    for (int i = 0; fits && i < len; i++) {
+        Rect r = rects[i];
+        int xOff = r.x - prevX;
+        GlyphRun* run = runs.IsEmpty() ? nullptr : &runs.Last();
+        if (!run || run->y != r.y || run->dy != r.dy || !FitsInI16(xOff)) {
+            runs.Append(GlyphRun{i, r.x, r.y, r.dy});
+            xOff = 0;
+        }
+        fits = FitsInI16(r.dx);
+        cc->xOffsets[i] = (i16)xOff;
+        cc->widths[i] = (i16)r.dx;
+        prevX = r.x;
+    }
+
+    size_t compactSize = runs.size() * sizeof(GlyphRun) + len * 2 * sizeof(i16);
+    if (!fits || compactSize >= len * sizeof(Rect)) {
+        free(cc->xOffsets);
+        free(cc->widths);
+        cc->xOffsets = nullptr;
+        cc->widths = nullptr;
+        cc->rects = (Rect*)memdup(rects, len * sizeof(Rect));
+        return cc;
+    }
+    cc->nRuns = runs.isize();
+    cc->runs = runs.StealData();
+    return cc;
+}
+
+void DeleteCompactCoords(CompactCoords* cc) {
+    if (!cc) {
+        return;
+    }
+    free(cc->runs);
+    free(cc->xOffsets);
+    free(cc->widths);
+    free(cc->rects);
+    delete cc;
+}
+
+// rectsOut must have space for cc->len Rects
+void DecodeCompactCoords(const CompactCoords* cc, Rect* rectsOut) {
+    if (cc->rects) {
+        memcpy(rectsOut, cc->rects, cc->len * sizeof(Rect));
+        return;
+    }
+    const GlyphRun* run = cc->runs;
+    const GlyphRun* nextRun = cc->runs;
+    const GlyphRun* end = cc->runs + cc->nRuns;
+    int x = 0;
+    for (int i = 0; i < cc->len; i++) {
+        if (nextRun < end && nextRun->start == i) {
+            run = nextRun++;
+            x = run->x;
+        } else {
+            x += cc->xOffsets[i];
+        }
+        rectsOut[i] = Rect(x, run->y, cc->widths[i], run->dy);
+    }
+}
+
+size_t CompactCoordsSize(const CompactCoords* cc) {
+    size_t size = sizeof(CompactCoords);
+    if (cc->rects) {
+        return size + cc->len * sizeof(Rect);
+    }
+    return size + cc->nRuns * sizeof(GlyphRun) + cc->len * 2 * sizeof(i16);
+}
+
+// an OCRed document can easily have several million glyphs
+constexpr size_t kMaxCoordsSize = 32 * 1024 * 1024;
+
 DocumentTextCache::DocumentTextCache(EngineBase* engine) : engine(engine) {
     nPages = engine->PageCount();
-    pagesText = AllocArray<PageText>(nPages);
-    debugSize = nPages * (sizeof(Rect*) + sizeof(WCHAR*) + sizeof(int));
+    pagesText = AllocArray<CachedPageText>(nPages);
+    maxCoordsSize = kMaxCoordsSize;
+    debugSize = nPages * (int)sizeof(CachedPageText);
 
     InitializeCriticalSection(&access);
 }
@@ -28,10 +113,9 @@ DocumentTextCache::DocumentTextCache(EngineBase* engine) : engine(engine) {
 DocumentTextCache::~DocumentTextCache() {
     EnterCriticalSection(&access);
 
-    int nPages = engine->PageCount();
     for (int i = 0; i < nPages; i++) {
-        PageText* pageText = &pagesText[i];
-        free(pageText->coords);
+        CachedPageText* pageText = &pagesText[i];
+        DeleteCompactCoords(pageText->coords);
         free(pageText->text);
     }
     free(pagesText);
@@ -41,39 +125,88 @@ DocumentTextCache::~DocumentTextCache() {
 
 bool DocumentTextCache::HasTextForPage(int pageNo) const {
     CrashIf(pageNo < 1 || pageNo > nPages);
-    PageText* pageText = &pagesText[pageNo - 1];
+    CachedPageText* pageText = &pagesText[pageNo - 1];
     return pageText->text != nullptr;
 }
 
-const WCHAR* DocumentTextCache::GetTextForPage(int pageNo, int* lenOut, Rect** coordsOut) {
+const WCHAR* DocumentTextCache::GetTextForPage(int pageNo, int* lenOut, Vec<Rect>* coordsOut) {
     CrashIf(pageNo < 1 || pageNo > nPages);
 
     ScopedCritSec scope(&access);
-    PageText* pageText = &pagesText[pageNo - 1];
+    CachedPageText* pageText = &pagesText[pageNo - 1];
+    pageText->lastUsed = ++useCount;
 
-    if (!pageText->text) {
-        *pageText = engine->ExtractPageText(pageNo);
+    // coordinates are only re-extracted (together with the text) if they've been evicted
+    if (!pageText->text || (coordsOut && !pageText->coords)) {
+        PageText extracted = engine->ExtractPageText(pageNo);
         if (!pageText->text) {
-            pageText->text = str::Dup(L"");
-            pageText->len = 0;
+            pageText->text = extracted.text ? extracted.text : str::Dup(L"");
+            pageText->len = extracted.text ? extracted.len : 0;
+            debugSize += (pageText->len + 1) * (int)sizeof(WCHAR);
+        } else {
+            CrashIf(extracted.len != pageText->len);
+            free(extracted.text);
         }
-        debugSize += (pageText->len + 1) * (int)(sizeof(WCHAR) + sizeof(Rect));
+        if (!pageText->coords) {
+            int len = extracted.coords ? std::min(extracted.len, pageText->len) : 0;
+            pageText->coords = NewCompactCoords(extracted.coords, len);
+            size_t size = CompactCoordsSize(pageText->coords);
+            coordsSize += size;
+            debugSize += (int)size;
+        }
+        free(extracted.coords);
+        EvictCoords(pageNo);
     }
 
     if (lenOut) {
         *lenOut = pageText->len;
     }
     if (coordsOut) {
-        *coordsOut = pageText->coords;
+        coordsOut->Reset();
+        Rect* rects = coordsOut->AppendBlanks(pageText->len);
+        DecodeCompactCoords(pageText->coords, rects);
+        for (int i = pageText->coords->len; i < pageText->len; i++) {
+            rects[i] = Rect();
+        }
     }
     return pageText->text;
 }
 
+// frees the least recently used glyph coordinates until there's again
+// some room below maxCoordsSize (text isn't evicted as it's cheap in comparison)
+void DocumentTextCache::EvictCoords(int keepPageNo) {
+    if (coordsSize <= maxCoordsSize) {
+        return;
+    }
+    Vec<CachedPageText*> cached;
+    for (int i = 0; i < nPages; i++) {
+        if (pagesText[i].coords && i != keepPageNo - 1) {
+            cached.Append(&pagesText[i]);
+        }
+    }
+    std::sort(cached.begin(), cached.end(),
+              [](CachedPageText* a, CachedPageText* b) { return a->lastUsed < b->lastUsed; });
+    for (CachedPageText* pageText : cached) {
+        if (coordsSize <= maxCoordsSize / 4 * 3) {
+            break;
+        }
+        size_t size = CompactCoordsSize(pageText->coords);
+        coordsSize -= size;
+        debugSize -= (int)size;
+        DeleteCompactCoords(pageText->coords);
+        pageText->coords = nullptr;
+    }
+}
+
 TextSelection::TextSelection(EngineBase* engine, DocumentTextCache* textCache) : engine(engine), textCache(textCache) {
 }
 
 TextSelection::~TextSelection() {
     Reset();
+    for (PageGlyphs* pg : pageGlyphs) {
+        DeleteGlyphGrid(pg->grid);
+        delete pg;
+    }
 }
 
 void TextSelection::Reset() {
@@ -85,41 +218,279 @@ void TextSelection::Reset() {
     result.rects = nullptr;
 }
 
-// returns the index of the glyph closest to the right of the given coordinates
-// (i.e. when over the right half of a glyph, the returned index will be for the
-// glyph following it, which will be the first glyph (not) to be selected)
-static int FindClosestGlyph(TextSelection* ts, int pageNo, double x, double y) {
-    int textLen;
-    Rect* coords;
-    ts->textCache->GetTextForPage(pageNo, &textLen, &coords);
-    PointF pt = PointF(x, y);
+static PageGlyphs* FindPageGlyphs(TextSelection* ts, int pageNo) {
+    for (PageGlyphs* pg : ts->pageGlyphs) {
+        if (pg->pageNo == pageNo) {
+            return pg;
+        }
+    }
+    return nullptr;
+}
 
-    unsigned int maxDist = UINT_MAX;
-    Point pti = ToPoint(pt);
-    bool overGlyph = false;
-    int result = -1;
+// glyph coordinates are decoded once and then reused while the same page is accessed.
+// pages in between the ends of a selection don't replace the hit tested ones
+static const WCHAR* GetTextAndCoords(TextSelection* ts, int pageNo, int* lenOut, Rect** coordsOut) {
+    const WCHAR* text;
+    if (PageGlyphs* pg = FindPageGlyphs(ts, pageNo)) {
+        text = ts->textCache->GetTextForPage(pageNo, lenOut);
+        *coordsOut = pg->coords.LendData();
+        return text;
+    }
+    if (ts->coordsPageNo == pageNo) {
+        text = ts->textCache->GetTextForPage(pageNo, lenOut);
+    } else {
+        text = ts->textCache->GetTextForPage(pageNo, lenOut, &ts->coords);
+        ts->coordsPageNo = pageNo;
+    }
+    *coordsOut = ts->coords.LendData();
+    return text;
+}
+
+// a uniform grid over the glyphs of a page, so that finding the glyph
+// at (resp. closest to) a point only has to look at a few of them
+struct GlyphGrid {
+    // bounding box of all glyphs (inclusive of right and bottom edges)
+    int x0{0}, y0{0}, x1{0}, y1{0};
+    int cellDx{1}, cellDy{1};
+    int cols{0}, rows{0};
+    // indices of the glyphs overlapping cell n are glyphs[cellStart[n]] to glyphs[cellStart[n + 1] - 1]
+    Vec<int> cellStart;
+    Vec<int> glyphs;
+    // glyphs overlapping too many cells are checked for every query instead
+    Vec<int> bigGlyphs;
+
+    int CellX(int x) const {
+        return (int)floor((double)(x - x0) / cellDx);
+    }
+    int CellY(int y) const {
+        return (int)floor((double)(y - y0) / cellDy);
+    }
+};
+
+static bool IsLineBreak(const Rect& r) {
+    return !r.x && !r.dx;
+}
+
+// returns false if the glyph should go into bigGlyphs
+static bool GlyphCells(GlyphGrid* grid, const Rect& r, int* c0, int* c1, int* r0, int* r1) {
+    *c0 = grid->CellX(std::min(r.x, r.x + r.dx));
+    *c1 = grid->CellX(std::max(r.x, r.x + r.dx));
+    *r0 = grid->CellY(std::min(r.y, r.y + r.dy));
+    *r1 = grid->CellY(std::max(r.y, r.y + r.dy));
+    return (*c1 - *c0 + 1) * (*r1 - *r0 + 1) <= 16;
+}
+
+GlyphGrid* NewGlyphGrid(const Rect* coords, int len) {
+    auto grid = new GlyphGrid();
+    int n = 0;
+    for (int i = 0; i < len; i++) {
+        const Rect& r = coords[i];
+        if (IsLineBreak(r)) {
+            continue;
+        }
+        int x0 = std::min(r.x, r.x + r.dx), x1 = std::max(r.x, r.x + r.dx);
+        int y0 = std::min(r.y, r.y + r.dy), y1 = std::max(r.y, r.y + r.dy);
+        if (n == 0) {
+            grid->x0 = x0, grid->x1 = x1, grid->y0 = y0, grid->y1 = y1;
+        }
+        grid->x0 = std::min(grid->x0, x0);
+        grid->x1 = std::max(grid->x1, x1);
+        grid->y0 = std::min(grid->y0, y0);
+        grid->y1 = std::max(grid->y1, y1);
+        n++;
+    }
+    if (n == 0) {
+        return grid;
+    }
 
-    for (int i = 0; i < textLen; i++) {
-        Rect& coord = coords[i];
-        if (!coord.x && !coord.dx) {
+    // aim for about 4 glyphs per cell with cells as square as possible
+    double dx = (double)grid->x1 - grid->x0 + 1;
+    double dy = (double)grid->y1 - grid->y0 + 1;
+    double nCells = std::max(n / 4, 1);
+    int cols = limitValue((int)sqrt(nCells * dx / dy), 1, (int)nCells);
+    int rows = std::max((int)(nCells / cols), 1);
+    grid->cellDx = std::max((int)ceil(dx / cols), 1);
+    grid->cellDy = std::max((int)ceil(dy / rows), 1);
+    grid->cols = (int)ceil(dx / grid->cellDx);
+    grid->rows = (int)ceil(dy / grid->cellDy);
+
+    // count the glyphs per cell, then fill in their indices
+    int nGridCells = grid->cols * grid->rows;
+    int* cellStart = grid->cellStart.AppendBlanks(nGridCells + 1);
+    int c0, c1, r0, r1;
+    for (int i = 0; i < len; i++) {
+        if (IsLineBreak(coords[i]) || !GlyphCells(grid, coords[i], &c0, &c1, &r0, &r1)) {
             continue;
         }
-        if (overGlyph && !coord.Contains(pti)) {
+        for (int row = r0; row <= r1; row++) {
+            for (int col = c0; col <= c1; col++) {
+                cellStart[row * grid->cols + col + 1]++;
+            }
+        }
+    }
+    for (int i = 0; i < nGridCells; i++) {
+        cellStart[i + 1] += cellStart[i];
+    }
+    int* glyphs = grid->glyphs.AppendBlanks(cellStart[nGridCells]);
+    Vec<int> cellEnd;
+    int* end = cellEnd.AppendBlanks(nGridCells);
+    memcpy(end, cellStart, nGridCells * sizeof(int));
+    for (int i = 0; i < len; i++) {
+        if (IsLineBreak(coords[i])) {
             continue;
         }
+        if (!GlyphCells(grid, coords[i], &c0, &c1, &r0, &r1)) {
+            grid->bigGlyphs.Append(i);
+            continue;
+        }
+        for (int row = r0; row <= r1; row++) {
+            for (int col = c0; col <= c1; col++) {
+                glyphs[end[row * grid->cols + col]++] = i;
+            }
+        }
+    }
+    return grid;
+}
+
+void DeleteGlyphGrid(GlyphGrid* grid) {
+    delete grid;
+}
+
+struct ClosestGlyph {
+    int idx{-1};
+    uint dist{UINT_MAX};
+};
+
+// for equally distant glyphs, the first one wins (as if they were all looked at in order)
+static void CheckGlyph(ClosestGlyph* closest, const Rect* coords, int i, Point pt, Point* mustContain) {
+    const Rect& coord = coords[i];
+    if (mustContain && !coord.Contains(*mustContain)) {
+        return;
+    }
+    uint dist = distSq(pt.x - coord.x - coord.dx / 2, pt.y - coord.y - coord.dy / 2);
+    bool isFirst = mustContain && closest->idx == -1;
+    if (isFirst || dist < closest->dist || dist == closest->dist && i < closest->idx) {
+        closest->idx = i;
+        closest->dist = dist;
+    }
+}
+
+static void CheckGlyphsInCell(ClosestGlyph* closest, GlyphGrid* grid, const Rect* coords, int col, int row, Point pt,
+                              Point* mustContain) {
+    int n = row * grid->cols + col;
+    for (int j = grid->cellStart.at(n); j < grid->cellStart.at(n + 1); j++) {
+        CheckGlyph(closest, coords, grid->glyphs.at(j), pt, mustContain);
+    }
+}
+
+// returns the glyph containing pti whose center is closest to pt (or -1)
+int FindGlyphAt(GlyphGrid* grid, const Rect* coords, Point pti, Point pt) {
+    ClosestGlyph closest;
+    for (int i : grid->bigGlyphs) {
+        CheckGlyph(&closest, coords, i, pt, &pti);
+    }
+    if (grid->cols > 0 && grid->x0 <= pti.x && pti.x <= grid->x1 && grid->y0 <= pti.y && pti.y <= grid->y1) {
+        CheckGlyphsInCell(&closest, grid, coords, grid->CellX(pti.x), grid->CellY(pti.y), pt, &pti);
+    }
+    return closest.idx;
+}
 
-        uint dist = distSq((int)x - coord.x - coord.dx / 2, (int)y - coord.y - coord.dy / 2);
-        if (dist < maxDist) {
-            result = i;
-            maxDist = dist;
+// returns the glyph whose center is closest to pt (or -1). looks at the cells
+// in rings of growing size around pt until the glyphs outside of them can't
+// be closer than the closest one found (the center of a glyph lies in one of
+// the cells it's been added to)
+int FindGlyphNextTo(GlyphGrid* grid, const Rect* coords, Point pt) {
+    ClosestGlyph closest;
+    for (int i : grid->bigGlyphs) {
+        CheckGlyph(&closest, coords, i, pt, nullptr);
+    }
+    if (grid->cols == 0) {
+        return closest.idx;
+    }
+
+    int col = grid->CellX(pt.x);
+    int row = grid->CellY(pt.y);
+    int lastCol = grid->cols - 1, lastRow = grid->rows - 1;
+    // rings closer to pt than the grid are empty, rings farther away than all its cells aren't needed
+    int kMin = std::max({0, col - lastCol, -col, row - lastRow, -row});
+    int kMax = std::max({abs(col), abs(col - lastCol), abs(row), abs(row - lastRow)});
+    for (int k = kMin; k <= kMax; k++) {
+        for (int r = std::max(row - k, 0); r <= std::min(row + k, lastRow); r++) {
+            if (r == row - k || r == row + k) {
+                for (int c = std::max(col - k, 0); c <= std::min(col + k, lastCol); c++) {
+                    CheckGlyphsInCell(&closest, grid, coords, c, r, pt, nullptr);
+                }
+                continue;
+            }
+            if (col - k >= 0 && col - k <= lastCol) {
+                CheckGlyphsInCell(&closest, grid, coords, col - k, r, pt, nullptr);
+            }
+            if (k > 0 && col + k >= 0 && col + k <= lastCol) {
+                CheckGlyphsInCell(&closest, grid, coords, col + k, r, pt, nullptr);
+            }
         }
-        // prefer glyphs the cursor is actually over
-        if (!overGlyph && coord.Contains(pti)) {
-            overGlyph = true;
-            result = i;
-            maxDist = dist;
+        if (closest.idx == -1) {
+            continue;
+        }
+        // the distance to the closest glyph center outside of the visited cells
+        i64 left = grid->x0 + (i64)(col - k) * grid->cellDx;
+        i64 right = grid->x0 + (i64)(col + k + 1) * grid->cellDx;
+        i64 top = grid->y0 + (i64)(row - k) * grid->cellDy;
+        i64 bottom = grid->y0 + (i64)(row + k + 1) * grid->cellDy;
+        i64 minDist = std::min({pt.x - left + 1, right - pt.x, pt.y - top + 1, bottom - pt.y});
+        if (minDist * minDist > (i64)closest.dist) {
+            break;
         }
     }
+    return closest.idx;
+}
+
+// a few pages are enough for a selection's start and end page
+constexpr int kMaxPageGlyphs = 4;
+
+// returns the glyphs of pageNo with the grid over them for hit testing
+static PageGlyphs* GetPageGlyphs(TextSelection* ts, int pageNo) {
+    PageGlyphs* pg = FindPageGlyphs(ts, pageNo);
+    if (!pg) {
+        if (ts->pageGlyphs.isize() >= kMaxPageGlyphs) {
+            PageGlyphs* lru = ts->pageGlyphs.at(0);
+            for (PageGlyphs* other : ts->pageGlyphs) {
+                if (other->lastUsed < lru->lastUsed) {
+                    lru = other;
+                }
+            }
+            ts->pageGlyphs.Remove(lru);
+            DeleteGlyphGrid(lru->grid);
+            delete lru;
+        }
+        pg = new PageGlyphs();
+        pg->pageNo = pageNo;
+        ts->textCache->GetTextForPage(pageNo, nullptr, &pg->coords);
+        ts->pageGlyphs.Append(pg);
+    }
+    pg->lastUsed = ++ts->pageGlyphsUseCount;
+    if (!pg->grid) {
+        pg->grid = NewGlyphGrid(pg->coords.LendData(), pg->coords.isize());
+    }
+    return pg;
+}
+
+// returns the index of the glyph closest to the right of the given coordinates
+// (i.e. when over the right half of a glyph, the returned index will be for the
+// glyph following it, which will be the first glyph (not) to be selected)
+static int FindClosestGlyph(TextSelection* ts, int pageNo, double x, double y) {
+    PageGlyphs* pg = GetPageGlyphs(ts, pageNo);
+    int textLen = pg->coords.isize();
+    Rect* coords = pg->coords.LendData();
+    PointF pt = PointF(x, y);
+
+    Point pti = ToPoint(pt);
+    Point ptDist((int)x, (int)y);
+    // prefer glyphs the cursor is actually over
+    int result = FindGlyphAt(pg->grid, coords, pti, ptDist);
+    if (-1 == result) {
+        result = FindGlyphNextTo(pg->grid, coords, ptDist);
+    }
 
     if (-1 == result) {
         return 0;
@@ -144,7 +515,7 @@ static int FindClosestGlyph(TextSelection* ts, int pageNo, double x, double y) {
 static void FillResultRects(TextSelection* ts, int pageNo, int glyph, int length, WStrVec* lines = nullptr) {
     int len;
     Rect* coords;
-    const WCHAR* text = ts->textCache->GetTextForPage(pageNo, &len, &coords);
+    const WCHAR* text = GetTextAndCoords(ts, pageNo, &len, &coords);
     CrashIf(len < glyph + length);
     Rect mediabox = ts->engine->PageMediabox(pageNo).Round();
     Rect *c = &coords[glyph], *end = c + length;
@@ -198,11 +569,10 @@ static void FillResultRects(TextSelection* ts, int pageNo, int glyph, int length
 }
 
 bool TextSelection::IsOverGlyph(int pageNo, double x, double y) {
-    int textLen;
-    Rect* coords;
-    textCache->GetTextForPage(pageNo, &textLen, &coords);
-
     int glyphIx = FindClosestGlyph(this, pageNo, x, y);
+    PageGlyphs* pg = GetPageGlyphs(this, pageNo);
+    int textLen = pg->coords.isize();
+    Rect* coords = pg->coords.LendData();
     Point pt = ToPoint(PointF(x, y));
     // when over the right half of a glyph, FindClosestGlyph returns the
     // index of the next glyph, in which case glyphIx must be decremented
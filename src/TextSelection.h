@@ -1,10 +1,49 @@
 /* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
    License: GPLv3 */
 
+// consecutive glyphs with the same y and dy (i.e. usually the glyphs of a line)
+struct GlyphRun {
+    int start{0}; // index of the first glyph in the run
+    int x{0};     // x of the first glyph
+    int y{0};
+    int dy{0};
+};
+
+// bounding boxes of the glyphs of a page in compact form: instead of a Rect,
+// each glyph only stores its x offset from the previous glyph and its width
+// as 16-bit values (4 instead of 16 bytes) while y and dy are shared per run.
+// if that doesn't save memory (or values don't fit), the Rects are kept
+struct CompactCoords {
+    int len{0};
+    GlyphRun* runs{nullptr};
+    int nRuns{0};
+    i16* xOffsets{nullptr};
+    i16* widths{nullptr};
+    Rect* rects{nullptr};
+};
+
+CompactCoords* NewCompactCoords(const Rect* rects, int len);
+void DeleteCompactCoords(CompactCoords* cc);
+void DecodeCompactCoords(const CompactCoords* cc, Rect* rectsOut);
+size_t CompactCoordsSize(const CompactCoords* cc);
+
+struct CachedPageText {
+    WCHAR* text{nullptr};
+    int len{0};
+    // nullptr if evicted, then re-extracted when needed
+    CompactCoords* coords{nullptr};
+    int lastUsed{0};
+};
+
 struct DocumentTextCache {
     EngineBase* engine{nullptr};
     int nPages{0};
-    PageText* pagesText{nullptr};
+    // text is kept until the cache is destroyed as callers hold on to it,
+    // glyph coordinates are evicted when they take more than maxCoordsSize
+    CachedPageText* pagesText{nullptr};
+    size_t coordsSize{0};
+    size_t maxCoordsSize{0};
+    int useCount{0};
     int debugSize{0};
 
     CRITICAL_SECTION access;
@@ -13,7 +52,29 @@ struct DocumentTextCache {
     ~DocumentTextCache();
 
     bool HasTextForPage(int pageNo) const;
-    const WCHAR* GetTextForPage(int pageNo, int* lenOut = nullptr, Rect** coordsOut = nullptr);
+    // coordsOut receives the bounding box of each char of the text
+    // (line breaks have an empty one)
+    const WCHAR* GetTextForPage(int pageNo, int* lenOut = nullptr, Vec<Rect>* coordsOut = nullptr);
+    void EvictCoords(int keepPageNo);
+};
+
+// spatial index over the glyph coordinates of a page for hit testing
+struct GlyphGrid;
+
+GlyphGrid* NewGlyphGrid(const Rect* coords, int len);
+void DeleteGlyphGrid(GlyphGrid* grid);
+// returns the glyph containing pti whose center is closest to pt (or -1)
+int FindGlyphAt(GlyphGrid* grid, const Rect* coords, Point pti, Point pt);
+// returns the glyph whose center is closest to pt (or -1)
+int FindGlyphNextTo(GlyphGrid* grid, const Rect* coords, Point pt);
+
+// decoded glyph coordinates of a hit tested page and the grid over them
+struct PageGlyphs {
+    int pageNo{0};
+    Vec<Rect> coords;
+    // created on the first hit test
+    GlyphGrid* grid{nullptr};
+    int lastUsed{0};
 };
 
 // TODO: replace with Vec<TextSel>
@@ -30,6 +91,13 @@ struct TextSelection {
 
     EngineBase* engine{nullptr};
     DocumentTextCache* textCache{nullptr};
+    // glyphs of the most recently hit tested pages (e.g. the pages
+    // a selection starts and ends on), least recently used are dropped
+    Vec<PageGlyphs*> pageGlyphs;
+    int pageGlyphsUseCount{0};
+    // glyph coordinates of coordsPageNo (not in pageGlyphs), decoded from textCache
+    Vec<Rect> coords;
+    int coordsPageNo{0};
 
     TextSelection(EngineBase* engine, DocumentTextCache* textCache);
     ~TextSelection();
@@ -99,6 +99,19 @@ CachedFont* GetCachedFont(const WCHAR* name, float size, FontStyle style) {
     return (*item = new CachedFontItem(name, size, style, font));
 }
 
+// text is never measured concurrently (see CanMeasureTextConcurrently),
+// so threads just share the fonts of the global cache
+ThreadFonts* AllocThreadFonts() {
+    return nullptr;
+}
+
+void FreeThreadFonts(__unused ThreadFonts* tf) {
+}
+
+CachedFont* GetThreadFont(__unused ThreadFonts* tf, const WCHAR* name, float size, FontStyle style) {
+    return GetCachedFont(name, size, style);
+}
+
 // set consistent mode for our graphics objects so that we get
 // the same results when measuring text
 void InitGraphicsMode(Graphics* g) {
@@ -133,6 +146,11 @@ void FreeGraphicsForMeasureText(__unused Graphics* g) {
     /* deallocation happens in mui::Destroy */
 }
 
+// the font cache and the Graphics object are shared without locking
+bool CanMeasureTextConcurrently() {
+    return false;
+}
+
 // allow for calls to mui::Initialize and mui::Destroy to be nested
 static LONG gMiniMuiRefCount = 0;
 
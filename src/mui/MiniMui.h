@@ -36,9 +36,15 @@ struct CachedFont {
 
 CachedFont* GetCachedFont(const WCHAR* name, float sizePt, Gdiplus::FontStyle style);
 
+struct ThreadFonts;
+ThreadFonts* AllocThreadFonts();
+void FreeThreadFonts(ThreadFonts* tf);
+CachedFont* GetThreadFont(ThreadFonts* tf, const WCHAR* name, float sizePt, Gdiplus::FontStyle style);
+
 void InitGraphicsMode(Gdiplus::Graphics* g);
 Gdiplus::Graphics* AllocGraphicsForMeasureText();
 void FreeGraphicsForMeasureText(Gdiplus::Graphics* g);
+bool CanMeasureTextConcurrently();
 }; // namespace mui
 
 class ScopedMiniMui {
@@ -148,13 +148,8 @@ HFONT CachedFont::GetHFont() {
     return hFont;
 }
 
-// convenience function: given cached style, get a Font object matching the font
-// properties.
-// Caller should not delete the font - it's cached for performance and deleted at exit
-CachedFont* GetCachedFont(const WCHAR* name, float sizePt, FontStyle style) {
-    ScopedMuiCritSec muiCs;
-
-    for (FontListItem* item = gFontsCache; item; item = item->next) {
+static CachedFont* GetFontFromList(FontListItem** list, const WCHAR* name, float sizePt, FontStyle style) {
+    for (FontListItem* item = *list; item; item = item->next) {
         if (item->cf.SameAs(name, sizePt, style) && item->cf.font != nullptr) {
             return &item->cf;
         }
@@ -167,18 +162,46 @@ CachedFont* GetCachedFont(const WCHAR* name, float sizePt, FontStyle style) {
         if (font->GetLastStatus() != Status::Ok) {
             // if no font is available, return the last successfully created one
             delete font;
-            if (gFontsCache) {
-                return &gFontsCache->cf;
+            if (*list) {
+                return &(*list)->cf;
             }
             return nullptr;
         }
     }
 
     FontListItem* item = new FontListItem(name, sizePt, style, font, nullptr);
-    ListInsert(&gFontsCache, item);
+    ListInsert(list, item);
     return &item->cf;
 }
 
+// convenience function: given cached style, get a Font object matching the font
+// properties.
+// Caller should not delete the font - it's cached for performance and deleted at exit
+CachedFont* GetCachedFont(const WCHAR* name, float sizePt, FontStyle style) {
+    ScopedMuiCritSec muiCs;
+    return GetFontFromList(&gFontsCache, name, sizePt, style);
+}
+
+struct ThreadFonts {
+    FontListItem* fonts = nullptr;
+};
+
+ThreadFonts* AllocThreadFonts() {
+    return new ThreadFonts();
+}
+
+void FreeThreadFonts(ThreadFonts* tf) {
+    if (tf) {
+        delete tf->fonts;
+    }
+    delete tf;
+}
+
+// only used by the thread that owns tf, so no locking needed
+CachedFont* GetThreadFont(ThreadFonts* tf, const WCHAR* name, float sizePt, FontStyle style) {
+    return GetFontFromList(&tf->fonts, name, sizePt, style);
+}
+
 Graphics* AllocGraphicsForMeasureText() {
     ScopedMuiCritSec muiCs;
 
@@ -226,6 +249,12 @@ void FreeGraphicsForMeasureText(Graphics* gfx) {
     CrashIf(true);
 }
 
+// every thread gets its own Graphics object, the font cache is locked
+// and layout threads use their own fonts (see GetThreadFont)
+bool CanMeasureTextConcurrently() {
+    return true;
+}
+
 int CeilI(float n) {
     n = ceil(n);
     return (int)n;
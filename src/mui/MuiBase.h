@@ -43,7 +43,16 @@ struct CachedFont {
 void InitGraphicsMode(Graphics* g);
 CachedFont* GetCachedFont(const WCHAR* name, float sizePt, FontStyle style);
 
+// Gdiplus::Font objects must not be used by several threads at once, so
+// threads that measure text concurrently get private copies of the fonts
+// from here. They're deleted by FreeThreadFonts()
+struct ThreadFonts;
+ThreadFonts* AllocThreadFonts();
+void FreeThreadFonts(ThreadFonts* tf);
+CachedFont* GetThreadFont(ThreadFonts* tf, const WCHAR* name, float sizePt, FontStyle style);
+
 Graphics* AllocGraphicsForMeasureText();
 void FreeGraphicsForMeasureText(Graphics* gfx);
+bool CanMeasureTextConcurrently();
 
 int CeilI(float n);
@@ -2,9 +2,11 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
+#include "utils/ThreadUtil.h"
 #include "Mui.h"
 
 /*
@@ -464,6 +466,212 @@ TextRenderHdc::~TextRenderHdc() {
     DeleteDC(hdc);
 }
 
+// the cache is emptied when it gets bigger than this
+constexpr int kTextMeasureCacheMaxEntries = 64 * 1024;
+constexpr u32 kTextMeasureCacheMaxKeyChars = 4 * 1024 * 1024;
+
+// maps (font, render method, string) to the size of the measured string
+struct TextMeasureCache {
+    struct Font {
+        WCHAR* name;
+        float sizePt;
+        Gdiplus::FontStyle style;
+        TextRenderMethod method;
+    };
+    struct Entry {
+        u32 hash;
+        // 0 for empty entries
+        u32 fontId;
+        // the string is keys[keyOff .. keyOff + keyLen]
+        u32 keyOff;
+        u32 keyLen;
+        RectF bbox;
+    };
+
+    Mutex mutex;
+    // fonts are identified by their properties (and not by CachedFont*)
+    // so that re-creating a font can't result in stale sizes.
+    // fontId is the index in fonts + 1
+    Vec<Font> fonts;
+    // open addressing with linear probing, size is a power of 2
+    Vec<Entry> table;
+    // arena for the strings of all entries
+    str::WStr keys;
+    TextMeasureCacheStats stats;
+
+    u32 GetFontId(CachedFont* font, TextRenderMethod method);
+    bool Find(u32 fontId, const WCHAR* s, size_t sLen, RectF& bboxOut);
+    void Insert(u32 fontId, const WCHAR* s, size_t sLen, RectF bbox);
+    void Reset();
+    void Grow();
+};
+
+static TextMeasureCache gTextMeasureCache;
+
+static u32 HashMeasuredString(u32 fontId, const WCHAR* s, size_t sLen) {
+    return MurmurHash2(s, sLen * sizeof(WCHAR)) ^ (fontId * 0x9E3779B1);
+}
+
+u32 TextMeasureCache::GetFontId(CachedFont* font, TextRenderMethod method) {
+    ScopedCritSec scope(&mutex.cs);
+    for (int i = 0; i < fonts.isize(); i++) {
+        Font& f = fonts.at(i);
+        if (f.sizePt == font->GetSize() && f.style == font->GetStyle() && f.method == method &&
+            str::Eq(f.name, font->GetName())) {
+            return (u32)i + 1;
+        }
+    }
+    fonts.Append({str::Dup(font->GetName()), font->GetSize(), font->GetStyle(), method});
+    return (u32)fonts.size();
+}
+
+bool TextMeasureCache::Find(u32 fontId, const WCHAR* s, size_t sLen, RectF& bboxOut) {
+    u32 hash = HashMeasuredString(fontId, s, sLen);
+    ScopedCritSec scope(&mutex.cs);
+    if (table.size() == 0) {
+        stats.misses++;
+        return false;
+    }
+    size_t mask = table.size() - 1;
+    for (size_t i = hash & mask; table.at(i).fontId != 0; i = (i + 1) & mask) {
+        Entry& e = table.at(i);
+        if (e.hash == hash && e.fontId == fontId && e.keyLen == sLen &&
+            0 == memcmp(keys.Get() + e.keyOff, s, sLen * sizeof(WCHAR))) {
+            bboxOut = e.bbox;
+            stats.hits++;
+            return true;
+        }
+    }
+    stats.misses++;
+    return false;
+}
+
+void TextMeasureCache::Insert(u32 fontId, const WCHAR* s, size_t sLen, RectF bbox) {
+    u32 hash = HashMeasuredString(fontId, s, sLen);
+    ScopedCritSec scope(&mutex.cs);
+    if (stats.entries >= kTextMeasureCacheMaxEntries || keys.size() + sLen > kTextMeasureCacheMaxKeyChars) {
+        Reset();
+    }
+    // keep the load factor below 1/2
+    if ((size_t)stats.entries * 2 >= table.size()) {
+        Grow();
+    }
+    size_t mask = table.size() - 1;
+    size_t i = hash & mask;
+    while (table.at(i).fontId != 0) {
+        Entry& e = table.at(i);
+        if (e.hash == hash && e.fontId == fontId && e.keyLen == sLen &&
+            0 == memcmp(keys.Get() + e.keyOff, s, sLen * sizeof(WCHAR))) {
+            // measured by another thread in the meantime
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+    Entry& e = table.at(i);
+    e.hash = hash;
+    e.fontId = fontId;
+    e.keyOff = (u32)keys.size();
+    e.keyLen = (u32)sLen;
+    e.bbox = bbox;
+    keys.Append(s, sLen);
+    stats.entries++;
+}
+
+// must be called with mutex locked
+void TextMeasureCache::Reset() {
+    table.Reset();
+    keys.Reset();
+    stats.entries = 0;
+    stats.resets++;
+}
+
+// must be called with mutex locked
+void TextMeasureCache::Grow() {
+    size_t newSize = std::max(table.size() * 2, (size_t)1024);
+    Vec<Entry> newTable;
+    newTable.AppendBlanks(newSize);
+    size_t mask = newSize - 1;
+    for (Entry& e : table) {
+        if (0 == e.fontId) {
+            continue;
+        }
+        size_t i = e.hash & mask;
+        while (newTable.at(i).fontId != 0) {
+            i = (i + 1) & mask;
+        }
+        newTable.at(i) = e;
+    }
+    table = newTable;
+}
+
+TextMeasureCacheStats GetTextMeasureCacheStats() {
+    ScopedCritSec scope(&gTextMeasureCache.mutex.cs);
+    return gTextMeasureCache.stats;
+}
+
+TextRenderCachedMeasure* TextRenderCachedMeasure::Create(ITextRender* tr) {
+    auto res = new TextRenderCachedMeasure(tr);
+    res->method = tr->method;
+    return res;
+}
+
+void TextRenderCachedMeasure::SetFont(CachedFont* font) {
+    tr->SetFont(font);
+    if (font != currFont) {
+        currFont = font;
+        currFontId = font ? gTextMeasureCache.GetFontId(font, tr->method) : 0;
+    }
+}
+
+void TextRenderCachedMeasure::SetTextColor(Gdiplus::Color col) {
+    tr->SetTextColor(col);
+}
+
+void TextRenderCachedMeasure::SetTextBgColor(Gdiplus::Color col) {
+    tr->SetTextBgColor(col);
+}
+
+float TextRenderCachedMeasure::GetCurrFontLineSpacing() {
+    return tr->GetCurrFontLineSpacing();
+}
+
+RectF TextRenderCachedMeasure::Measure(const char* s, size_t sLen) {
+    return tr->Measure(s, sLen);
+}
+
+RectF TextRenderCachedMeasure::Measure(const WCHAR* s, size_t sLen) {
+    if (0 == currFontId) {
+        return tr->Measure(s, sLen);
+    }
+    RectF bbox;
+    if (gTextMeasureCache.Find(currFontId, s, sLen, bbox)) {
+        return bbox;
+    }
+    bbox = tr->Measure(s, sLen);
+    gTextMeasureCache.Insert(currFontId, s, sLen, bbox);
+    return bbox;
+}
+
+void TextRenderCachedMeasure::Lock() {
+    tr->Lock();
+}
+
+void TextRenderCachedMeasure::Unlock() {
+    tr->Unlock();
+}
+
+void TextRenderCachedMeasure::Draw(const char* s, size_t sLen, RectF bb, bool isRtl) {
+    tr->Draw(s, sLen, bb, isRtl);
+}
+
+void TextRenderCachedMeasure::Draw(const WCHAR* s, size_t sLen, RectF bb, bool isRtl) {
+    tr->Draw(s, sLen, bb, isRtl);
+}
+
+TextRenderCachedMeasure::~TextRenderCachedMeasure() {
+    delete tr;
+}
+
 ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, int dy) {
     ITextRender* res = nullptr;
     if (TextRenderMethod::Gdiplus == method) {
@@ -478,6 +686,9 @@ ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, in
     if (TextRenderMethod::Hdc == method) {
         res = TextRenderHdc::Create(gfx, dx, dy);
     }
+    if (TextRenderMethod::FreeType == method) {
+        res = TextRenderFreeType::Create(gfx);
+    }
     CrashIf(!res);
     if (res) {
         res->method = method;
@@ -6,6 +6,7 @@ enum class TextRenderMethod {
     GdiplusQuick, // uses MeasureTextQuick
     Gdi,
     Hdc,
+    FreeType, // TextRenderFreeType, doesn't use Windows APIs for measuring
     // TODO: implement TextRenderDirectDraw
     // TextRenderDirectDraw
 };
@@ -170,6 +171,94 @@ class TextRenderHdc : public ITextRender {
     ~TextRenderHdc() override;
 };
 
+// loads fonts and draws text with mupdf (i.e. FreeType) and shapes it with HarfBuzz.
+// Measure() doesn't use any Windows API and doesn't need gfx, so this can be used
+// to lay out ebooks without a window (e.g. for benchmarks or pre-layout).
+// Draw() does nothing if gfx is nullptr
+class TextRenderFreeType : public ITextRender {
+  public:
+    // mupdf context, current font and HarfBuzz buffer (see TextRenderFreeType.cpp)
+    struct State;
+
+  private:
+    State* st = nullptr;
+    // We don't own gfx and currFont
+    Gdiplus::Graphics* gfx = nullptr;
+    CachedFont* currFont = nullptr;
+    Gdiplus::Color textColor{};
+    float dpi = 96.f;
+
+    TextRenderFreeType() = default;
+
+  public:
+    // if dpi is 0, it's taken from gfx (or 96 if gfx is nullptr)
+    static TextRenderFreeType* Create(Gdiplus::Graphics* gfx, float dpi = 0);
+
+    void SetFont(CachedFont* font) override;
+    void SetTextColor(Gdiplus::Color col) override;
+    void SetTextBgColor(__unused Gdiplus::Color col) override {
+    }
+
+    float GetCurrFontLineSpacing() override;
+
+    RectF Measure(const char* s, size_t sLen) override;
+    RectF Measure(const WCHAR* s, size_t sLen) override;
+
+    void Lock() override {
+    }
+    void Unlock() override {
+    }
+
+    void Draw(const char* s, size_t sLen, RectF bb, bool isRtl) override;
+    void Draw(const WCHAR* s, size_t sLen, RectF bb, bool isRtl) override;
+
+    ~TextRenderFreeType() override;
+};
+
+// forwards to another ITextRender (which it owns) and remembers the results of
+// Measure() in a cache shared by all instances, so that re-layouts (e.g. after
+// a window resize) don't have to measure the same words again
+class TextRenderCachedMeasure : public ITextRender {
+  private:
+    ITextRender* tr = nullptr;
+    CachedFont* currFont = nullptr;
+    // identifies currFont and tr->method in the cache
+    u32 currFontId = 0;
+
+    explicit TextRenderCachedMeasure(ITextRender* tr) : tr(tr) {
+    }
+
+  public:
+    static TextRenderCachedMeasure* Create(ITextRender* tr);
+
+    void SetFont(CachedFont* font) override;
+    void SetTextColor(Gdiplus::Color col) override;
+    void SetTextBgColor(Gdiplus::Color col) override;
+
+    float GetCurrFontLineSpacing() override;
+
+    RectF Measure(const char* s, size_t sLen) override;
+    RectF Measure(const WCHAR* s, size_t sLen) override;
+
+    void Lock() override;
+    void Unlock() override;
+
+    void Draw(const char* s, size_t sLen, RectF bb, bool isRtl) override;
+    void Draw(const WCHAR* s, size_t sLen, RectF bb, bool isRtl) override;
+
+    ~TextRenderCachedMeasure() override;
+};
+
+struct TextMeasureCacheStats {
+    i64 hits = 0;
+    i64 misses = 0;
+    // number of times the cache was emptied because it was full
+    int resets = 0;
+    int entries = 0;
+};
+
+TextMeasureCacheStats GetTextMeasureCacheStats();
+
 ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, int dy);
 
 size_t StringLenForWidth(ITextRender* textMeasure, const WCHAR* s, size_t len, float dx);
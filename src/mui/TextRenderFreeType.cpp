@@ -0,0 +1,312 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/WinUtil.h"
+#include "utils/ThreadUtil.h"
+#include "Mui.h"
+
+extern "C" {
+#include <mupdf/fitz.h>
+}
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include "hb.h"
+#include "hb-ft.h"
+
+extern "C" void pdf_install_load_system_font_funcs(fz_context* ctx);
+
+/*
+TextRenderFreeType loads fonts with mupdf (i.e. FreeType), shapes text with
+HarfBuzz and rasterizes it with mupdf's draw device. Measure() doesn't call
+any Windows API, which makes it possible to lay out ebooks without a window.
+
+Layout as a whole still needs Windows: HtmlFormatter allocates a Graphics
+(AllocGraphicsForMeasureText()) and selects fonts through mui::CachedFont,
+which creates a Gdiplus::Font, and HtmlFormatter, DrawInstr and ITextRender
+use Gdiplus types. Laying out (and benchmarking) ebooks on other platforms
+would first require porting those (see mui-todo.txt).
+
+All fz_contexts used here are clones of a single base context so that they
+share the locks: HarfBuzz allocates through whichever context currently
+holds FZ_LOCK_FREETYPE (see fz_hb_lock()), so all of them must use the same
+lock for it.
+*/
+
+namespace mui {
+
+// protects gFtBaseCtx and gFtFonts
+static Mutex gFtMutex;
+static Mutex gFtLocks[FZ_LOCK_MAX];
+static fz_locks_context gFtLocksCtx;
+static fz_context* gFtBaseCtx = nullptr;
+
+struct FtFont {
+    char* name;
+    bool bold;
+    bool italic;
+    fz_font* font;
+};
+
+// fonts are kept until the process exits, like CachedFont
+static Vec<FtFont>* gFtFonts = nullptr;
+
+struct TextRenderFreeType::State {
+    fz_context* ctx = nullptr;
+    fz_font* font = nullptr;
+    hb_buffer_t* hbBuf = nullptr;
+    // font size in pixels
+    float pxSize = 0;
+};
+
+static void FtLock(__unused void* user, int lock) {
+    gFtLocks[lock].Lock();
+}
+
+static void FtUnlock(__unused void* user, int lock) {
+    gFtLocks[lock].Unlock();
+}
+
+static fz_context* NewFtContext() {
+    ScopedCritSec scope(&gFtMutex.cs);
+    if (!gFtBaseCtx) {
+        gFtLocksCtx.lock = FtLock;
+        gFtLocksCtx.unlock = FtUnlock;
+        gFtBaseCtx = fz_new_context(nullptr, &gFtLocksCtx, FZ_STORE_DEFAULT);
+        if (!gFtBaseCtx) {
+            return nullptr;
+        }
+        pdf_install_load_system_font_funcs(gFtBaseCtx);
+    }
+    return fz_clone_context(gFtBaseCtx);
+}
+
+static const char* Base14FontName(bool bold, bool italic) {
+    if (bold) {
+        return italic ? "Times-BoldItalic" : "Times-Bold";
+    }
+    return italic ? "Times-Italic" : "Times-Roman";
+}
+
+static fz_font* GetFtFont(fz_context* ctx, CachedFont* cf) {
+    FontStyle style = cf->GetStyle();
+    bool bold = (style & FontStyleBold) != 0;
+    bool italic = (style & FontStyleItalic) != 0;
+    char* name = ToUtf8Temp(cf->GetName());
+
+    ScopedCritSec scope(&gFtMutex.cs);
+    if (!gFtFonts) {
+        gFtFonts = new Vec<FtFont>();
+    }
+    for (FtFont& f : *gFtFonts) {
+        if (f.bold == bold && f.italic == italic && str::Eq(f.name, name)) {
+            return f.font;
+        }
+    }
+
+    fz_font* font = nullptr;
+    fz_var(font);
+    fz_try(ctx) {
+        font = fz_load_system_font(ctx, name, bold, italic, 0);
+        if (!font) {
+            font = fz_new_base14_font(ctx, Base14FontName(bold, italic));
+        }
+    }
+    fz_catch(ctx) {
+        font = nullptr;
+    }
+    if (!font) {
+        return nullptr;
+    }
+    FtFont f{str::Dup(name), bold, italic, font};
+    gFtFonts->Append(f);
+    return font;
+}
+
+static void DestroyHbFont(fz_context* ctx, void* handle) {
+    fz_hb_lock(ctx);
+    hb_font_destroy((hb_font_t*)handle);
+    fz_hb_unlock(ctx);
+}
+
+// shapes the text into st->hbBuf. returns the number of font units per em,
+// in which the glyph positions are expressed (0 on error)
+static int ShapeText(TextRenderFreeType::State* st, const char* s, size_t sLen, bool isRtl) {
+    fz_context* ctx = st->ctx;
+    int upem = 0;
+    fz_hb_lock(ctx);
+    fz_try(ctx) {
+        FT_Face face = (FT_Face)fz_font_ft_face(ctx, st->font);
+        upem = face->units_per_EM;
+        if (FT_Set_Char_Size(face, upem, upem, 72, 72) != 0) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "FT_Set_Char_Size failed");
+        }
+        fz_shaper_data_t* hb = fz_font_shaper_data(ctx, st->font);
+        if (!hb->shaper_handle) {
+            hb->destroy = DestroyHbFont;
+            hb->shaper_handle = hb_ft_font_create(face, nullptr);
+        }
+        hb_buffer_clear_contents(st->hbBuf);
+        hb_buffer_set_direction(st->hbBuf, isRtl ? HB_DIRECTION_RTL : HB_DIRECTION_LTR);
+        hb_buffer_add_utf8(st->hbBuf, s, (int)sLen, 0, -1);
+        hb_buffer_guess_segment_properties(st->hbBuf);
+        hb_shape((hb_font_t*)hb->shaper_handle, st->hbBuf, nullptr, 0);
+    }
+    fz_always(ctx) {
+        fz_hb_unlock(ctx);
+    }
+    fz_catch(ctx) {
+        upem = 0;
+    }
+    return upem;
+}
+
+TextRenderFreeType* TextRenderFreeType::Create(Graphics* gfx, float dpi) {
+    fz_context* ctx = NewFtContext();
+    if (!ctx) {
+        return nullptr;
+    }
+    TextRenderFreeType* res = new TextRenderFreeType();
+    res->st = new State();
+    res->st->ctx = ctx;
+    fz_hb_lock(ctx);
+    res->st->hbBuf = hb_buffer_create();
+    fz_hb_unlock(ctx);
+    res->gfx = gfx;
+    if (gfx && dpi == 0) {
+        dpi = gfx->GetDpiY();
+    }
+    res->dpi = dpi == 0 ? 96.f : dpi;
+    // default to red to make mistakes stand out
+    res->SetTextColor(Color(0xff, 0xff, 0x0, 0x0));
+    return res;
+}
+
+void TextRenderFreeType::SetFont(CachedFont* font) {
+    if (currFont == font) {
+        return;
+    }
+    currFont = font;
+    st->font = GetFtFont(st->ctx, font);
+    st->pxSize = font->GetSize() * dpi / 72.f;
+}
+
+void TextRenderFreeType::SetTextColor(Gdiplus::Color col) {
+    textColor = col;
+}
+
+float TextRenderFreeType::GetCurrFontLineSpacing() {
+    CrashIf(!currFont);
+    if (!st->font) {
+        return st->pxSize;
+    }
+    float asc = fz_font_ascender(st->ctx, st->font);
+    float desc = fz_font_descender(st->ctx, st->font);
+    return (asc - desc) * st->pxSize;
+}
+
+RectF TextRenderFreeType::Measure(const char* s, size_t sLen) {
+    CrashIf(!currFont);
+    float lineDy = GetCurrFontLineSpacing();
+    int upem = st->font ? ShapeText(st, s, sLen, false) : 0;
+    if (upem == 0) {
+        return RectF(0, 0, 0, lineDy);
+    }
+    uint n = 0;
+    hb_glyph_position_t* pos = hb_buffer_get_glyph_positions(st->hbBuf, &n);
+    i64 dx = 0;
+    for (uint i = 0; i < n; i++) {
+        dx += pos[i].x_advance;
+    }
+    return RectF(0, 0, (float)dx * st->pxSize / (float)upem, lineDy);
+}
+
+RectF TextRenderFreeType::Measure(const WCHAR* s, size_t sLen) {
+    auto buf = ToUtf8Temp(s, sLen);
+    return Measure(buf.Get(), buf.size());
+}
+
+void TextRenderFreeType::Draw(const char* s, size_t sLen, RectF bb, bool isRtl) {
+    CrashIf(!currFont);
+    if (!gfx || !st->font || bb.dx <= 0 || bb.dy <= 0) {
+        return;
+    }
+    // rasterize at the resolution gfx will draw at
+    Gdiplus::Matrix m;
+    gfx->GetTransform(&m);
+    Gdiplus::REAL el[6];
+    m.GetElements(el);
+    float zoom = std::max(fabsf(el[0]), 0.01f);
+
+    int upem = ShapeText(st, s, sLen, isRtl);
+    if (upem == 0) {
+        return;
+    }
+    uint n = 0;
+    hb_glyph_position_t* pos = hb_buffer_get_glyph_positions(st->hbBuf, &n);
+    hb_glyph_info_t* info = hb_buffer_get_glyph_infos(st->hbBuf, nullptr);
+
+    fz_context* ctx = st->ctx;
+    float pxSize = st->pxSize * zoom;
+    float scale = pxSize / (float)upem;
+    float baseline = fz_font_ascender(ctx, st->font) * pxSize;
+    fz_irect r{0, 0, (int)ceilf(bb.dx * zoom) + 1, (int)ceilf(bb.dy * zoom) + 1};
+    float rgb[3] = {textColor.GetR() / 255.f, textColor.GetG() / 255.f, textColor.GetB() / 255.f};
+
+    fz_text* text = nullptr;
+    fz_pixmap* pix = nullptr;
+    fz_device* dev = nullptr;
+    fz_var(text);
+    fz_var(pix);
+    fz_var(dev);
+    fz_try(ctx) {
+        text = fz_new_text(ctx);
+        fz_matrix trm = fz_scale(pxSize, -pxSize);
+        float x = 0;
+        for (uint i = 0; i < n; i++) {
+            trm.e = (x + pos[i].x_offset) * scale;
+            trm.f = baseline - pos[i].y_offset * scale;
+            fz_show_glyph(ctx, text, st->font, trm, (int)info[i].codepoint, -1, 0, isRtl ? 1 : 0,
+                          FZ_BIDI_NEUTRAL, FZ_LANG_UNSET);
+            x += pos[i].x_advance;
+        }
+        pix = fz_new_pixmap_with_bbox(ctx, fz_device_bgr(ctx), r, nullptr, 1);
+        fz_clear_pixmap(ctx, pix);
+        dev = fz_new_draw_device(ctx, fz_scale(1, 1), pix);
+        fz_fill_text(ctx, dev, text, fz_scale(1, 1), fz_device_rgb(ctx), rgb, textColor.GetA() / 255.f,
+                     fz_default_color_params);
+        fz_close_device(ctx, dev);
+
+        // mupdf's pixmaps have premultiplied alpha
+        int stride = (int)fz_pixmap_stride(ctx, pix);
+        Bitmap bmp(r.x1, r.y1, stride, PixelFormat32bppPARGB, fz_pixmap_samples(ctx, pix));
+        Gdiplus::RectF dst(bb.x, bb.y, (float)r.x1 / zoom, (float)r.y1 / zoom);
+        gfx->DrawImage(&bmp, dst, 0, 0, (float)r.x1, (float)r.y1, UnitPixel);
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+        fz_drop_pixmap(ctx, pix);
+        fz_drop_text(ctx, text);
+    }
+    fz_catch(ctx) {
+        logf("TextRenderFreeType::Draw: %s\n", fz_caught_message(ctx));
+    }
+}
+
+void TextRenderFreeType::Draw(const WCHAR* s, size_t sLen, RectF bb, bool isRtl) {
+    auto buf = ToUtf8Temp(s, sLen);
+    Draw(buf.Get(), buf.size(), bb, isRtl);
+}
+
+TextRenderFreeType::~TextRenderFreeType() {
+    fz_context* ctx = st->ctx;
+    fz_hb_lock(ctx);
+    hb_buffer_destroy(st->hbBuf);
+    fz_hb_unlock(ctx);
+    fz_drop_context(ctx);
+    delete st;
+}
+
+} // namespace mui
@@ -0,0 +1,388 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// paint_bench times mupdf's span painters (the innermost loops of rendering),
+// image scaling and fast color conversions with plain C, SSE2 and AVX2 and
+// checks that they all produce the same pixels.
+// With -test, it only does the checks (run as part of the build) and only
+// reports mismatches.
+// For an end-to-end comparison, see scripts/simd-benchmark.py
+
+#include "mupdf/fitz.h"
+#include "../../mupdf/source/fitz/color-imp.h"
+#include "../../mupdf/source/fitz/draw-imp.h"
+#include "../../mupdf/source/fitz/pixmap-imp.h"
+#include "../../mupdf/source/fitz/cpu-imp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SPAN_W 1000
+#define ROWS 64
+#define REPEATS 200
+
+// the size of a scanned page at 150 dpi
+#define SCALE_W 1275
+#define SCALE_H 1650
+#define SCALE_REPEATS 10
+
+typedef struct {
+    const char* name;
+    int features;
+} Isa;
+
+static const Isa isas[] = {
+    {"C", 0},
+    {"SSE2", FZ_CPU_SSE2},
+    {"AVX2", FZ_CPU_SSE2 | FZ_CPU_AVX2},
+};
+
+// mask values as produced by anti-aliasing text and shapes:
+// mostly runs of 0 and 255 with partial coverage at the edges
+static void FillMask(unsigned char* mp, int len) {
+    int i = 0;
+    srand(1);
+    while (i < len) {
+        int run = 1 + rand() % 24;
+        int v = (rand() % 3 == 0) ? 255 : 0;
+        for (; run > 0 && i < len; run--) {
+            mp[i++] = (unsigned char)v;
+        }
+        if (i < len) {
+            mp[i++] = (unsigned char)(rand() & 255);
+        }
+    }
+}
+
+static void FillRandom(unsigned char* p, int len, int seed) {
+    int i;
+    srand(seed);
+    for (i = 0; i < len; i++) {
+        p[i] = (unsigned char)(rand() & 255);
+    }
+}
+
+// pixels with alpha are premultiplied, so no component may exceed the alpha
+// (the painters assert that in debug builds)
+static void Premultiply(unsigned char* p, int len, int n) {
+    int i, j;
+    for (i = 0; i + n <= len; i += n) {
+        for (j = 0; j < n - 1; j++) {
+            if (p[i + j] > p[i + n - 1]) {
+                p[i + j] = p[i + n - 1];
+            }
+        }
+    }
+}
+
+static int supportedFeatures;
+// in -test mode, every kernel only runs once and timings aren't printed
+static int testOnly;
+
+static double Seconds(clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+// which = 0: solid color, 1: span with color, 2: pixmap with mask
+static int Bench(fz_context* ctx, int which, int n, int da, int alpha) {
+    int stride = SPAN_W * n;
+    unsigned char* dst0 = (unsigned char*)malloc((size_t)stride * ROWS);
+    unsigned char* srcData = (unsigned char*)malloc((size_t)stride * ROWS);
+    unsigned char* dst = (unsigned char*)malloc((size_t)stride * ROWS);
+    unsigned char* ref = (unsigned char*)malloc((size_t)stride * ROWS);
+    unsigned char* mask = (unsigned char*)malloc((size_t)SPAN_W * ROWS);
+    unsigned char color[FZ_MAX_COLORS + 1];
+    const char* names[] = {"solid color", "span with color", "pixmap with mask"};
+    double baseTime = 0;
+    int failed = 0;
+    size_t k;
+
+    FillRandom(dst0, stride * ROWS, 2);
+    FillRandom(srcData, stride * ROWS, 3);
+    if (da) {
+        Premultiply(dst0, stride * ROWS, n);
+        Premultiply(srcData, stride * ROWS, n);
+    }
+    FillMask(mask, SPAN_W * ROWS);
+    FillRandom(color, sizeof(color), 4);
+    color[n - da] = (unsigned char)alpha;
+
+    for (k = 0; k < sizeof(isas) / sizeof(isas[0]); k++) {
+        clock_t start;
+        double secs;
+        int r, y;
+        if ((supportedFeatures & isas[k].features) != isas[k].features) {
+            continue;
+        }
+        fz_set_cpu_features_mask(isas[k].features);
+        memcpy(dst, dst0, (size_t)stride * ROWS);
+
+        if (which == 2) {
+            fz_pixmap* src = NULL;
+            fz_pixmap* dstPix = NULL;
+            fz_pixmap* msk = NULL;
+            fz_colorspace* cs = n - da == 1 ? fz_device_gray(ctx) : n - da == 3 ? fz_device_rgb(ctx) : fz_device_cmyk(ctx);
+            src = fz_new_pixmap_with_data(ctx, cs, SPAN_W, ROWS, NULL, da, stride, srcData);
+            dstPix = fz_new_pixmap_with_data(ctx, cs, SPAN_W, ROWS, NULL, da, stride, dst);
+            msk = fz_new_pixmap_with_data(ctx, NULL, SPAN_W, ROWS, NULL, 1, SPAN_W, mask);
+            start = clock();
+            for (r = 0; r < (testOnly ? 1 : REPEATS); r++) {
+                fz_paint_pixmap_with_mask(dstPix, src, msk);
+            }
+            secs = Seconds(start);
+            fz_drop_pixmap(ctx, src);
+            fz_drop_pixmap(ctx, dstPix);
+            fz_drop_pixmap(ctx, msk);
+        } else {
+            fz_solid_color_painter_t* solid = fz_get_solid_color_painter(n, color, da, NULL);
+            fz_span_color_painter_t* span = fz_get_span_color_painter(n, da, color, NULL);
+            start = clock();
+            for (r = 0; r < (testOnly ? 1 : REPEATS); r++) {
+                for (y = 0; y < ROWS; y++) {
+                    if (which == 0) {
+                        solid(dst + y * stride, n, SPAN_W, color, da, NULL);
+                    } else {
+                        span(dst + y * stride, mask + y * SPAN_W, n, SPAN_W, color, da, NULL);
+                    }
+                }
+            }
+            secs = Seconds(start);
+        }
+
+        if (k == 0) {
+            baseTime = secs;
+            memcpy(ref, dst, (size_t)stride * ROWS);
+        } else if (memcmp(ref, dst, (size_t)stride * ROWS) != 0) {
+            failed = 1;
+        }
+        if (!testOnly || failed) {
+            printf("%-16s n=%d da=%d alpha=%3d %-4s: %7.2f ms (%.2fx)%s\n", names[which], n, da, alpha, isas[k].name,
+                   secs * 1000, secs > 0 ? baseTime / secs : 0, failed ? " MISMATCH" : "");
+        }
+    }
+
+    free(dst0);
+    free(srcData);
+    free(dst);
+    free(ref);
+    free(mask);
+    return failed;
+}
+
+// scales an image of n components to factor times its size, offset by a fraction
+// of a pixel (which adds an alpha channel) if offset isn't 0
+static int BenchScale(fz_context* ctx, int n, int alpha, float factor, float offset) {
+    fz_colorspace* cs = n - alpha == 1 ? fz_device_gray(ctx) : n - alpha == 3 ? fz_device_rgb(ctx) : fz_device_cmyk(ctx);
+    fz_pixmap* src = fz_new_pixmap(ctx, cs, SCALE_W, SCALE_H, NULL, alpha);
+    fz_pixmap* ref = NULL;
+    double baseTime = 0;
+    int failed = 0;
+    size_t k;
+
+    FillRandom(src->samples, src->stride * src->h, 5);
+    if (alpha) {
+        Premultiply(src->samples, src->stride * src->h, n);
+    }
+    for (k = 0; k < sizeof(isas) / sizeof(isas[0]); k++) {
+        fz_pixmap* dst = NULL;
+        clock_t start;
+        double secs;
+        int r;
+        if ((supportedFeatures & isas[k].features) != isas[k].features) {
+            continue;
+        }
+        fz_set_cpu_features_mask(isas[k].features);
+        start = clock();
+        for (r = 0; r < (testOnly ? 1 : SCALE_REPEATS); r++) {
+            fz_drop_pixmap(ctx, dst);
+            dst = fz_scale_pixmap(ctx, src, offset, offset, SCALE_W * factor, SCALE_H * factor, NULL);
+        }
+        secs = Seconds(start);
+
+        if (k == 0) {
+            baseTime = secs;
+            ref = fz_keep_pixmap(ctx, dst);
+        } else if (dst->stride != ref->stride || dst->h != ref->h ||
+                   memcmp(ref->samples, dst->samples, (size_t)dst->stride * dst->h) != 0) {
+            failed = 1;
+        }
+        if (!testOnly || failed) {
+            printf("scale %.2fx%-10s n=%d alpha=%d   %-4s: %7.2f ms (%.2fx)%s\n", factor, offset ? " (offset)" : "", n,
+                   alpha, isas[k].name, secs * 1000, secs > 0 ? baseTime / secs : 0, failed ? " MISMATCH" : "");
+        }
+        fz_drop_pixmap(ctx, dst);
+    }
+
+    fz_drop_pixmap(ctx, ref);
+    fz_drop_pixmap(ctx, src);
+    return failed;
+}
+
+// returns a copy of pix whose rows are pad bytes longer than needed, like the
+// rows of pixmaps for DIB sections or of sub-pixmaps. The padding is zeroed
+static fz_pixmap* NewPaddedPixmap(fz_context* ctx, fz_pixmap* pix, int pad) {
+    int rowLen = pix->w * pix->n;
+    fz_pixmap* res =
+        fz_new_pixmap_with_data(ctx, pix->colorspace, pix->w, pix->h, NULL, pix->alpha, rowLen + pad, NULL);
+    int y;
+    memset(res->samples, 0, (size_t)res->stride * res->h);
+    for (y = 0; y < pix->h; y++) {
+        memcpy(res->samples + (size_t)y * res->stride, pix->samples + (size_t)y * pix->stride, rowLen);
+    }
+    return res;
+}
+
+// checks that the rows of pix match the tightly packed rows in ref and
+// that the padding at the end of the rows hasn't been touched
+static int SameRows(const unsigned char* ref, fz_pixmap* pix) {
+    size_t rowLen = (size_t)pix->w * pix->n;
+    int y;
+    for (y = 0; y < pix->h; y++) {
+        const unsigned char* row = pix->samples + (size_t)y * pix->stride;
+        size_t i;
+        if (memcmp(ref + y * rowLen, row, rowLen) != 0) {
+            return 0;
+        }
+        for (i = rowLen; i < (size_t)pix->stride; i++) {
+            if (row[i] != 0) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// converts an image between device colorspaces with the non-ICC converters.
+// With pad > 0, the rows of both pixmaps are padded, which the converters
+// must skip (for tightly packed rows they convert the image as a single row)
+static int BenchConvert(fz_context* ctx, fz_colorspace* srcCs, int srcAlpha, fz_colorspace* dstCs, int dstAlpha,
+                        int pad) {
+    fz_pixmap* src = fz_new_pixmap(ctx, srcCs, SCALE_W, SCALE_H, NULL, srcAlpha);
+    fz_pixmap* dst = fz_new_pixmap(ctx, dstCs, SCALE_W, SCALE_H, NULL, dstAlpha);
+    unsigned char* ref = (unsigned char*)malloc((size_t)dst->stride * dst->h);
+    double baseTime = 0;
+    int failed = 0;
+    size_t k;
+
+    FillRandom(src->samples, src->stride * src->h, 6);
+    if (srcAlpha) {
+        Premultiply(src->samples, src->stride * src->h, src->n);
+    }
+    if (pad > 0) {
+        // the expected result is that of converting the tightly packed rows
+        fz_pixmap* tmp;
+        fz_set_cpu_features_mask(0);
+        fz_convert_fast_pixmap_samples(ctx, src, dst, 0);
+        memcpy(ref, dst->samples, (size_t)dst->stride * dst->h);
+        tmp = src;
+        src = NewPaddedPixmap(ctx, tmp, pad);
+        fz_drop_pixmap(ctx, tmp);
+        tmp = dst;
+        dst = NewPaddedPixmap(ctx, tmp, pad);
+        fz_drop_pixmap(ctx, tmp);
+    }
+    for (k = 0; k < sizeof(isas) / sizeof(isas[0]); k++) {
+        clock_t start;
+        double secs;
+        int r;
+        if ((supportedFeatures & isas[k].features) != isas[k].features) {
+            continue;
+        }
+        fz_set_cpu_features_mask(isas[k].features);
+        memset(dst->samples, 0, (size_t)dst->stride * dst->h);
+        start = clock();
+        for (r = 0; r < (testOnly ? 1 : SCALE_REPEATS); r++) {
+            fz_convert_fast_pixmap_samples(ctx, src, dst, 0);
+        }
+        secs = Seconds(start);
+
+        if (k == 0) {
+            baseTime = secs;
+        }
+        if (k == 0 && pad == 0) {
+            memcpy(ref, dst->samples, (size_t)dst->stride * dst->h);
+        } else if (!SameRows(ref, dst)) {
+            failed = 1;
+        }
+        if (!testOnly || failed) {
+            printf("convert %s%s to %s%s%s %-4s: %7.2f ms (%.2fx)%s\n", fz_colorspace_name(ctx, srcCs),
+                   srcAlpha ? "+alpha" : "", fz_colorspace_name(ctx, dstCs), dstAlpha ? "+alpha" : "",
+                   pad ? " (padded)" : "", isas[k].name, secs * 1000, secs > 0 ? baseTime / secs : 0,
+                   failed ? " MISMATCH" : "");
+        }
+    }
+
+    free(ref);
+    fz_drop_pixmap(ctx, dst);
+    fz_drop_pixmap(ctx, src);
+    return failed;
+}
+
+int main(int argc, char** argv) {
+    fz_context* ctx;
+    int failed = 0;
+    if (argc > 1 && strcmp(argv[1], "-test") == 0) {
+        testOnly = 1;
+    } else if (argc > 1) {
+        fprintf(stderr, "usage: paint_bench [-test]\n");
+        return 1;
+    }
+    ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+    if (!ctx) {
+        fprintf(stderr, "cannot create mupdf context\n");
+        return 1;
+    }
+    supportedFeatures = fz_cpu_features();
+    printf("CPU features: %s%s\n", supportedFeatures & FZ_CPU_SSE2 ? "SSE2 " : "",
+           supportedFeatures & FZ_CPU_AVX2 ? "AVX2" : "");
+
+    failed |= Bench(ctx, 0, 4, 1, 128);
+    failed |= Bench(ctx, 0, 2, 1, 128);
+    failed |= Bench(ctx, 0, 4, 0, 128);
+    failed |= Bench(ctx, 1, 4, 1, 255);
+    failed |= Bench(ctx, 1, 4, 1, 128);
+    failed |= Bench(ctx, 1, 2, 1, 255);
+    failed |= Bench(ctx, 1, 1, 0, 255);
+    failed |= Bench(ctx, 1, 4, 0, 255);
+    failed |= Bench(ctx, 2, 4, 1, 255);
+    failed |= Bench(ctx, 2, 2, 1, 255);
+    failed |= Bench(ctx, 2, 1, 0, 255);
+    failed |= Bench(ctx, 2, 4, 0, 255);
+
+    // typical fit-width zooms of scanned pages and a small upscale
+    failed |= BenchScale(ctx, 1, 0, 0.33f, 0);
+    failed |= BenchScale(ctx, 1, 0, 0.5f, 0.5f);
+    failed |= BenchScale(ctx, 3, 0, 0.33f, 0);
+    failed |= BenchScale(ctx, 3, 0, 0.5f, 0);
+    failed |= BenchScale(ctx, 3, 0, 0.75f, 0.25f);
+    failed |= BenchScale(ctx, 4, 1, 0.5f, 0);
+    failed |= BenchScale(ctx, 3, 0, 1.5f, 0);
+
+    failed |= BenchConvert(ctx, fz_device_gray(ctx), 0, fz_device_rgb(ctx), 0, 0);
+    failed |= BenchConvert(ctx, fz_device_gray(ctx), 0, fz_device_bgr(ctx), 1, 0);
+    failed |= BenchConvert(ctx, fz_device_gray(ctx), 1, fz_device_bgr(ctx), 1, 0);
+    failed |= BenchConvert(ctx, fz_device_rgb(ctx), 0, fz_device_bgr(ctx), 0, 0);
+    failed |= BenchConvert(ctx, fz_device_rgb(ctx), 0, fz_device_bgr(ctx), 1, 0);
+    failed |= BenchConvert(ctx, fz_device_rgb(ctx), 1, fz_device_bgr(ctx), 1, 0);
+    failed |= BenchConvert(ctx, fz_device_cmyk(ctx), 0, fz_device_rgb(ctx), 0, 0);
+    failed |= BenchConvert(ctx, fz_device_cmyk(ctx), 0, fz_device_bgr(ctx), 1, 0);
+    // rows padded to a multiple of 4 bytes, as for DIB sections
+    failed |= BenchConvert(ctx, fz_device_gray(ctx), 0, fz_device_gray(ctx), 0, 1);
+    failed |= BenchConvert(ctx, fz_device_gray(ctx), 0, fz_device_rgb(ctx), 0, 3);
+    failed |= BenchConvert(ctx, fz_device_gray(ctx), 0, fz_device_bgr(ctx), 1, 4);
+    failed |= BenchConvert(ctx, fz_device_rgb(ctx), 0, fz_device_bgr(ctx), 0, 3);
+    failed |= BenchConvert(ctx, fz_device_bgr(ctx), 0, fz_device_rgb(ctx), 0, 3);
+    failed |= BenchConvert(ctx, fz_device_rgb(ctx), 0, fz_device_bgr(ctx), 1, 4);
+    failed |= BenchConvert(ctx, fz_device_rgb(ctx), 1, fz_device_bgr(ctx), 1, 4);
+    failed |= BenchConvert(ctx, fz_device_rgb(ctx), 0, fz_device_rgb(ctx), 0, 3);
+    failed |= BenchConvert(ctx, fz_device_cmyk(ctx), 0, fz_device_cmyk(ctx), 0, 4);
+    failed |= BenchConvert(ctx, fz_device_cmyk(ctx), 0, fz_device_bgr(ctx), 1, 4);
+
+    fz_drop_context(ctx);
+    if (testOnly) {
+        printf("paint_bench: %s\n", failed ? "FAILED" : "all checks passed");
+    }
+    return failed;
+}
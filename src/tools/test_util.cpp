@@ -13,21 +13,27 @@ extern void SumatraPDF_UnitTests();
 // in src/mui/SvgPath_ut.cpp
 extern void SvgPath_UnitTests();
 
+// in src/SystemFontCatalog_ut.cpp
+extern void SystemFontCatalog_UnitTests();
+
 extern void BaseUtilTest();
 extern void ByteOrderTests();
 extern void CmdLineParserTest();
 extern void CryptoUtilTest();
 extern void CssParser_UnitTests();
 extern void DictTest();
+extern void DictBench();
 extern void FileUtilTest();
 extern void HtmlPrettyPrintTest();
 extern void HtmlPullParser_UnitTests();
 extern void JsonTest();
+extern void PaletteUtilTest();
 extern void SettingsUtilTest();
 extern void SimpleLogTest();
 extern void SquareTreeTest();
 extern void StrFormatTest();
 extern void StrTest();
+extern void TraceTest();
 extern void TrivialHtmlParser_UnitTests();
 extern void VecTest();
 extern void WinUtilTest();
@@ -37,7 +43,13 @@ void _submitDebugReportIfFunc(__unused bool cond, __unused const char* condStr)
     // no-op implementation to satisfy SubmitBugReport()
 }
 
-int main(__unused int argc, __unused char** argv) {
+int main(int argc, char** argv) {
+    if (argc > 1 && str::Eq(argv[1], "-bench")) {
+        printf("Running benchmarks\n");
+        DictBench();
+        return 0;
+    }
+
     printf("Running unit tests\n");
 
     InitDynCalls();
@@ -51,15 +63,18 @@ int main(__unused int argc, __unused char** argv) {
     HtmlPrettyPrintTest();
     HtmlPullParser_UnitTests();
     JsonTest();
+    PaletteUtilTest();
     SettingsUtilTest();
     SimpleLogTest();
     SquareTreeTest();
     StrTest();
+    TraceTest();
     TrivialHtmlParser_UnitTests();
     VecTest();
     WinUtilTest();
     SumatraPDF_UnitTests();
     SvgPath_UnitTests();
+    SystemFontCatalog_UnitTests();
     StrFormatTest();
 
     int res = utassert_print_results();
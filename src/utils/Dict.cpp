@@ -15,10 +15,18 @@ hash table. The actual dict class is a wrapper that provides
 a type-safe API and handles policy decisions like allocations
 (if they are necessary).
 
-Our hash table uses the same parameters as the one in redis
-(but without complexity of incremental hashing):
-- we use chaining on collisions
-- size of the hash table is power of two
+Our hash table uses open addressing with separate metadata, similar to
+Abseil's / Rust's SwissTable:
+- slots are grouped by 16. For each slot there's a control byte which
+  is either kCtrlEmpty, kCtrlDeleted or the top 7 bits of the key's hash.
+  A lookup compares the control bytes of a whole group at once (with SSE2
+  if available) and only compares keys of slots whose bytes match
+- the full hash is stored in the slot, so that mismatches are rejected
+  without comparing keys and resizing doesn't need to re-hash the keys
+- the number of groups is a power of two. Groups are probed in
+  triangular order, which visits each of them exactly once
+- tables start small and double when they get 7/8 full (counting
+  deleted slots), so short-lived dictionaries are cheap
 
 TODO:
 - add iterator for keys/values
@@ -30,6 +38,10 @@ TODO:
 #include "utils/BaseUtil.h"
 #include "utils/Dict.h"
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace dict {
 
 class HasherComparator {
@@ -65,147 +77,201 @@ class WStrKeyHasherComparator : public HasherComparator {
 static StrKeyHasherComparator gStrKeyHasherComparator;
 static WStrKeyHasherComparator gWStrKeyHasherComparator;
 
+constexpr size_t kGroupSize = 16;
+constexpr u8 kCtrlEmpty = 0x80;
+constexpr u8 kCtrlDeleted = 0xfe;
+
 struct HashTableEntry {
     uintptr_t key;
     uintptr_t val;
-    struct HashTableEntry* next;
+    u32 hash;
 };
 
 // not a class so that it can be allocated with an allocator
 struct HashTable {
-    HashTableEntry** entries;
-    HashTableEntry* freeList;
+    // nSlots control bytes followed by nSlots entries
+    u8* ctrl;
+    HashTableEntry* entries;
 
-    size_t nEntries;
-    size_t nUsed; // total number of inserted entries
+    size_t nSlots; // multiple of kGroupSize and power of 2
+    size_t nUsed;  // total number of inserted entries
+    size_t nDeleted;
 
     // for debugging
     size_t nResizes;
     size_t nCollisions;
 };
 
+static inline u8 CtrlForHash(u32 hash) {
+    return (u8)(hash >> 25);
+}
+
+// bit i is set if ctrl[i] == c
+static inline uint MatchCtrlGroup(const u8* ctrl, u8 c) {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+    __m128i v = _mm_loadu_si128((const __m128i*)ctrl);
+    return (uint)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)c)));
+#else
+    uint res = 0;
+    for (size_t i = 0; i < kGroupSize; i++) {
+        if (ctrl[i] == c) {
+            res |= 1u << i;
+        }
+    }
+    return res;
+#endif
+}
+
+static inline uint PopLowestBit(uint& mask) {
+    uint idx = 0;
+    while ((mask & (1u << idx)) == 0) {
+        idx++;
+    }
+    mask &= mask - 1;
+    return idx;
+}
+
+static void AllocSlots(HashTable* h, size_t nSlots) {
+    // control bytes and entries are in a single block not allocated with allocator
+    // since they are freed when resizing
+    size_t cb = nSlots + nSlots * sizeof(HashTableEntry);
+    h->ctrl = (u8*)malloc(cb);
+    CrashAlwaysIf(!h->ctrl);
+    memset(h->ctrl, kCtrlEmpty, nSlots);
+    h->entries = (HashTableEntry*)(h->ctrl + nSlots);
+    h->nSlots = nSlots;
+}
+
 static HashTable* NewHashTable(size_t size, Allocator* allocator) {
     CrashIf(!allocator); // we'll leak otherwise
     HashTable* h = (HashTable*)Allocator::AllocZero(allocator, sizeof(HashTable));
-    // number of hash table entries should be power of 2
-    size = RoundToPowerOf2(size);
-    // entries are not allocated with allocator since those are large blocks
-    // and we don't want to waste their memory after
-    h->entries = AllocArray<HashTableEntry*>(size);
-    h->nEntries = size;
+    // make room for size entries without resizing
+    size = RoundToPowerOf2(std::max(size + size / 7, kGroupSize));
+    AllocSlots(h, size);
     return h;
 }
 
 static void DeleteHashTable(HashTable* h) {
-    free(h->entries);
+    free(h->ctrl);
     // the rest is freed by allocator
 }
 
-static void HashTableResize(HashTable* h, HasherComparator* hc) {
-    size_t newSize = RoundToPowerOf2(h->nEntries + 1);
-    CrashIf(newSize <= h->nEntries);
-    HashTableEntry** newEntries = AllocArray<HashTableEntry*>(newSize);
-    HashTableEntry *e, *next;
-    size_t hash, pos;
-    for (size_t i = 0; i < h->nEntries; i++) {
-        e = h->entries[i];
-        while (e) {
-            next = e->next;
-            hash = hc->Hash(e->key);
-            pos = hash % newSize;
-            e->next = newEntries[pos];
-            newEntries[pos] = e;
-            e = next;
+// returns the index of a slot for a new entry with this hash. There must be an empty one
+static size_t FindFreeSlot(HashTable* h, u32 hash) {
+    size_t groupMask = h->nSlots / kGroupSize - 1;
+    size_t group = hash & groupMask;
+    for (size_t i = 1;; i++) {
+        const u8* ctrl = h->ctrl + group * kGroupSize;
+        uint mask = MatchCtrlGroup(ctrl, kCtrlEmpty) | MatchCtrlGroup(ctrl, kCtrlDeleted);
+        if (mask != 0) {
+            return group * kGroupSize + PopLowestBit(mask);
         }
+        h->nCollisions++;
+        group = (group + i) & groupMask;
     }
-    free(h->entries);
-    h->entries = newEntries;
-    h->nEntries = newSize;
-    h->nResizes += 1;
+}
 
-    CrashIf(h->nUsed >= (h->nEntries * 3) / 2);
+static void HashTableResize(HashTable* h) {
+    u8* oldCtrl = h->ctrl;
+    HashTableEntry* oldEntries = h->entries;
+    size_t oldSize = h->nSlots;
+    // if most of the used slots are deleted entries, re-hashing
+    // into the same size is enough
+    size_t newSize = (h->nUsed * 2 >= oldSize) ? oldSize * 2 : oldSize;
+    AllocSlots(h, newSize);
+    for (size_t i = 0; i < oldSize; i++) {
+        if ((oldCtrl[i] & 0x80) != 0) {
+            continue;
+        }
+        HashTableEntry* e = &oldEntries[i];
+        size_t pos = FindFreeSlot(h, e->hash);
+        h->ctrl[pos] = oldCtrl[i];
+        h->entries[pos] = *e;
+    }
+    free(oldCtrl);
+    h->nDeleted = 0;
+    h->nResizes += 1;
 }
 
 // micro optimization: this is called often, so we want this check inlined. Resizing logic
 // is called rarely, so doesn't need to be inlined
-static inline void HashTableResizeIfNeeded(HashTable* h, HasherComparator* hc) {
-    // per http://stackoverflow.com/questions/1603712/when-should-i-do-rehashing-of-entire-hash-table/1604428#1604428
-    // when using collision chaining, load factor can be 150%
-    if (h->nUsed < (h->nEntries * 3) / 2) {
+static inline void HashTableResizeIfNeeded(HashTable* h) {
+    if (h->nUsed + h->nDeleted < (h->nSlots / 8) * 7) {
         return;
     }
-    HashTableResize(h, hc);
+    HashTableResize(h);
+}
+
+// returns the index of the slot with the key or -1 if not found
+static ptrdiff_t FindEntry(HashTable* h, HasherComparator* hc, uintptr_t key, u32 hash) {
+    u8 c = CtrlForHash(hash);
+    size_t groupMask = h->nSlots / kGroupSize - 1;
+    size_t group = hash & groupMask;
+    for (size_t i = 1; i <= groupMask + 1; i++) {
+        const u8* ctrl = h->ctrl + group * kGroupSize;
+        uint mask = MatchCtrlGroup(ctrl, c);
+        while (mask != 0) {
+            size_t pos = group * kGroupSize + PopLowestBit(mask);
+            HashTableEntry* e = &h->entries[pos];
+            if (e->hash == hash && hc->Equal(key, e->key)) {
+                return (ptrdiff_t)pos;
+            }
+        }
+        // an empty slot means the probe sequence of the key ends here
+        if (MatchCtrlGroup(ctrl, kCtrlEmpty) != 0) {
+            return -1;
+        }
+        group = (group + i) & groupMask;
+    }
+    return -1;
 }
 
 // note: allocator must be nullptr for get, non-nullptr for create
 static HashTableEntry* GetOrCreateEntry(HashTable* h, HasherComparator* hc, uintptr_t key, Allocator* allocator,
                                         bool& newEntry) {
     bool shouldCreate = (allocator != nullptr);
-    size_t hash = hc->Hash(key);
-    size_t pos = hash % h->nEntries;
-    HashTableEntry* e = h->entries[pos];
+    u32 hash = (u32)hc->Hash(key);
     newEntry = false;
-    while (e) {
-        if (hc->Equal(key, e->key)) {
-            return e;
-        }
-        e = e->next;
+    ptrdiff_t pos = FindEntry(h, hc, key, hash);
+    if (pos >= 0) {
+        return &h->entries[pos];
     }
     if (!shouldCreate) {
         return nullptr;
     }
 
-    if (h->freeList) {
-        e = h->freeList;
-        h->freeList = h->freeList->next;
-    } else {
-        e = (HashTableEntry*)Allocator::AllocZero(allocator, sizeof(HashTableEntry));
+    size_t freePos = FindFreeSlot(h, hash);
+    if (h->ctrl[freePos] == kCtrlDeleted) {
+        h->nDeleted--;
     }
-    e->next = h->entries[pos];
-    h->entries[pos] = e;
+    h->ctrl[freePos] = CtrlForHash(hash);
+    HashTableEntry* e = &h->entries[freePos];
+    e->key = 0;
+    e->val = 0;
+    e->hash = hash;
     h->nUsed++;
-    if (e->next != nullptr) {
-        h->nCollisions++;
-    }
     newEntry = true;
     return e;
 }
 
 static bool RemoveEntry(HashTable* h, HasherComparator* hc, uintptr_t key, uintptr_t* removedValOut) {
-    size_t hash = hc->Hash(key);
-    size_t pos = hash % h->nEntries;
-    HashTableEntry* e = h->entries[pos];
-    while (e) {
-        if (hc->Equal(key, e->key)) {
-            break;
-        }
-        e = e->next;
-    }
-    if (!e) {
+    u32 hash = (u32)hc->Hash(key);
+    ptrdiff_t pos = FindEntry(h, hc, key, hash);
+    if (pos < 0) {
         return false;
     }
-
-    // remove the the entry from the list
-    HashTableEntry* e2 = h->entries[pos];
-    if (e2 == e) {
-        h->entries[pos] = e->next;
-    } else {
-        while (e2->next != e) {
-            e2 = e2->next;
-        }
-        e2->next = e->next;
-    }
-    e->next = h->freeList;
-    h->freeList = e;
-    *removedValOut = e->val;
+    // the slot can't be marked empty as that would end the probe
+    // sequence of other keys that were placed after it
+    h->ctrl[pos] = kCtrlDeleted;
+    h->nDeleted++;
+    *removedValOut = h->entries[pos].val;
     CrashIf(0 == h->nUsed);
     h->nUsed -= 1;
     return true;
 }
 
 MapStrToInt::MapStrToInt(size_t initialSize) {
-    // we use PoolAllocator to allocate HashTableEntry entries
-    // and copies of string keys
+    // we use PoolAllocator to allocate HashTable and copies of string keys
     h = NewHashTable(initialSize, &allocator);
 }
 
@@ -244,7 +310,7 @@ bool MapStrToInt::Insert(const char* key, int val, int* existingValOut, const ch
         *existingKeyOut = (const char*)e->key;
     }
 
-    HashTableResizeIfNeeded(h, &gStrKeyHasherComparator);
+    HashTableResizeIfNeeded(h);
     return true;
 }
 
@@ -269,8 +335,7 @@ bool MapStrToInt::Get(const char* key, int* valOut) const {
 }
 
 MapWStrToInt::MapWStrToInt(size_t initialSize) {
-    // we use PoolAllocator to allocate HashTableEntry entries
-    // and copies of string keys
+    // we use PoolAllocator to allocate HashTable and copies of string keys
     h = NewHashTable(initialSize, &allocator);
 }
 
@@ -294,13 +359,13 @@ bool MapWStrToInt::Insert(const WCHAR* key, int val, int* prevVal) {
     e->key = (intptr_t)str::Dup(&allocator, key);
     e->val = (intptr_t)val;
 
-    HashTableResizeIfNeeded(h, &gWStrKeyHasherComparator);
+    HashTableResizeIfNeeded(h);
     return true;
 }
 
 bool MapWStrToInt::Remove(const WCHAR* key, int* removedValOut) const {
     uintptr_t removedVal;
-    bool removed = RemoveEntry(h, &gStrKeyHasherComparator, (uintptr_t)key, &removedVal);
+    bool removed = RemoveEntry(h, &gWStrKeyHasherComparator, (uintptr_t)key, &removedVal);
     if (removed && removedValOut) {
         *removedValOut = (int)removedVal;
     }
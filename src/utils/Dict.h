@@ -5,14 +5,12 @@ namespace dict {
 
 struct HashTable;
 
-// we are very generous with default initial size. It's a trade-off
-// between memory used by hash table and how often we need to resize it.
-// We allocate size*sizeof(ptr) which is 64k on 32-bit for 16k entries.
-// 64k is very little on today's machines, especially for short-lived
-// hash tables.
-// Should use smaller values for long-lived hash tables, especially
-// if there are many of them.
-enum { DEFAULT_HASH_TABLE_INITIAL_SIZE = 16 * 1024 };
+// initial size is the number of entries that can be inserted before the
+// hash table has to grow. Tables double in size when they get full, so the
+// default is small, which makes short-lived dictionaries (e.g. StringInterner
+// used while parsing a single file) cheap. Pass a bigger value if the
+// number of entries is known in advance.
+enum { DEFAULT_HASH_TABLE_INITIAL_SIZE = 16 };
 
 // a dictionary whose keys are char * strings and the values are integers
 // note: StrToInt would be more natural name but it's re-#define'd in <shlwapi.h>
@@ -5,6 +5,13 @@
 #include "HtmlParserLookup.h"
 #include "HtmlPullParser.h"
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define HTML_PARSER_SSE2 1
+#else
+#define HTML_PARSER_SSE2 0
+#endif
+
 // returns -1 if didn't find
 int HtmlEntityNameToRune(const char* name, size_t nameLen) {
     return FindHtmlEntityRune(name, nameLen);
@@ -31,35 +38,124 @@ int HtmlEntityNameToRune(const WCHAR* name, size_t nameLen) {
     return FindHtmlEntityRune(asciiName, nameLen);
 }
 
+/*
+The functions below are in the hot path of parsing every ebook and CHM
+ToC, so they scan 16 bytes at a time with SSE2 where it's available
+(and use memchr(), which is vectorized by the CRT, for single chars).
+Short runs (which are the common case for whitespace) are handled
+by the scalar loops before the vector loop starts.
+*/
+
+#if HTML_PARSER_SSE2
+// bit i of the result is set if s[i] is whitespace as defined by str::IsWs()
+static inline uint WsMask16(__m128i v) {
+    __m128i isSpace = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    // '\t' <= c <= '\r' as an unsigned comparison c - '\t' <= 4
+    __m128i t = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i isCtrlWs = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t);
+    return (uint)_mm_movemask_epi8(_mm_or_si128(isSpace, isCtrlWs));
+}
+
+static inline uint FirstSetBit(uint mask) {
+    CrashIf(mask == 0);
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward(&idx, mask);
+    return (uint)idx;
+#else
+    return (uint)__builtin_ctz(mask);
+#endif
+}
+#endif
+
+// returns a pointer to the first of c1, c2 or c3 in [s, end) or end if none of them are there
+static const char* FindFirstOf(const char* s, const char* end, char c1, char c2, char c3) {
+#if HTML_PARSER_SSE2
+    __m128i v1 = _mm_set1_epi8(c1);
+    __m128i v2 = _mm_set1_epi8(c2);
+    __m128i v3 = _mm_set1_epi8(c3);
+    for (; s + 16 <= end; s += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)s);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, v1), _mm_or_si128(_mm_cmpeq_epi8(v, v2), _mm_cmpeq_epi8(v, v3)));
+        uint mask = (uint)_mm_movemask_epi8(m);
+        if (mask != 0) {
+            return s + FirstSetBit(mask);
+        }
+    }
+#endif
+    while (s < end && *s != c1 && *s != c2 && *s != c3) {
+        s++;
+    }
+    return s;
+}
+
 bool SkipUntil(const char*& s, const char* end, char c) {
-    while ((s < end) && (*s != c)) {
-        ++s;
+    if (s >= end) {
+        return false;
     }
-    return *s == c;
+    const char* found = (const char*)memchr(s, c, end - s);
+    s = found ? found : end;
+    return found != nullptr;
 }
 
 bool SkipUntil(const char*& s, const char* end, const char* term) {
     size_t len = str::Len(term);
-    for (; s < end; s++) {
-        if (s + len <= end && str::StartsWith(s, term)) {
+    if (len == 0) {
+        return s < end;
+    }
+    while (s + len <= end) {
+        const char* found = (const char*)memchr(s, term[0], end - s - len + 1);
+        if (!found) {
+            break;
+        }
+        s = found;
+        if (memcmp(s, term, len) == 0) {
             return true;
         }
+        s++;
     }
+    s = end;
     return false;
 }
 
 // return true if skipped
 bool SkipWs(const char*& s, const char* end) {
     const char* start = s;
+    // most runs of whitespace are a single space or a newline
+    // followed by indentation, so the first bytes are checked one by one
+    for (int i = 0; i < 4; i++) {
+        if (s >= end || !str::IsWs(*s)) {
+            return start != s;
+        }
+        ++s;
+    }
+#if HTML_PARSER_SSE2
+    for (; s + 16 <= end; s += 16) {
+        uint mask = ~WsMask16(_mm_loadu_si128((const __m128i*)s)) & 0xffff;
+        if (mask != 0) {
+            s += FirstSetBit(mask);
+            return true;
+        }
+    }
+#endif
     while ((s < end) && str::IsWs(*s)) {
         ++s;
     }
-    return start != s;
+    return true;
 }
 
 // return true if skipped
 bool SkipNonWs(const char*& s, const char* end) {
     const char* start = s;
+#if HTML_PARSER_SSE2
+    for (; s + 16 <= end; s += 16) {
+        uint mask = WsMask16(_mm_loadu_si128((const __m128i*)s));
+        if (mask != 0) {
+            s += FirstSetBit(mask);
+            return start != s;
+        }
+    }
+#endif
     while ((s < end) && !str::IsWs(*s)) {
         ++s;
     }
@@ -354,17 +450,19 @@ AttrInfo* HtmlToken::NextAttr() {
 // Returns false if didn't find
 static bool SkipUntilTagEnd(const char*& s, const char* end) {
     while (s < end) {
+        s = FindFirstOf(s, end, '>', '\'', '"');
+        if (s == end) {
+            return false;
+        }
         char c = *s++;
         if ('>' == c) {
             --s;
             return true;
         }
-        if (('\'' == c) || ('"' == c)) {
-            if (!SkipUntil(s, end, c)) {
-                return false;
-            }
-            ++s;
+        if (!SkipUntil(s, end, c)) {
+            return false;
         }
+        ++s;
     }
     return false;
 }
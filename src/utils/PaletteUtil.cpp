@@ -0,0 +1,103 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/PaletteUtil.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define PALETTE_SSE2 1
+#else
+#define PALETTE_SSE2 0
+#endif
+
+/*
+Rendered pages mostly consist of long runs of a single color (the background)
+with few distinct colors in between. With SSE2, 4 pixels are compared against
+the last seen color at once and runs of it only cost a compare and a store.
+Other pixels are looked up in a small open-addressing hash table, so the cost
+doesn't grow with the size of the palette.
+*/
+
+constexpr int kPaletteSlots = 1024;
+constexpr u32 kColorMask = 0x00ffffff;
+
+struct PaletteBuilder {
+    u32 keys[kPaletteSlots];
+    i16 idxs[kPaletteSlots];
+    u32* palette = nullptr;
+    int paletteSize = 0;
+
+    explicit PaletteBuilder(u32* palette) : palette(palette) {
+        for (int i = 0; i < kPaletteSlots; i++) {
+            idxs[i] = -1;
+        }
+    }
+
+    // returns the index of c (which must be masked), -1 if the palette is full
+    int IndexOf(u32 c) {
+        uint slot = (c * 2654435761u) >> 22;
+        while (idxs[slot] >= 0 && keys[slot] != c) {
+            slot = (slot + 1) & (kPaletteSlots - 1);
+        }
+        if (idxs[slot] >= 0) {
+            return idxs[slot];
+        }
+        if (paletteSize == 256) {
+            return -1;
+        }
+        keys[slot] = c;
+        idxs[slot] = (i16)paletteSize;
+        palette[paletteSize] = c;
+        return paletteSize++;
+    }
+};
+
+#if PALETTE_SSE2
+static inline bool IsRunOf4(const u32* px, __m128i color, __m128i mask) {
+    __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*)px), mask);
+    return _mm_movemask_epi8(_mm_cmpeq_epi32(v, color)) == 0xffff;
+}
+#endif
+
+int PaletteFromBgrx(const u8* src, int w, int h, int srcStride, u8* dst, int dstStride, u32 palette[256]) {
+    PaletteBuilder pb(palette);
+    if (w <= 0 || h <= 0) {
+        return 0;
+    }
+    u32 lastColor = *(const u32*)src & kColorMask;
+    int lastIdx = pb.IndexOf(lastColor);
+#if PALETTE_SSE2
+    const __m128i mask = _mm_set1_epi32((int)kColorMask);
+    __m128i last = _mm_set1_epi32((int)lastColor);
+#endif
+    for (int y = 0; y < h; y++) {
+        const u32* row = (const u32*)(src + (size_t)y * srcStride);
+        u8* out = dst + (size_t)y * dstStride;
+        int x = 0;
+        while (x < w) {
+#if PALETTE_SSE2
+            while (x + 4 <= w && IsRunOf4(row + x, last, mask)) {
+                memset(out + x, lastIdx, 4);
+                x += 4;
+            }
+            if (x == w) {
+                break;
+            }
+#endif
+            u32 c = row[x] & kColorMask;
+            if (c != lastColor) {
+                lastIdx = pb.IndexOf(c);
+                if (lastIdx < 0) {
+                    return -1;
+                }
+                lastColor = c;
+#if PALETTE_SSE2
+                last = _mm_set1_epi32((int)lastColor);
+#endif
+            }
+            out[x++] = (u8)lastIdx;
+        }
+    }
+    return pb.paletteSize;
+}
@@ -0,0 +1,9 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// maps the pixels of a 32bpp BGRX image (w x h, srcStride bytes per row; the 4th
+// byte is ignored) to an 8-bit palette in a single pass. Writes one index per
+// pixel to dst (dstStride bytes per row) and the colors to palette (as RGBQUADs,
+// i.e. 0x00rrggbb, as expected by an 8bpp DIB).
+// Returns the number of colors or -1 if the image has more than 256
+int PaletteFromBgrx(const u8* src, int w, int h, int srcStride, u8* dst, int dstStride, u32 palette[256]);
@@ -0,0 +1,167 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/FileUtil.h"
+#include "utils/Trace.h"
+
+namespace trace {
+
+// must be a power of 2
+constexpr int kEventsPerThread = 8 * 1024;
+// the oldest events might be overwritten while exporting them
+constexpr int kExportMargin = 256;
+
+struct Event {
+    const char* name;
+    i64 start;
+    // -1 for instant events
+    i64 dur;
+    int arg;
+    // value of gEpoch when the event was recorded
+    int epoch;
+};
+
+struct ThreadEvents {
+    DWORD threadId = 0;
+    const char* threadName = nullptr;
+    // count of all events recorded, only written by the owning thread
+    LONG64 nEvents = 0;
+    ThreadEvents* next = nullptr;
+    Event events[kEventsPerThread];
+};
+
+static bool gEnabled = false;
+// set by the last Enable(true). Events recorded before it are not exported
+static int gEpoch = 0;
+static i64 gStartTime = 0;
+// events of all threads which have recorded any, kept until the process exits
+static ThreadEvents* gThreads = nullptr;
+static thread_local ThreadEvents* gThreadEvents = nullptr;
+// set by SetThreadName(), so that naming a thread doesn't allocate its events
+static thread_local const char* gThreadName = nullptr;
+
+static i64 Now() {
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+static ThreadEvents* GetThreadEvents() {
+    ThreadEvents* te = gThreadEvents;
+    if (te) {
+        return te;
+    }
+    te = new ThreadEvents();
+    te->threadId = GetCurrentThreadId();
+    te->threadName = gThreadName;
+    ThreadEvents* head;
+    do {
+        head = gThreads;
+        te->next = head;
+    } while (InterlockedCompareExchangePointer((void**)&gThreads, te, head) != head);
+    gThreadEvents = te;
+    return te;
+}
+
+static void Record(const char* name, i64 start, i64 dur, int arg) {
+    ThreadEvents* te = GetThreadEvents();
+    LONG64 n = te->nEvents;
+    Event& e = te->events[n & (kEventsPerThread - 1)];
+    e.name = name;
+    e.start = start;
+    e.dur = dur;
+    e.arg = arg;
+    e.epoch = gEpoch;
+    // publish the event to ExportChromeJson
+    InterlockedExchange64(&te->nEvents, n + 1);
+}
+
+// re-enabling starts a new trace: the events recorded so far stay in
+// the buffers but are skipped by ExportChromeJson()
+void Enable(bool enable) {
+    if (enable && !gEnabled) {
+        gEpoch++;
+        gStartTime = Now();
+    }
+    gEnabled = enable;
+}
+
+bool IsEnabled() {
+    return gEnabled;
+}
+
+void SetThreadName(const char* name) {
+    gThreadName = name;
+    if (gThreadEvents) {
+        gThreadEvents->threadName = name;
+    }
+}
+
+void Instant(const char* name, int arg) {
+    if (gEnabled) {
+        Record(name, Now(), -1, arg);
+    }
+}
+
+Scope::Scope(const char* name, int arg) : name(name), arg(arg) {
+    if (gEnabled) {
+        start = Now();
+    }
+}
+
+Scope::~Scope() {
+    if (start != 0) {
+        Record(name, start, Now() - start, arg);
+    }
+}
+
+void ExportChromeJson(str::Str& out) {
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    double usPerTick = 1000000.0 / (double)freq.QuadPart;
+    DWORD pid = GetCurrentProcessId();
+
+    out.Append("{\"traceEvents\":[\n");
+    const char* sep = "";
+    for (ThreadEvents* te = gThreads; te; te = te->next) {
+        DWORD tid = te->threadId;
+        if (te->threadName) {
+            out.AppendFmt("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                          sep, pid, tid, te->threadName);
+            sep = ",\n";
+        }
+        LONG64 end = InterlockedAdd64(&te->nEvents, 0);
+        LONG64 first = std::max(end - (kEventsPerThread - kExportMargin), (LONG64)0);
+        for (LONG64 i = first; i < end; i++) {
+            const Event& e = te->events[i & (kEventsPerThread - 1)];
+            // scopes started before the last Enable(true) are skipped as well
+            if (e.epoch != gEpoch || e.start < gStartTime) {
+                continue;
+            }
+            double ts = (double)(e.start - gStartTime) * usPerTick;
+            if (e.dur < 0) {
+                out.AppendFmt("%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%u,\"tid\":%u", sep,
+                              e.name, ts, pid, tid);
+            } else {
+                double dur = (double)e.dur * usPerTick;
+                out.AppendFmt("%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u", sep,
+                              e.name, ts, dur, pid, tid);
+            }
+            if (e.arg != -1) {
+                out.AppendFmt(",\"args\":{\"n\":%d}", e.arg);
+            }
+            out.Append("}");
+            sep = ",\n";
+        }
+    }
+    out.Append("\n]}\n");
+}
+
+bool SaveChromeJson(const char* path) {
+    str::Str data;
+    ExportChromeJson(data);
+    return file::WriteFile(path, data.AsSpan());
+}
+
+} // namespace trace
@@ -0,0 +1,38 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// Low-overhead tracing of where time is spent (e.g. when rendering pages).
+// Every thread records events into its own fixed-size ring buffer, so
+// recording doesn't need any locks. The most recent events can be exported
+// in Chrome's trace event format, for chrome://tracing or ui.perfetto.dev.
+// Recording does nothing until tracing is enabled.
+
+namespace trace {
+
+// enabling tracing (again) starts a new trace, older events aren't exported
+void Enable(bool enable);
+bool IsEnabled();
+
+// names the calling thread in exported traces (name must be a string literal).
+// The thread's event buffer is only allocated once it records an event
+void SetThreadName(const char* name);
+// records an event without duration (name must be a string literal)
+void Instant(const char* name, int arg = -1);
+
+void ExportChromeJson(str::Str& out);
+bool SaveChromeJson(const char* path);
+
+// records the time between construction and destruction
+// (name must be a string literal, arg is e.g. a page number)
+struct Scope {
+    const char* name = nullptr;
+    int arg = -1;
+    i64 start = 0;
+
+    explicit Scope(const char* name, int arg = -1);
+    Scope(Scope const&) = delete;
+    Scope& operator=(Scope const&) = delete;
+    ~Scope();
+};
+
+} // namespace trace
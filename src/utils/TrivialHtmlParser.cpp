@@ -63,12 +63,21 @@ static WCHAR IntToChar(int codepoint) {
 // caller needs to free() the result
 WCHAR* DecodeHtmlEntitites(const char* string, uint codepage) {
     WCHAR* fixed = strconv::StrToWstr(string, codepage);
-    WCHAR* dst = fixed;
-    const WCHAR* src = fixed;
+    // most attribute values don't contain any entities
+    WCHAR* dst = str::FindChar(fixed, '&');
+    if (!dst) {
+        return fixed;
+    }
+    const WCHAR* src = dst;
 
     while (*src) {
         if (*src != '&') {
-            *dst++ = *src++;
+            // copy the whole run up to the next entity at once
+            const WCHAR* next = str::FindChar(src, '&');
+            size_t n = next ? next - src : str::Len(src);
+            memmove(dst, src, n * sizeof(WCHAR));
+            dst += n;
+            src += n;
             continue;
         }
         src++;
@@ -0,0 +1,85 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/Dict.h"
+#include "utils/Timer.h"
+
+// micro benchmarks for dict::MapStrToInt and StringInterner.
+// Run with: test_util.exe -bench
+
+// keys look like identifiers (e.g. ids of EPUB manifest items), with a common prefix
+static void GenKeys(Vec<char*>& keys, int n, const char* prefix) {
+    for (int i = 0; i < n; i++) {
+        keys.Append(str::Format("%s%d_%x", prefix, i, (uint)(i * 2654435761u)));
+    }
+}
+
+static void BenchInsertGet(int n) {
+    Vec<char*> keys;
+    Vec<char*> missing;
+    GenKeys(keys, n, "item");
+    GenKeys(missing, n, "nope");
+
+    auto t = TimeGet();
+    dict::MapStrToInt d;
+    for (int i = 0; i < n; i++) {
+        d.Insert(keys.at(i), i, nullptr);
+    }
+    double insertMs = TimeSinceInMs(t);
+
+    t = TimeGet();
+    int val;
+    int found = 0;
+    for (int i = 0; i < n; i++) {
+        found += d.Get(keys.at(i), &val) ? 1 : 0;
+    }
+    double hitMs = TimeSinceInMs(t);
+    CrashIf(found != n);
+
+    t = TimeGet();
+    for (int i = 0; i < n; i++) {
+        found += d.Get(missing.at(i), &val) ? 1 : 0;
+    }
+    double missMs = TimeSinceInMs(t);
+    CrashIf(found != n);
+
+    t = TimeGet();
+    for (int i = 0; i < n; i += 2) {
+        d.Remove(keys.at(i), nullptr);
+    }
+    for (int i = 0; i < n; i += 2) {
+        d.Insert(keys.at(i), i, nullptr);
+    }
+    double churnMs = TimeSinceInMs(t);
+
+    printf("MapStrToInt %7d keys: insert %7.2f ms, get hit %7.2f ms, get miss %7.2f ms, remove+insert %7.2f ms\n", n,
+           insertMs, hitMs, missMs, churnMs);
+    keys.FreeMembers();
+    missing.FreeMembers();
+}
+
+// many short-lived interners, as created when parsing small files
+static void BenchSmallInterners(int nInterners, int nStrings) {
+    Vec<char*> keys;
+    GenKeys(keys, nStrings, "s");
+    auto t = TimeGet();
+    for (int i = 0; i < nInterners; i++) {
+        StringInterner interner;
+        for (int j = 0; j < nStrings; j++) {
+            interner.Intern(keys.at(j));
+            interner.Intern(keys.at(nStrings - 1 - j));
+        }
+    }
+    double ms = TimeSinceInMs(t);
+    printf("%d StringInterners with %d strings: %.2f ms\n", nInterners, nStrings, ms);
+    keys.FreeMembers();
+}
+
+void DictBench() {
+    BenchInsertGet(1000);
+    BenchInsertGet(100 * 1000);
+    BenchInsertGet(1000 * 1000);
+    BenchSmallInterners(10000, 10);
+    BenchSmallInterners(1000, 200);
+}
@@ -77,6 +77,46 @@ void DictTestMapStrToInt() {
     toRemove.FreeMembers();
 }
 
+static void DictTestMapWStrToInt() {
+    dict::MapWStrToInt d(0);
+    int val = 0;
+    utassert(d.Insert(L"foo", 5, &val));
+    utassert(!d.Insert(L"foo", 6, &val) && val == 5);
+    utassert(d.Get(L"foo", &val) && val == 5);
+    utassert(d.Remove(L"foo", &val) && val == 5);
+    utassert(!d.Get(L"foo", &val));
+    utassert(0 == d.Count());
+}
+
+// removed entries leave tombstones that must not break lookups
+// of keys inserted after them and must be re-used
+static void DictTestRemoveReinsert() {
+    dict::MapStrToInt d;
+    Vec<char*> keys;
+    for (int i = 0; i < 500; i++) {
+        keys.Append(str::Format("key%d", i));
+    }
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < keys.isize(); i++) {
+            if (i % 2 == 0 || round == 0) {
+                utassert(d.Insert(keys.at(i), i, nullptr));
+            }
+        }
+        utassert(d.Count() == keys.size());
+        for (int i = 0; i < keys.isize(); i++) {
+            int val = -1;
+            utassert(d.Get(keys.at(i), &val) && val == i);
+        }
+        for (int i = 0; i < keys.isize(); i += 2) {
+            utassert(d.Remove(keys.at(i), nullptr));
+        }
+        utassert(d.Count() == keys.size() / 2);
+    }
+    keys.FreeMembers();
+}
+
 void DictTest() {
     DictTestMapStrToInt();
+    DictTestMapWStrToInt();
+    DictTestRemoveReinsert();
 }
@@ -108,6 +108,86 @@ static void Test03() {
     utassert(!t);
 }
 
+// exercises the vectorized and the scalar paths of the scanning
+// functions by placing the searched for char at every position
+// within and across 16 byte blocks
+static void Test04() {
+    char buf[64];
+    for (int pos = 0; pos < 47; pos++) {
+        memset(buf, 'a', sizeof(buf));
+        buf[pos] = '<';
+        const char* end = buf + 48;
+        const char* s = buf;
+        utassert(SkipUntil(s, end, '<') && s == buf + pos);
+        s = buf;
+        utassert(!SkipUntil(s, buf + pos, '<') && s == buf + pos);
+
+        buf[pos + 1] = '!';
+        s = buf;
+        utassert(SkipUntil(s, end, "<!") && s == buf + pos);
+        s = buf;
+        utassert(!SkipUntil(s, buf + pos + 1, "<!") && s == buf + pos + 1);
+
+        memset(buf, ' ', sizeof(buf));
+        buf[3] = '\t';
+        buf[9] = '\r';
+        buf[pos] = 'x';
+        s = buf;
+        utassert(SkipWs(s, end) == (pos > 0) && s == buf + pos);
+        s = buf;
+        utassert(SkipWs(s, buf + pos) == (pos > 0) && s == buf + pos);
+
+        memset(buf, 'x', sizeof(buf));
+        buf[7] = '\xC3';
+        buf[pos] = '\n';
+        s = buf;
+        utassert(SkipNonWs(s, end) == (pos > 0) && s == buf + pos);
+        s = buf;
+        utassert(!SkipNonWs(s, s) && s == buf);
+    }
+
+    const char* ws = " \t\n\v\f\r";
+    const char* end = ws + str::Len(ws);
+    utassert(SkipWs(ws, end) && ws == end);
+    const char* indent = "\r\n\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+    utassert(IsSpaceOnly(indent, indent + str::Len(indent)));
+}
+
+// long attribute values, text runs and entity free text
+static void Test05() {
+    const char* s =
+        "<p class=\"a very long class name that spans several blocks\" "
+        "title='with > and \" inside of a quoted value' id=unquoted-value-that-is-long>"
+        "A long run of text without any entities that is longer than 16 bytes"
+        "</p>                                        <br/>";
+    HtmlPullParser parser(s, str::Len(s));
+    HtmlToken* t = parser.Next();
+    utassert(t && t->IsStartTag() && Tag_P == t->tag);
+    AttrInfo* a = t->GetAttrByName("class");
+    utassert(a && a->ValIs("a very long class name that spans several blocks"));
+    a = t->GetAttrByName("title");
+    utassert(a && a->ValIs("with > and \" inside of a quoted value"));
+    a = t->GetAttrByName("id");
+    utassert(a && a->ValIs("unquoted-value-that-is-long"));
+    t = parser.Next();
+    utassert(t && t->IsText());
+    const char* text = ResolveHtmlEntities(t->s, t->s + t->sLen, nullptr);
+    utassert(text == t->s);
+    t = parser.Next();
+    utassert(t && t->IsEndTag() && Tag_P == t->tag);
+    t = parser.Next();
+    utassert(t && t->IsText() && IsSpaceOnly(t->s, t->s + t->sLen));
+    t = parser.Next();
+    utassert(t && t->IsEmptyElementEndTag() && Tag_Br == t->tag);
+    t = parser.Next();
+    utassert(!t);
+
+    s = "<a title='unclosed quote that is longer than a block>";
+    HtmlPullParser parser2(s, str::Len(s));
+    t = parser2.Next();
+    utassert(t && t->IsError() && HtmlToken::UnclosedTag == t->error);
+}
+
 void HtmlPullParser_UnitTests() {
     Test00("<p a1='>' foo=bar />", HtmlToken::EmptyElementTag);
     Test00("<p a1 ='>'     foo=\"bar\"/>", HtmlToken::EmptyElementTag);
@@ -118,4 +198,6 @@ void HtmlPullParser_UnitTests() {
     Test01();
     Test02();
     Test03();
+    Test04();
+    Test05();
 }
@@ -0,0 +1,55 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/PaletteUtil.h"
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+static void SetPixel(u8* img, int stride, int x, int y, u32 bgrx) {
+    memcpy(img + (size_t)y * stride + x * 4, &bgrx, 4);
+}
+
+void PaletteUtilTest() {
+    // odd width and padded rows so that runs straddle the 4 pixel steps
+    constexpr int w = 13;
+    constexpr int h = 5;
+    constexpr int stride = w * 4 + 8;
+    constexpr int dstStride = 16;
+    u8 img[stride * h];
+    u8 idxs[dstStride * h];
+    u32 palette[256];
+
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            // the 4th byte must be ignored
+            SetPixel(img, stride, x, y, 0xffffffff - (u32)(x & 1) * 0x01000000);
+        }
+    }
+    SetPixel(img, stride, 6, 2, 0xff123456);
+    SetPixel(img, stride, 12, 4, 0x00000000);
+    int n = PaletteFromBgrx(img, w, h, stride, idxs, dstStride, palette);
+    utassert(n == 3);
+    utassert(palette[0] == 0x00ffffff);
+    utassert(palette[1] == 0x00123456);
+    utassert(palette[2] == 0x00000000);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            u8 expected = (x == 6 && y == 2) ? 1 : (x == 12 && y == 4) ? 2 : 0;
+            utassert(idxs[y * dstStride + x] == expected);
+        }
+    }
+
+    // 257 colors don't fit
+    u8 img2[257 * 4];
+    u8 idxs2[257];
+    for (int i = 0; i < 257; i++) {
+        SetPixel(img2, 0, i, 0, (u32)i * 0x010101);
+    }
+    utassert(PaletteFromBgrx(img2, 256, 1, 0, idxs2, 0, palette) == 256);
+    for (int i = 0; i < 256; i++) {
+        utassert(idxs2[i] == i && palette[i] == (u32)i * 0x010101);
+    }
+    utassert(PaletteFromBgrx(img2, 257, 1, 0, idxs2, 0, palette) == -1);
+}
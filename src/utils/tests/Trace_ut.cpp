@@ -0,0 +1,74 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/JsonParser.h"
+#include "utils/Trace.h"
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+class TraceEventCounter : public json::ValueVisitor {
+  public:
+    int nEvents = 0;
+    int nOldEvents = 0;
+    int nInstant = 0;
+    int nArgs = 0;
+    int nThreadNames = 0;
+
+    bool Visit(const char* path, const char* value, __unused json::Type type) override {
+        if (str::EndsWith(path, "/name") && str::Eq(value, "trace-test")) {
+            nEvents++;
+        }
+        if (str::EndsWith(path, "/name") && str::Eq(value, "trace-test-old")) {
+            nOldEvents++;
+        }
+        if (str::EndsWith(path, "/args/name") && str::Eq(value, "trace-test-thread")) {
+            nThreadNames++;
+        }
+        if (str::EndsWith(path, "/ph") && str::Eq(value, "i")) {
+            nInstant++;
+        }
+        if (str::EndsWith(path, "/args/n") && str::Eq(value, "42")) {
+            nArgs++;
+        }
+        return true;
+    }
+};
+
+void TraceTest() {
+    // naming a thread doesn't start recording for it
+    trace::SetThreadName("trace-test-thread");
+    {
+        str::Str s;
+        trace::ExportChromeJson(s);
+        TraceEventCounter counter;
+        utassert(json::Parse(s.Get(), &counter));
+        utassert(counter.nThreadNames == 0);
+    }
+
+    trace::Enable(true);
+    trace::Instant("trace-test-old");
+    trace::Enable(false);
+
+    // only events since the last Enable(true) are exported
+    trace::Enable(true);
+    {
+        trace::Scope scope("trace-test", 42);
+    }
+    trace::Instant("trace-test");
+    trace::Enable(false);
+    {
+        trace::Scope scope("trace-test", 42);
+    }
+
+    str::Str s;
+    trace::ExportChromeJson(s);
+    TraceEventCounter counter;
+    utassert(json::Parse(s.Get(), &counter));
+    utassert(counter.nEvents == 2);
+    utassert(counter.nOldEvents == 0);
+    utassert(counter.nInstant == 1);
+    utassert(counter.nArgs == 1);
+    utassert(counter.nThreadNames == 1);
+}
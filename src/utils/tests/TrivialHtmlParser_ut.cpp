@@ -161,6 +161,10 @@ static void HtmlParser07() {
 static void HtmlParser08() {
     AutoFreeWstr val(DecodeHtmlEntitites("&auml&test;&&ouml-", CP_ACP));
     utassert(str::Eq(val, L"\xE4&test;&\xF6-"));
+    val.Set(DecodeHtmlEntitites("no entities here", CP_ACP));
+    utassert(str::Eq(val, L"no entities here"));
+    val.Set(DecodeHtmlEntitites("a long run of text before &lt; and a long run after &gt;", CP_ACP));
+    utassert(str::Eq(val, L"a long run of text before < and a long run after >"));
 }
 
 static void HtmlParser09() {
@@ -753,8 +753,9 @@ void PopulateTreeItem(TreeCtrl* tree, TreeItem* parent, HTREEITEM hParent) {
             n = (int)dimof(tmp);
         }
     }
-    // ChildAt() is optimized for sequential access and we need to
-    // insert backwards, so gather the items in v first
+    // we need to insert backwards. ChildAt() is O(1) for the ToC (TocTree
+    // indexes its items, see TocTree::BuildIndex()) but other tree models
+    // might walk their children for every call, so gather the items in a first
     for (int i = 0; i < n; i++) {
         auto ti = parent->ChildAt(i);
         CrashIf(ti == nullptr);